@@ -0,0 +1,421 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Bring a backup copy of a FAT image up to date from its change journal
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t data_region_start;
+    int cluster_bytes;
+}diskInfo;
+
+// change journal {image}.jnl written by diskput -j and diskrm -j, see diskput.c
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+// a byte range of the image to copy
+struct copyRange{
+    size_t start;
+    size_t len;
+};
+
+// {backup file}.stamp, what the image looked like when the backup last matched it
+struct backupStamp{
+    char magic[8];
+    int64_t image_size;
+    int64_t image_mtime;
+    int64_t image_mtime_nsec;
+    uint32_t checksum;       // first FAT and root directory, see checksum_metadata()
+};
+
+struct backupInfo{
+    struct copyRange *ranges;
+    int range_count;
+    int records;
+    size_t bytes_copied;
+    int writes;
+}backupInfo;
+
+
+void get_disk_info(char *p);
+int read_journal(char *name, size_t image_size);
+void add_range(size_t start, size_t len, size_t image_size);
+int compare_ranges(const void *a, const void *b);
+void write_ranges(char *p, int backup_fd);
+uint32_t checksum_metadata(char *p);
+int load_stamp(char *name, struct backupStamp *stamp);
+void save_stamp(char *name, struct stat *sb, uint32_t checksum);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd, backup_fd;
+	struct stat sb, backup_sb;
+    char journal_name[4096];
+    char busy_name[4096];
+    char stamp_name[4096];
+    struct backupStamp stamp;
+
+    if(argc != 3){
+        printf("Input format: ./diskbackup {image file} {backup file}\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+    get_disk_info(p);
+
+    // writers start a fresh journal while this run works on the renamed one;
+    // a .busy journal left by an interrupted run is replayed again
+    snprintf(journal_name, sizeof(journal_name), "%s.jnl", argv[1]);
+    snprintf(busy_name, sizeof(busy_name), "%s.jnl.busy", argv[1]);
+    if(access(busy_name, F_OK) != 0 && rename(journal_name, busy_name) != 0 && errno != ENOENT){
+        printf("Error: failed to claim %s\n", journal_name);
+        exit(1);
+    }
+
+    // an incremental run needs a backup that still matches its stamp, and a changed image
+    // without a journal was written by a tool that does not journal
+    snprintf(stamp_name, sizeof(stamp_name), "%s.stamp", argv[2]);
+    int full = (stat(argv[2], &backup_sb) != 0 || backup_sb.st_size != sb.st_size
+        || !load_stamp(stamp_name, &stamp) || stamp.image_size != sb.st_size);
+    if(!full && access(busy_name, F_OK) != 0
+        && (stamp.image_mtime != sb.st_mtim.tv_sec || stamp.image_mtime_nsec != sb.st_mtim.tv_nsec)){
+        full = 1;
+    }
+
+    backup_fd = open(argv[2], O_RDWR | O_CREAT, 0644);
+    if(backup_fd < 0){
+        printf("Error: failed to open %s\n", argv[2]);
+        exit(1);
+    }
+
+    char *q = NULL;
+    if(!full){
+        q = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, backup_fd, 0);
+        if(q == MAP_FAILED){
+            printf("Error: failed to map %s\n", argv[2]);
+            exit(1);
+        }
+        full = (checksum_metadata(q) != stamp.checksum);
+    }
+
+    if(!full){
+        if(read_journal(busy_name, sb.st_size) != 0){
+            printf("Error: %s is not a change journal\n", busy_name);
+            exit(1);
+        }
+        write_ranges(p, backup_fd);
+
+        // a write that was not journaled shows up as a FAT or root directory difference
+        if(checksum_metadata(q) != checksum_metadata(p)){
+            printf("Journal does not cover every change, copying the whole image\n");
+            full = 1;
+            backupInfo.range_count = 0;
+        }
+    }
+    if(q != NULL){
+        munmap(q, sb.st_size);
+    }
+
+    if(full){
+        if(ftruncate(backup_fd, sb.st_size) != 0){
+            printf("Error: failed to write %s\n", argv[2]);
+            exit(1);
+        }
+        add_range(0, sb.st_size, sb.st_size);
+        write_ranges(p, backup_fd);
+    }
+
+    if(fsync(backup_fd) != 0){
+        printf("Error: failed to write %s\n", argv[2]);
+        exit(1);
+    }
+    save_stamp(stamp_name, &sb, checksum_metadata(p));
+    unlink(busy_name);
+
+    printf("%s backup: %d journal records, %zu bytes in %d writes\n", full ? "Full" : "Incremental",
+        backupInfo.records, backupInfo.bytes_copied, backupInfo.writes);
+
+    close(backup_fd);
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: get_disk_info(char *p)
+* =================================
+* Purpose: collect the geometry of the disk image (FAT12, FAT16 or FAT32)
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_disk_info(char *p){
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+
+    // FAT32 leaves the 16 bit FAT size at 0 and keeps a 32 bit one in its own BPB
+    diskInfo.sector_per_fat = sector_per_fat;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+    }
+
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors
+        + ((diskInfo.root_dir_entries * 32 + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector);
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+}
+
+
+/*
+* Function: read_journal(char *name, size_t image_size)
+* =================================
+* Purpose: turn every journal record into the byte range of the image it names.
+*          A missing journal means nothing changed
+*
+* Input:
+*   char* name: journal file name
+*   size_t image_size: size of the image
+*
+* Return:
+*   int: 0 on success, -1 if the file is not a journal
+*
+*/
+int read_journal(char *name, size_t image_size){
+    struct journalRecord record;
+    char magic[8];
+    size_t sector_bytes = diskInfo.bytes_per_sector;
+    size_t fat_start = (size_t)diskInfo.reserved_sectors * sector_bytes;
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * sector_bytes;
+
+    FILE *journal = fopen(name, "r");
+    if(journal == NULL){
+        return 0;
+    }
+    if(fread(magic, 8, 1, journal) != 1 || memcmp(magic, "FATJNL1", 8) != 0){
+        fclose(journal);
+        return -1;
+    }
+
+    while(fread(&record, sizeof(record), 1, journal) == 1){
+        backupInfo.records++;
+        if(record.kind == 'C' && record.value >= 2){
+            add_range((size_t)diskInfo.data_region_start * sector_bytes + (size_t)(record.value - 2) * diskInfo.cluster_bytes,
+                diskInfo.cluster_bytes, image_size);
+        }else if(record.kind == 'F'){
+            for(int i = 0; i < diskInfo.num_of_fats; i++){
+                add_range(fat_start + i * fat_bytes + (size_t)record.value * sector_bytes, sector_bytes, image_size);
+            }
+        }else if(record.kind == 'E'){
+            add_range((size_t)record.value * 32, 32, image_size);
+        }else if(record.kind == 'S'){
+            add_range((size_t)record.value * sector_bytes, sector_bytes, image_size);
+        }
+    }
+    fclose(journal);
+    return 0;
+}
+
+
+/*
+* Function: add_range(size_t start, size_t len, size_t image_size)
+* =================================
+* Purpose: queue a byte range for copying, clipped to the image
+*
+* Input:
+*   size_t start: offset in the image
+*   size_t len: length of the range
+*   size_t image_size: size of the image
+*
+*/
+void add_range(size_t start, size_t len, size_t image_size){
+    if(start >= image_size){
+        return;
+    }
+    if(start + len > image_size){
+        len = image_size - start;
+    }
+    backupInfo.ranges = realloc(backupInfo.ranges, sizeof(struct copyRange)*(backupInfo.range_count + 1));
+    backupInfo.ranges[backupInfo.range_count].start = start;
+    backupInfo.ranges[backupInfo.range_count].len = len;
+    backupInfo.range_count++;
+}
+
+
+/*
+* Function: compare_ranges(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering ranges by start offset
+*
+*/
+int compare_ranges(const void *a, const void *b){
+    const struct copyRange *x = a;
+    const struct copyRange *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+
+/*
+* Function: write_ranges(char *p, int backup_fd)
+* =================================
+* Purpose: sort the queued ranges, merge overlapping and touching ones and pwrite each
+*          merged run from the image mapping into the backup
+*
+* Input:
+*   char* p: image data pointer
+*   int backup_fd: backup file descriptor
+*
+*/
+void write_ranges(char *p, int backup_fd){
+    qsort(backupInfo.ranges, backupInfo.range_count, sizeof(struct copyRange), compare_ranges);
+
+    for(int i = 0; i < backupInfo.range_count; i++){
+        size_t start = backupInfo.ranges[i].start;
+        size_t end = start + backupInfo.ranges[i].len;
+        while(i + 1 < backupInfo.range_count && backupInfo.ranges[i+1].start <= end){
+            i++;
+            if(backupInfo.ranges[i].start + backupInfo.ranges[i].len > end){
+                end = backupInfo.ranges[i].start + backupInfo.ranges[i].len;
+            }
+        }
+
+        size_t done = start;
+        while(done < end){
+            ssize_t written = pwrite(backup_fd, p + done, end - done, done);
+            if(written <= 0){
+                printf("Error: failed to write backup\n");
+                exit(1);
+            }
+            done += written;
+        }
+        backupInfo.bytes_copied += end - start;
+        backupInfo.writes++;
+    }
+}
+
+
+/*
+* Function: checksum_metadata(char *p)
+* =================================
+* Purpose: checksum the first FAT and the root directory, 8 bytes at a time
+*
+* Input:
+*   char* p: image (or backup) data pointer
+*
+*/
+uint32_t checksum_metadata(char *p){
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+    size_t sector_bytes = diskInfo.bytes_per_sector;
+    size_t fat_start = (size_t)diskInfo.reserved_sectors * sector_bytes;
+    size_t root_dir_start = fat_start + (size_t)diskInfo.num_of_fats * diskInfo.sector_per_fat * sector_bytes;
+    size_t root_dir_ends = (size_t)diskInfo.data_region_start * sector_bytes;
+
+    for(size_t i = fat_start; i + 8 <= fat_start + (size_t)diskInfo.sector_per_fat * sector_bytes; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i + 8 <= root_dir_ends; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+/*
+* Function: load_stamp(char *name, struct backupStamp *stamp)
+* =================================
+* Purpose: read the stamp left by the last run
+*
+* Input:
+*   char* name: stamp file name
+*   struct backupStamp* stamp: filled in from the file
+*
+* Return:
+*   int: 1 if a valid stamp was read, 0 otherwise
+*
+*/
+int load_stamp(char *name, struct backupStamp *stamp){
+    FILE *fptr = fopen(name, "r");
+    int valid;
+
+    if(fptr == NULL){
+        return 0;
+    }
+    valid = fread(stamp, sizeof(*stamp), 1, fptr) == 1 && memcmp(stamp->magic, "FATBAK1", 8) == 0;
+    fclose(fptr);
+    return valid;
+}
+
+
+/*
+* Function: save_stamp(char *name, struct stat *sb, uint32_t checksum)
+* =================================
+* Purpose: record the image the backup now matches. Written after the backup is
+*          fsynced, a crash in between leaves the old stamp and forces a full copy
+*
+* Input:
+*   char* name: stamp file name
+*   struct stat* sb: stats of the image when this run started
+*   uint32_t checksum: checksum_metadata() of the image
+*
+*/
+void save_stamp(char *name, struct stat *sb, uint32_t checksum){
+    struct backupStamp stamp;
+    FILE *fptr = fopen(name, "w");
+
+    if(fptr == NULL){
+        printf("Error: failed to write %s\n", name);
+        exit(1);
+    }
+    memset(&stamp, 0, sizeof(stamp));
+    memcpy(stamp.magic, "FATBAK1", 8);
+    stamp.image_size = sb->st_size;
+    stamp.image_mtime = sb->st_mtim.tv_sec;
+    stamp.image_mtime_nsec = sb->st_mtim.tv_nsec;
+    stamp.checksum = checksum;
+    if(fwrite(&stamp, sizeof(stamp), 1, fptr) != 1 || fflush(fptr) != 0 || fsync(fileno(fptr)) != 0){
+        printf("Error: failed to write %s\n", name);
+        exit(1);
+    }
+    fclose(fptr);
+}
@@ -0,0 +1,980 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Check (and optionally repair) the FAT and directory tree of a FAT12, FAT16 or FAT32 image
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+struct checkInfo{
+    uint32_t *fat_table;     // decoded first FAT
+    uint8_t *claimed;        // one bit per cluster, set once any chain owns it
+    uint8_t *in_chain;       // one bit per cluster of the chain being walked
+    uint32_t next_free;      // where copy_cluster looks for a free cluster next
+    int fat_dirty;
+    int entries;
+    int cross_links;
+    int cycles;
+    int bad_chains;
+    int size_mismatches;
+    int lost_clusters;
+    int lost_runs;
+    int fat_mismatches;
+    char path[256];
+}checkInfo;
+
+// change journal {image}.jnl, see diskput.c for the record layout
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+struct journalInfo{
+    struct journalRecord *records;
+    int count;
+}journalInfo;
+
+int repair = 0;
+int use_journal = 0;
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc);
+size_t fat_entry_offset(uint32_t cluster);
+uint32_t get_entry_flc(char *entry);
+void set_entry_flc(char *entry, uint32_t flc);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+char* cluster_ptr(char *p, uint32_t cluster);
+void decode_fat(char *p);
+void check_fat_copies(char *p);
+void check_directory(char *p, uint32_t dir_flc, int length);
+void check_entry(char *p, char *entry_start);
+int check_chain(char *p, char *entry_start, uint32_t flc);
+void trim_chain(char *p, char *entry_start, uint32_t flc, int keep);
+uint32_t copy_cluster(char *p, uint32_t cluster);
+void check_lost_clusters(char *p);
+void set_fat(char *p, uint32_t cluster, uint32_t value);
+void sync_fat_copies(char *p);
+int update_fsinfo(char *p);
+void entry_path(char *entry_start, char *path_out);
+int test_bit(uint8_t *map, int bit);
+void set_bit(uint8_t *map, int bit);
+void clear_bit(uint8_t *map, int bit);
+void journal_add(char kind, uint32_t value);
+void journal_write(char *image_name);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+    int problems;
+
+    int bad_args = (argc < 2);
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-r") == 0){
+            repair = 1;
+        }else if(strcmp(argv[i], "-j") == 0){
+            use_journal = 1;
+        }else{
+            bad_args = 1;
+        }
+    }
+    if(bad_args){
+        printf("Input format: ./diskcheck {image file} [-r] [-j]\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], repair ? O_RDWR : O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ | (repair ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+    decode_fat(p);
+    check_fat_copies(p);
+    check_directory(p, 0, 0);
+    check_lost_clusters(p);
+
+    if(repair && (checkInfo.fat_dirty || checkInfo.fat_mismatches > 0)){
+        sync_fat_copies(p);
+    }
+
+    problems = checkInfo.cross_links + checkInfo.cycles + checkInfo.bad_chains + checkInfo.size_mismatches
+        + checkInfo.lost_clusters + checkInfo.fat_mismatches;
+
+    printf("==============\n");
+    printf("Entries checked: %d\n", checkInfo.entries);
+    printf("Cross-linked chains: %d\n", checkInfo.cross_links);
+    printf("Cyclic chains: %d\n", checkInfo.cycles);
+    printf("Broken chains: %d\n", checkInfo.bad_chains);
+    printf("Size mismatches: %d\n", checkInfo.size_mismatches);
+    printf("Lost clusters: %d in %d runs\n", checkInfo.lost_clusters, checkInfo.lost_runs);
+    printf("Diverged FAT sectors: %d\n", checkInfo.fat_mismatches);
+    if(problems == 0){
+        printf("Image is clean\n");
+    }else if(repair){
+        printf("Problems repaired\n");
+    }
+
+    if(repair){
+        journal_write(argv[1]);
+        msync(p, sb.st_size, MS_SYNC);
+    }
+    munmap(p, sb.st_size);
+    close(fd);
+	return problems == 0 ? 0 : 1;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: decode_fat(char *p)
+* =================================
+* Purpose: decode the first FAT into a flat table and allocate the cluster bitmaps
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void decode_fat(char *p){
+    int count = diskInfo.cluster_count;
+
+    checkInfo.fat_table = malloc(sizeof(uint32_t)*count);
+    checkInfo.claimed = calloc((count / 8) + 1, 1);
+    checkInfo.in_chain = calloc((count / 8) + 1, 1);
+    checkInfo.next_free = 2;
+
+    for(int i = 0; i < count; i++){
+        checkInfo.fat_table[i] = get_fat_entry(p, i);
+    }
+}
+
+
+/*
+* Function: check_fat_copies(char *p)
+* =================================
+* Purpose: compare every FAT copy against the first one, sector by sector
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void check_fat_copies(char *p){
+    int sector_bytes = diskInfo.bytes_per_sector;
+    char *fat_start = p + diskInfo.fat_start;
+
+    for(int i = 1; i < diskInfo.num_of_fats; i++){
+        char *copy = fat_start + (size_t)i * diskInfo.sector_per_fat * sector_bytes;
+        for(int s = 0; s < diskInfo.sector_per_fat; s++){
+            if(memcmp(fat_start + (size_t)s*sector_bytes, copy + (size_t)s*sector_bytes, sector_bytes) != 0){
+                printf("FAT copy %d differs from FAT 1 in sector %d\n", i+1, s);
+                checkInfo.fat_mismatches++;
+            }
+        }
+    }
+}
+
+
+/*
+* Function: check_directory(char *p, uint32_t dir_flc, int length)
+* =================================
+* Purpose: check every entry of a directory, recursing into sub directories
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   int length: number of clusters check_chain kept for the directory
+*
+*/
+void check_directory(char *p, uint32_t dir_flc, int length){
+    char *entry_start;
+    int entries_per_cluster = diskInfo.cluster_bytes / 32;
+
+    // the FAT32 root is a cluster chain, it is claimed like the chain of a sub directory
+    if(dir_flc == 0 && diskInfo.fat_type == 32){
+        length = check_chain(p, NULL, diskInfo.root_cluster);
+        if(length < 0){
+            return;
+        }
+        dir_flc = diskInfo.root_cluster;
+    }
+
+    if(dir_flc == 0){
+        char *root = p + (diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+        for(int k = 0; k < diskInfo.root_dir_entries; k++){
+            entry_start = root + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                break;
+            }
+            check_entry(p, entry_start);
+        }
+        return;
+    }
+
+    // only walk the clusters check_chain kept, the FAT past them may loop
+    uint32_t cluster = dir_flc;
+    for(int i = 0; i < length; i++){
+        for(int k = 0; k < entries_per_cluster; k++){
+            entry_start = cluster_ptr(p, cluster) + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                return;
+            }
+            check_entry(p, entry_start);
+        }
+        cluster = checkInfo.fat_table[cluster];
+    }
+}
+
+
+/*
+* Function: check_entry(char *p, char *entry_start)
+* =================================
+* Purpose: check the chain and size of one directory entry
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the directory entry
+*
+*/
+void check_entry(char *p, char *entry_start){
+    uint8_t file_attributes;
+    uint32_t flc;
+    uint32_t file_size;
+    int length;
+    int expected;
+    char path[300];
+
+    memcpy(&file_attributes, (entry_start + 11), 1);
+    flc = get_entry_flc(entry_start);
+    memcpy(&file_size, (entry_start + 28), 4);
+
+    if((uint8_t)entry_start[0] == 0xE5 || entry_start[0] == '.' || file_attributes == 0x0F || (0x08 & file_attributes)){
+        return;
+    }
+    checkInfo.entries++;
+    entry_path(entry_start, path);
+
+    if(flc == 0){
+        if(!(0x10 & file_attributes) && file_size != 0){
+            printf("%s: size %u but no clusters\n", path, file_size);
+            checkInfo.size_mismatches++;
+            if(repair){
+                file_size = 0;
+                memcpy(entry_start + 28, &file_size, 4);
+                journal_add('E', (entry_start - p) / 32);
+            }
+        }
+        return;
+    }
+
+    length = check_chain(p, entry_start, flc);
+    if(length < 0){
+        return;
+    }
+    // repair may have given the entry a copy of a shared first cluster
+    flc = get_entry_flc(entry_start);
+
+    if(0x10 & file_attributes){
+        int path_len = strlen(checkInfo.path);
+        if(strlen(path) < sizeof(checkInfo.path)){
+            strcpy(checkInfo.path, path);
+        }
+        check_directory(p, flc, length);
+        checkInfo.path[path_len] = '\0';
+        return;
+    }
+
+    expected = (file_size + diskInfo.cluster_bytes - 1) / diskInfo.cluster_bytes;
+    if(length != expected){
+        printf("%s: size %u needs %d clusters, chain has %d\n", path, file_size, expected, length);
+        checkInfo.size_mismatches++;
+        if(repair){
+            if(length > expected){
+                trim_chain(p, entry_start, flc, expected);
+            }else{
+                file_size = length * diskInfo.cluster_bytes;
+                memcpy(entry_start + 28, &file_size, 4);
+                journal_add('E', (entry_start - p) / 32);
+            }
+        }
+    }
+}
+
+
+/*
+* Function: check_chain(char *p, char *entry_start, uint32_t flc)
+* =================================
+* Purpose: walk one chain, claiming its clusters and stopping at the first
+*          cross link, cycle or broken link. Each cluster is visited at most
+*          twice (claim and in_chain cleanup) over the whole check. A chain whose
+*          very first cluster is cross-linked is repaired with a copy of that cluster
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the owning directory entry, NULL for the FAT32 root
+*   uint32_t flc: first logical cluster of the chain
+*
+* Return:
+*   int: number of clusters kept in the chain, -1 if the entry lost its chain
+*
+*/
+int check_chain(char *p, char *entry_start, uint32_t flc){
+    uint32_t cluster = flc;
+    uint32_t prev = 0;
+    uint32_t next;
+    int length = 0;
+    int shared = 0;
+    char path[300];
+
+    if(entry_start == NULL){
+        strcpy(path, "/");
+    }else{
+        entry_path(entry_start, path);
+    }
+
+    while(1){
+        if(cluster < 2 || cluster >= diskInfo.cluster_count || checkInfo.fat_table[cluster] == 0x000){
+            printf("%s: chain links to %s cluster %u\n", path,
+                (cluster >= 2 && cluster < diskInfo.cluster_count) ? "free" : "invalid", cluster);
+            checkInfo.bad_chains++;
+            break;
+        }
+        if(test_bit(checkInfo.in_chain, cluster)){
+            printf("%s: chain loops back to cluster %u\n", path, cluster);
+            checkInfo.cycles++;
+            break;
+        }
+        if(test_bit(checkInfo.claimed, cluster)){
+            printf("%s: cluster %u is cross-linked with another chain\n", path, cluster);
+            checkInfo.cross_links++;
+            shared = 1;
+            break;
+        }
+
+        set_bit(checkInfo.claimed, cluster);
+        set_bit(checkInfo.in_chain, cluster);
+        length++;
+
+        // the bad cluster marker sits just below the end of chain values
+        next = checkInfo.fat_table[cluster];
+        if(next >= diskInfo.eoc_min){
+            prev = 0;
+            break;
+        }
+        if(next == diskInfo.eoc_min - 1){
+            printf("%s: chain links to bad cluster marker at %u\n", path, cluster);
+            checkInfo.bad_chains++;
+            prev = cluster;
+            break;
+        }
+        prev = cluster;
+        cluster = next;
+    }
+
+    // the loop left through a broken link after prev, end the chain there
+    if(repair && prev != 0){
+        set_fat(p, prev, diskInfo.eoc);
+    }
+    // like a mid-chain cross link keeps the clusters before the shared one, a chain sharing
+    // its first cluster keeps the entry with a private copy of that cluster
+    uint32_t copy = (repair && length == 0 && shared && entry_start != NULL) ? copy_cluster(p, flc) : 0;
+    if(copy != 0){
+        printf("%s: first cluster %u copied to %u, the chain ends there\n", path, flc, copy);
+        set_entry_flc(entry_start, copy);
+        journal_add('E', (entry_start - p) / 32);
+        char *dir_start = cluster_ptr(p, copy);
+        if((entry_start[11] & 0x10) && dir_start[0] == '.' && dir_start[1] == ' '){
+            set_entry_flc(dir_start, copy);
+        }
+        flc = copy;
+        length = 1;
+    }else if(repair && length == 0 && entry_start != NULL){
+        uint32_t zero_size = 0;
+        set_entry_flc(entry_start, 0);
+        memcpy(entry_start + 28, &zero_size, 4);
+        journal_add('E', (entry_start - p) / 32);
+    }
+
+    // clear the in_chain marks again with a second walk of the kept clusters
+    cluster = flc;
+    for(int i = 0; i < length; i++){
+        clear_bit(checkInfo.in_chain, cluster);
+        cluster = checkInfo.fat_table[cluster];
+    }
+
+    return length > 0 ? length : -1;
+}
+
+
+/*
+* Function: trim_chain(char *p, char *entry_start, uint32_t flc, int keep)
+* =================================
+* Purpose: free the clusters of a chain past the first keep clusters
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the owning directory entry
+*   uint32_t flc: first logical cluster of the chain
+*   int keep: number of clusters to keep
+*
+*/
+void trim_chain(char *p, char *entry_start, uint32_t flc, int keep){
+    uint32_t cluster = flc;
+    uint32_t next;
+
+    for(int i = 1; i < keep; i++){
+        cluster = checkInfo.fat_table[cluster];
+    }
+
+    if(keep == 0){
+        set_entry_flc(entry_start, 0);
+        journal_add('E', (entry_start - p) / 32);
+        next = cluster;
+    }else{
+        next = checkInfo.fat_table[cluster];
+        set_fat(p, cluster, diskInfo.eoc);
+    }
+
+    while(next >= 2 && next < diskInfo.cluster_count){
+        cluster = next;
+        next = checkInfo.fat_table[cluster];
+        set_fat(p, cluster, 0x000);
+        clear_bit(checkInfo.claimed, cluster);
+    }
+}
+
+
+/*
+* Function: copy_cluster(char *p, uint32_t cluster)
+* =================================
+* Purpose: copy a cluster into a free cluster and end a chain on the copy
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster to copy
+*
+* Return:
+*   uint32_t: the copy, 0 when the image has no free cluster left
+*
+*/
+uint32_t copy_cluster(char *p, uint32_t cluster){
+    uint32_t copy = checkInfo.next_free;
+
+    while(copy < diskInfo.cluster_count && (checkInfo.fat_table[copy] != 0x000 || test_bit(checkInfo.claimed, copy))){
+        copy++;
+    }
+    if(copy >= diskInfo.cluster_count){
+        return 0;
+    }
+    checkInfo.next_free = copy + 1;
+
+    memcpy(cluster_ptr(p, copy), cluster_ptr(p, cluster), diskInfo.cluster_bytes);
+    journal_add('C', copy);
+    set_fat(p, copy, diskInfo.eoc);
+    set_bit(checkInfo.claimed, copy);
+    return copy;
+}
+
+
+/*
+* Function: check_lost_clusters(char *p)
+* =================================
+* Purpose: report allocated clusters no directory entry reaches
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void check_lost_clusters(char *p){
+    int in_run = 0;
+
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        uint32_t entry = checkInfo.fat_table[c];
+
+        if(entry != 0x000 && entry != diskInfo.eoc_min - 1 && !test_bit(checkInfo.claimed, c)){
+            checkInfo.lost_clusters++;
+            if(!in_run){
+                checkInfo.lost_runs++;
+                printf("Lost cluster run starting at %d\n", c);
+            }
+            in_run = 1;
+            if(repair){
+                set_fat(p, c, 0x000);
+            }
+        }else{
+            in_run = 0;
+        }
+    }
+}
+
+
+/*
+* Function: set_fat(char *p, uint32_t cluster, uint32_t value)
+* =================================
+* Purpose: change a FAT entry in both the decoded table and the first FAT
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster number
+*   uint32_t value: new FAT entry
+*
+*/
+void set_fat(char *p, uint32_t cluster, uint32_t value){
+    checkInfo.fat_table[cluster] = value;
+    set_next_fat_entry(p, cluster, value);
+    checkInfo.fat_dirty = 1;
+}
+
+
+/*
+* Function: sync_fat_copies(char *p)
+* =================================
+* Purpose: copy the first FAT over every other FAT copy, FAT32 also gets its
+*          FSInfo free count updated
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void sync_fat_copies(char *p){
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * diskInfo.bytes_per_sector;
+    char *fat_start = p + diskInfo.fat_start;
+
+    for(int i = 1; i < diskInfo.num_of_fats; i++){
+        memcpy(fat_start + i*fat_bytes, fat_start, fat_bytes);
+    }
+    for(int s = 0; s < diskInfo.sector_per_fat; s++){
+        journal_add('F', s);
+    }
+    int fsinfo_sector = update_fsinfo(p);
+    if(fsinfo_sector != 0){
+        journal_add('S', fsinfo_sector);
+    }
+}
+
+
+/*
+* Function: entry_path(char *entry_start, char *path_out)
+* =================================
+* Purpose: build the full path of an entry in the directory being checked
+*
+* Input:
+*   char* entry_start: start location of the directory entry
+*   char* path_out: output string location
+*
+*/
+void entry_path(char *entry_start, char *path_out){
+    int len;
+
+    strcpy(path_out, checkInfo.path);
+    strcat(path_out, "/");
+    len = strlen(path_out);
+    for(int i = 0; i < 8 && entry_start[i] != ' '; i++){
+        path_out[len++] = entry_start[i];
+    }
+    if(entry_start[8] != ' '){
+        path_out[len++] = '.';
+    }
+    for(int i = 8; i < 11 && entry_start[i] != ' '; i++){
+        path_out[len++] = entry_start[i];
+    }
+    path_out[len] = '\0';
+}
+
+
+/*
+* Function: cluster_ptr(char *p, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(char *p, uint32_t cluster){
+    return p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: set_entry_flc(char *entry, uint32_t flc)
+* =================================
+* Purpose: store the first cluster in a directory entry (high 16 bits only on FAT32)
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*   uint32_t flc: first logical cluster
+*
+*/
+void set_entry_flc(char *entry, uint32_t flc){
+    uint16_t low = flc & 0xFFFF;
+    uint16_t high = flc >> 16;
+
+    memcpy((entry + 26), &low, 2);
+    if(diskInfo.fat_type == 32){
+        memcpy((entry + 20), &high, 2);
+    }
+}
+
+
+/*
+* Function: set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc)
+* =================================
+* Purpose: set the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: location of entry
+*   uint32_t next_flc: entry to be put into FAT
+*
+*/
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc){
+    char *fat = p + diskInfo.fat_start;
+    size_t ent_offset = fat_entry_offset(flc);
+    uint8_t first, second;
+
+    if(diskInfo.fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+        return;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
+        first = (uint8_t)(0xff & next_flc);
+        second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
+
+    }else{
+        first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
+        second = (uint8_t)(0xff & (next_flc >> 4));
+    }
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
+    journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+    journal_add('F', (ent_offset + 1) / diskInfo.bytes_per_sector);
+}
+
+
+/*
+* Function: update_fsinfo(char *p)
+* =================================
+* Purpose: store the free cluster count of the decoded FAT in the FAT32 FSInfo sector
+*          and drop its next free hint
+*
+* Input:
+*   char* p: image data pointer
+*
+* Return:
+*   int: the FSInfo sector, 0 when the image has none
+*
+*/
+int update_fsinfo(char *p){
+    uint16_t fsinfo_sector;
+    uint32_t signature;
+    uint32_t free_count = 0;
+    uint32_t next_free = 0xFFFFFFFF;
+
+    if(diskInfo.fat_type != 32){
+        return 0;
+    }
+    memcpy(&fsinfo_sector, (p + 48), 2);
+    if(fsinfo_sector == 0 || fsinfo_sector >= diskInfo.reserved_sectors){
+        return 0;
+    }
+    char *fsinfo = p + (size_t)fsinfo_sector * diskInfo.bytes_per_sector;
+    memcpy(&signature, fsinfo, 4);
+    if(signature != 0x41615252){
+        return 0;
+    }
+
+    for(uint32_t c = 2; c < diskInfo.cluster_count; c++){
+        if(checkInfo.fat_table[c] == 0){
+            free_count++;
+        }
+    }
+    memcpy((fsinfo + 488), &free_count, 4);
+    memcpy((fsinfo + 492), &next_free, 4);
+    return fsinfo_sector;
+}
+
+
+/*
+* Function: test_bit(uint8_t *map, int bit) / set_bit(uint8_t *map, int bit) / clear_bit(uint8_t *map, int bit)
+* =================================
+* Purpose: read and change single bits of a cluster bitmap
+*
+*/
+int test_bit(uint8_t *map, int bit){
+    return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+void set_bit(uint8_t *map, int bit){
+    map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+}
+
+void clear_bit(uint8_t *map, int bit){
+    map[bit / 8] &= (uint8_t)~(1 << (bit % 8));
+}
+
+
+/*
+* Function: journal_add(char kind, uint32_t value)
+* =================================
+* Purpose: remember one changed cluster ('C'), FAT sector ('F') or directory entry ('E')
+*          for the change journal, nothing is kept without -j
+*
+* Input:
+*   char kind: record kind
+*   uint32_t value: cluster, sector of the first FAT or entry offset / 32
+*
+*/
+void journal_add(char kind, uint32_t value){
+    if(!use_journal){
+        return;
+    }
+    if(journalInfo.count > 0 && journalInfo.records[journalInfo.count-1].kind == kind
+        && journalInfo.records[journalInfo.count-1].value == value){
+        return;
+    }
+    journalInfo.records = realloc(journalInfo.records, sizeof(struct journalRecord)*(journalInfo.count + 1));
+    memset(&journalInfo.records[journalInfo.count], 0, sizeof(struct journalRecord));
+    journalInfo.records[journalInfo.count].kind = kind;
+    journalInfo.records[journalInfo.count].value = value;
+    journalInfo.count++;
+}
+
+
+/*
+* Function: journal_write(char *image_name)
+* =================================
+* Purpose: append the remembered records to {image}.jnl and fsync it, called before
+*          the image is synced so after a crash the journal can only list too much
+*
+* Input:
+*   char* image_name: image file name
+*
+*/
+void journal_write(char *image_name){
+    char journal_name[4096];
+
+    if(journalInfo.count == 0){
+        return;
+    }
+    snprintf(journal_name, sizeof(journal_name), "%s.jnl", image_name);
+    FILE *journal = fopen(journal_name, "a");
+    if(journal == NULL){
+        printf("Error: failed to open %s\n", journal_name);
+        exit(1);
+    }
+    if(ftell(journal) == 0){
+        fwrite("FATJNL1", 8, 1, journal);
+    }
+    fwrite(journalInfo.records, sizeof(struct journalRecord), journalInfo.count, journal);
+    if(fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+        printf("Error: failed to write %s\n", journal_name);
+        exit(1);
+    }
+    fclose(journal);
+    journalInfo.count = 0;
+}
@@ -0,0 +1,301 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Make a sparse copy of a FAT12, FAT16 or FAT32 image holding only its allocated clusters
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+struct cloneInfo{
+    int src_fd;
+    int dst_fd;
+    off_t image_size;
+    off_t bytes_copied;
+    int runs;
+}cloneInfo;
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+size_t fat_entry_offset(uint32_t cluster);
+void copy_range(char *p, off_t start, off_t len);
+void write_all(char *data, off_t offset, off_t len);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	struct stat sb;
+
+    if(argc != 3){
+        printf("Input format: ./diskclone {image file} {clone file}\n");
+        exit(1);
+    }
+
+    cloneInfo.src_fd = open(argv[1], O_RDONLY);
+    if(cloneInfo.src_fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(cloneInfo.src_fd, &sb);
+    cloneInfo.image_size = sb.st_size;
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, cloneInfo.src_fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+
+    // truncating the image itself (or a link to it) would wipe it before it is read
+    struct stat dst_sb;
+    if(stat(argv[2], &dst_sb) == 0 && dst_sb.st_dev == sb.st_dev && dst_sb.st_ino == sb.st_ino){
+        printf("Error: %s is the image itself\n", argv[2]);
+        exit(1);
+    }
+
+    // the clone starts as one hole of the full size, only written ranges take space
+    cloneInfo.dst_fd = open(argv[2], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(cloneInfo.dst_fd < 0 || ftruncate(cloneInfo.dst_fd, sb.st_size) != 0){
+        printf("Error: failed to create %s\n", argv[2]);
+        exit(1);
+    }
+
+    // boot sector, FATs and root directory
+    off_t data_start = (off_t)diskInfo.data_region_start * diskInfo.bytes_per_sector;
+    copy_range(p, 0, data_start);
+
+    // every run of allocated clusters in one write
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        if(get_fat_entry(p, c) == 0x000){
+            continue;
+        }
+        int start = c;
+        while(c < diskInfo.cluster_count && get_fat_entry(p, c) != 0x000){
+            c++;
+        }
+        copy_range(p, data_start + (off_t)(start - 2) * diskInfo.cluster_bytes, (off_t)(c - start) * diskInfo.cluster_bytes);
+    }
+
+    // anything past the last cluster (unused sectors, trailing data) is copied as is
+    off_t data_end = data_start + (off_t)(diskInfo.cluster_count - 2) * diskInfo.cluster_bytes;
+    if(data_end < sb.st_size){
+        copy_range(p, data_end, sb.st_size - data_end);
+    }
+
+    if(fsync(cloneInfo.dst_fd) != 0){
+        printf("Error: failed to write %s\n", argv[2]);
+        exit(1);
+    }
+    fstat(cloneInfo.dst_fd, &sb);
+    printf("Copied %lld of %lld bytes in %d writes, clone uses %lld KB\n", (long long)cloneInfo.bytes_copied,
+        (long long)cloneInfo.image_size, cloneInfo.runs, (long long)sb.st_blocks / 2);
+
+    munmap(p, cloneInfo.image_size);
+    close(cloneInfo.dst_fd);
+    close(cloneInfo.src_fd);
+	return 0;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: copy_range(char *p, off_t start, off_t len)
+* =================================
+* Purpose: copy a range of the image to the clone, skipping parts that are already
+*          holes in the source (SEEK_DATA / SEEK_HOLE) so they stay holes in the clone
+*
+* Input:
+*   char* p: image data pointer
+*   off_t start: offset of the range
+*   off_t len: length of the range
+*
+*/
+void copy_range(char *p, off_t start, off_t len){
+    off_t end = start + len;
+
+    if(end > cloneInfo.image_size){
+        end = cloneInfo.image_size;
+    }
+    while(start < end){
+        off_t data = lseek(cloneInfo.src_fd, start, SEEK_DATA);
+        if(data < 0 || data >= end){
+            return;
+        }
+        off_t hole = lseek(cloneInfo.src_fd, data, SEEK_HOLE);
+        if(hole < 0 || hole > end){
+            hole = end;
+        }
+        write_all(p + data, data, hole - data);
+        start = hole;
+    }
+}
+
+
+/*
+* Function: write_all(char *data, off_t offset, off_t len)
+* =================================
+* Purpose: pwrite a range to the clone, retrying short writes
+*
+* Input:
+*   char* data: source bytes
+*   off_t offset: offset in the clone
+*   off_t len: number of bytes
+*
+*/
+void write_all(char *data, off_t offset, off_t len){
+    cloneInfo.runs++;
+    while(len > 0){
+        ssize_t written = pwrite(cloneInfo.dst_fd, data, len, offset);
+        if(written <= 0){
+            printf("Error: failed to write clone\n");
+            exit(1);
+        }
+        data += written;
+        offset += written;
+        len -= written;
+        cloneInfo.bytes_copied += written;
+    }
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
@@ -0,0 +1,1084 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Copy files and directory trees from one FAT12, FAT16 or FAT32 image to another without the host file system
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define NO_DIR 0xFFFFFFFF
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+// one mapped image; source and destination are the same struct when both name one file
+struct imageInfo{
+    char *p;
+    size_t size;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+    int cluster_count;
+    uint32_t *fat_table;     // decoded first FAT, allocations land here until commit
+    int next_free;
+}srcImage, dstImage;
+
+// change journal {image}.jnl, see diskput.c for the record layout
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+struct journalInfo{
+    struct journalRecord *records;
+    int count;
+}journalInfo;
+
+int recursive = 0;
+int use_journal = 0;
+int files_copied = 0;
+int dirs_copied = 0;
+
+
+void open_image(struct imageInfo *img, char *path, int writable);
+void get_geometry(struct imageInfo *img);
+unsigned int get_fat_entry(struct imageInfo *img, uint32_t flc);
+void set_next_fat_entry(struct imageInfo *img, uint32_t flc, uint32_t next_flc);
+size_t fat_entry_offset(struct imageInfo *img, uint32_t cluster);
+uint32_t get_entry_flc(struct imageInfo *img, char *entry);
+void set_entry_flc(struct imageInfo *img, char *entry, uint32_t flc);
+char* cluster_ptr(struct imageInfo *img, uint32_t cluster);
+char* scan_directory(struct imageInfo *img, uint32_t dir_flc, char *short_name);
+char* resolve_path(struct imageInfo *img, char *path, uint32_t *parent_flc, char *last_name);
+int make_short_name(char *name, char *short_name);
+uint32_t* chain_list(struct imageInfo *img, uint32_t flc, int *count);
+uint32_t alloc_chain(struct imageInfo *img, int count, uint32_t *list);
+int* run_lengths(uint32_t *list, int count);
+void copy_data(struct imageInfo *src, uint32_t *src_list, int src_count, struct imageInfo *dst, uint32_t *dst_list, int dst_count, uint32_t size);
+void copy_entry(struct imageInfo *src, char *src_entry, struct imageInfo *dst, uint32_t dst_parent, char *short_name, char *entry_out);
+void copy_tree(struct imageInfo *src, uint32_t src_dir, struct imageInfo *dst, uint32_t dst_dir);
+char* add_entry_slot(struct imageInfo *img, uint32_t dir_flc);
+void commit_fat(struct imageInfo *img);
+int update_fsinfo(struct imageInfo *img);
+void split_image_path(char *arg, char **image, char **path);
+void journal_changes(struct imageInfo *img, char *slot, char *image_name);
+void journal_add(char kind, uint32_t value);
+void journal_write(char *image_name);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+    char *src_file, *src_path, *dst_file, *dst_path;
+    char src_name[13], dst_name[13];
+    char short_name[11];
+    char entry[32];
+    uint32_t src_parent, dst_parent;
+    char *args[2];
+    int arg_count = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-r") == 0){
+            recursive = 1;
+        }else if(strcmp(argv[i], "-j") == 0){
+            use_journal = 1;
+        }else if(arg_count < 2){
+            args[arg_count++] = argv[i];
+        }else{
+            arg_count++;
+        }
+    }
+    if(arg_count != 2){
+        printf("Input format: ./diskcp {source image}:{image path} {destination image}:{image path} [-r] [-j]\n");
+        exit(1);
+    }
+    split_image_path(args[0], &src_file, &src_path);
+    split_image_path(args[1], &dst_file, &dst_path);
+
+    open_image(&srcImage, src_file, 0);
+    open_image(&dstImage, dst_file, 1);
+    struct imageInfo *src = &srcImage;
+    struct imageInfo *dst = &dstImage;
+
+    // copying inside one image must see its own allocations
+    if(srcImage.dev == dstImage.dev && srcImage.ino == dstImage.ino){
+        src = dst;
+    }
+
+    char *src_entry = resolve_path(src, src_path, &src_parent, src_name);
+    if(src_entry == NULL){
+        printf("%s: no such file or directory\n", args[0]);
+        exit(1);
+    }
+    if((src_entry[11] & 0x10) && !recursive){
+        printf("%s: is a directory, use -r\n", args[0]);
+        exit(1);
+    }
+
+    // an existing directory as destination keeps the name, otherwise the last component is the new name
+    char *dst_entry = resolve_path(dst, dst_path, &dst_parent, dst_name);
+    if(dst_path[strspn(dst_path, "/.")] == '\0'){
+        dst_parent = 0;
+        strcpy(dst_name, src_name);
+        make_short_name(dst_name, short_name);
+        dst_entry = scan_directory(dst, dst_parent, short_name);
+    }else if(dst_entry != NULL && (dst_entry[11] & 0x10)){
+        dst_parent = get_entry_flc(dst, dst_entry);
+        strcpy(dst_name, src_name);
+        make_short_name(dst_name, short_name);
+        dst_entry = scan_directory(dst, dst_parent, short_name);
+    }else if(dst_parent == NO_DIR){
+        printf("%s: destination directory not found\n", args[1]);
+        exit(1);
+    }
+    if(dst_entry != NULL){
+        printf("%s: destination already exists\n", args[1]);
+        exit(1);
+    }
+    if(make_short_name(dst_name, short_name) != 0){
+        printf("%s: not a valid 8.3 name\n", dst_name);
+        exit(1);
+    }
+
+    // 1 data and new directory clusters go into free clusters, 2 the FAT, 3 the one visible entry
+    char *slot = add_entry_slot(dst, dst_parent);
+    copy_entry(src, src_entry, dst, dst_parent, short_name, entry);
+    if(use_journal){
+        journal_changes(dst, slot, dst_file);
+    }
+    msync(dst->p, dst->size, MS_SYNC);
+
+    commit_fat(dst);
+    msync(dst->p, dst->size, MS_SYNC);
+
+    memcpy(slot, entry, 32);
+    msync(dst->p, dst->size, MS_SYNC);
+
+    printf("Copied %d files and %d directories\n", files_copied, dirs_copied);
+    munmap(dstImage.p, dstImage.size);
+    munmap(srcImage.p, srcImage.size);
+    close(dstImage.fd);
+    close(srcImage.fd);
+	return 0;
+}
+
+
+/*
+* Function: split_image_path(char *arg, char **image, char **path)
+* =================================
+* Purpose: split an {image}:{path} argument at its last ':'
+*
+* Input:
+*   char* arg: command line argument
+*   char** image: set to the image file name
+*   char** path: set to the path inside the image
+*
+*/
+void split_image_path(char *arg, char **image, char **path){
+    char *colon = strrchr(arg, ':');
+
+    if(colon == NULL){
+        printf("%s: expected {image file}:{image path}\n", arg);
+        exit(1);
+    }
+    *colon = '\0';
+    *image = arg;
+    *path = colon + 1;
+}
+
+
+/*
+* Function: open_image(struct imageInfo *img, char *path, int writable)
+* =================================
+* Purpose: map an image, read its geometry and decode its FAT
+*
+* Input:
+*   struct imageInfo* img: image to fill in
+*   char* path: image file name
+*   int writable: map read/write instead of read only
+*
+*/
+void open_image(struct imageInfo *img, char *path, int writable){
+    struct stat sb;
+
+    img->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if(img->fd < 0){
+        printf("Error: failed to open %s\n", path);
+        exit(1);
+    }
+    fstat(img->fd, &sb);
+    img->size = sb.st_size;
+    img->dev = sb.st_dev;
+    img->ino = sb.st_ino;
+
+    // Make pointer to start of image
+    img->p = mmap(NULL, img->size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, img->fd, 0);
+    if (img->p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(img);
+    img->fat_table = malloc(sizeof(uint32_t)*img->cluster_count);
+    for(int i = 0; i < img->cluster_count; i++){
+        img->fat_table[i] = get_fat_entry(img, i);
+    }
+    img->next_free = 2;
+}
+
+
+/*
+* Function: get_geometry(struct imageInfo *img)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*
+*/
+void get_geometry(struct imageInfo *img){
+    char *p = img->p;
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&img->root_dir_entries, (p + 17), 2);
+    memcpy(&img->num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&img->reserved_sectors, (p + 14), 2);
+    memcpy(&img->sectors_per_cluster, (p + 13), 1);
+    memcpy(&img->bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    img->sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&img->sector_count, (p + 32), 4);
+    }
+    img->sector_per_fat = sector_per_fat;
+    img->root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&img->sector_per_fat, (p + 36), 4);
+        memcpy(&img->root_cluster, (p + 44), 4);
+    }
+
+    img->root_dir_sectors = ((img->root_dir_entries * 32) + img->bytes_per_sector - 1) / img->bytes_per_sector;
+    img->data_region_start = (img->num_of_fats * img->sector_per_fat) + img->reserved_sectors + img->root_dir_sectors;
+    img->cluster_count = ((img->sector_count - img->data_region_start) / img->sectors_per_cluster) + 2;
+    img->fat_start = (size_t)img->reserved_sectors * img->bytes_per_sector;
+    img->cluster_bytes = img->bytes_per_sector * img->sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(img->cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        img->fat_type = 12;
+        img->eoc = 0xFFF;
+    }else if(img->cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        img->fat_type = 16;
+        img->eoc = 0xFFFF;
+    }else{
+        img->fat_type = 32;
+        img->eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: scan_directory(struct imageInfo *img, uint32_t dir_flc, char *short_name)
+* =================================
+* Purpose: find an entry in a directory by its 8.3 name
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* short_name: 11 byte name to look for
+*
+* Return:
+*   char*: the entry, NULL if there is none
+*
+*/
+char* scan_directory(struct imageInfo *img, uint32_t dir_flc, char *short_name){
+    // the FAT32 root is a cluster chain like any sub directory
+    uint32_t cluster = (dir_flc == 0) ? img->root_cluster : dir_flc;
+    char *start;
+    int entry_count;
+
+    for(int steps = 0; steps < img->cluster_count; steps++){
+        if(cluster == 0){
+            start = img->p + ((size_t)img->data_region_start - img->root_dir_sectors) * img->bytes_per_sector;
+            entry_count = img->root_dir_entries;
+        }else{
+            start = cluster_ptr(img, cluster);
+            entry_count = img->cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+
+            if(first == 0x00){
+                return NULL;
+            }
+            if(first != 0xE5 && entry_start[11] != 0x0F && !(entry_start[11] & 0x08) && memcmp(entry_start, short_name, 11) == 0){
+                return entry_start;
+            }
+        }
+
+        if(cluster == 0){
+            return NULL;
+        }
+        cluster = img->fat_table[cluster];
+        if(cluster < 2 || cluster >= (uint32_t)img->cluster_count){
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Function: resolve_path(struct imageInfo *img, char *path, uint32_t *parent_flc, char *last_name)
+* =================================
+* Purpose: look up an image path one component at a time
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   char* path: path such as /SUB1/FILE.TXT, case does not matter
+*   uint32_t* parent_flc: set to the directory holding the last component, NO_DIR if a
+*                         directory on the way does not exist
+*   char* last_name: set to the upper case last component, at least 13 bytes
+*
+* Return:
+*   char*: the entry of the last component, NULL if it does not exist
+*
+*/
+char* resolve_path(struct imageInfo *img, char *path, uint32_t *parent_flc, char *last_name){
+    char *copy = strdup(path);
+    char *parts[64];
+    int part_count = 0;
+    char short_name[11];
+    char *entry = NULL;
+    uint32_t dir_flc = 0;
+
+    for(char *part = strtok(copy, "/"); part != NULL && part_count < 64; part = strtok(NULL, "/")){
+        if(strcmp(part, ".") != 0){
+            parts[part_count++] = part;
+        }
+    }
+
+    *parent_flc = NO_DIR;
+    last_name[0] = '\0';
+    if(part_count == 0){
+        free(copy);
+        return NULL;
+    }
+
+    for(int i = 0; i < part_count; i++){
+        for(int k = 0; parts[i][k] != '\0'; k++){
+            parts[i][k] = toupper((unsigned char)parts[i][k]);
+        }
+        if(i == part_count - 1){
+            *parent_flc = dir_flc;
+            snprintf(last_name, 13, "%s", parts[i]);
+        }
+        if(make_short_name(parts[i], short_name) != 0){
+            entry = NULL;
+            break;
+        }
+        entry = scan_directory(img, dir_flc, short_name);
+        if(i == part_count - 1 || entry == NULL){
+            break;
+        }
+        if(!(entry[11] & 0x10)){
+            entry = NULL;
+            break;
+        }
+        dir_flc = get_entry_flc(img, entry);
+    }
+    free(copy);
+    return entry;
+}
+
+
+/*
+* Function: make_short_name(char *name, char *short_name)
+* =================================
+* Purpose: build the space padded 8.3 form of a NAME.EXT string
+*
+* Input:
+*   char* name: upper case name
+*   char* short_name: 11 byte output, not null terminated
+*
+* Return:
+*   int: 0 on success, -1 if the name does not fit 8.3
+*
+*/
+int make_short_name(char *name, char *short_name){
+    char *ext = strrchr(name, '.');
+    int name_len = ext ? (int)(ext - name) : (int)strlen(name);
+    int ext_len = ext ? (int)strlen(ext + 1) : 0;
+
+    if(name_len == 0 || name_len > 8 || ext_len > 3){
+        return -1;
+    }
+    memset(short_name, ' ', 11);
+    memcpy(short_name, name, name_len);
+    if(ext != NULL){
+        memcpy(short_name + 8, ext + 1, ext_len);
+    }
+    return 0;
+}
+
+
+/*
+* Function: chain_list(struct imageInfo *img, uint32_t flc, int *count)
+* =================================
+* Purpose: list the clusters of a chain in order
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t flc: first logical cluster
+*   int* count: set to the number of clusters
+*
+* Return:
+*   uint32_t*: the clusters, free with free()
+*
+*/
+uint32_t* chain_list(struct imageInfo *img, uint32_t flc, int *count){
+    uint32_t *list = malloc(sizeof(uint32_t)*img->cluster_count);
+    uint32_t cluster = flc;
+
+    *count = 0;
+    while(cluster >= 2 && cluster < (uint32_t)img->cluster_count && *count < img->cluster_count){
+        list[(*count)++] = cluster;
+        cluster = img->fat_table[cluster];
+    }
+    return list;
+}
+
+
+/*
+* Function: alloc_chain(struct imageInfo *img, int count, uint32_t *list)
+* =================================
+* Purpose: take free clusters in ascending order and link them into a chain in the
+*          decoded FAT. Free space is usually one run, so this hands out extents
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   int count: number of clusters wanted
+*   uint32_t* list: set to the clusters of the chain
+*
+* Return:
+*   uint32_t: first logical cluster of the chain, 0 when count is 0
+*
+*/
+uint32_t alloc_chain(struct imageInfo *img, int count, uint32_t *list){
+    for(int i = 0; i < count; i++){
+        while(img->next_free < img->cluster_count && img->fat_table[img->next_free] != 0x000){
+            img->next_free++;
+        }
+        if(img->next_free >= img->cluster_count){
+            printf("Insufficient space on disk\n");
+            exit(1);
+        }
+        list[i] = img->next_free;
+        img->fat_table[list[i]] = img->eoc;
+        if(i > 0){
+            img->fat_table[list[i-1]] = list[i];
+        }
+    }
+    return count > 0 ? list[0] : 0;
+}
+
+
+/*
+* Function: run_lengths(uint32_t *list, int count)
+* =================================
+* Purpose: for every position of a cluster list, count how many clusters from there on
+*          follow each other on disk
+*
+* Input:
+*   uint32_t* list: cluster list
+*   int count: number of clusters
+*
+* Return:
+*   int*: run length per position, free with free()
+*
+*/
+int* run_lengths(uint32_t *list, int count){
+    int *run = malloc(sizeof(int)*(count + 1));
+
+    for(int i = count - 1; i >= 0; i--){
+        run[i] = (i + 1 < count && list[i+1] == list[i] + 1) ? run[i+1] + 1 : 1;
+    }
+    return run;
+}
+
+
+/*
+* Function: copy_data(...)
+* =================================
+* Purpose: copy file data between two chains, one memcpy for each stretch where both the
+*          source and the destination clusters are contiguous. Works across cluster sizes
+*
+* Input:
+*   struct imageInfo* src / dst: source and destination image
+*   uint32_t* src_list / dst_list: clusters of both chains
+*   int src_count / dst_count: number of clusters in both chains
+*   uint32_t size: number of bytes to copy
+*
+*/
+void copy_data(struct imageInfo *src, uint32_t *src_list, int src_count, struct imageInfo *dst, uint32_t *dst_list, int dst_count, uint32_t size){
+    int *src_run = run_lengths(src_list, src_count);
+    int *dst_run = run_lengths(dst_list, dst_count);
+    uint32_t pos = 0;
+
+    while(pos < size){
+        int si = pos / src->cluster_bytes;
+        int di = pos / dst->cluster_bytes;
+        if(si >= src_count){
+            break;
+        }
+        uint32_t src_off = pos % src->cluster_bytes;
+        uint32_t dst_off = pos % dst->cluster_bytes;
+        uint32_t len = size - pos;
+        uint32_t src_span = src_run[si] * src->cluster_bytes - src_off;
+        uint32_t dst_span = dst_run[di] * dst->cluster_bytes - dst_off;
+
+        if(len > src_span){
+            len = src_span;
+        }
+        if(len > dst_span){
+            len = dst_span;
+        }
+        memcpy(cluster_ptr(dst, dst_list[di]) + dst_off, cluster_ptr(src, src_list[si]) + src_off, len);
+        pos += len;
+    }
+
+    // zero the slack after the data, a short source chain reads as zeros too
+    if(dst_count > 0){
+        uint32_t end = (uint32_t)dst_count * dst->cluster_bytes;
+        while(pos < end){
+            int di = pos / dst->cluster_bytes;
+            uint32_t dst_off = pos % dst->cluster_bytes;
+            memset(cluster_ptr(dst, dst_list[di]) + dst_off, 0, dst->cluster_bytes - dst_off);
+            pos += dst->cluster_bytes - dst_off;
+        }
+    }
+    free(src_run);
+    free(dst_run);
+}
+
+
+/*
+* Function: copy_entry(...)
+* =================================
+* Purpose: copy one file or directory tree and build its destination entry. The entry
+*          itself is returned, not written, so the caller decides when it becomes visible
+*
+* Input:
+*   struct imageInfo* src: source image
+*   char* src_entry: source directory entry
+*   struct imageInfo* dst: destination image
+*   uint32_t dst_parent: destination directory, used for the .. entry of a copied directory
+*   char* short_name: 11 byte destination name
+*   char* entry_out: 32 byte destination entry
+*
+*/
+void copy_entry(struct imageInfo *src, char *src_entry, struct imageInfo *dst, uint32_t dst_parent, char *short_name, char *entry_out){
+    uint32_t src_flc = get_entry_flc(src, src_entry);
+    uint32_t size;
+    uint32_t dst_flc;
+
+    memcpy(entry_out, src_entry, 32);
+    memcpy(entry_out, short_name, 11);
+    memcpy(&size, src_entry + 28, 4);
+
+    if(src_entry[11] & 0x10){
+        // a new directory starts as one cluster holding . and ..
+        uint32_t cluster;
+        dst_flc = alloc_chain(dst, 1, &cluster);
+        char *dir = cluster_ptr(dst, dst_flc);
+        memset(dir, 0, dst->cluster_bytes);
+        memcpy(dir, entry_out, 32);
+        memcpy(dir, ".          ", 11);
+        set_entry_flc(dst, dir, dst_flc);
+        memcpy(dir + 32, entry_out, 32);
+        memcpy(dir + 32, "..         ", 11);
+        set_entry_flc(dst, dir + 32, dst_parent);
+        dir[11] = 0x10;
+        dir[32 + 11] = 0x10;
+
+        copy_tree(src, src_flc, dst, dst_flc);
+        dirs_copied++;
+    }else{
+        int src_count;
+        int dst_count = (size + dst->cluster_bytes - 1) / dst->cluster_bytes;
+        uint32_t *src_list = chain_list(src, src_flc, &src_count);
+        uint32_t *dst_list = malloc(sizeof(uint32_t)*(dst_count + 1));
+
+        dst_flc = alloc_chain(dst, dst_count, dst_list);
+        copy_data(src, src_list, src_count, dst, dst_list, dst_count, size);
+        free(src_list);
+        free(dst_list);
+        files_copied++;
+    }
+    set_entry_flc(dst, entry_out, dst_flc);
+}
+
+
+/*
+* Function: copy_tree(struct imageInfo *src, uint32_t src_dir, struct imageInfo *dst, uint32_t dst_dir)
+* =================================
+* Purpose: copy every entry of a source directory into a new destination directory
+*
+* Input:
+*   struct imageInfo* src: source image
+*   uint32_t src_dir: first logical cluster of the source directory
+*   struct imageInfo* dst: destination image
+*   uint32_t dst_dir: first logical cluster of the destination directory
+*
+*/
+void copy_tree(struct imageInfo *src, uint32_t src_dir, struct imageInfo *dst, uint32_t dst_dir){
+    int src_count;
+    uint32_t *src_list = chain_list(src, src_dir, &src_count);
+    char entry[32];
+
+    for(int i = 0; i < src_count; i++){
+        char *start = cluster_ptr(src, src_list[i]);
+        for(int k = 0; k < src->cluster_bytes / 32; k++){
+            char *src_entry = start + 32*k;
+            uint8_t first = (uint8_t)src_entry[0];
+
+            if(first == 0x00){
+                free(src_list);
+                return;
+            }
+            if(first == 0xE5 || first == '.' || src_entry[11] == 0x0F || (src_entry[11] & 0x08)){
+                continue;
+            }
+            copy_entry(src, src_entry, dst, dst_dir, src_entry, entry);
+            memcpy(add_entry_slot(dst, dst_dir), entry, 32);
+        }
+    }
+    free(src_list);
+}
+
+
+/*
+* Function: add_entry_slot(struct imageInfo *img, uint32_t dir_flc)
+* =================================
+* Purpose: find a free entry in a directory, growing a full sub directory or FAT32 root
+*          directory by one cluster
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*
+* Return:
+*   char*: the free entry
+*
+*/
+char* add_entry_slot(struct imageInfo *img, uint32_t dir_flc){
+    // the FAT32 root is a cluster chain like any sub directory
+    uint32_t cluster = (dir_flc == 0) ? img->root_cluster : dir_flc;
+    uint32_t tail = cluster;
+    char *start;
+    int entry_count;
+
+    for(int steps = 0; steps < img->cluster_count; steps++){
+        if(cluster == 0){
+            start = img->p + ((size_t)img->data_region_start - img->root_dir_sectors) * img->bytes_per_sector;
+            entry_count = img->root_dir_entries;
+        }else{
+            start = cluster_ptr(img, cluster);
+            entry_count = img->cluster_bytes / 32;
+        }
+        for(int k = 0; k < entry_count; k++){
+            uint8_t first = (uint8_t)start[32*k];
+            if(first == 0x00 || first == 0xE5){
+                return start + 32*k;
+            }
+        }
+        if(cluster == 0){
+            printf("Directory full\n");
+            exit(1);
+        }
+        tail = cluster;
+        cluster = img->fat_table[cluster];
+        if(cluster < 2 || cluster >= (uint32_t)img->cluster_count){
+            break;
+        }
+    }
+
+    uint32_t added;
+    alloc_chain(img, 1, &added);
+    img->fat_table[tail] = added;
+    memset(cluster_ptr(img, added), 0, img->cluster_bytes);
+    return cluster_ptr(img, added);
+}
+
+
+/*
+* Function: commit_fat(struct imageInfo *img)
+* =================================
+* Purpose: encode the changed entries of the decoded FAT into the first FAT, then copy
+*          each run of changed FAT sectors over the other FAT copies. FAT32 also gets its
+*          FSInfo free count updated
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*
+*/
+void commit_fat(struct imageInfo *img){
+    int sector_bytes = img->bytes_per_sector;
+    size_t fat_bytes = (size_t)img->sector_per_fat * sector_bytes;
+    char *fat_start = img->p + img->fat_start;
+    uint8_t *dirty_sectors = calloc(img->sector_per_fat + 1, 1);
+
+    // a 12 bit entry can straddle two sectors, 16 and 32 bit entries never do
+    for(int c = 2; c < img->cluster_count; c++){
+        if(get_fat_entry(img, c) != img->fat_table[c]){
+            set_next_fat_entry(img, c, img->fat_table[c]);
+            dirty_sectors[fat_entry_offset(img, c) / sector_bytes] = 1;
+            dirty_sectors[(fat_entry_offset(img, c) + 1) / sector_bytes] = 1;
+        }
+    }
+
+    for(uint32_t s = 0; s < img->sector_per_fat; s++){
+        if(!dirty_sectors[s]){
+            continue;
+        }
+        int run = 1;
+        while(s + run < img->sector_per_fat && dirty_sectors[s + run]){
+            run++;
+        }
+        for(int i = 1; i < img->num_of_fats; i++){
+            memcpy(fat_start + i*fat_bytes + (size_t)s*sector_bytes, fat_start + (size_t)s*sector_bytes, (size_t)run * sector_bytes);
+        }
+        s += run;
+    }
+    free(dirty_sectors);
+    update_fsinfo(img);
+}
+
+
+/*
+* Function: journal_changes(struct imageInfo *img, char *slot, char *image_name)
+* =================================
+* Purpose: journal everything the copy is about to commit: the newly allocated clusters,
+*          the FAT sectors that differ from the decoded FAT, the FAT32 FSInfo sector and the new entry
+*
+* Input:
+*   struct imageInfo* img: destination image
+*   char* slot: entry the copy becomes visible in
+*   char* image_name: destination image file name
+*
+*/
+void journal_changes(struct imageInfo *img, char *slot, char *image_name){
+    for(int c = 2; c < img->cluster_count; c++){
+        unsigned int on_disk = get_fat_entry(img, c);
+        if(on_disk == img->fat_table[c]){
+            continue;
+        }
+        if(on_disk == 0x000){
+            journal_add('C', c);
+        }
+        journal_add('F', fat_entry_offset(img, c) / img->bytes_per_sector);
+        journal_add('F', (fat_entry_offset(img, c) + 1) / img->bytes_per_sector);
+    }
+    if(img->fat_type == 32){
+        uint16_t fsinfo_sector;
+        memcpy(&fsinfo_sector, (img->p + 48), 2);
+        journal_add('S', fsinfo_sector);
+    }
+    journal_add('E', (slot - img->p) / 32);
+    journal_write(image_name);
+}
+
+
+/*
+* Function: cluster_ptr(struct imageInfo *img, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(struct imageInfo *img, uint32_t cluster){
+    return img->p + ((size_t)(cluster - 2) * img->sectors_per_cluster + img->data_region_start) * img->bytes_per_sector;
+}
+
+
+/*
+* Function: fat_entry_offset(struct imageInfo *img, uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(struct imageInfo *img, uint32_t cluster){
+    if(img->fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(img->fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(struct imageInfo *img, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(struct imageInfo *img, uint32_t flc){
+    char *fat = img->p + img->fat_start;
+    size_t ent_offset = fat_entry_offset(img, flc);
+
+    if(img->fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (fat + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (fat + ent_offset), 2);
+    if(img->fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(struct imageInfo *img, char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(struct imageInfo *img, char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(img->fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: set_entry_flc(struct imageInfo *img, char *entry, uint32_t flc)
+* =================================
+* Purpose: store the first cluster in a directory entry. The high 16 bits are always
+*          written, as 0 below FAT32, so an entry copied from a FAT32 image keeps none of its own
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   char* entry: start of the 32 byte directory entry
+*   uint32_t flc: first logical cluster
+*
+*/
+void set_entry_flc(struct imageInfo *img, char *entry, uint32_t flc){
+    uint16_t low = flc & 0xFFFF;
+    uint16_t high = (img->fat_type == 32) ? flc >> 16 : 0;
+
+    memcpy((entry + 26), &low, 2);
+    memcpy((entry + 20), &high, 2);
+}
+
+
+/*
+* Function: set_next_fat_entry(struct imageInfo *img, uint32_t flc, uint32_t next_flc)
+* =================================
+* Purpose: set the entry value at a FAT location
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t flc: location of entry
+*   uint32_t next_flc: entry to be put into FAT
+*
+*/
+void set_next_fat_entry(struct imageInfo *img, uint32_t flc, uint32_t next_flc){
+    char *fat = img->p + img->fat_start;
+    size_t ent_offset = fat_entry_offset(img, flc);
+    uint8_t first, second;
+
+    if(img->fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        return;
+    }
+    if(img->fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
+        first = (uint8_t)(0xff & next_flc);
+        second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
+
+    }else{
+        first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
+        second = (uint8_t)(0xff & (next_flc >> 4));
+    }
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
+}
+
+
+/*
+* Function: update_fsinfo(struct imageInfo *img)
+* =================================
+* Purpose: store the free cluster count of the decoded FAT in the FAT32 FSInfo sector
+*          and drop its next free hint
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*
+* Return:
+*   int: the FSInfo sector, 0 when the image has none
+*
+*/
+int update_fsinfo(struct imageInfo *img){
+    uint16_t fsinfo_sector;
+    uint32_t signature;
+    uint32_t free_count = 0;
+    uint32_t next_free = 0xFFFFFFFF;
+
+    if(img->fat_type != 32){
+        return 0;
+    }
+    memcpy(&fsinfo_sector, (img->p + 48), 2);
+    if(fsinfo_sector == 0 || fsinfo_sector >= img->reserved_sectors){
+        return 0;
+    }
+    char *fsinfo = img->p + (size_t)fsinfo_sector * img->bytes_per_sector;
+    memcpy(&signature, fsinfo, 4);
+    if(signature != 0x41615252){
+        return 0;
+    }
+
+    for(int c = 2; c < img->cluster_count; c++){
+        if(img->fat_table[c] == 0){
+            free_count++;
+        }
+    }
+    memcpy((fsinfo + 488), &free_count, 4);
+    memcpy((fsinfo + 492), &next_free, 4);
+    return fsinfo_sector;
+}
+
+
+/*
+* Function: journal_add(char kind, uint32_t value)
+* =================================
+* Purpose: remember one changed cluster ('C'), FAT sector ('F'), directory entry ('E') or
+*          other sector ('S') for the change journal, nothing is kept without -j
+*
+* Input:
+*   char kind: record kind
+*   uint32_t value: cluster, sector of the first FAT, entry offset / 32 or absolute sector
+*
+*/
+void journal_add(char kind, uint32_t value){
+    if(!use_journal){
+        return;
+    }
+    if(journalInfo.count > 0 && journalInfo.records[journalInfo.count-1].kind == kind
+        && journalInfo.records[journalInfo.count-1].value == value){
+        return;
+    }
+    journalInfo.records = realloc(journalInfo.records, sizeof(struct journalRecord)*(journalInfo.count + 1));
+    memset(&journalInfo.records[journalInfo.count], 0, sizeof(struct journalRecord));
+    journalInfo.records[journalInfo.count].kind = kind;
+    journalInfo.records[journalInfo.count].value = value;
+    journalInfo.count++;
+}
+
+
+/*
+* Function: journal_write(char *image_name)
+* =================================
+* Purpose: append the remembered records to {image}.jnl and fsync it, called before
+*          the image is synced so after a crash the journal can only list too much
+*
+* Input:
+*   char* image_name: image file name
+*
+*/
+void journal_write(char *image_name){
+    char journal_name[4096];
+
+    if(journalInfo.count == 0){
+        return;
+    }
+    snprintf(journal_name, sizeof(journal_name), "%s.jnl", image_name);
+    FILE *journal = fopen(journal_name, "a");
+    if(journal == NULL){
+        printf("Error: failed to open %s\n", journal_name);
+        exit(1);
+    }
+    if(ftell(journal) == 0){
+        fwrite("FATJNL1", 8, 1, journal);
+    }
+    fwrite(journalInfo.records, sizeof(struct journalRecord), journalInfo.count, journal);
+    if(fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+        printf("Error: failed to write %s\n", journal_name);
+        exit(1);
+    }
+    fclose(journal);
+    journalInfo.count = 0;
+}
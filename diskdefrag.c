@@ -0,0 +1,1058 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Defragment a FAT12, FAT16 or FAT32 image so every file and directory is one contiguous extent
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// one cluster chain owned by a directory entry
+struct chainInfo{
+    uint32_t flc;
+    int length;
+    int is_dir;
+    uint32_t parent_flc;     // flc of the directory holding the entry, 0 for root
+    uint32_t entry_cluster;  // cluster holding the entry, 0 for the FAT12/FAT16 root
+    int entry_offset;        // byte offset of the entry inside that cluster (or the root directory),
+                             // -1 for the FAT32 root chain, which the boot sector points to
+};
+
+// clusters src.. moving together to dst.., copied with one memmove
+struct moveRun{
+    uint32_t src;            // 0 when the single cluster comes from the temp buffer
+    uint32_t dst;
+    int len;
+    int done;
+};
+
+struct defragInfo{
+    uint32_t *fat_table;     // decoded FAT
+    uint32_t *new_loc;       // old cluster -> planned cluster, 0 when not part of a chain
+    uint32_t *old_loc;       // planned cluster -> old cluster, 0 when nothing moves there
+    uint8_t *visited;        // one bit per cluster, set once a chain claims it
+    uint8_t *moved;          // one bit per cluster, set once its data reached its new location
+    char *temp;              // single cluster buffer for breaking cycles
+    uint32_t saved;          // cluster whose data sits in temp, 0 when none
+    int clusters_moved;
+    int copies;
+    struct moveRun *runs;    // planned moves in ascending target order
+    int run_count;
+}defragInfo;
+
+// change journal {image}.jnl, see diskput.c for the record layout
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+struct journalInfo{
+    struct journalRecord *records;
+    int count;
+}journalInfo;
+
+struct chainInfo *chain_list = NULL;
+int chain_count = 0;
+int dry_run = 0;
+int use_journal = 0;
+
+struct chainInfo* mem_alloc(struct chainInfo *chains, int size){
+    struct chainInfo *temp = NULL;
+    if(chains == NULL){
+        temp = (struct chainInfo *) malloc(sizeof(struct chainInfo)*size);
+        return temp;
+    }
+    else{
+        temp = (struct chainInfo *)realloc(chains, sizeof(struct chainInfo)*size);
+
+        if(temp != NULL){
+            return temp;
+        }
+        else{
+            printf("realloc failed");
+            exit(1);
+        }
+    }
+}
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc);
+size_t fat_entry_offset(uint32_t cluster);
+uint32_t get_entry_flc(char *entry);
+void set_entry_flc(char *entry, uint32_t flc);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+char* cluster_ptr(char *p, uint32_t cluster);
+void decode_fat(char *p);
+void walk_directory(char *p, uint32_t dir_flc);
+void add_chain(char *p, char *entry_start, uint32_t parent_flc, uint32_t entry_cluster, int entry_offset);
+void claim_chain(uint32_t flc, int is_dir, uint32_t parent_flc, uint32_t entry_cluster, int entry_offset);
+int compare_chains(const void *a, const void *b);
+int is_immovable(uint32_t cluster);
+void plan_layout();
+void plan_runs();
+void add_run(struct moveRun *runs, int *count, uint32_t src, uint32_t dst, int len);
+int is_pending(uint32_t cluster);
+int run_ready(struct moveRun *run);
+void move_run(char *p, struct moveRun *run);
+int split_runs();
+void break_cycle(char *p);
+void move_clusters(char *p);
+void rewrite_fat(char *p);
+void rewrite_entries(char *p);
+char* entry_ptr(char *p, uint32_t entry_cluster, int entry_offset);
+int test_bit(uint8_t *map, int bit);
+void set_bit(uint8_t *map, int bit);
+void journal_add(char kind, uint32_t value);
+void journal_write(char *image_name);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+
+    int bad_args = (argc < 2);
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-n") == 0){
+            dry_run = 1;
+        }else if(strcmp(argv[i], "-j") == 0){
+            use_journal = 1;
+        }else{
+            bad_args = 1;
+        }
+    }
+    if(bad_args){
+        printf("Input format: ./diskdefrag {image file} [-n] [-j]\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+    decode_fat(p);
+    if(diskInfo.root_cluster != 0){
+        claim_chain(diskInfo.root_cluster, 0, 0, 0, -1);
+    }
+    walk_directory(p, 0);
+    plan_layout();
+
+    if(dry_run){
+        plan_runs();
+        printf("Chains: %d\n", chain_count);
+        printf("Clusters to move: %d in %d runs\n", defragInfo.clusters_moved, defragInfo.run_count);
+    }else{
+        move_clusters(p);
+        rewrite_fat(p);
+        rewrite_entries(p);
+
+        printf("Chains: %d\n", chain_count);
+        printf("Clusters moved: %d in %d copies\n", defragInfo.clusters_moved, defragInfo.copies);
+        journal_write(argv[1]);
+        msync(p, sb.st_size, MS_SYNC);
+    }
+
+    // save changes to image and close
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: decode_fat(char *p)
+* =================================
+* Purpose: decode the FAT into a flat table and allocate the planning maps
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void decode_fat(char *p){
+    int count = diskInfo.cluster_count;
+
+    defragInfo.fat_table = malloc(sizeof(uint32_t)*count);
+    defragInfo.new_loc = calloc(count, sizeof(uint32_t));
+    defragInfo.old_loc = calloc(count, sizeof(uint32_t));
+    defragInfo.visited = calloc((count / 8) + 1, 1);
+    defragInfo.moved = calloc((count / 8) + 1, 1);
+    defragInfo.temp = malloc(diskInfo.cluster_bytes);
+
+    for(int i = 0; i < count; i++){
+        defragInfo.fat_table[i] = get_fat_entry(p, i);
+    }
+}
+
+
+/*
+* Function: walk_directory(char *p, uint32_t dir_flc)
+* =================================
+* Purpose: record the chain of every entry in a directory, recursing into sub directories
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*
+*/
+void walk_directory(char *p, uint32_t dir_flc){
+    char *entry_start;
+    int entries_per_cluster = diskInfo.cluster_bytes / 32;
+    // the FAT32 root is a cluster chain like any sub directory
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+
+    if(cluster == 0){
+        char *root = p + ((size_t)diskInfo.data_region_start - diskInfo.root_dir_sectors) * diskInfo.bytes_per_sector;
+        for(int k = 0; k < diskInfo.root_dir_entries; k++){
+            entry_start = root + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                break;
+            }
+            add_chain(p, entry_start, 0, 0, 32*k);
+        }
+        return;
+    }
+
+    while(cluster >= 2 && cluster < diskInfo.cluster_count){
+        for(int k = 0; k < entries_per_cluster; k++){
+            entry_start = cluster_ptr(p, cluster) + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                return;
+            }
+            add_chain(p, entry_start, dir_flc, cluster, 32*k);
+        }
+        cluster = defragInfo.fat_table[cluster];
+    }
+}
+
+
+/*
+* Function: add_chain(char *p, char *entry_start, uint32_t parent_flc, uint32_t entry_cluster, int entry_offset)
+* =================================
+* Purpose: claim the clusters of one directory entry's chain
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the directory entry
+*   uint32_t parent_flc: first logical cluster of the holding directory, 0 for root
+*   uint32_t entry_cluster: cluster holding the entry, 0 for root
+*   int entry_offset: byte offset of the entry in that cluster
+*
+*/
+void add_chain(char *p, char *entry_start, uint32_t parent_flc, uint32_t entry_cluster, int entry_offset){
+    uint8_t file_attributes;
+    uint32_t flc = get_entry_flc(entry_start);
+
+    memcpy(&file_attributes, (entry_start + 11), 1);
+
+    if((uint8_t)entry_start[0] == 0xE5 || entry_start[0] == '.' || file_attributes == 0x0F || (0x08 & file_attributes)){
+        return;
+    }
+    if(flc < 2){
+        return;
+    }
+
+    claim_chain(flc, (0x10 & file_attributes) != 0, parent_flc, entry_cluster, entry_offset);
+    if(0x10 & file_attributes){
+        walk_directory(p, flc);
+    }
+}
+
+
+/*
+* Function: claim_chain(uint32_t flc, int is_dir, uint32_t parent_flc, uint32_t entry_cluster, int entry_offset)
+* =================================
+* Purpose: mark the clusters of a chain as visited and add it to the chain list
+*
+* Input:
+*   uint32_t flc: first logical cluster of the chain
+*   int is_dir: 1 if the . and .. entries of the chain have to follow it
+*   uint32_t parent_flc / entry_cluster / entry_offset: see struct chainInfo
+*
+*/
+void claim_chain(uint32_t flc, int is_dir, uint32_t parent_flc, uint32_t entry_cluster, int entry_offset){
+    uint32_t cluster;
+    int length = 0;
+
+    // claim the clusters, refusing images with cross linked or cyclic chains
+    cluster = flc;
+    while(cluster < diskInfo.eoc_min){
+        if(cluster < 2 || cluster >= diskInfo.cluster_count || test_bit(defragInfo.visited, cluster)){
+            printf("Error: inconsistent chain at cluster %u, run diskcheck first\n", cluster);
+            exit(1);
+        }
+        set_bit(defragInfo.visited, cluster);
+        length++;
+        cluster = defragInfo.fat_table[cluster];
+    }
+
+    chain_list = mem_alloc(chain_list, chain_count+1);
+    chain_list[chain_count].flc = flc;
+    chain_list[chain_count].length = length;
+    chain_list[chain_count].is_dir = is_dir;
+    chain_list[chain_count].parent_flc = parent_flc;
+    chain_list[chain_count].entry_cluster = entry_cluster;
+    chain_list[chain_count].entry_offset = entry_offset;
+    chain_count++;
+}
+
+
+/*
+* Function: compare_chains(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering chains by their current first cluster
+*
+*/
+int compare_chains(const void *a, const void *b){
+    const struct chainInfo *x = a;
+    const struct chainInfo *y = b;
+    return (int)x->flc - (int)y->flc;
+}
+
+
+/*
+* Function: is_immovable(uint32_t cluster)
+* =================================
+* Purpose: check if a cluster has to stay where it is (bad, or allocated without an owner)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+* Return:
+*   int: 1 if the cluster can not be used as a target
+*
+*/
+int is_immovable(uint32_t cluster){
+    uint32_t entry = defragInfo.fat_table[cluster];
+
+    // the bad cluster marker sits just below the end of chain range
+    if(entry == diskInfo.eoc_min - 1){
+        return 1;
+    }
+    return entry != 0x000 && !test_bit(defragInfo.visited, cluster);
+}
+
+
+/*
+* Function: plan_layout()
+* =================================
+* Purpose: pack the chains from cluster 2 upward in order of their current position,
+*          so chains that are already packed keep their clusters
+*
+*/
+void plan_layout(){
+    uint32_t cursor = 2;
+
+    qsort(chain_list, chain_count, sizeof(struct chainInfo), compare_chains);
+
+    for(int i = 0; i < chain_count; i++){
+        uint32_t cluster = chain_list[i].flc;
+
+        for(int k = 0; k < chain_list[i].length; k++){
+            while(is_immovable(cursor)){
+                cursor++;
+            }
+            defragInfo.new_loc[cluster] = cursor;
+            defragInfo.old_loc[cursor] = cluster;
+            if(cursor != cluster){
+                defragInfo.clusters_moved++;
+                journal_add('C', cursor);
+            }
+            cluster = defragInfo.fat_table[cluster];
+            cursor++;
+        }
+    }
+}
+
+
+/*
+* Function: plan_runs()
+* =================================
+* Purpose: split the planned moves into runs where both the old and the new clusters
+*          are contiguous, in ascending order of the new location
+*
+*/
+void plan_runs(){
+    defragInfo.runs = malloc(sizeof(struct moveRun)*(diskInfo.cluster_count + 1));
+    defragInfo.run_count = 0;
+
+    for(uint32_t t = 2; t < diskInfo.cluster_count; t++){
+        uint32_t src = defragInfo.old_loc[t];
+        if(src == 0 || src == t){
+            continue;
+        }
+        int len = 1;
+        while(t + len < diskInfo.cluster_count && defragInfo.old_loc[t + len] == src + len){
+            len++;
+        }
+        add_run(defragInfo.runs, &defragInfo.run_count, src, t, len);
+        t += len - 1;
+    }
+}
+
+
+/*
+* Function: add_run(struct moveRun *runs, int *count, uint32_t src, uint32_t dst, int len)
+* =================================
+* Purpose: append a run to a run list
+*
+* Input:
+*   struct moveRun* runs: run list with room for one more
+*   int* count: number of runs in the list
+*   uint32_t src: first old cluster, 0 for the temp buffer
+*   uint32_t dst: first new cluster
+*   int len: number of clusters
+*
+*/
+void add_run(struct moveRun *runs, int *count, uint32_t src, uint32_t dst, int len){
+    runs[*count].src = src;
+    runs[*count].dst = dst;
+    runs[*count].len = len;
+    runs[*count].done = 0;
+    (*count)++;
+}
+
+
+/*
+* Function: is_pending(uint32_t cluster)
+* =================================
+* Purpose: check if a cluster still holds data that has not reached its new location
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+int is_pending(uint32_t cluster){
+    uint32_t target = defragInfo.new_loc[cluster];
+
+    if(cluster == defragInfo.saved){
+        return 0;
+    }
+    return target != 0 && target != cluster && !test_bit(defragInfo.moved, target);
+}
+
+
+/*
+* Function: run_ready(struct moveRun *run)
+* =================================
+* Purpose: check if a run can be copied now: no target cluster still holds data
+*          another move needs, overlap with the run's own source is left to memmove
+*
+* Input:
+*   struct moveRun* run: planned run
+*
+*/
+int run_ready(struct moveRun *run){
+    for(int i = 0; i < run->len; i++){
+        uint32_t target = run->dst + i;
+        if(is_pending(target) && (run->src == 0 || target < run->src || target >= run->src + run->len)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*
+* Function: move_run(char *p, struct moveRun *run)
+* =================================
+* Purpose: copy a whole run with one memmove (or put the temp cluster back)
+*
+* Input:
+*   char* p: image data pointer
+*   struct moveRun* run: planned run
+*
+*/
+void move_run(char *p, struct moveRun *run){
+    if(run->src == 0){
+        memcpy(cluster_ptr(p, run->dst), defragInfo.temp, diskInfo.cluster_bytes);
+        defragInfo.saved = 0;
+    }else{
+        memmove(cluster_ptr(p, run->dst), cluster_ptr(p, run->src), (size_t)run->len * diskInfo.cluster_bytes);
+    }
+    for(int i = 0; i < run->len; i++){
+        set_bit(defragInfo.moved, run->dst + i);
+    }
+    run->done = 1;
+    defragInfo.copies++;
+}
+
+
+/*
+* Function: split_runs()
+* =================================
+* Purpose: cut every blocked run where its targets change between free and still
+*          holding data, so the free parts can be copied
+*
+* Return:
+*   int: 1 if a run was cut
+*
+*/
+int split_runs(){
+    struct moveRun *runs = malloc(sizeof(struct moveRun)*(diskInfo.cluster_count + 1));
+    int count = 0;
+    int split = 0;
+
+    for(int i = 0; i < defragInfo.run_count; i++){
+        struct moveRun *run = &defragInfo.runs[i];
+        if(run->done){
+            continue;
+        }
+        int start = 0;
+        for(int k = 1; k <= run->len; k++){
+            if(k == run->len || is_pending(run->dst + k) != is_pending(run->dst + start)){
+                add_run(runs, &count, run->src ? run->src + start : 0, run->dst + start, k - start);
+                split |= (k < run->len);
+                start = k;
+            }
+        }
+    }
+    free(defragInfo.runs);
+    defragInfo.runs = runs;
+    defragInfo.run_count = count;
+    return split;
+}
+
+
+/*
+* Function: break_cycle(char *p)
+* =================================
+* Purpose: every target left still holds data, so the moves form cycles. Park the
+*          first target in the temp cluster, which frees it, and move its data
+*          from temp once its own target is free
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void break_cycle(char *p){
+    uint32_t cluster = defragInfo.runs[0].dst;
+    int count = 0;
+    struct moveRun *runs = malloc(sizeof(struct moveRun)*(diskInfo.cluster_count + 1));
+
+    memcpy(defragInfo.temp, cluster_ptr(p, cluster), diskInfo.cluster_bytes);
+    defragInfo.copies++;
+    defragInfo.saved = cluster;
+
+    // take the move out of cluster out of the run holding it
+    for(int i = 0; i < defragInfo.run_count; i++){
+        struct moveRun *run = &defragInfo.runs[i];
+        if(cluster < run->src || cluster >= run->src + run->len){
+            add_run(runs, &count, run->src, run->dst, run->len);
+            continue;
+        }
+        int at = cluster - run->src;
+        if(at > 0){
+            add_run(runs, &count, run->src, run->dst, at);
+        }
+        add_run(runs, &count, 0, run->dst + at, 1);
+        if(at + 1 < run->len){
+            add_run(runs, &count, run->src + at + 1, run->dst + at + 1, run->len - at - 1);
+        }
+    }
+    free(defragInfo.runs);
+    defragInfo.runs = runs;
+    defragInfo.run_count = count;
+}
+
+
+/*
+* Function: move_clusters(char *p)
+* =================================
+* Purpose: apply the planned permutation. Runs are copied whole as soon as their
+*          targets are free, left moves in ascending and right moves in descending
+*          target order. Runs blocked by each other are cut down to their free parts,
+*          and cycles are broken through the single temp cluster, which copies the
+*          parked cluster twice.
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void move_clusters(char *p){
+    int progress = 1;
+
+    plan_runs();
+    while(defragInfo.run_count > 0){
+        while(progress){
+            progress = 0;
+            for(int i = 0; i < defragInfo.run_count; i++){
+                struct moveRun *run = &defragInfo.runs[i];
+                if(!run->done && run->dst <= run->src && run_ready(run)){
+                    move_run(p, run);
+                    progress = 1;
+                }
+            }
+            for(int i = defragInfo.run_count - 1; i >= 0; i--){
+                struct moveRun *run = &defragInfo.runs[i];
+                if(!run->done && run->dst > run->src && run_ready(run)){
+                    move_run(p, run);
+                    progress = 1;
+                }
+            }
+        }
+
+        // split_runs() also drops the finished runs
+        progress = split_runs();
+        if(!progress && defragInfo.run_count > 0){
+            break_cycle(p);
+            progress = 1;
+        }
+    }
+}
+
+
+/*
+* Function: rewrite_fat(char *p)
+* =================================
+* Purpose: write the packed chains into the first FAT and copy it over the other FATs
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void rewrite_fat(char *p){
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * diskInfo.bytes_per_sector;
+    char *fat_start = p + diskInfo.fat_start;
+
+    // free every chain cluster, keeping bad and unowned clusters as they are
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        if(test_bit(defragInfo.visited, c)){
+            set_next_fat_entry(p, c, 0x000);
+        }
+    }
+
+    for(int i = 0; i < chain_count; i++){
+        uint32_t cluster = defragInfo.new_loc[chain_list[i].flc];
+
+        for(int k = 1; k < chain_list[i].length; k++){
+            uint32_t next = cluster + 1;
+            while(is_immovable(next)){
+                next++;
+            }
+            set_next_fat_entry(p, cluster, next);
+            cluster = next;
+        }
+        set_next_fat_entry(p, cluster, diskInfo.eoc);
+    }
+
+    for(int i = 1; i < diskInfo.num_of_fats; i++){
+        memcpy(fat_start + i*fat_bytes, fat_start, fat_bytes);
+    }
+}
+
+
+/*
+* Function: rewrite_entries(char *p)
+* =================================
+* Purpose: point each directory entry (and the . and .. entries of moved directories)
+*          at the new first cluster, and the boot sector at the new FAT32 root cluster
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void rewrite_entries(char *p){
+    for(int i = 0; i < chain_count; i++){
+        uint32_t new_flc = defragInfo.new_loc[chain_list[i].flc];
+        uint32_t parent_flc = 0;
+
+        if(chain_list[i].entry_offset < 0){
+            memcpy((p + 44), &new_flc, 4);
+            journal_add('S', 0);
+            continue;
+        }
+        char *entry_start = entry_ptr(p, chain_list[i].entry_cluster, chain_list[i].entry_offset);
+
+        set_entry_flc(entry_start, new_flc);
+        journal_add('E', (entry_start - p) / 32);
+
+        if(chain_list[i].is_dir){
+            if(chain_list[i].parent_flc != 0){
+                parent_flc = defragInfo.new_loc[chain_list[i].parent_flc];
+            }
+            char *dir_start = cluster_ptr(p, new_flc);
+            if(dir_start[0] == '.' && dir_start[1] == ' '){
+                set_entry_flc(dir_start, new_flc);
+            }
+            if(dir_start[32] == '.' && dir_start[33] == '.'){
+                set_entry_flc(dir_start + 32, parent_flc);
+            }
+            journal_add('C', new_flc);
+        }
+    }
+}
+
+
+/*
+* Function: entry_ptr(char *p, uint32_t entry_cluster, int entry_offset)
+* =================================
+* Purpose: locate a recorded directory entry after its cluster may have moved
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t entry_cluster: old cluster holding the entry, 0 for the FAT12/FAT16 root
+*   int entry_offset: byte offset of the entry
+*
+* Return:
+*   char*: pointer to the entry
+*
+*/
+char* entry_ptr(char *p, uint32_t entry_cluster, int entry_offset){
+    if(entry_cluster == 0){
+        return p + ((size_t)diskInfo.data_region_start - diskInfo.root_dir_sectors) * diskInfo.bytes_per_sector + entry_offset;
+    }
+    return cluster_ptr(p, defragInfo.new_loc[entry_cluster]) + entry_offset;
+}
+
+
+/*
+* Function: cluster_ptr(char *p, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(char *p, uint32_t cluster){
+    return p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: set_entry_flc(char *entry, uint32_t flc)
+* =================================
+* Purpose: store the first cluster in a directory entry (high 16 bits only on FAT32)
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*   uint32_t flc: first logical cluster
+*
+*/
+void set_entry_flc(char *entry, uint32_t flc){
+    uint16_t low = flc & 0xFFFF;
+    uint16_t high = flc >> 16;
+
+    memcpy((entry + 26), &low, 2);
+    if(diskInfo.fat_type == 32){
+        memcpy((entry + 20), &high, 2);
+    }
+}
+
+
+/*
+* Function: set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc)
+* =================================
+* Purpose: set the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: location of entry
+*   uint32_t next_flc: entry to be put into FAT
+*
+*/
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc){
+    char *fat = p + diskInfo.fat_start;
+    size_t ent_offset = fat_entry_offset(flc);
+    uint8_t first, second;
+
+    if(diskInfo.fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+        return;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
+        first = (uint8_t)(0xff & next_flc);
+        second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
+
+    }else{
+        first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
+        second = (uint8_t)(0xff & (next_flc >> 4));
+    }
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
+    journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+    journal_add('F', (ent_offset + 1) / diskInfo.bytes_per_sector);
+}
+
+
+/*
+* Function: test_bit(uint8_t *map, int bit) / set_bit(uint8_t *map, int bit)
+* =================================
+* Purpose: read and set single bits of a cluster bitmap
+*
+*/
+int test_bit(uint8_t *map, int bit){
+    return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+void set_bit(uint8_t *map, int bit){
+    map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+}
+
+
+/*
+* Function: journal_add(char kind, uint32_t value)
+* =================================
+* Purpose: remember one changed cluster ('C'), FAT sector ('F'), directory entry ('E') or
+*          other sector ('S') for the change journal, nothing is kept without -j
+*
+* Input:
+*   char kind: record kind
+*   uint32_t value: cluster, sector of the first FAT, entry offset / 32 or absolute sector
+*
+*/
+void journal_add(char kind, uint32_t value){
+    if(!use_journal){
+        return;
+    }
+    if(journalInfo.count > 0 && journalInfo.records[journalInfo.count-1].kind == kind
+        && journalInfo.records[journalInfo.count-1].value == value){
+        return;
+    }
+    journalInfo.records = realloc(journalInfo.records, sizeof(struct journalRecord)*(journalInfo.count + 1));
+    memset(&journalInfo.records[journalInfo.count], 0, sizeof(struct journalRecord));
+    journalInfo.records[journalInfo.count].kind = kind;
+    journalInfo.records[journalInfo.count].value = value;
+    journalInfo.count++;
+}
+
+
+/*
+* Function: journal_write(char *image_name)
+* =================================
+* Purpose: append the remembered records to {image}.jnl and fsync it, called before
+*          the image is synced so after a crash the journal can only list too much
+*
+* Input:
+*   char* image_name: image file name
+*
+*/
+void journal_write(char *image_name){
+    char journal_name[4096];
+
+    if(journalInfo.count == 0){
+        return;
+    }
+    snprintf(journal_name, sizeof(journal_name), "%s.jnl", image_name);
+    FILE *journal = fopen(journal_name, "a");
+    if(journal == NULL){
+        printf("Error: failed to open %s\n", journal_name);
+        exit(1);
+    }
+    if(ftell(journal) == 0){
+        fwrite("FATJNL1", 8, 1, journal);
+    }
+    fwrite(journalInfo.records, sizeof(struct journalRecord), journalInfo.count, journal);
+    if(fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+        printf("Error: failed to write %s\n", journal_name);
+        exit(1);
+    }
+    fclose(journal);
+    journalInfo.count = 0;
+}
@@ -0,0 +1,231 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Inspect, commit or discard the copy-on-write delta file of a FAT12 image
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// copy-on-write overlay written by diskput -d, see diskput.c
+struct deltaHeader{
+    char magic[8];
+    int64_t base_size;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t base_checksum;  // first FAT and root directory of the base image, see checksum_base()
+    uint32_t reserved;
+};
+
+struct deltaInfo{
+    char *d;                 // mapped delta file
+    size_t size;
+    struct deltaHeader *header;
+    uint32_t *sector_list;
+    char *sector_data;
+}deltaInfo;
+
+
+void open_delta(char *name, int64_t base_size, uint32_t base_checksum);
+uint32_t checksum_base(char *p, size_t image_size);
+void print_delta();
+void commit_delta(int fd);
+
+
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+
+    if(argc != 4 || (strcmp(argv[3], "info") != 0 && strcmp(argv[3], "commit") != 0 && strcmp(argv[3], "discard") != 0)){
+        printf("Input format: ./diskdelta {image file} {delta file} {info | commit | discard}\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], strcmp(argv[3], "commit") == 0 ? O_RDWR : O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // the checksum is taken from the base, the delta itself is never mapped over it here
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+    uint32_t base_checksum = checksum_base(p, sb.st_size);
+    munmap(p, sb.st_size);
+
+    open_delta(argv[2], sb.st_size, base_checksum);
+
+    if(strcmp(argv[3], "info") == 0){
+        print_delta();
+    }else{
+        if(strcmp(argv[3], "commit") == 0){
+            commit_delta(fd);
+            printf("Committed %u sectors to %s\n", deltaInfo.header->sector_count, argv[1]);
+        }else{
+            printf("Discarded %u sectors\n", deltaInfo.header->sector_count);
+        }
+        munmap(deltaInfo.d, deltaInfo.size);
+        unlink(argv[2]);
+    }
+
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: open_delta(char *name, int64_t base_size, uint32_t base_checksum)
+* =================================
+* Purpose: map a delta file and check that it belongs to the image
+*
+* Input:
+*   char* name: delta file name
+*   int64_t base_size: size of the base image
+*   uint32_t base_checksum: checksum_base() of the base image
+*
+*/
+void open_delta(char *name, int64_t base_size, uint32_t base_checksum){
+    struct stat sb;
+    int fd = open(name, O_RDONLY);
+
+    if(fd < 0){
+        printf("Error: failed to open %s\n", name);
+        exit(1);
+    }
+    fstat(fd, &sb);
+    deltaInfo.size = sb.st_size;
+    if(deltaInfo.size < sizeof(struct deltaHeader)){
+        printf("Error: %s is not a delta file\n", name);
+        exit(1);
+    }
+
+    deltaInfo.d = mmap(NULL, deltaInfo.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (deltaInfo.d == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    deltaInfo.header = (struct deltaHeader *)deltaInfo.d;
+    if(memcmp(deltaInfo.header->magic, "FATDLT2", 8) != 0 || deltaInfo.header->base_size != base_size
+        || deltaInfo.header->base_checksum != base_checksum){
+        printf("Error: %s is not a delta of this image\n", name);
+        exit(1);
+    }
+    size_t expected = sizeof(struct deltaHeader) + (size_t)deltaInfo.header->sector_count * (sizeof(uint32_t) + deltaInfo.header->sector_size);
+    if(deltaInfo.size < expected){
+        printf("Error: %s is truncated\n", name);
+        exit(1);
+    }
+    deltaInfo.sector_list = (uint32_t *)(deltaInfo.d + sizeof(struct deltaHeader));
+    deltaInfo.sector_data = (char *)(deltaInfo.sector_list + deltaInfo.header->sector_count);
+}
+
+
+/*
+* Function: print_delta()
+* =================================
+* Purpose: print the size of the delta and the sector runs it replaces
+*
+*/
+void print_delta(){
+    uint32_t count = deltaInfo.header->sector_count;
+
+    printf("Sector size: %u bytes\n", deltaInfo.header->sector_size);
+    printf("Sectors in delta: %u (%u bytes)\n", count, count * deltaInfo.header->sector_size);
+    printf("Runs:\n");
+    for(uint32_t i = 0; i < count; i++){
+        uint32_t start = deltaInfo.sector_list[i];
+        while(i + 1 < count && deltaInfo.sector_list[i+1] == deltaInfo.sector_list[i] + 1){
+            i++;
+        }
+        printf("  %u-%u\n", start, deltaInfo.sector_list[i]);
+    }
+}
+
+
+/*
+* Function: commit_delta(int fd)
+* =================================
+* Purpose: write the delta into the base image, one pwrite per run of consecutive
+*          sectors (they are stored back to back in the delta), then fsync
+*
+* Input:
+*   int fd: base image file descriptor
+*
+*/
+void commit_delta(int fd){
+    uint32_t count = deltaInfo.header->sector_count;
+    uint32_t sector_size = deltaInfo.header->sector_size;
+
+    for(uint32_t i = 0; i < count; i++){
+        uint32_t first = i;
+        while(i + 1 < count && deltaInfo.sector_list[i+1] == deltaInfo.sector_list[i] + 1){
+            i++;
+        }
+        size_t len = (size_t)(i - first + 1) * sector_size;
+        if(pwrite(fd, deltaInfo.sector_data + (size_t)first * sector_size, len, (off_t)deltaInfo.sector_list[first] * sector_size) != (ssize_t)len){
+            printf("Error: failed to write image\n");
+            exit(1);
+        }
+    }
+    if(fsync(fd) != 0){
+        printf("Error: failed to write image\n");
+        exit(1);
+    }
+}
+
+
+/*
+* Function: checksum_base(char *p, size_t image_size)
+* =================================
+* Purpose: checksum the first FAT and root directory of the base image, 8 bytes at a
+*          time, so a delta is only laid over the base it was made from
+*
+* Input:
+*   char* p: base image data pointer, before any delta is laid over it
+*   size_t image_size: size of the base image
+*
+*/
+uint32_t checksum_base(char *p, size_t image_size){
+    uint16_t bytes_per_sector, reserved_sectors, root_dir_entries, sector_per_fat16;
+    uint8_t num_of_fats;
+    uint32_t sector_per_fat;
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+
+    memcpy(&bytes_per_sector, (p + 11), 2);
+    memcpy(&reserved_sectors, (p + 14), 2);
+    memcpy(&num_of_fats, (p + 16), 1);
+    memcpy(&root_dir_entries, (p + 17), 2);
+    memcpy(&sector_per_fat16, (p + 22), 2);
+    sector_per_fat = sector_per_fat16;
+    if(sector_per_fat == 0){
+        memcpy(&sector_per_fat, (p + 36), 4);
+    }
+
+    size_t fat_start = (size_t)reserved_sectors * bytes_per_sector;
+    size_t fat_ends = fat_start + (size_t)sector_per_fat * bytes_per_sector;
+    size_t root_dir_start = fat_start + (size_t)num_of_fats * sector_per_fat * bytes_per_sector;
+    size_t root_dir_ends = root_dir_start + (size_t)root_dir_entries * 32;
+
+    for(size_t i = fat_start; i + 8 <= fat_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i + 8 <= root_dir_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
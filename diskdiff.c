@@ -0,0 +1,642 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Report the files that differ between two snapshots of a FAT12, FAT16 or FAT32 image
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// clusters compared per memcmp before narrowing down to single clusters
+#define BLOCK_CLUSTERS 64
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct fileRecord{
+    char path[256];
+    uint32_t flc;
+    uint32_t size;
+    uint8_t attributes;
+    uint16_t date;
+    uint16_t time;
+};
+
+// one mapped snapshot with its decoded FAT and file list
+struct imageInfo{
+    char *p;
+    size_t size;
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    size_t fat_start;
+    int cluster_bytes;
+    int cluster_count;
+    uint32_t *fat_table;
+    struct fileRecord *files;
+    int file_count;
+}oldImage, newImage;
+
+struct diffInfo{
+    uint8_t *changed;        // one bit per cluster whose data differs
+    uint8_t *owned;          // one bit per cluster owned by a file in either image
+    int changed_clusters;
+    int boot_sectors;        // boot sector and the rest of the reserved area (FSInfo, backup boot sector)
+    int fat_sectors;
+    int root_sectors;
+    int added;
+    int removed;
+    int modified;
+}diffInfo;
+
+
+void open_image(struct imageInfo *img, char *path);
+void get_geometry(struct imageInfo *img);
+unsigned int get_fat_entry(struct imageInfo *img, uint32_t flc);
+size_t fat_entry_offset(struct imageInfo *img, uint32_t cluster);
+uint32_t get_entry_flc(struct imageInfo *img, char *entry);
+char* cluster_ptr(struct imageInfo *img, uint32_t cluster);
+void collect_files(struct imageInfo *img, uint32_t dir_flc, char *dir_path, int depth);
+void add_file(struct imageInfo *img, char *entry_start, char *dir_path);
+int compare_records(const void *a, const void *b);
+void compare_system_area();
+void compare_data_region();
+void mark_owned(struct imageInfo *img, uint32_t flc);
+int file_changed(struct fileRecord *old_file, struct fileRecord *new_file);
+void print_ranges(struct fileRecord *old_file, struct fileRecord *new_file);
+int test_bit(uint8_t *map, int bit);
+void set_bit(uint8_t *map, int bit);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+    if(argc != 3){
+        printf("Input format: ./diskdiff {old image} {new image}\n");
+        exit(1);
+    }
+
+    open_image(&oldImage, argv[1]);
+    open_image(&newImage, argv[2]);
+    if(oldImage.size != newImage.size || oldImage.cluster_count != newImage.cluster_count
+        || oldImage.cluster_bytes != newImage.cluster_bytes || oldImage.data_region_start != newImage.data_region_start
+        || oldImage.fat_type != newImage.fat_type || oldImage.reserved_sectors != newImage.reserved_sectors
+        || oldImage.bytes_per_sector != newImage.bytes_per_sector){
+        printf("Error: the images do not have the same geometry\n");
+        exit(1);
+    }
+
+    compare_system_area();
+    compare_data_region();
+
+    collect_files(&oldImage, 0, "", 0);
+    collect_files(&newImage, 0, "", 0);
+    qsort(oldImage.files, oldImage.file_count, sizeof(struct fileRecord), compare_records);
+    qsort(newImage.files, newImage.file_count, sizeof(struct fileRecord), compare_records);
+
+    // both lists are sorted by path, one merge pass pairs them up
+    int i = 0, k = 0;
+    while(i < oldImage.file_count || k < newImage.file_count){
+        int order;
+        if(i == oldImage.file_count){
+            order = 1;
+        }else if(k == newImage.file_count){
+            order = -1;
+        }else{
+            order = strcmp(oldImage.files[i].path, newImage.files[k].path);
+        }
+
+        if(order < 0){
+            printf("- %s\n", oldImage.files[i].path);
+            diffInfo.removed++;
+            i++;
+        }else if(order > 0){
+            printf("+ %s\n", newImage.files[k].path);
+            diffInfo.added++;
+            k++;
+        }else{
+            if(file_changed(&oldImage.files[i], &newImage.files[k])){
+                printf("M %s", newImage.files[k].path);
+                if(oldImage.files[i].size != newImage.files[k].size){
+                    printf(" (size %u -> %u)", oldImage.files[i].size, newImage.files[k].size);
+                }
+                printf("\n");
+                if(!(newImage.files[k].attributes & 0x10)){
+                    print_ranges(&oldImage.files[i], &newImage.files[k]);
+                }
+                diffInfo.modified++;
+            }
+            i++;
+            k++;
+        }
+    }
+
+    int unowned = 0;
+    for(int c = 2; c < newImage.cluster_count; c++){
+        if(test_bit(diffInfo.changed, c) && !test_bit(diffInfo.owned, c)){
+            unowned++;
+        }
+    }
+
+    printf("==============\n");
+    printf("Added: %d, removed: %d, modified: %d\n", diffInfo.added, diffInfo.removed, diffInfo.modified);
+    printf("Changed clusters: %d (%d not owned by any file)\n", diffInfo.changed_clusters, unowned);
+    printf("Changed boot/reserved sectors: %d\n", diffInfo.boot_sectors);
+    printf("Changed FAT sectors: %d, changed root directory sectors: %d\n", diffInfo.fat_sectors, diffInfo.root_sectors);
+	return (diffInfo.added + diffInfo.removed + diffInfo.modified + diffInfo.changed_clusters
+        + diffInfo.boot_sectors + diffInfo.fat_sectors + diffInfo.root_sectors) == 0 ? 0 : 1;
+}
+
+
+/*
+* Function: open_image(struct imageInfo *img, char *path)
+* =================================
+* Purpose: map an image read only, read its geometry and decode its FAT
+*
+* Input:
+*   struct imageInfo* img: image to fill in
+*   char* path: image file name
+*
+*/
+void open_image(struct imageInfo *img, char *path){
+    struct stat sb;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0){
+        printf("Error: failed to open %s\n", path);
+        exit(1);
+    }
+    fstat(fd, &sb);
+    img->size = sb.st_size;
+
+    // Make pointer to start of image
+    img->p = mmap(NULL, img->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (img->p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(img);
+
+    img->fat_table = malloc(sizeof(uint32_t)*img->cluster_count);
+    for(int i = 0; i < img->cluster_count; i++){
+        img->fat_table[i] = get_fat_entry(img, i);
+    }
+}
+
+
+/*
+* Function: get_geometry(struct imageInfo *img)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*
+*/
+void get_geometry(struct imageInfo *img){
+    char *p = img->p;
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&img->root_dir_entries, (p + 17), 2);
+    memcpy(&img->num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&img->reserved_sectors, (p + 14), 2);
+    memcpy(&img->sectors_per_cluster, (p + 13), 1);
+    memcpy(&img->bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    img->sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&img->sector_count, (p + 32), 4);
+    }
+    img->sector_per_fat = sector_per_fat;
+    img->root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&img->sector_per_fat, (p + 36), 4);
+        memcpy(&img->root_cluster, (p + 44), 4);
+    }
+
+    img->root_dir_sectors = ((img->root_dir_entries * 32) + img->bytes_per_sector - 1) / img->bytes_per_sector;
+    img->data_region_start = (img->num_of_fats * img->sector_per_fat) + img->reserved_sectors + img->root_dir_sectors;
+    img->cluster_count = ((img->sector_count - img->data_region_start) / img->sectors_per_cluster) + 2;
+    img->fat_start = (size_t)img->reserved_sectors * img->bytes_per_sector;
+    img->cluster_bytes = img->bytes_per_sector * img->sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(img->cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        img->fat_type = 12;
+    }else if(img->cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        img->fat_type = 16;
+    }else{
+        img->fat_type = 32;
+    }
+}
+
+
+/*
+* Function: compare_system_area()
+* =================================
+* Purpose: count the boot/reserved, FAT and root directory sectors that differ
+*
+*/
+void compare_system_area(){
+    int sector_bytes = newImage.bytes_per_sector;
+    int fat_start = newImage.reserved_sectors;
+    int root_start = fat_start + newImage.num_of_fats * newImage.sector_per_fat;
+
+    for(int s = 0; s < newImage.data_region_start; s++){
+        if(memcmp(oldImage.p + (size_t)s * sector_bytes, newImage.p + (size_t)s * sector_bytes, sector_bytes) != 0){
+            if(s < fat_start){
+                diffInfo.boot_sectors++;
+            }else if(s < root_start){
+                diffInfo.fat_sectors++;
+            }else{
+                diffInfo.root_sectors++;
+            }
+        }
+    }
+}
+
+
+/*
+* Function: compare_data_region()
+* =================================
+* Purpose: find the clusters whose data differs. Blocks of BLOCK_CLUSTERS clusters are
+*          compared with one memcmp and only differing blocks are split into clusters
+*
+*/
+void compare_data_region(){
+    int count = newImage.cluster_count;
+    int cluster_bytes = newImage.cluster_bytes;
+
+    diffInfo.changed = calloc((count / 8) + 1, 1);
+    diffInfo.owned = calloc((count / 8) + 1, 1);
+
+    for(int block = 2; block < count; block += BLOCK_CLUSTERS){
+        int block_len = (count - block < BLOCK_CLUSTERS) ? count - block : BLOCK_CLUSTERS;
+        if(memcmp(cluster_ptr(&oldImage, block), cluster_ptr(&newImage, block), (size_t)block_len * cluster_bytes) == 0){
+            continue;
+        }
+        for(int c = block; c < block + block_len; c++){
+            if(memcmp(cluster_ptr(&oldImage, c), cluster_ptr(&newImage, c), cluster_bytes) != 0){
+                set_bit(diffInfo.changed, c);
+                diffInfo.changed_clusters++;
+            }
+        }
+    }
+}
+
+
+/*
+* Function: collect_files(struct imageInfo *img, uint32_t dir_flc, char *dir_path, int depth)
+* =================================
+* Purpose: record every file and directory below a directory
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* dir_path: path of the directory, "" for root
+*   int depth: nesting depth, guards against directory loops
+*
+*/
+void collect_files(struct imageInfo *img, uint32_t dir_flc, char *dir_path, int depth){
+    // the FAT32 root is a cluster chain like any sub directory
+    uint32_t cluster = (dir_flc == 0) ? img->root_cluster : dir_flc;
+    char *start;
+    int entry_count;
+
+    if(depth > 32){
+        return;
+    }
+    for(int steps = 0; steps < img->cluster_count; steps++){
+        if(cluster == 0){
+            start = img->p + ((size_t)img->data_region_start - img->root_dir_sectors) * img->bytes_per_sector;
+            entry_count = img->root_dir_entries;
+        }else{
+            start = cluster_ptr(img, cluster);
+            entry_count = img->cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+
+            if(first == 0x00){
+                return;
+            }
+            if(first == 0xE5 || first == '.' || entry_start[11] == 0x0F || (entry_start[11] & 0x08)){
+                continue;
+            }
+            add_file(img, entry_start, dir_path);
+
+            struct fileRecord *added = &img->files[img->file_count - 1];
+            mark_owned(img, added->flc);
+            if(added->attributes & 0x10){
+                char path[256];
+                strcpy(path, added->path);
+                collect_files(img, added->flc, path, depth + 1);
+            }
+        }
+
+        if(cluster == 0){
+            return;
+        }
+        cluster = img->fat_table[cluster];
+        if(cluster < 2 || cluster >= (uint32_t)img->cluster_count){
+            return;
+        }
+    }
+}
+
+
+/*
+* Function: add_file(struct imageInfo *img, char *entry_start, char *dir_path)
+* =================================
+* Purpose: append one directory entry to the image's file list
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   char* entry_start: start location of the directory entry
+*   char* dir_path: path of the directory holding the entry
+*
+*/
+void add_file(struct imageInfo *img, char *entry_start, char *dir_path){
+    char name[13];
+    int len = 0;
+
+    for(int i = 0; i < 8 && entry_start[i] != ' '; i++){
+        name[len++] = entry_start[i];
+    }
+    if(entry_start[8] != ' '){
+        name[len++] = '.';
+    }
+    for(int i = 8; i < 11 && entry_start[i] != ' '; i++){
+        name[len++] = entry_start[i];
+    }
+    name[len] = '\0';
+
+    img->files = realloc(img->files, sizeof(struct fileRecord)*(img->file_count + 1));
+    struct fileRecord *record = &img->files[img->file_count++];
+    snprintf(record->path, sizeof(record->path), "%.240s/%s", dir_path, name);
+    record->flc = get_entry_flc(img, entry_start);
+    memcpy(&record->size, entry_start + 28, 4);
+    memcpy(&record->date, entry_start + 24, 2);
+    memcpy(&record->time, entry_start + 22, 2);
+    record->attributes = (uint8_t)entry_start[11];
+}
+
+
+/*
+* Function: mark_owned(struct imageInfo *img, uint32_t flc)
+* =================================
+* Purpose: mark the clusters of a chain as owned by some file
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t flc: first logical cluster
+*
+*/
+void mark_owned(struct imageInfo *img, uint32_t flc){
+    uint32_t cluster = flc;
+
+    for(int steps = 0; steps < img->cluster_count && cluster >= 2 && cluster < (uint32_t)img->cluster_count; steps++){
+        set_bit(diffInfo.owned, cluster);
+        cluster = img->fat_table[cluster];
+    }
+}
+
+
+/*
+* Function: file_changed(struct fileRecord *old_file, struct fileRecord *new_file)
+* =================================
+* Purpose: check if an entry, its chain or any of its clusters changed
+*
+* Input:
+*   struct fileRecord* old_file: entry in the old image
+*   struct fileRecord* new_file: entry in the new image
+*
+*/
+int file_changed(struct fileRecord *old_file, struct fileRecord *new_file){
+    if(old_file->size != new_file->size || old_file->flc != new_file->flc || old_file->attributes != new_file->attributes
+        || old_file->date != new_file->date || old_file->time != new_file->time){
+        return 1;
+    }
+
+    uint32_t old_cluster = old_file->flc;
+    uint32_t new_cluster = new_file->flc;
+    for(int steps = 0; steps < newImage.cluster_count && new_cluster >= 2 && new_cluster < (uint32_t)newImage.cluster_count; steps++){
+        if(old_cluster != new_cluster || test_bit(diffInfo.changed, new_cluster)){
+            return 1;
+        }
+        old_cluster = oldImage.fat_table[old_cluster];
+        new_cluster = newImage.fat_table[new_cluster];
+    }
+    return old_cluster != new_cluster;
+}
+
+
+/*
+* Function: print_ranges(struct fileRecord *old_file, struct fileRecord *new_file)
+* =================================
+* Purpose: walk both chains side by side and print the byte ranges of the file that
+*          differ. Clusters that did not move and did not change are skipped without a compare
+*
+* Input:
+*   struct fileRecord* old_file: entry in the old image
+*   struct fileRecord* new_file: entry in the new image
+*
+*/
+void print_ranges(struct fileRecord *old_file, struct fileRecord *new_file){
+    int cluster_bytes = newImage.cluster_bytes;
+    uint32_t common = old_file->size < new_file->size ? old_file->size : new_file->size;
+    uint32_t old_cluster = old_file->flc;
+    uint32_t new_cluster = new_file->flc;
+    int64_t range_start = -1;
+    int64_t range_end = -1;
+
+    for(uint32_t pos = 0; pos < common; pos += cluster_bytes){
+        if(old_cluster < 2 || old_cluster >= (uint32_t)oldImage.cluster_count || new_cluster < 2 || new_cluster >= (uint32_t)newImage.cluster_count){
+            break;
+        }
+        uint32_t len = (common - pos < (uint32_t)cluster_bytes) ? common - pos : (uint32_t)cluster_bytes;
+
+        if(old_cluster != new_cluster || test_bit(diffInfo.changed, new_cluster)){
+            char *a = cluster_ptr(&oldImage, old_cluster);
+            char *b = cluster_ptr(&newImage, new_cluster);
+            if(memcmp(a, b, len) != 0){
+                uint32_t first = 0;
+                uint32_t last = len - 1;
+                while(a[first] == b[first]){
+                    first++;
+                }
+                while(a[last] == b[last]){
+                    last--;
+                }
+                if(range_end >= 0 && pos + first > range_end + 1){
+                    printf("    bytes %lld-%lld\n", (long long)range_start, (long long)range_end);
+                    range_start = -1;
+                }
+                if(range_start < 0){
+                    range_start = pos + first;
+                }
+                range_end = pos + last;
+            }
+        }
+        old_cluster = oldImage.fat_table[old_cluster];
+        new_cluster = newImage.fat_table[new_cluster];
+    }
+
+    // bytes past the shorter size count as changed
+    if(old_file->size != new_file->size){
+        uint32_t longer = old_file->size > new_file->size ? old_file->size : new_file->size;
+        if(range_end >= 0 && common > range_end + 1){
+            printf("    bytes %lld-%lld\n", (long long)range_start, (long long)range_end);
+            range_start = -1;
+        }
+        if(range_start < 0){
+            range_start = common;
+        }
+        range_end = longer - 1;
+    }
+    if(range_start >= 0){
+        printf("    bytes %lld-%lld\n", (long long)range_start, (long long)range_end);
+    }
+}
+
+
+/*
+* Function: compare_records(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering file records by path
+*
+*/
+int compare_records(const void *a, const void *b){
+    return strcmp(((const struct fileRecord *)a)->path, ((const struct fileRecord *)b)->path);
+}
+
+
+/*
+* Function: cluster_ptr(struct imageInfo *img, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(struct imageInfo *img, uint32_t cluster){
+    return img->p + ((size_t)(cluster - 2) * img->sectors_per_cluster + img->data_region_start) * img->bytes_per_sector;
+}
+
+
+/*
+* Function: fat_entry_offset(struct imageInfo *img, uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(struct imageInfo *img, uint32_t cluster){
+    if(img->fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(img->fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(struct imageInfo *img, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(struct imageInfo *img, uint32_t flc){
+    char *fat = img->p + img->fat_start;
+    size_t ent_offset = fat_entry_offset(img, flc);
+
+    if(img->fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (fat + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (fat + ent_offset), 2);
+    if(img->fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(struct imageInfo *img, char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   struct imageInfo* img: mapped image
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(struct imageInfo *img, char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(img->fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: test_bit(uint8_t *map, int bit) / set_bit(uint8_t *map, int bit)
+* =================================
+* Purpose: read and change single bits of a cluster bitmap
+*
+*/
+int test_bit(uint8_t *map, int bit){
+    return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+void set_bit(uint8_t *map, int bit){
+    map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+}
@@ -1,7 +1,7 @@
 /*
 *   Author: Jonathan Cote V00962634
 *   Title: A3 CSC 360
-*   Purpose: Copy file from FAT12 image to local linux directory 
+*   Purpose: Copy file from FAT12/FAT16/FAT32 image to local linux directory 
 *   
 */
 #include <stdio.h>
@@ -9,42 +9,123 @@
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+#define MANIFEST_MAX_DEPTH 64
+#define EXTRACT_MAX_THREADS 8     // writer threads, at most one per online CPU
+#define EXTRACT_QUEUE_DEPTH 16    // resolved files waiting for a writer, all prefetched
+
 struct diskInfo{
     uint8_t num_of_fats;
     uint8_t sectors_per_cluster;
-    uint16_t sector_per_fat;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
     uint16_t reserved_sectors;
     uint16_t root_dir_entries;
     uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    size_t fat_start;
 }diskInfo;
 
 struct fileInfo{
     char *file_name;
-    char file_org_name[11];
+    char file_org_name[13];     // 8.3 name, the dot and the terminator
     int file_size;
     int flc;
     char *data;
 }fileInfo;
 
+// copy-on-write overlay written by diskput -d, see diskput.c
+struct deltaHeader{
+    char magic[8];
+    int64_t base_size;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t base_checksum;  // first FAT and root directory of the base image, see checksum_base()
+    uint32_t reserved;
+};
+
+char *delta_name = NULL;
+
+// a run of contiguous clusters of a requested file
+struct extent{
+    uint32_t cluster;
+    uint32_t count;
+};
 
+// one path of a manifest
+struct request{
+    char *path;                  // as written in the manifest, also the local path of the copy
+    char *match;                 // upper case image path
+    int found;
+    int failed;                  // set by the writer when the local copy could not be written
+    uint32_t flc;
+    uint32_t size;
+    struct extent *extents;
+    int extent_count;
+};
 
+struct manifest{
+    struct request *requests;
+    int count;
+}manifest;
 
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir);
-void read_file_info(char *p, uint16_t sector, uint16_t entry);
+// bounded queue from the resolver stage to the writer threads
+struct jobQueue{
+    struct request *jobs[EXTRACT_QUEUE_DEPTH];
+    int head;
+    int count;
+    int closed;                  // the resolver has queued its last file
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+}jobQueue = {.lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER};
+
+
+
+
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir);
+void read_file_info(char *p, uint32_t sector, uint16_t entry);
 void get_disk_info(char *p);
-unsigned int get_fat_entry(char *p, uint16_t flc);
-uint16_t calc_data_loc(char *p, uint16_t flc);
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
 void get_file_data(char *p);
 void get_string(char *start, int byte_len, char *string_out);
 void build_comp_name(char* name, char* ext, char* comp_name);
-void write_data_to_file(char* data_start, int data_len, FILE *fptr);
+void write_data_to_file(char* data_start, size_t data_len, FILE *fptr, char *file_name);
 void convert_to_upper(char *str);
+int run_manifest(char *p, char *manifest_path);
+void read_manifest(char *manifest_path);
+void resolve_directory(char *p, uint32_t dir_flc, char *path, int depth);
+int wants_directory(char *path);
+void build_extents(char *p, struct request *request);
+void extract_request(char *p, struct request *request);
+void *writer_thread(void *arg);
+void queue_push(struct request *request);
+struct request *queue_pop();
+void prefetch_extent(char *p, struct extent *extent);
+void make_parent_dirs(char *path);
+int compare_match(const void *a, const void *b);
+int compare_start(const void *a, const void *b);
+void apply_delta(char *p, size_t image_size);
+uint32_t checksum_base(char *p, size_t image_size);
 
 
 // Code referenced from mmap_test.c provided in tutorials
@@ -52,26 +133,72 @@ int main(int argc, char *argv[]){
 	int fd;
 	struct stat sb;
 
+    // -d {delta file} reads the image as seen through a delta, it may come anywhere after the image
+    for(int i = 2; i + 1 < argc; i++){
+        if(strcmp(argv[i], "-d") == 0){
+            delta_name = argv[i+1];
+            for(int k = i; k + 2 <= argc; k++){
+                argv[k] = argv[k+2];
+            }
+            argc -= 2;
+            break;
+        }
+    }
+
     // open file and get file stats
-    if(argc != 3){
-        printf("Input format: ./diskget {image file} {file}");
+    if(argc == 4 && strcmp(argv[2], "-m") == 0){
+        fd = open(argv[1], O_RDONLY);
+        if(fd < 0){
+            printf("Error: failed to open image\n");
+            exit(1);
+        }
+        fstat(fd, &sb);
+
+        // a delta is laid over a private copy, the image itself is never written
+        char *p = mmap(NULL, sb.st_size, PROT_READ | (delta_name ? PROT_WRITE : 0), delta_name ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            printf("Error: failed to map memory\n");
+            exit(1);
+        }
+        if(delta_name){
+            apply_delta(p, sb.st_size);
+        }
+
+        int failures = run_manifest(p, argv[3]);
+
+        munmap(p, sb.st_size);
+        close(fd);
+        if(failures > 0){
+            exit(1);
+        }
+    }else if(argc != 3){
+        printf("Input format: ./diskget {image file} {file} [-d {delta file}]\n");
+        printf("              ./diskget {image file} -m {manifest file} [-d {delta file}]\n");
     }else{
-        fd = open(argv[1], O_RDWR); // add error msg for if file does not exist
+        fd = open(argv[1], delta_name ? O_RDONLY : O_RDWR); // add error msg for if file does not exist
         fstat(fd, &sb);
 
-        fileInfo.file_name = malloc(sizeof(char)*strlen(argv[2]));
+        // only an 8.3 name of the root directory can match, anything longer is not on the image
+        if(strlen(argv[2]) >= sizeof(fileInfo.file_org_name)){
+            printf("File not found.\n");
+            exit(1);
+        }
+        fileInfo.file_name = malloc(sizeof(char)*(strlen(argv[2])+1));
         strcpy(fileInfo.file_name, argv[2]);
         strcpy(fileInfo.file_org_name, fileInfo.file_name);
         
         // convert to upper case
         convert_to_upper(fileInfo.file_name);
 
-        // Make pointer to start of image
-        char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // Make pointer to start of image, a delta is laid over a private copy
+        char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, delta_name ? MAP_PRIVATE : MAP_SHARED, fd, 0);
         if (p == MAP_FAILED) {
             printf("Error: failed to map memory\n");
             exit(1);
         }
+        if(delta_name){
+            apply_delta(p, sb.st_size);
+        }
 
         get_disk_info(p);
 
@@ -94,17 +221,24 @@ int main(int argc, char *argv[]){
 *
 */
 void get_disk_info(char *p){
-    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
-    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
-    memcpy(&diskInfo.sector_per_fat, (p + 22), 2);
-    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
-    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
-    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    get_geometry(p);
 
-    uint16_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
-    uint16_t root_dir_ends = root_dir_start + (diskInfo.root_dir_entries / 16);
+    uint32_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
+    uint32_t root_dir_ends = root_dir_start + diskInfo.root_dir_sectors;
 
-    traverse(p, root_dir_start, root_dir_ends, 0);
+    if(diskInfo.fat_type == 32){
+        // the FAT32 root is a cluster chain, it has no . and .. entries to skip
+        uint32_t cluster = diskInfo.root_cluster;
+        for(uint32_t steps = 0; cluster >= 2 && cluster < diskInfo.eoc_min && steps < diskInfo.cluster_count; steps++){
+            uint32_t data_loc = calc_data_loc(p, cluster);
+            if(traverse(p, data_loc, data_loc + diskInfo.sectors_per_cluster, 0)){
+                break;
+            }
+            cluster = get_fat_entry(p, cluster);
+        }
+    }else{
+        traverse(p, root_dir_start, root_dir_ends, 0);
+    }
 
     if(fileInfo.flc == 0){
         printf("File not found.\n");
@@ -116,70 +250,66 @@ void get_disk_info(char *p){
 
 
 /*
-* Function: traverse(char *p, uint16_t start, uint16_t ends, int sub_dir)
+* Function: traverse(char *p, uint32_t start, uint32_t ends, int sub_dir)
 * =================================
-* Purpose: traverse a directory
+* Purpose: traverse a directory, bytes_per_sector / 32 entries per sector
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t start: location to start the traversal
-*   uint16_t ends: location traversal ends
-*   int sub_dir: flag for controlling subdir traversal differences
+*   uint32_t start: location to start the traversal
+*   uint32_t ends: location traversal ends
+*   int sub_dir: 1 for the first cluster of a sub directory (skips . and ..)
+*
+* Return:
+*   int: 1 when the end of directory entry was reached
 *
 */
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir){
-    uint8_t entry_free = 0x01; // Just a inital value so while loop enters
-    int i = start;
-
-    while(i < ends && entry_free != 0x00){
-        for(int k = 0; k < 16; k++){
-            if(sub_dir != 1 || k > 1){
-                memcpy(&entry_free , (p + 512*i + 32*k), 1);
-                if(entry_free == 0x00){
-                    break;
-                }
-                if(entry_free != 0xE5){
-                    read_file_info(p, i, k);
-                }
-            }
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir){
+    uint8_t entry_free;
+    uint32_t entries_per_sector = diskInfo.bytes_per_sector / 32;
+    uint32_t entry_count = (ends - start) * entries_per_sector;
+    char *dir_start = p + (size_t)start * diskInfo.bytes_per_sector;
+
+    for(uint32_t k = (sub_dir == 1) ? 2 : 0; k < entry_count; k++){
+        memcpy(&entry_free, (dir_start + (size_t)32*k), 1);
+        if(entry_free == 0x00){
+            return 1;
+        }
+        if(entry_free != 0xE5){
+            read_file_info(p, start + k / entries_per_sector, k % entries_per_sector);
         }
-        i++;
     }
+    return 0;
 }
 
 
 /*
 * Function: get_file_data(char *p)
 * =================================
-* Purpose: controller for reading file data from FAT12 to local file
+* Purpose: controller for reading file data from the image to local file, one
+*          whole cluster per step
 *
 * Input: 
 *   char* p: image data pointer
 *
 */
 void get_file_data(char *p){
-    uint16_t data_loc;
-    uint16_t cluster_ends;
-    int last_sector_bytes = fileInfo.file_size % diskInfo.bytes_per_sector;
-    int full_sector_span = (fileInfo.file_size - (last_sector_bytes)) / diskInfo.bytes_per_sector;
-    int read_count = 0;
+    uint32_t data_loc;
+    int cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
     int size_copied = 0;
     FILE *fptr = fopen(fileInfo.file_org_name, "w");
-    char *test = malloc(sizeof(char)*512);
 
     // get sector data starts
-    while((fileInfo.flc != 0xFFF) && (fileInfo.file_size != size_copied)){
+    while((fileInfo.flc >= 2 && fileInfo.flc < diskInfo.eoc_min) && (fileInfo.file_size != size_copied)){
         data_loc = calc_data_loc(p, fileInfo.flc);
 
-        if(read_count == full_sector_span){
-            write_data_to_file((p + data_loc*512), last_sector_bytes, fptr);
-            size_copied = size_copied + last_sector_bytes;
-            read_count++;
-        }else{
-            write_data_to_file((p + data_loc*512), diskInfo.bytes_per_sector, fptr);
-            size_copied = size_copied + diskInfo.bytes_per_sector;
-            read_count++;
+        // the last cluster is only copied up to the file size
+        int data_len = fileInfo.file_size - size_copied;
+        if(data_len > cluster_bytes){
+            data_len = cluster_bytes;
         }
+        write_data_to_file((p + (size_t)data_loc*diskInfo.bytes_per_sector), data_len, fptr, fileInfo.file_org_name);
+        size_copied = size_copied + data_len;
 
         // check FAT for next cluster
         fileInfo.flc = get_fat_entry(p, fileInfo.flc);
@@ -189,59 +319,65 @@ void get_file_data(char *p){
 
 
 /*
-* Function: write_data_to_file(char* data_start, int data_len, FILE *fptr)
+* Function: write_data_to_file(char* data_start, size_t data_len, FILE *fptr, char *file_name)
 * =================================
 * Purpose: write file data
 *
 * Input: 
 *   char* data_start: start location on image of data to be written
-*   int data_len: length of data to read
+*   size_t data_len: length of data to read
 *   FILE *fptr: pointer to file to write to
+*   char* file_name: name of the file, for the error message
 *
 */
-void write_data_to_file(char* data_start, int data_len, FILE *fptr){
-    char *buffer = malloc(sizeof(char));
-    for(int i = 0; i<data_len; i++){
-        memcpy(buffer, (data_start + i), 1);
-        putc(buffer[0], fptr);
+void write_data_to_file(char* data_start, size_t data_len, FILE *fptr, char *file_name){
+    if(fwrite(data_start, 1, data_len, fptr) != data_len){
+        printf("Error: failed to write %s\n", file_name);
+        exit(1);
     }
 }
 
 
 /*
-* Function: calc_data_loc(char *p, uint16_t flc)
+* Function: calc_data_loc(char *p, uint32_t flc)
 * =================================
 * Purpose: calculate the data location for a given flc
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-uint16_t calc_data_loc(char *p, uint16_t flc){
-    uint8_t data_region_start;
-    uint16_t data_loc;
-
-    data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + (diskInfo.root_dir_entries / 16) + diskInfo.reserved_sectors;
-    data_loc = ((flc - 2) * diskInfo.sectors_per_cluster) + data_region_start;
-    
-    return data_loc;
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
 }
 
 
 /*
-* Function: get_fat_entry(char *p, uint16_t flc)
+* Function: get_fat_entry(char *p, uint32_t flc)
 * =================================
-* Purpose: get the entry value at a FAT location
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-unsigned int get_fat_entry(char *p, uint16_t flc){
-    int ent_offset = (flc * 3) / 2;
-    unsigned short entry = *(unsigned short*)(p + 512 + ent_offset);
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
     
     if(flc % 2 == 1){
         entry >>= 4;
@@ -254,38 +390,111 @@ unsigned int get_fat_entry(char *p, uint16_t flc){
 
 
 /*
-* Function: read_file_info(char *p, uint16_t sector, uint16_t entry)
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input: 
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input: 
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+    }
+}
+
+
+/*
+* Function: read_file_info(char *p, uint32_t sector, uint16_t entry)
 * =================================
 * Purpose: read the file meta data from directory entry
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t sector: FAT12 sector
+*   uint32_t sector: image sector
 *   uint16_t entry: entry in the sector
 *
 */
-void read_file_info(char *p, uint16_t sector, uint16_t entry){
+void read_file_info(char *p, uint32_t sector, uint16_t entry){
+    char *dir_start = p + ((size_t)diskInfo.bytes_per_sector*sector + 32*entry);
     uint8_t file_attributes;
-    uint16_t flc;
-    uint32_t file_size;
    // char *name_buffer = malloc(sizeof(char));
    // char *ext_buffer = malloc(sizeof(char));
-    char *file_name = malloc(sizeof(char));
-    char *file_ext = malloc(sizeof(char));
-    char *comp_file_name = malloc(sizeof(char));
+    char file_name[9];
+    char file_ext[4];
+    char comp_file_name[13];
     //int dir = 0;
 
-    memcpy(&file_attributes, (p + (512*sector + 32*entry) + 11), 1);
+    memcpy(&file_attributes, (dir_start + 11), 1);
     if(file_attributes != 0x0F && !(0x04 & file_attributes)){
-        get_string((p + (512*sector + 32*entry)), 8, file_name);  // this might not work..
-        get_string((p + (512*sector + 32*entry) + 8), 3, file_ext); // this might not work... test more
+        get_string(dir_start, 8, file_name);  // this might not work..
+        get_string((dir_start + 8), 3, file_ext); // this might not work... test more
 
         build_comp_name(file_name, file_ext, comp_file_name);
 
         if(!(0x08 & file_attributes)){
             if(strcmp(fileInfo.file_name, comp_file_name) == 0){
-                memcpy(&fileInfo.flc, (p + (512*sector + 32*entry) + 26), 2);
-                memcpy(&fileInfo.file_size, (p + (512*sector + 32*entry) + 28), 4);
+                fileInfo.flc = get_entry_flc(dir_start);
+                memcpy(&fileInfo.file_size, (dir_start + 28), 4);
                 get_file_data(p);
             }
         }
@@ -302,21 +511,18 @@ void read_file_info(char *p, uint16_t sector, uint16_t entry){
 * Input: 
 *   char* start: start location in image of string
 *   int byte_len: number of bytes to read
-*   char *string_out: output string location
+*   char *string_out: output string location, at least byte_len + 1 bytes
 *
 */
 void get_string(char *start, int byte_len, char *string_out){
-    char *buffer = malloc(sizeof(char)*byte_len);
-    int size = 1;
+    int size = 0;
     for(int i = 0; i<byte_len; i++){
-        memcpy(&buffer[i], (start + i), 1);
-        if(isspace(buffer[i]) == 0){
-            string_out[i] = buffer[i];
-            string_out = realloc(string_out, sizeof(char)*size);
+        if(isspace(start[i]) == 0){
+            string_out[size] = start[i];
             size++;
         }
     }
-    free(buffer);
+    string_out[size] = '\0';
 }
 
 
@@ -328,13 +534,10 @@ void get_string(char *start, int byte_len, char *string_out){
 * Input: 
 *   char* name: file name
 *   char* ext: file extension
-*   char* comp_name: output string location
+*   char* comp_name: output string location, at least 13 bytes
 *
 */
 void build_comp_name(char* name, char* ext, char* comp_name){
-    int len = strlen(name) + strlen(ext) + 1;
-    
-    comp_name = realloc(comp_name, sizeof(char)*len);
     strcpy(comp_name, name);
     strcat(comp_name, ".");
     strcat(comp_name, ext);
@@ -354,4 +557,545 @@ void convert_to_upper(char *str){
     for(int i = 0; i < strlen(str); i++){
         str[i] = toupper(str[i]);
     }
-}
\ No newline at end of file
+}
+
+
+/*
+* Function: run_manifest(char *p, char *manifest_path)
+* =================================
+* Purpose: extract every file listed in a manifest: all paths are resolved in one pass
+*          over the directory tree, then a resolver stage walks the files in order of their
+*          first cluster and feeds a bounded queue drained by a pool of writer threads
+*
+* Input:
+*   char* p: image data pointer
+*   char* manifest_path: file with one image path per line, - for stdin
+*
+* Return:
+*   int: number of listed files that were not found or could not be written
+*
+*/
+int run_manifest(char *p, char *manifest_path){
+    get_geometry(p);
+    read_manifest(manifest_path);
+
+    // sorted by image path so the directory pass can look names up with bsearch
+    qsort(manifest.requests, manifest.count, sizeof(struct request), compare_match);
+    int unique = 0;
+    for(int i = 0; i < manifest.count; i++){
+        if(unique > 0 && strcmp(manifest.requests[unique-1].match, manifest.requests[i].match) == 0){
+            free(manifest.requests[i].path);
+            free(manifest.requests[i].match);
+            continue;
+        }
+        manifest.requests[unique++] = manifest.requests[i];
+    }
+    manifest.count = unique;
+
+    char path[PATH_MAX] = "";
+    resolve_directory(p, 0, path, 0);
+
+    int failures = 0;
+    for(int i = 0; i < manifest.count; i++){
+        if(!manifest.requests[i].found){
+            printf("File not found: %s\n", manifest.requests[i].path);
+            failures++;
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = (cpus < 1) ? 1 : (cpus > EXTRACT_MAX_THREADS) ? EXTRACT_MAX_THREADS : (int)cpus;
+    pthread_t threads[EXTRACT_MAX_THREADS];
+    for(int i = 0; i < thread_count; i++){
+        if(pthread_create(&threads[i], NULL, writer_thread, p) != 0){
+            printf("Error: failed to start writer thread\n");
+            exit(1);
+        }
+    }
+
+    // resolver stage: in disk order, follow each chain and prefetch its extents, the
+    // queue depth bounds how far the hints run ahead of the writers
+    qsort(manifest.requests, manifest.count, sizeof(struct request), compare_start);
+    for(int i = 0; i < manifest.count; i++){
+        if(manifest.requests[i].found){
+            build_extents(p, &manifest.requests[i]);
+            for(int k = 0; k < manifest.requests[i].extent_count; k++){
+                prefetch_extent(p, &manifest.requests[i].extents[k]);
+            }
+            queue_push(&manifest.requests[i]);
+        }
+    }
+
+    pthread_mutex_lock(&jobQueue.lock);
+    jobQueue.closed = 1;
+    pthread_cond_broadcast(&jobQueue.not_empty);
+    pthread_mutex_unlock(&jobQueue.lock);
+    for(int i = 0; i < thread_count; i++){
+        pthread_join(threads[i], NULL);
+    }
+    for(int i = 0; i < manifest.count; i++){
+        failures += manifest.requests[i].failed;
+    }
+    return failures;
+}
+
+
+/*
+* Function: read_manifest(char *manifest_path)
+* =================================
+* Purpose: read the manifest, blank lines are skipped and leading slashes dropped
+*
+* Input:
+*   char* manifest_path: manifest file, - for stdin
+*
+*/
+void read_manifest(char *manifest_path){
+    char line[PATH_MAX];
+    FILE *fptr = (strcmp(manifest_path, "-") == 0) ? stdin : fopen(manifest_path, "r");
+
+    if(fptr == NULL){
+        printf("Error: failed to open %s\n", manifest_path);
+        exit(1);
+    }
+
+    while(fgets(line, sizeof(line), fptr) != NULL){
+        line[strcspn(line, "\r\n")] = '\0';
+        char *path = line;
+        while(*path == '/'){
+            path++;
+        }
+        if(*path == '\0'){
+            continue;
+        }
+        // the path is also where the copy goes, it has to stay below the current directory
+        if(strcmp(path, "..") == 0 || strncmp(path, "../", 3) == 0 || strstr(path, "/../") != NULL
+            || (strlen(path) >= 3 && strcmp(path + strlen(path) - 3, "/..") == 0)){
+            printf("Error: %s leaves the current directory, skipped\n", path);
+            continue;
+        }
+
+        manifest.requests = realloc(manifest.requests, sizeof(struct request)*(manifest.count + 1));
+        struct request *request = &manifest.requests[manifest.count++];
+        memset(request, 0, sizeof(struct request));
+        request->path = strdup(path);
+        request->match = strdup(path);
+        convert_to_upper(request->match);
+    }
+
+    if(fptr != stdin){
+        fclose(fptr);
+    }
+}
+
+
+/*
+* Function: resolve_directory(char *p, uint32_t dir_flc, char *path, int depth)
+* =================================
+* Purpose: the one directory pass of a manifest run: every file of the directory is
+*          matched against the manifest and only sub directories that lead to a requested
+*          path are entered
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* path: image path of the directory with a trailing /, "" for root
+*   int depth: nesting level, guards against directory loops
+*
+*/
+void resolve_directory(char *p, uint32_t dir_flc, char *path, int depth){
+    int fixed_root = (dir_flc == 0 && diskInfo.fat_type != 32);
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    size_t cluster_bytes = (size_t)diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+    size_t len = strlen(path);
+    char *start;
+    int entry_count;
+
+    if(depth > MANIFEST_MAX_DEPTH){
+        return;
+    }
+
+    for(uint32_t steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(fixed_root){
+            start = p + (size_t)(diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            start = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+            entry_count = cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+            char file_name[9];
+            char file_ext[4];
+            char comp_file_name[13];
+
+            if(first == 0x00){
+                return;
+            }
+            // deleted, long name, volume label and the . and .. entries
+            if(first == 0xE5 || entry_start[11] == 0x0F || (entry_start[11] & 0x08) || first == '.'){
+                continue;
+            }
+            get_string(entry_start, 8, file_name);
+            get_string((entry_start + 8), 3, file_ext);
+            build_comp_name(file_name, file_ext, comp_file_name);
+            if(file_ext[0] == '\0'){
+                comp_file_name[strlen(comp_file_name) - 1] = '\0';
+            }
+            if(len + strlen(comp_file_name) + 2 > PATH_MAX){
+                continue;
+            }
+            strcpy(path + len, comp_file_name);
+
+            if(entry_start[11] & 0x10){
+                uint32_t sub_flc = get_entry_flc(entry_start);
+                strcat(path, "/");
+                if(sub_flc >= 2 && sub_flc < diskInfo.cluster_count && wants_directory(path)){
+                    resolve_directory(p, sub_flc, path, depth + 1);
+                }
+            }else{
+                struct request key = {.match = path};
+                struct request *request = bsearch(&key, manifest.requests, manifest.count, sizeof(struct request), compare_match);
+                if(request != NULL){
+                    request->found = 1;
+                    request->flc = get_entry_flc(entry_start);
+                    memcpy(&request->size, (entry_start + 28), 4);
+                }
+            }
+            path[len] = '\0';
+        }
+
+        if(fixed_root){
+            return;
+        }
+        cluster = get_fat_entry(p, cluster);
+        if(cluster < 2 || cluster >= diskInfo.eoc_min){
+            return;
+        }
+    }
+}
+
+
+/*
+* Function: wants_directory(char *path)
+* =================================
+* Purpose: check if any manifest path lies below a directory
+*
+* Input:
+*   char* path: image path of the directory with a trailing /
+*
+* Return:
+*   int: 1 if the directory has to be entered
+*
+*/
+int wants_directory(char *path){
+    size_t len = strlen(path);
+    int low = 0;
+    int high = manifest.count;
+
+    // first path not sorting before the prefix, it starts with it if anything does
+    while(low < high){
+        int mid = (low + high) / 2;
+        if(strcmp(manifest.requests[mid].match, path) < 0){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    return low < manifest.count && strncmp(manifest.requests[low].match, path, len) == 0;
+}
+
+
+/*
+* Function: build_extents(char *p, struct request *request)
+* =================================
+* Purpose: follow a file's chain once and store it as runs of contiguous clusters
+*
+* Input:
+*   char* p: image data pointer
+*   struct request* request: a resolved request
+*
+*/
+void build_extents(char *p, struct request *request){
+    size_t cluster_bytes = (size_t)diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+    uint32_t needed = (uint32_t)((request->size + cluster_bytes - 1) / cluster_bytes);
+    uint32_t cluster = request->flc;
+
+    for(uint32_t n = 0; n < needed && cluster >= 2 && cluster < diskInfo.cluster_count; n++){
+        struct extent *last = (request->extent_count > 0) ? &request->extents[request->extent_count - 1] : NULL;
+
+        if(last != NULL && last->cluster + last->count == cluster){
+            last->count++;
+        }else{
+            request->extents = realloc(request->extents, sizeof(struct extent)*(request->extent_count + 1));
+            request->extents[request->extent_count].cluster = cluster;
+            request->extents[request->extent_count].count = 1;
+            request->extent_count++;
+        }
+        cluster = get_fat_entry(p, cluster);
+    }
+}
+
+
+/*
+* Function: extract_request(char *p, struct request *request)
+* =================================
+* Purpose: copy one file to its local path, each extent in one write straight from the mapping.
+*          A copy that can not be created or closed marks the request as failed
+*
+* Input:
+*   char* p: image data pointer
+*   struct request* request: a resolved request with its extents built
+*
+*/
+void extract_request(char *p, struct request *request){
+    size_t cluster_bytes = (size_t)diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+    size_t left = request->size;
+
+    make_parent_dirs(request->path);
+    FILE *fptr = fopen(request->path, "w");
+    if(fptr == NULL){
+        printf("Error: failed to create %s\n", request->path);
+        request->failed = 1;
+        free(request->extents);
+        return;
+    }
+
+    for(int i = 0; i < request->extent_count && left > 0; i++){
+        char *data = p + (size_t)calc_data_loc(p, request->extents[i].cluster) * diskInfo.bytes_per_sector;
+        size_t data_len = (size_t)request->extents[i].count * cluster_bytes;
+        if(data_len > left){
+            data_len = left;
+        }
+        write_data_to_file(data, data_len, fptr, request->path);
+        left -= data_len;
+    }
+    if(fclose(fptr) != 0){
+        printf("Error: failed to write %s\n", request->path);
+        request->failed = 1;
+    }
+    free(request->extents);
+}
+
+
+/*
+* Function: writer_thread(void *arg)
+* =================================
+* Purpose: writer stage: take resolved files off the queue and copy them until the
+*          resolver closes it
+*
+* Input:
+*   void* arg: image data pointer
+*
+*/
+void *writer_thread(void *arg){
+    struct request *request;
+
+    while((request = queue_pop()) != NULL){
+        extract_request((char *)arg, request);
+    }
+    return NULL;
+}
+
+
+/*
+* Function: queue_push(struct request *request)
+* =================================
+* Purpose: hand a resolved file to the writers, waits while the queue is full
+*
+* Input:
+*   struct request* request: request with its extents built
+*
+*/
+void queue_push(struct request *request){
+    pthread_mutex_lock(&jobQueue.lock);
+    while(jobQueue.count == EXTRACT_QUEUE_DEPTH){
+        pthread_cond_wait(&jobQueue.not_full, &jobQueue.lock);
+    }
+    jobQueue.jobs[(jobQueue.head + jobQueue.count) % EXTRACT_QUEUE_DEPTH] = request;
+    jobQueue.count++;
+    pthread_cond_signal(&jobQueue.not_empty);
+    pthread_mutex_unlock(&jobQueue.lock);
+}
+
+
+/*
+* Function: queue_pop()
+* =================================
+* Purpose: take the next file off the queue, waits while it is empty
+*
+* Return:
+*   struct request*: the request, NULL once the queue is closed and drained
+*
+*/
+struct request *queue_pop(){
+    struct request *request = NULL;
+
+    pthread_mutex_lock(&jobQueue.lock);
+    while(jobQueue.count == 0 && !jobQueue.closed){
+        pthread_cond_wait(&jobQueue.not_empty, &jobQueue.lock);
+    }
+    if(jobQueue.count > 0){
+        request = jobQueue.jobs[jobQueue.head];
+        jobQueue.head = (jobQueue.head + 1) % EXTRACT_QUEUE_DEPTH;
+        jobQueue.count--;
+        pthread_cond_signal(&jobQueue.not_full);
+    }
+    pthread_mutex_unlock(&jobQueue.lock);
+    return request;
+}
+
+
+/*
+* Function: prefetch_extent(char *p, struct extent *extent)
+* =================================
+* Purpose: ask the kernel to start reading an extent that will be copied soon
+*
+* Input:
+*   char* p: image data pointer
+*   struct extent* extent: the extent
+*
+*/
+void prefetch_extent(char *p, struct extent *extent){
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)calc_data_loc(p, extent->cluster) * diskInfo.bytes_per_sector;
+    size_t end = start + (size_t)extent->count * diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    start &= ~(page - 1);
+    madvise(p + start, end - start, MADV_WILLNEED);
+}
+
+
+/*
+* Function: make_parent_dirs(char *path)
+* =================================
+* Purpose: create the local directories a manifest path needs
+*
+* Input:
+*   char* path: relative local path of a file
+*
+*/
+void make_parent_dirs(char *path){
+    char dir[PATH_MAX];
+
+    strcpy(dir, path);
+    for(char *slash = strchr(dir, '/'); slash != NULL; slash = strchr(slash + 1, '/')){
+        *slash = '\0';
+        mkdir(dir, 0755);
+        *slash = '/';
+    }
+}
+
+
+/*
+* Function: compare_match(const void *a, const void *b)
+* =================================
+* Purpose: qsort / bsearch comparator ordering requests by upper case image path
+*
+*/
+int compare_match(const void *a, const void *b){
+    const struct request *x = a;
+    const struct request *y = b;
+    return strcmp(x->match, y->match);
+}
+
+
+/*
+* Function: compare_start(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering requests by first cluster, empty files first
+*
+*/
+int compare_start(const void *a, const void *b){
+    const struct request *x = a;
+    const struct request *y = b;
+    return (x->flc > y->flc) - (x->flc < y->flc);
+}
+
+
+/*
+* Function: apply_delta(char *p, size_t image_size)
+* =================================
+* Purpose: copy the sectors of a delta file over the private image mapping
+*
+* Input:
+*   char* p: image data pointer (MAP_PRIVATE)
+*   size_t image_size: size of the base image
+*
+*/
+void apply_delta(char *p, size_t image_size){
+    struct deltaHeader header;
+    FILE *delta = fopen(delta_name, "r");
+
+    if(delta == NULL){
+        printf("Error: failed to open %s\n", delta_name);
+        exit(1);
+    }
+    if(fread(&header, sizeof(header), 1, delta) != 1 || memcmp(header.magic, "FATDLT2", 8) != 0
+        || header.base_size != (int64_t)image_size || header.sector_size == 0
+        || header.base_checksum != checksum_base(p, image_size)){
+        printf("Error: %s is not a delta of this image\n", delta_name);
+        exit(1);
+    }
+
+    uint32_t *sector_list = malloc(sizeof(uint32_t)*(header.sector_count + 1));
+    if(fread(sector_list, sizeof(uint32_t), header.sector_count, delta) != header.sector_count){
+        printf("Error: %s is truncated\n", delta_name);
+        exit(1);
+    }
+    for(uint32_t i = 0; i < header.sector_count; i++){
+        size_t offset = (size_t)sector_list[i] * header.sector_size;
+        if(offset + header.sector_size > image_size || fread(p + offset, header.sector_size, 1, delta) != 1){
+            printf("Error: %s is truncated\n", delta_name);
+            exit(1);
+        }
+    }
+    free(sector_list);
+    fclose(delta);
+}
+
+
+/*
+* Function: checksum_base(char *p, size_t image_size)
+* =================================
+* Purpose: checksum the first FAT and root directory of the base image, 8 bytes at a
+*          time, so a delta is only laid over the base it was made from
+*
+* Input:
+*   char* p: base image data pointer, before any delta is laid over it
+*   size_t image_size: size of the base image
+*
+*/
+uint32_t checksum_base(char *p, size_t image_size){
+    uint16_t bytes_per_sector, reserved_sectors, root_dir_entries, sector_per_fat16;
+    uint8_t num_of_fats;
+    uint32_t sector_per_fat;
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+
+    memcpy(&bytes_per_sector, (p + 11), 2);
+    memcpy(&reserved_sectors, (p + 14), 2);
+    memcpy(&num_of_fats, (p + 16), 1);
+    memcpy(&root_dir_entries, (p + 17), 2);
+    memcpy(&sector_per_fat16, (p + 22), 2);
+    sector_per_fat = sector_per_fat16;
+    if(sector_per_fat == 0){
+        memcpy(&sector_per_fat, (p + 36), 4);
+    }
+
+    size_t fat_start = (size_t)reserved_sectors * bytes_per_sector;
+    size_t fat_ends = fat_start + (size_t)sector_per_fat * bytes_per_sector;
+    size_t root_dir_start = fat_start + (size_t)num_of_fats * sector_per_fat * bytes_per_sector;
+    size_t root_dir_ends = root_dir_start + (size_t)root_dir_entries * 32;
+
+    for(size_t i = fat_start; i + 8 <= fat_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i + 8 <= root_dir_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -14,30 +14,67 @@
 #include <unistd.h>
 
 
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
 struct diskInfo{
     char os_name[9]; // try to switch these 2 char fields to use malloc
     char disk_label[9];
-    int total_space;
-    int used_space;
-    int free_space;
+    long long total_space;
+    long long used_space;
+    long long free_space;
     int file_count;
     uint8_t num_of_fats;
     uint8_t sectors_per_cluster;
-    uint16_t sector_per_fat;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
     uint16_t reserved_sectors;
     uint16_t root_dir_entries;
     uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    size_t fat_start;
     
 }diskInfo;
 
-
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir);
-void traverse_sub_directory(char *p, uint16_t flc);
-void read_file_info(char *p, uint16_t sector, uint16_t entry);
+struct fragInfo{
+    uint32_t *fat_table;
+    int cluster_count;
+    int files;
+    int fragmented_files;
+    int total_extents;
+    int histogram[6];
+    int free_clusters;
+    int free_runs;
+    int largest_free_run;
+    int worst_extents[5];
+    char *worst_paths[5];
+    char **file_paths;
+    int *file_extents;
+    char path[256];
+}fragInfo;
+
+int frag_report = 0;
+
+
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir);
+void traverse_sub_directory(char *p, uint32_t flc, int sub_dir);
+void read_file_info(char *p, uint32_t sector, uint16_t entry);
 void get_disk_info(char *p);
-unsigned int get_fat_entry(char *p, uint16_t flc);
-uint16_t calc_data_loc(char *p, uint16_t flc);
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
 void print_info();
+void decode_fat(char *p);
+int count_extents(uint32_t flc);
+void record_file_extents(char *dir_start, int extents);
+void print_frag_info();
 
 
 // Code referenced from mmap_test.c provided in tutorials
@@ -45,6 +82,12 @@ int main(int argc, char *argv[]){
 	int fd;
 	struct stat sb;
 
+    if(argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "-f") != 0)){
+        printf("Input format: ./diskinfo {image file} [-f]\n");
+        exit(1);
+    }
+    frag_report = (argc == 3);
+
     // open file and get file stats
 	fd = open(argv[1], O_RDWR);
 	fstat(fd, &sb);
@@ -61,6 +104,9 @@ int main(int argc, char *argv[]){
     
     // Print diskInfo
     print_info();
+    if(frag_report){
+        print_frag_info();
+    }
 
     // save changes to image and close
 	//munmap(p, sb.st_size);
@@ -78,8 +124,9 @@ int main(int argc, char *argv[]){
 void print_info(){
     printf("OS Name: %s\n", diskInfo.os_name);
     printf("Label of the disk: %s\n", diskInfo.disk_label); // TODO check boot sector in image2020 for label
-    printf("Total size of the disk: %u\n", diskInfo.total_space);
-    printf("Free size of the disk: %u\n", diskInfo.free_space);
+    printf("File system: FAT%u\n", diskInfo.fat_type);
+    printf("Total size of the disk: %lld\n", diskInfo.total_space);
+    printf("Free size of the disk: %lld\n", diskInfo.free_space);
     printf("==============\n");
     printf("The number of files: %u\n", diskInfo.file_count);
     printf("=============\n");
@@ -88,50 +135,228 @@ void print_info(){
 }
 
 
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir){
-    uint8_t entry_free = 0x01; // Just a inital value so while loop enters
-    int i = start;
+/*
+* Function: print_frag_info()
+* =================================
+* Purpose: print the fragmentation report collected during traversal
+*
+*/
+void print_frag_info(){
+    const char *labels[6] = {"1", "2", "3-4", "5-8", "9-16", "17+"};
+    double index = 0;
 
-    while(i < ends && entry_free != 0x00){
-        for(int k = 0; k < 16; k++){
-            if(sub_dir != 1 || k > 1){
-                memcpy(&entry_free , (p + 512*i + 32*k), 1);
-                if(entry_free == 0x00){
-                    break;
-                }
-                if(entry_free != 0xE5){
-                    read_file_info(p, i, k);
-                }
+    if(fragInfo.free_clusters > 0){
+        index = 100.0 * (1.0 - (double)fragInfo.largest_free_run / fragInfo.free_clusters);
+    }
+
+    printf("=============\n");
+    printf("File extents:\n");
+    for(int i = 0; i < fragInfo.files; i++){
+        printf("%8d  %s\n", fragInfo.file_extents[i], fragInfo.file_paths[i]);
+    }
+    printf("Fragmented files: %d of %d\n", fragInfo.fragmented_files, fragInfo.files);
+    printf("Total file extents: %d\n", fragInfo.total_extents);
+    printf("Extents per file:\n");
+    for(int i = 0; i < 6; i++){
+        printf("%8s: %d\n", labels[i], fragInfo.histogram[i]);
+    }
+    printf("Free clusters: %d in %d runs\n", fragInfo.free_clusters, fragInfo.free_runs);
+    printf("Largest free run: %d clusters\n", fragInfo.largest_free_run);
+    printf("Free space fragmentation index: %.2f%%\n", index);
+    printf("Most fragmented files:\n");
+    for(int i = 0; i < 5 && fragInfo.worst_paths[i] != NULL; i++){
+        printf("%8d  %s\n", fragInfo.worst_extents[i], fragInfo.worst_paths[i]);
+    }
+}
+
+
+/*
+* Function: decode_fat(char *p)
+* =================================
+* Purpose: decode every FAT entry into fragInfo.fat_table and collect the
+*          free run statistics in the same pass
+*
+* Input: 
+*   char* p: image data pointer
+*
+*/
+void decode_fat(char *p){
+    int run = 0;
+
+    fragInfo.cluster_count = diskInfo.cluster_count;
+    fragInfo.fat_table = malloc(sizeof(uint32_t)*fragInfo.cluster_count);
+
+    for(int i = 0; i < fragInfo.cluster_count; i++){
+        fragInfo.fat_table[i] = get_fat_entry(p, i);
+
+        if(i >= 2 && fragInfo.fat_table[i] == 0x000){
+            fragInfo.free_clusters++;
+            if(run == 0){
+                fragInfo.free_runs++;
+            }
+            run++;
+            if(run > fragInfo.largest_free_run){
+                fragInfo.largest_free_run = run;
             }
+        }else{
+            run = 0;
         }
-        i++;
     }
 }
 
 
 /*
-* Function: traverse_sub_directory(char *p, uint16_t flc)
+* Function: count_extents(uint32_t flc)
 * =================================
-* Purpose: set needed data for sub dir traversal
+* Purpose: count the contiguous cluster runs in a chain using the decoded FAT
+*
+* Input: 
+*   uint32_t flc: first logical cluster of the chain
+*
+* Return:
+*   int: number of extents (0 for an empty chain)
+*
+*/
+int count_extents(uint32_t flc){
+    int extents = 0;
+    int steps = 0;
+    uint32_t prev = 0;
+
+    // the step limit keeps a cyclic chain from looping forever
+    while(flc >= 2 && flc < fragInfo.cluster_count && steps < fragInfo.cluster_count){
+        if(extents == 0 || flc != prev + 1){
+            extents++;
+        }
+        prev = flc;
+        flc = fragInfo.fat_table[flc];
+        steps++;
+    }
+    return extents;
+}
+
+
+/*
+* Function: record_file_extents(char *dir_start, int extents)
+* =================================
+* Purpose: add a file to the histogram and the most fragmented list
+*
+* Input: 
+*   char* dir_start: start location of the directory entry
+*   int extents: extent count of the file
+*
+*/
+void record_file_extents(char *dir_start, int extents){
+    char path[300];
+    int bucket = 0;
+    int len = 0;
+
+    // strip the space padding from the entry name and extension
+    strcpy(path, fragInfo.path);
+    strcat(path, "/");
+    len = strlen(path);
+    for(int i = 0; i < 8 && dir_start[i] != ' '; i++){
+        path[len++] = dir_start[i];
+    }
+    if(dir_start[8] != ' '){
+        path[len++] = '.';
+    }
+    for(int i = 8; i < 11 && dir_start[i] != ' '; i++){
+        path[len++] = dir_start[i];
+    }
+    path[len] = '\0';
+
+    fragInfo.file_paths = realloc(fragInfo.file_paths, sizeof(char *)*(fragInfo.files+1));
+    fragInfo.file_extents = realloc(fragInfo.file_extents, sizeof(int)*(fragInfo.files+1));
+    fragInfo.file_paths[fragInfo.files] = strdup(path);
+    fragInfo.file_extents[fragInfo.files] = extents;
+    fragInfo.files++;
+    fragInfo.total_extents += extents;
+    if(extents > 1){
+        fragInfo.fragmented_files++;
+    }
+
+    while(bucket < 5 && extents > (1 << bucket)){
+        bucket++;
+    }
+    if(extents > 0){
+        fragInfo.histogram[bucket]++;
+    }
+
+    // insertion into the sorted top 5 list
+    for(int i = 0; i < 5; i++){
+        if(fragInfo.worst_paths[i] == NULL || extents > fragInfo.worst_extents[i]){
+            free(fragInfo.worst_paths[4]);
+            for(int k = 4; k > i; k--){
+                fragInfo.worst_paths[k] = fragInfo.worst_paths[k-1];
+                fragInfo.worst_extents[k] = fragInfo.worst_extents[k-1];
+            }
+            fragInfo.worst_paths[i] = strdup(path);
+            fragInfo.worst_extents[i] = extents;
+            break;
+        }
+    }
+}
+
+
+/*
+* Function: traverse(char *p, uint32_t start, uint32_t ends, int sub_dir)
+* =================================
+* Purpose: traverse a directory, bytes_per_sector / 32 entries per sector
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster of directory start
+*   uint32_t start: location to start the traversal
+*   uint32_t ends: location traversal ends
+*   int sub_dir: 1 for the first cluster of a sub directory (skips . and ..)
+*
+* Return:
+*   int: 1 when the end of directory entry was reached
 *
 */
-void traverse_sub_directory(char *p, uint16_t flc){
-    uint8_t sectors_per_cluster;
-    uint16_t data_loc;
-    uint16_t cluster_ends;
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir){
+    uint8_t entry_free;
+    uint32_t entries_per_sector = diskInfo.bytes_per_sector / 32;
+    uint32_t entry_count = (ends - start) * entries_per_sector;
+    char *dir_start = p + (size_t)start * diskInfo.bytes_per_sector;
+
+    for(uint32_t k = (sub_dir == 1) ? 2 : 0; k < entry_count; k++){
+        memcpy(&entry_free, (dir_start + (size_t)32*k), 1);
+        if(entry_free == 0x00){
+            return 1;
+        }
+        if(entry_free != 0xE5){
+            read_file_info(p, start + k / entries_per_sector, k % entries_per_sector);
+        }
+    }
+    return 0;
+}
 
-    memcpy(&sectors_per_cluster, (p + 13), 1);
+
+/*
+* Function: traverse_sub_directory(char *p, uint32_t flc, int sub_dir)
+* =================================
+* Purpose: set needed data for sub dir traversal, also used for the FAT32 root chain
+*
+* Input: 
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster of directory start
+*   int sub_dir: 1 for a sub directory, 0 for the FAT32 root (no . and .. entries)
+*
+*/
+void traverse_sub_directory(char *p, uint32_t flc, int sub_dir){
+    uint32_t data_loc;
+    uint32_t cluster_ends;
+    uint32_t steps = 0;
     
-    // get sector data starts
-    while(flc != 0xFFF){
+    // get sector data starts, the step limit keeps a cyclic chain from looping forever
+    while(flc >= 2 && flc < diskInfo.eoc_min && steps++ < diskInfo.cluster_count){
         data_loc = calc_data_loc(p, flc);
-        cluster_ends = data_loc + sectors_per_cluster;
+        cluster_ends = data_loc + diskInfo.sectors_per_cluster;
         // traverse data
-        traverse(p, data_loc, cluster_ends, 1);
+        if(traverse(p, data_loc, cluster_ends, sub_dir)){
+            break;
+        }
+        sub_dir = 0; // only the first cluster holds . and ..
 
         // check FAT for next cluster
         flc = get_fat_entry(p, flc);
@@ -141,47 +366,45 @@ void traverse_sub_directory(char *p, uint16_t flc){
 
 
 /*
-* Function: calc_data_loc(char *p, uint16_t flc)
+* Function: calc_data_loc(char *p, uint32_t flc)
 * =================================
 * Purpose: calculate the data location for a given flc
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-uint16_t calc_data_loc(char *p, uint16_t flc){
-    uint8_t sectors_per_cluster;
-    uint8_t data_region_start;
-    uint16_t reserved_sectors;
-    uint16_t root_dir_entries;
-    uint16_t data_loc;
-
-    memcpy(&reserved_sectors, (p + 14), 2);
-    memcpy(&sectors_per_cluster, (p + 13), 1);
-    memcpy(&root_dir_entries, (p + 17), 2);
-
-    data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + (root_dir_entries / 16) + reserved_sectors;
-
-    data_loc = ((flc - 2) * sectors_per_cluster) + data_region_start;
-
-    return data_loc;
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
 }
 
 
 /*
-* Function: get_fat_entry(char *p, uint16_t flc)
+* Function: get_fat_entry(char *p, uint32_t flc)
 * =================================
-* Purpose: get the entry value at a FAT location
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-unsigned int get_fat_entry(char *p, uint16_t flc){
-    int ent_offset = (flc * 3) / 2;
-    unsigned short entry = *(unsigned short*)(p + 512 + ent_offset);
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
     
     if(flc % 2 == 1){
         entry >>= 4;
@@ -194,32 +417,54 @@ unsigned int get_fat_entry(char *p, uint16_t flc){
 
 
 /*
-* Function: read_file_info(char *p, uint16_t sector, uint16_t entry)
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input: 
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: read_file_info(char *p, uint32_t sector, uint16_t entry)
 * =================================
 * Purpose: read the file meta data from directory entry
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t sector: FAT12 sector
+*   uint32_t sector: image sector
 *   uint16_t entry: entry in the sector
 *
 */
-void read_file_info(char *p, uint16_t sector, uint16_t entry){
+void read_file_info(char *p, uint32_t sector, uint16_t entry){
+    char *dir_start = p + ((size_t)diskInfo.bytes_per_sector*sector + 32*entry);
     char file_name[9];
     uint8_t file_attributes;
-    uint16_t flc;
+    uint32_t flc;
     uint32_t file_size;
 
-    memcpy(&file_attributes, (p + (512*sector + 32*entry) + 11), 1);
+    memcpy(&file_attributes, (dir_start + 11), 1);
 
     if(file_attributes != 0x0F){
-        memcpy(file_name, (p + (512*sector + 32*entry)), 8);
-        file_name[9] = '\0';
+        memcpy(file_name, dir_start, 8);
+        file_name[8] = '\0';
 
-        memcpy(&file_size, (p + (512*sector + 32*entry) + 28), 4);
+        memcpy(&file_size, (dir_start + 28), 4);
         diskInfo.used_space = diskInfo.used_space + file_size;
 
-        memcpy(&flc, (p + (512*sector + 32*entry) + 26), 2);
+        flc = get_entry_flc(dir_start);
 
         if(!(0x04 & file_attributes)){
             if(0x08 & file_attributes){
@@ -228,11 +473,20 @@ void read_file_info(char *p, uint16_t sector, uint16_t entry){
             }
             if(0x10 & file_attributes){
                 // loop through this sub directory (use FAT and flc)
-                traverse_sub_directory(p, flc);
+                int path_len = strlen(fragInfo.path);
+                if(path_len + 9 < sizeof(fragInfo.path)){
+                    strcat(fragInfo.path, "/");
+                    strncat(fragInfo.path, file_name, strcspn(file_name, " "));
+                }
+                traverse_sub_directory(p, flc, 1);
+                fragInfo.path[path_len] = '\0';
 
             }
             if(!(0x10 & file_attributes) && !(0x08 & file_attributes)){
                 diskInfo.file_count++;
+                if(frag_report){
+                    record_file_extents(dir_start, count_extents(flc));
+                }
             }
         }
     }
@@ -250,27 +504,76 @@ void read_file_info(char *p, uint16_t sector, uint16_t entry){
 *
 */
 void get_disk_info(char *p){
-    uint16_t reserved_sectors;
-    uint16_t max_root_dir_entries;
-    uint16_t bytes_per_sector;
-    uint16_t root_dir_entries;
-    uint16_t sector_count;
-    
-    memcpy(&root_dir_entries, (p + 17), 2);
-    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
-    memcpy(&diskInfo.sector_per_fat, (p + 22), 2);
+    get_geometry(p);
     memcpy(diskInfo.os_name, (p + 3), 8);
-    diskInfo.os_name[9] = '\0';
-    memcpy(&reserved_sectors, (p + 14), 2);
-    memcpy(&sector_count, (p + 19), 2);
-    memcpy(&bytes_per_sector, (p + 11), 2);
+    diskInfo.os_name[8] = '\0';
 
-    uint16_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + reserved_sectors;
-    uint16_t root_dir_ends = root_dir_start + (root_dir_entries / 16);
-    diskInfo.total_space = bytes_per_sector * sector_count;
+    uint32_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
+    uint32_t root_dir_ends = root_dir_start + diskInfo.root_dir_sectors;
+    diskInfo.total_space = (long long)diskInfo.bytes_per_sector * diskInfo.sector_count;
 
-    traverse(p, root_dir_start, root_dir_ends, 0);
+    if(frag_report){
+        decode_fat(p);
+    }
+    if(diskInfo.fat_type == 32){
+        traverse_sub_directory(p, diskInfo.root_cluster, 0);
+    }else{
+        traverse(p, root_dir_start, root_dir_ends, 0);
+    }
    
     diskInfo.free_space = diskInfo.total_space - diskInfo.used_space;
 
 }
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input: 
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+    }
+}
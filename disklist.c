@@ -1,7 +1,7 @@
 /*
 *   Author: Jonathan Cote V00962634
 *   Title: A3 CSC 360
-*   Purpose: Display file structure of MSDOS FAT12 Image.
+*   Purpose: Display file structure of MSDOS FAT12/FAT16/FAT32 Image.
 */
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,13 +14,25 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
 struct diskInfo{
     uint8_t num_of_fats;
     uint8_t sectors_per_cluster;
-    uint16_t sector_per_fat;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
     uint16_t reserved_sectors;
     uint16_t root_dir_entries;
     uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    size_t fat_start;
 }diskInfo;
 
 struct fileInfo{
@@ -28,9 +40,62 @@ struct fileInfo{
     char file_name[9];
     int file_size;
     char time[20];
-    char date[5];
+    char date[11];
 }fileInfo;
 
+// sidecar index header, followed by the decoded FAT (uint32 entries), the directory sector
+// list, the directory table and the listing entries
+struct indexHeader{
+    char magic[8];
+    int64_t image_mtime;
+    int64_t image_size;
+    uint32_t checksum;
+    uint32_t cluster_count;
+    uint32_t dir_sector_count;
+    uint32_t dir_count;
+    uint32_t entry_count;
+    uint32_t used_space;
+};
+
+struct indexDir{
+    uint32_t name_hash;
+    int32_t flc;
+    char path[256];
+};
+
+// one listing line, file_type 'H' marks a directory header
+struct indexEntry{
+    char file_type;
+    char file_name[9];
+    char date[11];
+    char time[6];
+    uint32_t file_size;
+    uint32_t name_hash;
+    int32_t dir;
+};
+
+struct indexBuild{
+    uint32_t *dir_sectors;
+    int dir_sector_count;
+    struct indexEntry *entries;
+    int entry_count;
+    int curr_dir;
+    uint32_t used_space;
+}indexBuild;
+
+// copy-on-write overlay written by diskput -d, see diskput.c
+struct deltaHeader{
+    char magic[8];
+    int64_t base_size;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t base_checksum;  // first FAT and root directory of the base image, see checksum_base()
+    uint32_t reserved;
+};
+
+int use_index = 0;
+char *delta_name = NULL;
+
 
 struct subDir{
     char *path;
@@ -65,39 +130,76 @@ struct subDir* mem_alloc(struct subDir *dir, int size){
 }
 
 
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir);
-void traverse_sub_directory(char *p, uint16_t flc);
-void read_file_info(char *p, uint16_t sector, uint16_t entry);
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir);
+void traverse_sub_directory(char *p, uint32_t flc, int sub_dir);
+void read_file_info(char *p, uint32_t sector, uint16_t entry);
 void get_disk_info(char *p);
-unsigned int get_fat_entry(char *p, uint16_t flc);
-uint16_t calc_data_loc(char *p, uint16_t flc);
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
 void subdir_traversal_controller(char *p);
 void print_info();
 void build_dir_path(char *dir_name);
 void date_time(char *dir_start);
+void print_header();
+void record_entry(char file_type);
+uint32_t hash_string(const char *str);
+uint32_t checksum_image(char *p, uint32_t *dir_sectors, int dir_sector_count);
+int print_from_index(char *p, char *index_name, struct stat *sb);
+void save_index(char *p, char *index_name, struct stat *sb);
+void apply_delta(char *p, size_t image_size);
+uint32_t checksum_base(char *p, size_t image_size);
 
 
 // Code referenced from mmap_test.c provided in tutorials
 int main(int argc, char *argv[]){
 	int fd;
 	struct stat sb;
+    char index_name[4096];
+
+    int bad_args = (argc < 2);
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-i") == 0){
+            use_index = 1;
+        }else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc){
+            delta_name = argv[++i];
+        }else{
+            bad_args = 1;
+        }
+    }
 
     // open file and get file stats
-    if(argc != 2){
-        printf("Input format: ./diskinfo {image file}\n");
+    if(bad_args){
+        printf("Input format: ./disklist {image file} [-i] [-d {delta file}]\n");
     }else{
         fd = open(argv[1], O_RDWR); // add error msg for if file does not exist
         fstat(fd, &sb);
 
-        // Make pointer to start of image
-        char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // Make pointer to start of image, a delta is laid over a private copy
+        char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, delta_name ? MAP_PRIVATE : MAP_SHARED, fd, 0);
         if (p == MAP_FAILED) {
             printf("Error: failed to map memory\n");
             exit(1);
         }
+        if(delta_name){
+            // the index describes the base image, not the overlay
+            use_index = 0;
+            apply_delta(p, sb.st_size);
+        }
+
+        snprintf(index_name, sizeof(index_name), "%s.idx", argv[1]);
+        if(use_index && print_from_index(p, index_name, &sb)){
+            close(fd);
+            return 0;
+        }
 
         get_disk_info(p);
 
+        if(use_index){
+            save_index(p, index_name, &sb);
+        }
+
         // save changes to image and close
         //munmap(p, sb.st_size);
         close(fd);
@@ -117,26 +219,78 @@ int main(int argc, char *argv[]){
 *
 */
 void get_disk_info(char *p){
-    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
-    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
-    memcpy(&diskInfo.sector_per_fat, (p + 22), 2);
-    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
-    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
-    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    get_geometry(p);
 
-    uint16_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
-    uint16_t root_dir_ends = root_dir_start + (diskInfo.root_dir_entries / 16);
+    uint32_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
+    uint32_t root_dir_ends = root_dir_start + diskInfo.root_dir_sectors;
 
-    currDir.dir_name = malloc(sizeof(char));
+    currDir.dir_name = malloc(sizeof(char)*3);
     strcpy(currDir.dir_name, "./");
     currDir.flag = 0;
-    traverse(p, root_dir_start, root_dir_ends, 0);
+    if(diskInfo.fat_type == 32){
+        traverse_sub_directory(p, diskInfo.root_cluster, 0);
+    }else{
+        traverse(p, root_dir_start, root_dir_ends, 0);
+    }
 
    
     subdir_traversal_controller(p);
 }
 
 
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input: 
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+    }
+}
+
+
 /*
 * Function: print_info()
 * =================================
@@ -146,70 +300,100 @@ void get_disk_info(char *p){
 void print_info(){
     if(currDir.flag == 0){ // this can be moved elsewhere so we only need 1 header print (improve modularity)
         currDir.flag = 1;
-        printf("\n%s\n", currDir.dir_name);
-        printf("====================================================\n");
+        print_header();
     }
     printf("%c %10u %20s %s %s\n", fileInfo.file_type, fileInfo.file_size, fileInfo.file_name, fileInfo.date, fileInfo.time);
+    if(use_index){
+        record_entry(fileInfo.file_type);
+    }
 }
 
 
 /*
-* Function: traverse(char *p, uint16_t start, uint16_t ends, int sub_dir)
+* Function: print_header()
 * =================================
-* Purpose: traverse a directory
+* Purpose: print the header of the current directory
+*
+*/
+void print_header(){
+    printf("\n%s\n", currDir.dir_name);
+    printf("====================================================\n");
+    if(use_index){
+        record_entry('H');
+    }
+}
+
+
+/*
+* Function: traverse(char *p, uint32_t start, uint32_t ends, int sub_dir)
+* =================================
+* Purpose: traverse a directory, bytes_per_sector / 32 entries per sector
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t start: location to start the traversal
-*   uint16_t ends: location traversal ends
-*   int sub_dir: flag for controlling subdir traversal differences
+*   uint32_t start: location to start the traversal
+*   uint32_t ends: location traversal ends
+*   int sub_dir: 1 for the first cluster of a sub directory (skips . and ..)
+*
+* Return:
+*   int: 1 when the end of directory entry was reached
 *
 */
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir){
-    uint8_t entry_free = 0x01; // Just a inital value so while loop enters
-    int i = start;
-
-    while(i < ends && entry_free != 0x00){
-        for(int k = 0; k < 16; k++){
-            if(sub_dir != 1 || k > 1){
-                memcpy(&entry_free , (p + 512*i + 32*k), 1);
-                if(entry_free == 0x00){
-                    if((k < 3 && sub_dir == 1) || k == 0){
-                        printf("\n%s\n", currDir.dir_name);
-                        printf("====================================================\n");
-                    }
-                    break;
-                }
-                if(entry_free != 0xE5){
-                    read_file_info(p, i, k);
-                }
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir){
+    uint8_t entry_free;
+    uint32_t entries_per_sector = diskInfo.bytes_per_sector / 32;
+    uint32_t entry_count = (ends - start) * entries_per_sector;
+    char *dir_start = p + (size_t)start * diskInfo.bytes_per_sector;
+
+    for(uint32_t k = (sub_dir == 1) ? 2 : 0; k < entry_count; k++){
+        memcpy(&entry_free, (dir_start + (size_t)32*k), 1);
+        if(entry_free == 0x00){
+            // a directory with nothing to list still gets its header
+            if(currDir.flag == 0){
+                currDir.flag = 1;
+                print_header();
             }
+            return 1;
+        }
+        if(entry_free != 0xE5){
+            read_file_info(p, start + k / entries_per_sector, k % entries_per_sector);
         }
-        i++;
     }
+    return 0;
 }
 
 
 /*
-* Function: traverse_sub_directory(char *p, uint16_t flc)
+* Function: traverse_sub_directory(char *p, uint32_t flc, int sub_dir)
 * =================================
-* Purpose: set needed data for sub dir traversal
+* Purpose: set needed data for sub dir traversal, also used for the FAT32 root chain
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster of directory start
+*   uint32_t flc: first logical cluster of directory start
+*   int sub_dir: 1 for a sub directory, 0 for the FAT32 root (no . and .. entries)
 *
 */
-void traverse_sub_directory(char *p, uint16_t flc){
-    uint16_t data_loc;
-    uint16_t cluster_ends;
+void traverse_sub_directory(char *p, uint32_t flc, int sub_dir){
+    uint32_t data_loc;
+    uint32_t cluster_ends;
+    uint32_t steps = 0;
     
-    // get sector data starts
-    while(flc != 0xFFF){
+    // get sector data starts, the step limit keeps a cyclic chain from looping forever
+    while(flc >= 2 && flc < diskInfo.eoc_min && steps++ < diskInfo.cluster_count){
         data_loc = calc_data_loc(p, flc);
         cluster_ends = data_loc + diskInfo.sectors_per_cluster;
 
-        traverse(p, data_loc, cluster_ends, 1);
+        if(use_index){
+            for(uint32_t s = data_loc; s < cluster_ends; s++){
+                indexBuild.dir_sectors = realloc(indexBuild.dir_sectors, sizeof(uint32_t)*(indexBuild.dir_sector_count+1));
+                indexBuild.dir_sectors[indexBuild.dir_sector_count++] = s;
+            }
+        }
+        if(traverse(p, data_loc, cluster_ends, sub_dir)){
+            break;
+        }
+        sub_dir = 0; // only the first cluster holds . and ..
 
         // check FAT for next cluster
         flc = get_fat_entry(p, flc);
@@ -229,48 +413,55 @@ void traverse_sub_directory(char *p, uint16_t flc){
 void subdir_traversal_controller(char *p){
     // travel the sub directories
     for(int i = 0; i < sub_dir_count; i++){
-        currDir.dir_name = realloc(currDir.dir_name, (sizeof(char)*strlen(sub_dir_list[i].path)));
+        currDir.dir_name = realloc(currDir.dir_name, (sizeof(char)*(strlen(sub_dir_list[i].path)+1)));
         strcpy(currDir.dir_name, sub_dir_list[i].path);
         currDir.flag = 0;
-        traverse_sub_directory(p, sub_dir_list[i].flc);
+        indexBuild.curr_dir = i + 1;
+        traverse_sub_directory(p, sub_dir_list[i].flc, 1);
     }
 }
 
 
 /*
-* Function: calc_data_loc(char *p, uint16_t flc)
+* Function: calc_data_loc(char *p, uint32_t flc)
 * =================================
 * Purpose: calculate the data location for a given flc
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-uint16_t calc_data_loc(char *p, uint16_t flc){
-    uint8_t data_region_start;
-    uint16_t data_loc;
-
-    data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + (diskInfo.root_dir_entries / 16) + diskInfo.reserved_sectors;
-    data_loc = ((flc - 2) * diskInfo.sectors_per_cluster) + data_region_start;
-    
-    return data_loc;
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
 }
 
 
 /*
-* Function: get_fat_entry(char *p, uint16_t flc)
+* Function: get_fat_entry(char *p, uint32_t flc)
 * =================================
-* Purpose: get the entry value at a FAT location
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-unsigned int get_fat_entry(char *p, uint16_t flc){
-    int ent_offset = (flc * 3) / 2;
-    unsigned short entry = *(unsigned short*)(p + 512 + ent_offset);
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
     
     if(flc % 2 == 1){
         entry >>= 4;
@@ -283,33 +474,55 @@ unsigned int get_fat_entry(char *p, uint16_t flc){
 
 
 /*
-* Function: read_file_info(char *p, uint16_t sector, uint16_t entry)
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input: 
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: read_file_info(char *p, uint32_t sector, uint16_t entry)
 * =================================
 * Purpose: read the file meta data from directory entry
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t sector: FAT12 sector
+*   uint32_t sector: image sector
 *   uint16_t entry: entry in the sector
 *
 */
-void read_file_info(char *p, uint16_t sector, uint16_t entry){
+void read_file_info(char *p, uint32_t sector, uint16_t entry){
+    char *dir_start = p + ((size_t)diskInfo.bytes_per_sector*sector + 32*entry);
     uint8_t file_attributes;
-    uint16_t flc;
-    uint32_t file_size;
+    uint32_t flc;
     char file_name[9];
     //int dir = 0;
 
-    memcpy(&file_attributes, (p + (512*sector + 32*entry) + 11), 1);
+    memcpy(&file_attributes, (dir_start + 11), 1);
 
     if(file_attributes != 0x0F && !(0x04 & file_attributes)){
-        memcpy(file_name, (p + (512*sector + 32*entry)), 8);
-        file_name[9] = '\0';
+        memcpy(file_name, dir_start, 8);
+        file_name[8] = '\0';
         strcpy(fileInfo.file_name, file_name);
 
-        memcpy(&fileInfo.file_size, (p + (512*sector + 32*entry) + 28), 4);
+        memcpy(&fileInfo.file_size, (dir_start + 28), 4);
+        indexBuild.used_space = indexBuild.used_space + fileInfo.file_size;
 
-        memcpy(&flc, (p + (512*sector + 32*entry) + 26), 2);
+        flc = get_entry_flc(dir_start);
 
         if(0x10 & file_attributes){
             if(flc > 1){
@@ -326,7 +539,7 @@ void read_file_info(char *p, uint16_t sector, uint16_t entry){
         }
         else if(!(0x08 & file_attributes)){
             fileInfo.file_type = 'F';
-            date_time(p + (512*sector + 32*entry));
+            date_time(dir_start);
             print_info();
         }
     }
@@ -346,7 +559,7 @@ void build_dir_path(char *dir_name){
     int p_path_len = strlen(currDir.dir_name);
     int c_path_len = strlen(dir_name);
     int total_len = p_path_len + c_path_len;
-    char *path = malloc(sizeof(char)*total_len);
+    char *path = malloc(sizeof(char)*(total_len+2));
 
     strcpy(path, currDir.dir_name);
     if(strcmp(currDir.dir_name, "./") != 0){
@@ -354,15 +567,17 @@ void build_dir_path(char *dir_name){
     }
     strcat(path, dir_name);
 
-    sub_dir_list[sub_dir_count].path = malloc(sizeof(char));
-    int size = 1;
-    for(int i = 0; i <= total_len; i++){
+    // drop the space padding of the 8.3 name
+    sub_dir_list[sub_dir_count].path = malloc(sizeof(char)*(total_len+2));
+    int size = 0;
+    for(int i = 0; path[i] != '\0'; i++){
         if(isspace(path[i]) == 0){
-            sub_dir_list[sub_dir_count].path[i] = path[i];
-            sub_dir_list[sub_dir_count].path = realloc(sub_dir_list[sub_dir_count].path, (sizeof(char))*size+1);
+            sub_dir_list[sub_dir_count].path[size] = path[i];
             size++;
         }
     }
+    sub_dir_list[sub_dir_count].path[size] = '\0';
+    free(path);
 }
 
 
@@ -390,4 +605,306 @@ void date_time(char *dir_start){
 
     sprintf(fileInfo.date, "%d-%02d-%02d", year, month, day);
     sprintf(fileInfo.time, "%02d:%02d", hours, minutes);
-}
\ No newline at end of file
+}
+
+
+/*
+* Function: record_entry(char file_type)
+* =================================
+* Purpose: keep a printed line (or header) for the sidecar index
+*
+* Input:
+*   char file_type: 'F', 'D' or 'H' for a directory header
+*
+*/
+void record_entry(char file_type){
+    struct indexEntry *entry;
+
+    indexBuild.entries = realloc(indexBuild.entries, sizeof(struct indexEntry)*(indexBuild.entry_count+1));
+    entry = &indexBuild.entries[indexBuild.entry_count++];
+    memset(entry, 0, sizeof(struct indexEntry));
+
+    entry->file_type = file_type;
+    entry->dir = indexBuild.curr_dir;
+    if(file_type != 'H'){
+        strcpy(entry->file_name, fileInfo.file_name);
+        strncpy(entry->date, fileInfo.date, sizeof(entry->date) - 1);
+        strncpy(entry->time, fileInfo.time, sizeof(entry->time) - 1);
+        entry->file_size = fileInfo.file_size;
+        entry->name_hash = hash_string(fileInfo.file_name);
+    }
+}
+
+
+/*
+* Function: hash_string(const char *str)
+* =================================
+* Purpose: 32 bit FNV-1a hash of a name or path
+*
+* Input:
+*   const char* str: string to hash
+*
+*/
+uint32_t hash_string(const char *str){
+    uint32_t hash = 2166136261u;
+    while(*str){
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+
+/*
+* Function: checksum_image(char *p, uint32_t *dir_sectors, int dir_sector_count)
+* =================================
+* Purpose: checksum the first FAT, the root directory and the listed sub directory
+*          sectors, 8 bytes at a time
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t* dir_sectors: sub directory sectors
+*   int dir_sector_count: number of sub directory sectors
+*
+*/
+uint32_t checksum_image(char *p, uint32_t *dir_sectors, int dir_sector_count){
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+    size_t sector_bytes = diskInfo.bytes_per_sector;
+    size_t root_dir_start = ((size_t)diskInfo.num_of_fats * diskInfo.sector_per_fat + diskInfo.reserved_sectors) * sector_bytes;
+    size_t root_dir_ends = root_dir_start + (size_t)diskInfo.root_dir_sectors * sector_bytes;
+
+    for(size_t i = 0; i < (size_t)diskInfo.sector_per_fat * sector_bytes; i += 8){
+        memcpy(&word, p + diskInfo.fat_start + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i < root_dir_ends; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(int s = 0; s < dir_sector_count; s++){
+        for(size_t i = 0; i < sector_bytes; i += 8){
+            memcpy(&word, p + (size_t)dir_sectors[s]*sector_bytes + i, 8);
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+/*
+* Function: print_from_index(char *p, char *index_name, struct stat *sb)
+* =================================
+* Purpose: map the sidecar index and print the listing from it if it still
+*          matches the image
+*
+* Input:
+*   char* p: image data pointer
+*   char* index_name: path of the index file
+*   struct stat* sb: stats of the image
+*
+* Return:
+*   int: 1 if the listing was printed from the index, 0 if the image has to be walked
+*
+*/
+int print_from_index(char *p, char *index_name, struct stat *sb){
+    struct stat isb;
+    struct indexHeader *header;
+    int fd = open(index_name, O_RDONLY);
+
+    if(fd < 0){
+        return 0;
+    }
+    fstat(fd, &isb);
+    if(isb.st_size < sizeof(struct indexHeader)){
+        close(fd);
+        return 0;
+    }
+
+    char *ip = mmap(NULL, isb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ip == MAP_FAILED){
+        return 0;
+    }
+
+    header = (struct indexHeader *)ip;
+    uint32_t *dir_sectors = (uint32_t *)(ip + sizeof(struct indexHeader) + sizeof(uint32_t)*header->cluster_count);
+    struct indexDir *dirs = (struct indexDir *)(dir_sectors + header->dir_sector_count);
+    struct indexEntry *entries = (struct indexEntry *)(dirs + header->dir_count);
+
+    get_geometry(p);
+
+    if(memcmp(header->magic, "FATIDX2", 8) != 0
+        || header->image_mtime != sb->st_mtime
+        || header->image_size != sb->st_size
+        || (char *)(entries + header->entry_count) != ip + isb.st_size){
+        munmap(ip, isb.st_size);
+        return 0;
+    }
+    for(int s = 0; s < header->dir_sector_count; s++){
+        if(((size_t)dir_sectors[s] + 1) * diskInfo.bytes_per_sector > sb->st_size){
+            munmap(ip, isb.st_size);
+            return 0;
+        }
+    }
+    if(checksum_image(p, dir_sectors, header->dir_sector_count) != header->checksum){
+        munmap(ip, isb.st_size);
+        return 0;
+    }
+
+    for(int i = 0; i < header->entry_count; i++){
+        if(entries[i].file_type == 'H'){
+            printf("\n%s\n", dirs[entries[i].dir].path);
+            printf("====================================================\n");
+        }else{
+            printf("%c %10u %20s %s %s\n", entries[i].file_type, entries[i].file_size, entries[i].file_name,
+                entries[i].date, entries[i].time);
+        }
+    }
+    munmap(ip, isb.st_size);
+    return 1;
+}
+
+
+/*
+* Function: save_index(char *p, char *index_name, struct stat *sb)
+* =================================
+* Purpose: write the sidecar index collected during the traversal
+*
+* Input:
+*   char* p: image data pointer
+*   char* index_name: path of the index file
+*   struct stat* sb: stats of the image
+*
+*/
+void save_index(char *p, char *index_name, struct stat *sb){
+    struct indexHeader header;
+    struct indexDir dir;
+    uint32_t fat_entry;
+    char temp_name[4200];
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FATIDX2", 8);
+    header.image_mtime = sb->st_mtime;
+    header.image_size = sb->st_size;
+    header.checksum = checksum_image(p, indexBuild.dir_sectors, indexBuild.dir_sector_count);
+    header.cluster_count = diskInfo.cluster_count;
+    header.dir_sector_count = indexBuild.dir_sector_count;
+    header.dir_count = sub_dir_count + 1;
+    header.entry_count = indexBuild.entry_count;
+    header.used_space = indexBuild.used_space;
+
+    // write to a temp file and rename so readers never map a half written index
+    snprintf(temp_name, sizeof(temp_name), "%s.tmp", index_name);
+    FILE *fptr = fopen(temp_name, "w");
+    if(fptr == NULL){
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, fptr);
+    for(int i = 0; i < header.cluster_count; i++){
+        fat_entry = get_fat_entry(p, i);
+        fwrite(&fat_entry, sizeof(uint32_t), 1, fptr);
+    }
+    fwrite(indexBuild.dir_sectors, sizeof(uint32_t), indexBuild.dir_sector_count, fptr);
+
+    memset(&dir, 0, sizeof(dir));
+    strcpy(dir.path, "./");
+    dir.name_hash = hash_string(dir.path);
+    dir.flc = 0;
+    fwrite(&dir, sizeof(dir), 1, fptr);
+    for(int i = 0; i < sub_dir_count; i++){
+        memset(&dir, 0, sizeof(dir));
+        strncpy(dir.path, sub_dir_list[i].path, sizeof(dir.path) - 1);
+        dir.name_hash = hash_string(dir.path);
+        dir.flc = sub_dir_list[i].flc;
+        fwrite(&dir, sizeof(dir), 1, fptr);
+    }
+    fwrite(indexBuild.entries, sizeof(struct indexEntry), indexBuild.entry_count, fptr);
+    fclose(fptr);
+    rename(temp_name, index_name);
+}
+
+
+/*
+* Function: apply_delta(char *p, size_t image_size)
+* =================================
+* Purpose: copy the sectors of a delta file over the private image mapping
+*
+* Input:
+*   char* p: image data pointer (MAP_PRIVATE)
+*   size_t image_size: size of the base image
+*
+*/
+void apply_delta(char *p, size_t image_size){
+    struct deltaHeader header;
+    FILE *delta = fopen(delta_name, "r");
+
+    if(delta == NULL){
+        return;
+    }
+    if(fread(&header, sizeof(header), 1, delta) != 1 || memcmp(header.magic, "FATDLT2", 8) != 0
+        || header.base_size != (int64_t)image_size || header.sector_size == 0
+        || header.base_checksum != checksum_base(p, image_size)){
+        printf("Error: %s is not a delta of this image\n", delta_name);
+        exit(1);
+    }
+
+    uint32_t *sector_list = malloc(sizeof(uint32_t)*(header.sector_count + 1));
+    if(fread(sector_list, sizeof(uint32_t), header.sector_count, delta) != header.sector_count){
+        printf("Error: %s is truncated\n", delta_name);
+        exit(1);
+    }
+    for(uint32_t i = 0; i < header.sector_count; i++){
+        size_t offset = (size_t)sector_list[i] * header.sector_size;
+        if(offset + header.sector_size > image_size || fread(p + offset, header.sector_size, 1, delta) != 1){
+            printf("Error: %s is truncated\n", delta_name);
+            exit(1);
+        }
+    }
+    free(sector_list);
+    fclose(delta);
+}
+
+
+/*
+* Function: checksum_base(char *p, size_t image_size)
+* =================================
+* Purpose: checksum the first FAT and root directory of the base image, 8 bytes at a
+*          time, so a delta is only laid over the base it was made from
+*
+* Input:
+*   char* p: base image data pointer, before any delta is laid over it
+*   size_t image_size: size of the base image
+*
+*/
+uint32_t checksum_base(char *p, size_t image_size){
+    uint16_t bytes_per_sector, reserved_sectors, root_dir_entries, sector_per_fat16;
+    uint8_t num_of_fats;
+    uint32_t sector_per_fat;
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+
+    memcpy(&bytes_per_sector, (p + 11), 2);
+    memcpy(&reserved_sectors, (p + 14), 2);
+    memcpy(&num_of_fats, (p + 16), 1);
+    memcpy(&root_dir_entries, (p + 17), 2);
+    memcpy(&sector_per_fat16, (p + 22), 2);
+    sector_per_fat = sector_per_fat16;
+    if(sector_per_fat == 0){
+        memcpy(&sector_per_fat, (p + 36), 4);
+    }
+
+    size_t fat_start = (size_t)reserved_sectors * bytes_per_sector;
+    size_t fat_ends = fat_start + (size_t)sector_per_fat * bytes_per_sector;
+    size_t root_dir_start = fat_start + (size_t)num_of_fats * sector_per_fat * bytes_per_sector;
+    size_t root_dir_ends = root_dir_start + (size_t)root_dir_entries * 32;
+
+    for(size_t i = fat_start; i + 8 <= fat_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i + 8 <= root_dir_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
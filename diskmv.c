@@ -0,0 +1,774 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Move or rename a file or directory inside a FAT12, FAT16 or FAT32 image without copying its data
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define NO_DIR 0xFFFFFFFF
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// change journal {image}.jnl, see diskput.c for the record layout
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+struct journalInfo{
+    struct journalRecord *records;
+    int count;
+}journalInfo;
+
+int use_journal = 0;
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc);
+size_t fat_entry_offset(uint32_t cluster);
+uint32_t get_entry_flc(char *entry);
+void set_entry_flc(char *entry, uint32_t flc);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+char* cluster_ptr(char *p, uint32_t cluster);
+char* scan_directory(char *p, uint32_t dir_flc, char *short_name, char **first_entry);
+char* extend_directory(char *p, uint32_t dir_flc);
+char* resolve_path(char *p, char *path, uint32_t *parent_flc, char *last_name);
+int make_short_name(char *name, char *short_name);
+int is_inside(char *p, uint32_t dir_flc, uint32_t ancestor_flc);
+void sync_fat_copies(char *p);
+int update_fsinfo(char *p);
+void journal_add(char kind, uint32_t value);
+void journal_write(char *image_name);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+    uint32_t src_parent, dst_parent;
+    char src_name[13], dst_name[13];
+    char short_name[11];
+    char *src_first;
+
+    if(argc == 5 && strcmp(argv[4], "-j") == 0){
+        use_journal = 1;
+        argc--;
+    }
+    if(argc != 4){
+        printf("Input format: ./diskmv {image file} {image path} {new image path} [-j]\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+
+    char *src = resolve_path(p, argv[2], &src_parent, src_name);
+    if(src == NULL){
+        printf("%s: no such file or directory\n", argv[2]);
+        exit(1);
+    }
+    scan_directory(p, src_parent, src, &src_first);
+
+    // an existing directory (or just /) as destination keeps the name, otherwise the last component is the new name
+    char *dst = resolve_path(p, argv[3], &dst_parent, dst_name);
+    if(argv[3][strspn(argv[3], "/.")] == '\0'){
+        dst_parent = 0;
+        strcpy(dst_name, src_name);
+        make_short_name(dst_name, short_name);
+        dst = scan_directory(p, dst_parent, short_name, NULL);
+    }else if(dst != NULL && (dst[11] & 0x10)){
+        dst_parent = get_entry_flc(dst);
+        strcpy(dst_name, src_name);
+        make_short_name(dst_name, short_name);
+        dst = scan_directory(p, dst_parent, short_name, NULL);
+    }else if(dst_parent == NO_DIR){
+        printf("%s: destination directory not found\n", argv[3]);
+        exit(1);
+    }
+    if(dst != NULL){
+        printf("%s: destination already exists\n", argv[3]);
+        exit(1);
+    }
+    if(make_short_name(dst_name, short_name) != 0){
+        printf("%s: not a valid 8.3 name\n", dst_name);
+        exit(1);
+    }
+
+    uint32_t src_flc = get_entry_flc(src);
+    int is_dir = src[11] & 0x10;
+    if(is_dir && is_inside(p, dst_parent, src_flc)){
+        printf("Cannot move a directory into itself\n");
+        exit(1);
+    }
+
+    // 1 write the new entry, a crash after this leaves the file visible twice but never lost.
+    // Only the fixed FAT12/16 root can not grow
+    char *slot = scan_directory(p, dst_parent, NULL, NULL);
+    if(slot == NULL && (dst_parent != 0 || diskInfo.fat_type == 32)){
+        slot = extend_directory(p, dst_parent);
+    }
+    if(slot == NULL){
+        printf("Directory full\n");
+        exit(1);
+    }
+    memcpy(slot, src, 32);
+    memcpy(slot, short_name, 11);
+    journal_add('E', (slot - p) / 32);
+    journal_write(argv[1]);
+    msync(p, sb.st_size, MS_SYNC);
+
+    // 2 delete the old entry and the long name entries in front of it
+    src[0] = (char)0xE5;
+    journal_add('E', (src - p) / 32);
+    for(char *lfn = src - 32; lfn >= src_first && lfn[11] == 0x0F && (uint8_t)lfn[0] != 0xE5; lfn -= 32){
+        lfn[0] = (char)0xE5;
+        journal_add('E', (lfn - p) / 32);
+    }
+
+    // 3 a moved directory points its .. entry at the new parent
+    if(is_dir && src_parent != dst_parent){
+        char *dot_dot = cluster_ptr(p, src_flc) + 32;
+        set_entry_flc(dot_dot, dst_parent);
+        journal_add('E', (dot_dot - p) / 32);
+    }
+
+    journal_write(argv[1]);
+    msync(p, sb.st_size, MS_SYNC);
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: scan_directory(char *p, uint32_t dir_flc, char *short_name, char **first_entry)
+* =================================
+* Purpose: find an entry in a directory by its 8.3 name, or the first free entry
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* short_name: 11 byte name to look for, NULL for a free entry. A pointer into
+*                     the image is also accepted, it then matches that entry itself
+*   char** first_entry: set to the first entry of the cluster the result is in, may be NULL
+*
+* Return:
+*   char*: the entry, NULL if there is none
+*
+*/
+char* scan_directory(char *p, uint32_t dir_flc, char *short_name, char **first_entry){
+    int entries_per_cluster = diskInfo.cluster_bytes / 32;
+    // the FAT32 root is a cluster chain like any sub directory
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    char *start;
+    int entry_count;
+
+    for(int steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(cluster == 0){
+            start = p + (diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            start = cluster_ptr(p, cluster);
+            entry_count = entries_per_cluster;
+        }
+        if(first_entry != NULL){
+            *first_entry = start;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+
+            if(short_name == NULL){
+                if(first == 0x00 || first == 0xE5){
+                    return entry_start;
+                }
+                continue;
+            }
+            if(first == 0x00){
+                return NULL;
+            }
+            if(entry_start == short_name){
+                return entry_start;
+            }
+            if(first != 0xE5 && entry_start[11] != 0x0F && !(entry_start[11] & 0x08) && memcmp(entry_start, short_name, 11) == 0){
+                return entry_start;
+            }
+        }
+
+        if(cluster == 0){
+            return NULL;
+        }
+        cluster = get_fat_entry(p, cluster);
+        if(cluster < 2 || cluster >= diskInfo.cluster_count){
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Function: extend_directory(char *p, uint32_t dir_flc)
+* =================================
+* Purpose: add a zeroed cluster to the end of a full sub directory or FAT32 root
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for the FAT32 root
+*
+* Return:
+*   char*: the first entry of the new cluster, NULL if the disk is full
+*
+*/
+char* extend_directory(char *p, uint32_t dir_flc){
+    uint32_t tail = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    int free_cluster = -1;
+
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        if(get_fat_entry(p, c) == 0x000){
+            free_cluster = c;
+            break;
+        }
+    }
+    if(free_cluster == -1){
+        return NULL;
+    }
+
+    for(int steps = 0; steps < diskInfo.cluster_count; steps++){
+        uint32_t next = get_fat_entry(p, tail);
+        if(next < 2 || next >= diskInfo.cluster_count){
+            break;
+        }
+        tail = next;
+    }
+
+    memset(cluster_ptr(p, free_cluster), 0, diskInfo.cluster_bytes);
+    journal_add('C', free_cluster);
+    set_next_fat_entry(p, free_cluster, diskInfo.eoc);
+    set_next_fat_entry(p, tail, free_cluster);
+    sync_fat_copies(p);
+    int fsinfo_sector = update_fsinfo(p);
+    if(fsinfo_sector != 0){
+        journal_add('S', fsinfo_sector);
+    }
+    return cluster_ptr(p, free_cluster);
+}
+
+
+/*
+* Function: resolve_path(char *p, char *path, uint32_t *parent_flc, char *last_name)
+* =================================
+* Purpose: look up an image path one component at a time
+*
+* Input:
+*   char* p: image data pointer
+*   char* path: path such as /SUB1/FILE.TXT, case does not matter
+*   uint32_t* parent_flc: set to the directory holding the last component, NO_DIR if a
+*                         directory on the way does not exist
+*   char* last_name: set to the upper case last component, at least 13 bytes
+*
+* Return:
+*   char*: the entry of the last component, NULL if it does not exist
+*
+*/
+char* resolve_path(char *p, char *path, uint32_t *parent_flc, char *last_name){
+    char *copy = strdup(path);
+    char *parts[64];
+    int part_count = 0;
+    char short_name[11];
+    char *entry = NULL;
+    uint32_t dir_flc = 0;
+
+    for(char *part = strtok(copy, "/"); part != NULL && part_count < 64; part = strtok(NULL, "/")){
+        if(strcmp(part, ".") != 0){
+            parts[part_count++] = part;
+        }
+    }
+
+    *parent_flc = NO_DIR;
+    last_name[0] = '\0';
+    if(part_count == 0){
+        free(copy);
+        return NULL;
+    }
+
+    for(int i = 0; i < part_count; i++){
+        for(int k = 0; parts[i][k] != '\0'; k++){
+            parts[i][k] = toupper((unsigned char)parts[i][k]);
+        }
+        if(i == part_count - 1){
+            *parent_flc = dir_flc;
+            snprintf(last_name, 13, "%s", parts[i]);
+        }
+        if(make_short_name(parts[i], short_name) != 0){
+            entry = NULL;
+            break;
+        }
+        entry = scan_directory(p, dir_flc, short_name, NULL);
+        if(i == part_count - 1 || entry == NULL){
+            break;
+        }
+        if(!(entry[11] & 0x10)){
+            entry = NULL;
+            break;
+        }
+        dir_flc = get_entry_flc(entry);
+    }
+    free(copy);
+    return entry;
+}
+
+
+/*
+* Function: make_short_name(char *name, char *short_name)
+* =================================
+* Purpose: build the space padded 8.3 form of a NAME.EXT string
+*
+* Input:
+*   char* name: upper case name
+*   char* short_name: 11 byte output, not null terminated
+*
+* Return:
+*   int: 0 on success, -1 if the name does not fit 8.3
+*
+*/
+int make_short_name(char *name, char *short_name){
+    char *ext = strrchr(name, '.');
+    int name_len = ext ? (int)(ext - name) : (int)strlen(name);
+    int ext_len = ext ? (int)strlen(ext + 1) : 0;
+
+    if(name_len == 0 || name_len > 8 || ext_len > 3){
+        return -1;
+    }
+    memset(short_name, ' ', 11);
+    memcpy(short_name, name, name_len);
+    if(ext != NULL){
+        memcpy(short_name + 8, ext + 1, ext_len);
+    }
+    return 0;
+}
+
+
+/*
+* Function: is_inside(char *p, uint32_t dir_flc, uint32_t ancestor_flc)
+* =================================
+* Purpose: check if a directory is ancestor_flc or below it by following .. entries up to root
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   uint32_t ancestor_flc: first logical cluster of the possible ancestor
+*
+*/
+int is_inside(char *p, uint32_t dir_flc, uint32_t ancestor_flc){
+    for(int steps = 0; dir_flc != 0 && steps < diskInfo.cluster_count; steps++){
+        if(dir_flc == ancestor_flc){
+            return 1;
+        }
+        dir_flc = get_entry_flc(cluster_ptr(p, dir_flc) + 32);
+    }
+    return 0;
+}
+
+
+/*
+* Function: sync_fat_copies(char *p)
+* =================================
+* Purpose: copy the first FAT over every other FAT copy
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void sync_fat_copies(char *p){
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * diskInfo.bytes_per_sector;
+    char *fat_start = p + diskInfo.fat_start;
+
+    for(int i = 1; i < diskInfo.num_of_fats; i++){
+        memcpy(fat_start + i*fat_bytes, fat_start, fat_bytes);
+    }
+}
+
+
+/*
+* Function: cluster_ptr(char *p, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(char *p, uint32_t cluster){
+    return p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: set_entry_flc(char *entry, uint32_t flc)
+* =================================
+* Purpose: store the first cluster in a directory entry (high 16 bits only on FAT32)
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*   uint32_t flc: first logical cluster
+*
+*/
+void set_entry_flc(char *entry, uint32_t flc){
+    uint16_t low = flc & 0xFFFF;
+    uint16_t high = flc >> 16;
+
+    memcpy((entry + 26), &low, 2);
+    if(diskInfo.fat_type == 32){
+        memcpy((entry + 20), &high, 2);
+    }
+}
+
+
+/*
+* Function: set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc)
+* =================================
+* Purpose: set the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: location of entry
+*   uint32_t next_flc: entry to be put into FAT
+*
+*/
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc){
+    char *fat = p + diskInfo.fat_start;
+    size_t ent_offset = fat_entry_offset(flc);
+    uint8_t first, second;
+
+    if(diskInfo.fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+        return;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
+        first = (uint8_t)(0xff & next_flc);
+        second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
+
+    }else{
+        first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
+        second = (uint8_t)(0xff & (next_flc >> 4));
+    }
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
+    journal_add('F', ent_offset / diskInfo.bytes_per_sector);
+    journal_add('F', (ent_offset + 1) / diskInfo.bytes_per_sector);
+}
+
+
+/*
+* Function: update_fsinfo(char *p)
+* =================================
+* Purpose: store the free cluster count of the decoded FAT in the FAT32 FSInfo sector
+*          and drop its next free hint
+*
+* Input:
+*   char* p: image data pointer
+*
+* Return:
+*   int: the FSInfo sector, 0 when the image has none
+*
+*/
+int update_fsinfo(char *p){
+    uint16_t fsinfo_sector;
+    uint32_t signature;
+    uint32_t free_count = 0;
+    uint32_t next_free = 0xFFFFFFFF;
+
+    if(diskInfo.fat_type != 32){
+        return 0;
+    }
+    memcpy(&fsinfo_sector, (p + 48), 2);
+    if(fsinfo_sector == 0 || fsinfo_sector >= diskInfo.reserved_sectors){
+        return 0;
+    }
+    char *fsinfo = p + (size_t)fsinfo_sector * diskInfo.bytes_per_sector;
+    memcpy(&signature, fsinfo, 4);
+    if(signature != 0x41615252){
+        return 0;
+    }
+
+    for(uint32_t c = 2; c < diskInfo.cluster_count; c++){
+        if(get_fat_entry(p, c) == 0){
+            free_count++;
+        }
+    }
+    memcpy((fsinfo + 488), &free_count, 4);
+    memcpy((fsinfo + 492), &next_free, 4);
+    return fsinfo_sector;
+}
+
+
+/*
+* Function: journal_add(char kind, uint32_t value)
+* =================================
+* Purpose: remember one changed cluster ('C'), FAT sector ('F') or directory entry ('E')
+*          for the change journal, nothing is kept without -j
+*
+* Input:
+*   char kind: record kind
+*   uint32_t value: cluster, sector of the first FAT or entry offset / 32
+*
+*/
+void journal_add(char kind, uint32_t value){
+    if(!use_journal){
+        return;
+    }
+    if(journalInfo.count > 0 && journalInfo.records[journalInfo.count-1].kind == kind
+        && journalInfo.records[journalInfo.count-1].value == value){
+        return;
+    }
+    journalInfo.records = realloc(journalInfo.records, sizeof(struct journalRecord)*(journalInfo.count + 1));
+    memset(&journalInfo.records[journalInfo.count], 0, sizeof(struct journalRecord));
+    journalInfo.records[journalInfo.count].kind = kind;
+    journalInfo.records[journalInfo.count].value = value;
+    journalInfo.count++;
+}
+
+
+/*
+* Function: journal_write(char *image_name)
+* =================================
+* Purpose: append the remembered records to {image}.jnl and fsync it, called before
+*          the image is synced so after a crash the journal can only list too much
+*
+* Input:
+*   char* image_name: image file name
+*
+*/
+void journal_write(char *image_name){
+    char journal_name[4096];
+
+    if(journalInfo.count == 0){
+        return;
+    }
+    snprintf(journal_name, sizeof(journal_name), "%s.jnl", image_name);
+    FILE *journal = fopen(journal_name, "a");
+    if(journal == NULL){
+        printf("Error: failed to open %s\n", journal_name);
+        exit(1);
+    }
+    if(ftell(journal) == 0){
+        fwrite("FATJNL1", 8, 1, journal);
+    }
+    fwrite(journalInfo.records, sizeof(struct journalRecord), journalInfo.count, journal);
+    if(fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+        printf("Error: failed to write %s\n", journal_name);
+        exit(1);
+    }
+    fclose(journal);
+    journalInfo.count = 0;
+}
@@ -0,0 +1,675 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Find which files of a FAT12, FAT16 or FAT32 image own a cluster or a range of sectors
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// one directory entry that owns clusters, entry 0 stands for the root directory
+// (entry 1 too on FAT32, it owns the root's cluster chain)
+struct ownerEntry{
+    char path[256];
+    uint64_t entry_offset;   // byte offset of the directory entry in the image
+    uint32_t file_size;
+    uint8_t file_attributes;
+};
+
+// header of the persisted map, followed by the owner array and the entry table
+struct ownerHeader{
+    char magic[8];
+    int64_t image_mtime;
+    int64_t image_mtime_nsec;   // whole seconds miss a rewrite within the same second
+    int64_t image_size;
+    uint32_t cluster_count;
+    uint32_t entry_count;
+};
+
+struct ownerMap{
+    uint32_t *owner;         // cluster -> index into entry_list, 0 when free or unowned
+    struct ownerEntry *entry_list;
+    int entry_count;
+    char path[256];
+}ownerMap;
+
+struct ownerEntry* mem_alloc(struct ownerEntry *entries, int size){
+    struct ownerEntry *temp = NULL;
+    if(entries == NULL){
+        temp = (struct ownerEntry *) malloc(sizeof(struct ownerEntry)*size);
+        return temp;
+    }
+    else{
+        temp = (struct ownerEntry *)realloc(entries, sizeof(struct ownerEntry)*size);
+
+        if(temp != NULL){
+            return temp;
+        }
+        else{
+            printf("realloc failed");
+            exit(1);
+        }
+    }
+}
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+size_t fat_entry_offset(uint32_t cluster);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+char* cluster_ptr(char *p, uint32_t cluster);
+void build_owner_map(char *p);
+void map_directory(char *p, uint32_t dir_flc);
+void map_entry(char *p, char *entry_start);
+int load_owner_map(char *map_name, struct stat *sb);
+void save_owner_map(char *map_name, struct stat *sb);
+void print_cluster_owner(uint32_t cluster);
+void print_sector_owners(uint32_t first, uint32_t last);
+int parse_number(char *arg, unsigned long limit, unsigned long *value);
+void entry_path(char *entry_start, char *path_out);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+    int persist = 0;
+    int args = argc;
+    char map_name[4096];
+
+    if(argc > 1 && strcmp(argv[argc-1], "-w") == 0){
+        persist = 1;
+        args--;
+    }
+    if(!(args == 3 || (args == 5 && strcmp(argv[2], "-s") == 0))){
+        printf("Input format: ./diskowner {image file} {cluster} [-w]\n");
+        printf("              ./diskowner {image file} -s {first sector} {last sector} [-w]\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+
+    // a bad number is refused here, atoi() would quietly turn it into 0 or wrap it
+    unsigned long first = 0;
+    unsigned long last = 0;
+    if(args == 3){
+        if(!parse_number(argv[2], diskInfo.cluster_count - 1, &first) || first < 2){
+            printf("Error: cluster must be between 2 and %u\n", diskInfo.cluster_count - 1);
+            exit(1);
+        }
+    }else{
+        if(!parse_number(argv[3], diskInfo.sector_count - 1, &first)
+            || !parse_number(argv[4], diskInfo.sector_count - 1, &last) || first > last){
+            printf("Error: sector range must be within 0 and %u\n", diskInfo.sector_count - 1);
+            exit(1);
+        }
+    }
+
+    snprintf(map_name, sizeof(map_name), "%s.own", argv[1]);
+    if(!load_owner_map(map_name, &sb)){
+        build_owner_map(p);
+        if(persist){
+            save_owner_map(map_name, &sb);
+        }
+    }
+
+    if(args == 3){
+        print_cluster_owner(first);
+    }else{
+        print_sector_owners(first, last);
+    }
+
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: build_owner_map(char *p)
+* =================================
+* Purpose: fill the cluster -> entry map with one traversal of the directory tree
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void build_owner_map(char *p){
+    ownerMap.owner = calloc(diskInfo.cluster_count, sizeof(uint32_t));
+    ownerMap.entry_list = mem_alloc(ownerMap.entry_list, 2);
+
+    strcpy(ownerMap.entry_list[0].path, "/");
+    ownerMap.entry_list[0].entry_offset = 0;
+    ownerMap.entry_list[0].file_size = 0;
+    ownerMap.entry_list[0].file_attributes = 0x10;
+    ownerMap.entry_count = 1;
+
+    if(diskInfo.fat_type != 32){
+        map_directory(p, 0);
+        return;
+    }
+
+    // index 0 means no owner, so the FAT32 root chain is owned by a second root entry
+    ownerMap.entry_list[1] = ownerMap.entry_list[0];
+    ownerMap.entry_count = 2;
+    uint32_t cluster = diskInfo.root_cluster;
+    while(cluster >= 2 && cluster < diskInfo.cluster_count && ownerMap.owner[cluster] == 0){
+        ownerMap.owner[cluster] = 1;
+        cluster = get_fat_entry(p, cluster);
+    }
+    map_directory(p, diskInfo.root_cluster);
+}
+
+
+/*
+* Function: map_directory(char *p, uint32_t dir_flc)
+* =================================
+* Purpose: map every entry of a directory, recursing into sub directories
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for the FAT12/16 root
+*
+*/
+void map_directory(char *p, uint32_t dir_flc){
+    char *entry_start;
+    int entries_per_cluster = diskInfo.cluster_bytes / 32;
+
+    if(dir_flc == 0){
+        char *root = p + (size_t)(diskInfo.data_region_start - diskInfo.root_dir_sectors) * diskInfo.bytes_per_sector;
+        for(int k = 0; k < diskInfo.root_dir_entries; k++){
+            entry_start = root + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                break;
+            }
+            map_entry(p, entry_start);
+        }
+        return;
+    }
+
+    // the step limit keeps a cyclic directory chain from looping forever
+    uint32_t cluster = dir_flc;
+    int steps = 0;
+    while(cluster >= 2 && cluster < diskInfo.cluster_count && steps++ < diskInfo.cluster_count){
+        for(int k = 0; k < entries_per_cluster; k++){
+            entry_start = cluster_ptr(p, cluster) + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                return;
+            }
+            map_entry(p, entry_start);
+        }
+        cluster = get_fat_entry(p, cluster);
+    }
+}
+
+
+/*
+* Function: map_entry(char *p, char *entry_start)
+* =================================
+* Purpose: add one entry to the table and mark the clusters of its chain.
+*          A cluster that is already owned ends the walk, so cross links keep
+*          their first owner and cycles terminate. A directory is only walked
+*          when this entry claimed its first cluster, so a directory loop ends too.
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the directory entry
+*
+*/
+void map_entry(char *p, char *entry_start){
+    uint8_t file_attributes;
+    uint32_t flc;
+    uint32_t cluster;
+    uint32_t index;
+    int path_len;
+    int claimed;
+
+    memcpy(&file_attributes, (entry_start + 11), 1);
+    flc = get_entry_flc(entry_start);
+
+    if((uint8_t)entry_start[0] == 0xE5 || entry_start[0] == '.' || file_attributes == 0x0F || (0x08 & file_attributes)){
+        return;
+    }
+
+    index = ownerMap.entry_count;
+    ownerMap.entry_list = mem_alloc(ownerMap.entry_list, ownerMap.entry_count+1);
+    entry_path(entry_start, ownerMap.entry_list[index].path);
+    ownerMap.entry_list[index].entry_offset = entry_start - p;
+    memcpy(&ownerMap.entry_list[index].file_size, (entry_start + 28), 4);
+    ownerMap.entry_list[index].file_attributes = file_attributes;
+    ownerMap.entry_count++;
+
+    claimed = (flc >= 2 && flc < diskInfo.cluster_count && ownerMap.owner[flc] == 0);
+    cluster = flc;
+    while(cluster >= 2 && cluster < diskInfo.cluster_count && ownerMap.owner[cluster] == 0){
+        ownerMap.owner[cluster] = index;
+        cluster = get_fat_entry(p, cluster);
+    }
+
+    if((0x10 & file_attributes) && claimed){
+        path_len = strlen(ownerMap.path);
+        strcpy(ownerMap.path, ownerMap.entry_list[index].path);
+        map_directory(p, flc);
+        ownerMap.path[path_len] = '\0';
+    }
+}
+
+
+/*
+* Function: load_owner_map(char *map_name, struct stat *sb)
+* =================================
+* Purpose: load a persisted map if it was written for this exact image
+*
+* Input:
+*   char* map_name: path of the map file
+*   struct stat* sb: stats of the image
+*
+* Return:
+*   int: 1 if the map was loaded, 0 if it has to be rebuilt
+*
+*/
+int load_owner_map(char *map_name, struct stat *sb){
+    struct ownerHeader header;
+    FILE *fptr = fopen(map_name, "r");
+
+    if(fptr == NULL){
+        return 0;
+    }
+    if(fread(&header, sizeof(header), 1, fptr) != 1
+        || memcmp(header.magic, "FATOWN3", 8) != 0
+        || header.image_mtime != sb->st_mtim.tv_sec
+        || header.image_mtime_nsec != sb->st_mtim.tv_nsec
+        || header.image_size != sb->st_size
+        || header.cluster_count != diskInfo.cluster_count){
+        fclose(fptr);
+        return 0;
+    }
+
+    ownerMap.owner = malloc(sizeof(uint32_t)*header.cluster_count);
+    ownerMap.entry_list = mem_alloc(NULL, header.entry_count);
+    ownerMap.entry_count = header.entry_count;
+    if(fread(ownerMap.owner, sizeof(uint32_t), header.cluster_count, fptr) != header.cluster_count
+        || fread(ownerMap.entry_list, sizeof(struct ownerEntry), header.entry_count, fptr) != header.entry_count){
+        free(ownerMap.owner);
+        free(ownerMap.entry_list);
+        ownerMap.entry_list = NULL;
+        fclose(fptr);
+        return 0;
+    }
+    fclose(fptr);
+    return 1;
+}
+
+
+/*
+* Function: save_owner_map(char *map_name, struct stat *sb)
+* =================================
+* Purpose: persist the map next to the image
+*
+* Input:
+*   char* map_name: path of the map file
+*   struct stat* sb: stats of the image
+*
+*/
+void save_owner_map(char *map_name, struct stat *sb){
+    struct ownerHeader header;
+    FILE *fptr = fopen(map_name, "w");
+
+    if(fptr == NULL){
+        printf("Error: failed to write %s\n", map_name);
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FATOWN3", 8);
+    header.image_mtime = sb->st_mtim.tv_sec;
+    header.image_mtime_nsec = sb->st_mtim.tv_nsec;
+    header.image_size = sb->st_size;
+    header.cluster_count = diskInfo.cluster_count;
+    header.entry_count = ownerMap.entry_count;
+
+    fwrite(&header, sizeof(header), 1, fptr);
+    fwrite(ownerMap.owner, sizeof(uint32_t), diskInfo.cluster_count, fptr);
+    fwrite(ownerMap.entry_list, sizeof(struct ownerEntry), ownerMap.entry_count, fptr);
+    fclose(fptr);
+}
+
+
+/*
+* Function: parse_number(char *arg, unsigned long limit, unsigned long *value)
+* =================================
+* Purpose: parse a decimal argument that must not exceed limit
+*
+* Input:
+*   char* arg: argument text
+*   unsigned long limit: largest accepted value
+*   unsigned long* value: parsed value
+*
+* Return:
+*   int: 1 if arg is a whole number within the limit, 0 otherwise
+*
+*/
+int parse_number(char *arg, unsigned long limit, unsigned long *value){
+    char *end;
+
+    if(arg[0] < '0' || arg[0] > '9'){
+        return 0;
+    }
+    errno = 0;
+    *value = strtoul(arg, &end, 10);
+    return errno == 0 && *end == '\0' && *value <= limit;
+}
+
+
+/*
+* Function: print_cluster_owner(uint32_t cluster)
+* =================================
+* Purpose: print the owner of one cluster
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+void print_cluster_owner(uint32_t cluster){
+    if(cluster < 2 || cluster >= diskInfo.cluster_count){
+        printf("Cluster %u is outside the data region\n", cluster);
+        return;
+    }
+    if(ownerMap.owner[cluster] == 0){
+        printf("Cluster %u: no owner\n", cluster);
+        return;
+    }
+
+    struct ownerEntry *entry = &ownerMap.entry_list[ownerMap.owner[cluster]];
+    printf("Cluster %u: %c %s (entry at byte %llu)\n", cluster,
+        (0x10 & entry->file_attributes) ? 'D' : 'F', entry->path, (unsigned long long)entry->entry_offset);
+}
+
+
+/*
+* Function: print_sector_owners(uint32_t first, uint32_t last)
+* =================================
+* Purpose: print each file owning a sector in the range once, in order of first hit
+*
+* Input:
+*   uint32_t first: first sector of the range
+*   uint32_t last: last sector of the range (inclusive)
+*
+*/
+void print_sector_owners(uint32_t first, uint32_t last){
+    uint8_t *seen = calloc(ownerMap.entry_count, 1);
+    uint32_t root_dir_start = diskInfo.data_region_start - diskInfo.root_dir_sectors;
+    int boot_seen = 0;
+    int fat_seen = 0;
+
+    for(uint32_t s = first; s <= last && s < diskInfo.sector_count; s++){
+        if(s < diskInfo.reserved_sectors){
+            if(!boot_seen){
+                boot_seen = 1;
+                printf("Sector %u: boot sector\n", s);
+            }
+            continue;
+        }
+        if(s < root_dir_start){
+            if(!fat_seen){
+                fat_seen = 1;
+                printf("Sector %u: FAT\n", s);
+            }
+            continue;
+        }
+        if(s < diskInfo.data_region_start){
+            if(!seen[0]){
+                seen[0] = 1;
+                printf("Sector %u: D /\n", s);
+            }
+            continue;
+        }
+
+        uint32_t cluster = ((s - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+        if(cluster >= diskInfo.cluster_count){
+            break;
+        }
+        uint32_t index = ownerMap.owner[cluster];
+        if(index != 0 && !seen[index]){
+            seen[index] = 1;
+            printf("Sector %u: %c %s\n", s, (0x10 & ownerMap.entry_list[index].file_attributes) ? 'D' : 'F',
+                ownerMap.entry_list[index].path);
+        }
+    }
+    free(seen);
+}
+
+
+/*
+* Function: entry_path(char *entry_start, char *path_out)
+* =================================
+* Purpose: build the full path of an entry in the directory being mapped
+*
+* Input:
+*   char* entry_start: start location of the directory entry
+*   char* path_out: output string location
+*
+*/
+void entry_path(char *entry_start, char *path_out){
+    int len;
+
+    strcpy(path_out, ownerMap.path);
+    strcat(path_out, "/");
+    len = strlen(path_out);
+    for(int i = 0; i < 8 && entry_start[i] != ' ' && len < 250; i++){
+        path_out[len++] = entry_start[i];
+    }
+    if(entry_start[8] != ' '){
+        path_out[len++] = '.';
+    }
+    for(int i = 8; i < 11 && entry_start[i] != ' ' && len < 254; i++){
+        path_out[len++] = entry_start[i];
+    }
+    path_out[len] = '\0';
+}
+
+
+/*
+* Function: cluster_ptr(char *p, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(char *p, uint32_t cluster){
+    return p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
@@ -16,17 +16,29 @@
 #include <linux/limits.h>
 #include <time.h>
 
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
 struct diskInfo{
     uint8_t num_of_fats;
     uint8_t sectors_per_cluster;
-    uint16_t sector_per_fat;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
     uint16_t reserved_sectors;
     uint16_t root_dir_entries;
     uint16_t bytes_per_sector;
-    uint16_t sector_count;
-    int used_space;
-    int total_space;
-    int free_space;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    long long used_space;
+    long long total_space;
+    long long free_space;
 }diskInfo;
 
 struct fileInfo{
@@ -42,17 +54,104 @@ struct fileInfo{
 struct subDir{
     char *path;
     int flc;
+    uint32_t name_hash;
 };
 
 struct currDir{
     char *dir_name;
 }currDir;
 
+// sidecar index written by disklist -i, see disklist.c for the layout
+struct indexHeader{
+    char magic[8];
+    int64_t image_mtime;
+    int64_t image_size;
+    uint32_t checksum;
+    uint32_t cluster_count;
+    uint32_t dir_sector_count;
+    uint32_t dir_count;
+    uint32_t entry_count;
+    uint32_t used_space;
+};
+
+struct indexDir{
+    uint32_t name_hash;
+    int32_t flc;
+    char path[256];
+};
+
+#define PUT_NEW 0
+#define PUT_APPEND 1
+#define PUT_OVERWRITE 2
+
+#define TXN_DATA 0
+#define TXN_FAT 1
+#define TXN_DIR 2
+
+// a dirty byte range of the image
+struct writeRange{
+    size_t start;
+    size_t len;
+};
+
+// a directory entry that is only written to the image on commit
+struct pendingEntry{
+    size_t offset;
+    char entry[32];
+};
+
+// write transaction shared by every put of one run. File data goes straight
+// into free clusters, FAT changes stay in the decoded table and directory
+// entries stay pending until txn_commit() flushes them in that order.
+struct transaction{
+    struct writeRange *ranges[3];
+    int range_count[3];
+    struct pendingEntry *entries;
+    int entry_count;
+    uint32_t *fat_table;
+    uint8_t *fat_dirty;
+    int cluster_count;
+    int free_clusters;
+}txn;
+
+// copy-on-write overlay: header, sorted uint32 sector numbers, then the sector data
+struct deltaHeader{
+    char magic[8];
+    int64_t base_size;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t base_checksum;  // first FAT and root directory of the base image, see checksum_base()
+    uint32_t reserved;
+};
+
+// with -d the base image is mapped privately and changed sectors go to the delta file
+struct overlay{
+    char *name;
+    uint8_t *sectors;        // one bit per image sector held by the delta
+    int total_sectors;
+    uint32_t base_checksum;
+}overlay;
+
+// change journal {image}.jnl: an 8 byte magic, then records of what a run is about to write.
+// 'C' data cluster, 'F' sector index inside the FAT (every copy), 'E' 32 byte entry (byte offset / 32),
+// 'S' any other image sector (the FAT32 FSInfo sector)
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+int use_journal = 0;
+char journal_name[4096];
+
 struct subDir *sub_dir_list = NULL;
 int sub_dir_count = 0;
 int insert_dir = -1;
 FILE* fptr;
-char *buffer;
+int use_index = 0;
+int put_mode = PUT_NEW;
+char index_name[4096];
+struct stat image_stat;
 
 struct subDir* mem_alloc(struct subDir *dir, int size){
     struct subDir *temp = NULL;
@@ -74,99 +173,208 @@ struct subDir* mem_alloc(struct subDir *dir, int size){
 }
 
 
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir);
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir);
+void traverse_sub_directory(char *p, uint32_t flc, int sub_dir);
 void subdir_traversal_controller(char *p);
-void read_file_info(char *p, uint16_t sector, uint16_t entry);
+void read_file_info(char *p, uint32_t sector, uint16_t entry);
 void get_disk_info(char *p);
-unsigned int get_fat_entry(char *p, uint16_t flc);
-uint16_t calc_data_loc(char *p, uint16_t flc);
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+void set_entry_flc(char *entry, uint32_t flc);
+size_t fat_entry_offset(uint32_t cluster);
+uint32_t calc_data_loc(char *p, uint32_t flc);
 void build_dir_path(char *dir_name);
 void split_input_name(char *input);
 void convert_to_upper(char *str);
 void get_string(char *start, int byte_len, char *string_out);
 void put_file(char* p);
 int find_open_fat(char *p, int flc);
-int find_open_dir(char *p, int start, int end, int sub_dir);
-void insert_file_info(char *p, int offset);
-void split_name_ext(char *name_ext, char *name, char *ext);
+long long find_open_dir(char *p, uint32_t start, uint32_t end, int sub_dir, char *short_name);
+long long find_dir_entry(char *p, char *short_name);
+long long extend_dir(char *p, int clusters);
+void insert_file_info(char *p, size_t offset);
+void build_short_name(char *short_name);
+void update_file(char *p, size_t offset);
 void get_file_mod_time();
-int insert_file_data(char *p, int data_loc, int data_len, int data_inserted);
-void set_next_fat_entry(char *p, uint16_t flc, uint16_t next_flc);
-void read_file();
+int insert_file_data(char *p, size_t data_loc, int data_len, int cluster_len);
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc);
+void prepare_file(char *input);
+int find_insert_dir();
+void decode_fat(char *p);
+void set_fat(uint32_t cluster, uint32_t value);
+void txn_mark(int kind, size_t start, size_t len);
+void txn_stage_entry(size_t offset, char *entry);
+char *txn_staged_entry(size_t offset);
+void txn_sync(char *p, int kind);
+void txn_commit(char *p, int fd);
+void mirror_fat(char *p);
+int compare_ranges(const void *a, const void *b);
+uint32_t hash_string(const char *str);
+uint32_t checksum_image(char *p, uint32_t *dir_sectors, int dir_sector_count);
+int load_index(char *p);
+void load_delta(char *p, size_t image_size);
+void journal_changes(char *p);
+void update_fsinfo(char *p);
+void save_delta(char *p, size_t image_size);
+uint32_t checksum_base(char *p, size_t image_size);
 
 
 // Code referenced from mmap_test.c provided in tutorials
 int main(int argc, char *argv[]){
 	int fd;
 	struct stat sb;
+    int put_count = 0;
+
+    // every argument after the image that is not an option is a file to put
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-i") == 0){
+            use_index = 1;
+        }else if(strcmp(argv[i], "-a") == 0){
+            put_mode = PUT_APPEND;
+        }else if(strcmp(argv[i], "-o") == 0){
+            put_mode = PUT_OVERWRITE;
+        }else if(strcmp(argv[i], "-j") == 0){
+            use_journal = 1;
+        }else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc){
+            overlay.name = argv[++i];
+        }else{
+            put_count++;
+        }
+    }
 
     // open file and get file stats
-    if(argc != 3){
-        printf("Input format: ./diskput {image file} {file path}\n");
+    if(argc < 3 || put_count == 0){
+        printf("Input format: ./diskput {image file} {file path} [file path ...] [-i] [-a | -o] [-d {delta file}] [-j]\n");
     }else{
-        fd = open(argv[1], O_RDWR); // add error msg for if file does not exist
-        fstat(fd, &sb);
-
-        char *temp = malloc(sizeof(char)*strlen(argv[2]));
-        strcpy(temp, argv[2]);
-
-        split_input_name(temp);
-
-        free(temp);
-
-        fptr = fopen(fileInfo.file_name, "r");
-        if(fptr == NULL){
-            printf("file not found\n");
+        snprintf(index_name, sizeof(index_name), "%s.idx", argv[1]);
+        snprintf(journal_name, sizeof(journal_name), "%s.jnl", argv[1]);
+        fd = open(argv[1], overlay.name ? O_RDONLY : O_RDWR);
+        if(fd < 0){
+            printf("Error: failed to open image\n");
             exit(1);
         }
+        fstat(fd, &sb);
+        image_stat = sb;
 
-        get_file_mod_time();
-
-        convert_to_upper(fileInfo.file_name);
-        convert_to_upper(fileInfo.file_dir);
-
-        // save file size
-        fseek(fptr, 0L, SEEK_END);
-        fileInfo.size = ftell(fptr);
-        rewind(fptr);
-
-        // get file mod time
-
-        // Make pointer to start of image
-        char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // Make pointer to start of image, private when writes go to a delta file
+        char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, overlay.name ? MAP_PRIVATE : MAP_SHARED, fd, 0);
         if (p == MAP_FAILED) {
             printf("Error: failed to map memory\n");
             exit(1);
         }
+        if(overlay.name){
+            load_delta(p, sb.st_size);
+        }
 
         get_disk_info(p);
-
-        if(insert_dir == -1 && strcmp(fileInfo.file_dir, "./") != 0){
-            printf("Directory not found\n");
-            exit(1);
-        }
-        
-        // check if enough space on disc for the file else exit with error
-        diskInfo.free_space = diskInfo.total_space - diskInfo.used_space;
-        if(diskInfo.free_space < fileInfo.size){
-            printf("Insufficient space on disk\n");
-            exit(1);
+        if(txn.fat_table == NULL){
+            decode_fat(p);
         }
 
-        read_file();
+        // a failed put exits before txn_commit(), so none of the batch becomes visible
+        for(int i = 2; i < argc; i++){
+            if(strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-j") == 0){
+                continue;
+            }
+            if(strcmp(argv[i], "-d") == 0){
+                i++;
+                continue;
+            }
+            prepare_file(argv[i]);
+
+            insert_dir = find_insert_dir();
+            if(insert_dir == -1 && strcmp(fileInfo.file_dir, "./") != 0){
+                printf("Directory not found\n");
+                exit(1);
+            }
 
+            // -a and -o change a file that already exists, otherwise a new entry is made
+            long long entry = -1;
+            if(put_mode != PUT_NEW){
+                char short_name[11];
+                build_short_name(short_name);
+                entry = find_dir_entry(p, short_name);
+            }
+            if(entry != -1){
+                update_file(p, entry);
+            }else{
+                put_file(p);
+            }
+            fclose(fptr);
+        }
 
-        put_file(p);
+        txn_commit(p, fd);
+        if(overlay.name){
+            save_delta(p, sb.st_size);
+        }
 
         // save changes to image and close
-        //munmap(p, sb.st_size);
-        fclose(fptr);
+        munmap(p, sb.st_size);
         close(fd);
     }
 	
 	return 0;
 }
 
+
+/*
+* Function: prepare_file(char *input)
+* =================================
+* Purpose: open the local file named by one input path and collect its size and mod time
+*
+* Input:
+*   char* input: {image path}/{file name} as given on the command line
+*
+*/
+void prepare_file(char *input){
+    char *temp = malloc(sizeof(char)*(strlen(input)+1));
+    strcpy(temp, input);
+
+    free(fileInfo.file_name);
+    free(fileInfo.file_dir);
+    split_input_name(temp);
+
+    free(temp);
+
+    fptr = fopen(fileInfo.file_name, "r");
+    if(fptr == NULL){
+        printf("file not found\n");
+        exit(1);
+    }
+
+    get_file_mod_time();
+
+    convert_to_upper(fileInfo.file_name);
+    convert_to_upper(fileInfo.file_dir);
+
+    // save file size
+    fseek(fptr, 0L, SEEK_END);
+    fileInfo.size = ftell(fptr);
+    rewind(fptr);
+}
+
+
+/*
+* Function: find_insert_dir()
+* =================================
+* Purpose: look up the sub directory named by fileInfo.file_dir
+*
+* Return:
+*   int: index into sub_dir_list, -1 if it is not a known sub directory
+*
+*/
+int find_insert_dir(){
+    uint32_t dir_hash = hash_string(fileInfo.file_dir);
+
+    for(int i = 0; i < sub_dir_count; i++){
+        if(sub_dir_list[i].name_hash == dir_hash && strcmp(sub_dir_list[i].path, fileInfo.file_dir) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
 /*
 * Function: put_file(char *p)
 * =================================
@@ -177,93 +385,113 @@ int main(int argc, char *argv[]){
 *
 */
 void put_file(char* p){
-   // printf("Dir for file insertion: %s\n", fileInfo.file_dir);
-   // printf("%s\n", sub_dir_list[insert_dir].path);
+    int cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+    int clusters = (fileInfo.size + cluster_bytes - 1) / cluster_bytes;
     int curr_flc = 2;
-    int dir_entry;
-    int data_loc;
+    int prev_flc = 0;
+    long long dir_entry = -1;
     int data_len;
-    int data_inserted;
-    int next_flc;
-    // 1 find open FAT entry, set flc for file as that FAT entry
-    curr_flc = find_open_fat(p, curr_flc);
-
-    // 2 put file info in the directory
-    fileInfo.flc = curr_flc;
+    int data_inserted = 0;
 
-    if(insert_dir == -1){
-        uint16_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
-        uint16_t root_dir_ends = root_dir_start + (diskInfo.root_dir_entries / 16);
-        dir_entry = find_open_dir(p, root_dir_start, root_dir_ends, 0);
-    }else{
-        uint16_t dir_loc = calc_data_loc(p, sub_dir_list[insert_dir].flc);
-        uint16_t cluster_ends = dir_loc + diskInfo.sectors_per_cluster;
-        dir_entry = find_open_dir(p, dir_loc, cluster_ends, 1);
+    if(clusters > txn.free_clusters){
+        printf("Insufficient space on disk\n");
+        exit(1);
     }
 
-    insert_file_info(p, dir_entry);
+    // 1 find an open directory entry, a full sub directory (or FAT32 root) grows by a cluster
+    dir_entry = find_dir_entry(p, NULL);
+    if(dir_entry == -1){
+        dir_entry = extend_dir(p, clusters);
+    }
+    if(dir_entry == -1){
+        printf("Directory full\n");
+        exit(1);
+    }
 
+    // 2 put data in free clusters, linking each one to the previous
+    fileInfo.flc = 0;
     while(data_inserted < fileInfo.size){
-        if(data_inserted + 512 <= fileInfo.size){
-            data_len = 512;
+        curr_flc = find_open_fat(p, curr_flc);
+        if(prev_flc == 0){
+            fileInfo.flc = curr_flc;
         }else{
-            data_len = 512 - fileInfo.size;
+            set_fat(prev_flc, curr_flc);
+        }
+        set_fat(curr_flc, diskInfo.eoc);
+
+        data_len = fileInfo.size - data_inserted;
+        if(data_len > cluster_bytes){
+            data_len = cluster_bytes;
         }
-        // 3 put data in data_section at that flc
-        data_loc = calc_data_loc(p, curr_flc);
-        data_inserted = data_inserted + insert_file_data(p, data_loc*512, data_len, data_inserted);
+        size_t data_loc = (size_t)calc_data_loc(p, curr_flc) * diskInfo.bytes_per_sector;
+        data_inserted = data_inserted + insert_file_data(p, data_loc, data_len, cluster_bytes);
 
-        // 4 find next entry/flc in FAT
-        next_flc = find_open_fat(p, curr_flc+1);
-        set_next_fat_entry(p, curr_flc, next_flc);
-        curr_flc = next_flc;
+        prev_flc = curr_flc;
+        curr_flc++;
     }
-    // 5 repeat step 3 -> 4 tell file data is populated
+
+    // 3 stage the directory entry, it reaches the image on commit
+    insert_file_info(p, dir_entry);
 }
 
 
 /*
-* Function: find_out_fat(char *p, int flc)
+* Function: find_open_fat(char *p, int flc)
 * =================================
-* Purpose: find and open FAT entry
+* Purpose: find an open FAT entry in the decoded FAT
 *
 * Input: 
 *   char* p: image data pointer
 *   int flc: first logical cluster to start looking from
 *
 * Return:
-*   int: location of first open entry in FAT
+*   int: location of first open entry in FAT, -1 if the FAT is full
 *
 */
 int find_open_fat(char *p, int flc){
-    int entry = get_fat_entry(p, flc);
-
-    if(entry == 0){
-        return flc;
-    }else{
-        entry = find_open_fat(p, flc + 1);
+    for(int i = flc; i < txn.cluster_count; i++){
+        if(txn.fat_table[i] == 0x000){
+            return i;
+        }
     }
+    return -1;
 }
 
 
 /*
-* Function: set_next_fat_entry(char *p, uint16_t flc, uint16_t next_flc)
+* Function: set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc)
 * =================================
 * Purpose: set the entry value at a FAT location
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: location of entry
-*   uint16_t next_flc: entry to be put into FAT
+*   uint32_t flc: location of entry
+*   uint32_t next_flc: entry to be put into FAT
 *
 */
-void set_next_fat_entry(char *p, uint16_t flc, uint16_t next_flc){
-    uint32_t ent_offset = (flc * 3) / 2;
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc){
+    char *fat = p + diskInfo.fat_start;
+    size_t ent_offset = fat_entry_offset(flc);
     uint8_t first, second;
-    memcpy(&first, (p + 512 + ent_offset), 1);
-    memcpy(&second, (p + 512 + ent_offset + 1), 1);
 
-    if(flc % 2 == 1){
+    if(diskInfo.fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        return;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
         first = (uint8_t)(0xff & next_flc);
         second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
         
@@ -271,47 +499,40 @@ void set_next_fat_entry(char *p, uint16_t flc, uint16_t next_flc){
         first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
         second = (uint8_t)(0xff & (next_flc >> 4));
     }
-    memcpy((p + 512 + ent_offset), &first, 1);
-    memcpy((p + 512 + ent_offset + 1), &second, 1);
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
 }
 
 
 /*
-* Function: insert_file_data(char *p, int data_loc, int data_len, int data_inserted)
+* Function: insert_file_data(char *p, size_t data_loc, int data_len, int cluster_len)
 * =================================
-* Purpose: insert file data into data sector
+* Purpose: read the next part of the local file straight into a data cluster
 *
 * Input: 
 *   char* p: image data pointer
-*   int data_loc: start location for data entry
+*   size_t data_loc: byte offset of the cluster in the image
 *   int data_len: the amount of data to be entered
-*   int data_inserted: current amount of data already inserted
+*   int cluster_len: size of the cluster, the slack after the data is zeroed
 *
 * Return:
 *   int: the new amount of data inserted this run
 *
 */
-int insert_file_data(char *p, int data_loc, int data_len, int data_inserted){
-    memcpy((p + data_loc), buffer + data_inserted, data_len);
+int insert_file_data(char *p, size_t data_loc, int data_len, int cluster_len){
+    if(fread(p + data_loc, 1, data_len, fptr) != data_len){
+        printf("Error: failed to read %s\n", fileInfo.file_name);
+        exit(1);
+    }
+    memset(p + data_loc + data_len, 0, cluster_len - data_len);
+    txn_mark(TXN_DATA, data_loc, cluster_len);
 
     return data_len;
 }
 
 
 /*
-* Function: read_file()
-* =================================
-* Purpose: read the file data into a buffer
-*
-*/
-void read_file(){
-    buffer = realloc(buffer, fileInfo.size);
-    fread(buffer, 1, fileInfo.size, fptr);
-}
-
-
-/*
-* Function: insert_file_info(char *p, int offset)
+* Function: insert_file_info(char *p, size_t offset)
 * =================================
 * Purpose: insert file meta data into directory entry
 *
@@ -320,38 +541,148 @@ void read_file(){
 *   int offset: start location for directory entry
 *
 */
-void insert_file_info(char *p, int offset){
-    char buff[11];
-    char file_name[8];
-    char file_ext[3];
+void insert_file_info(char *p, size_t offset){
+    char entry[32];
     uint8_t attributes = 0x00;
     uint16_t date = fileInfo.date;
     uint16_t time = fileInfo.time;
-    uint8_t flc = fileInfo.flc;
     uint32_t size = fileInfo.size;
 
-    strcpy(buff, fileInfo.file_name);
+    memset(entry, 0, 32);
+    build_short_name(entry);
 
-    char *token;
-    token = strtok(buff, ".");
-    strcpy(file_name, token);
-    memcpy(p + offset, file_name, 8);
-    
-    token = strtok(NULL, ".");
-    strcpy(file_ext, token);
-    memcpy(p + offset + 8, file_ext, 3);
+    memcpy(entry + 11, &attributes, 1);
+    set_entry_flc(entry, fileInfo.flc);
+    memcpy(entry + 28, &size, 4);
+
+    memcpy(entry + 16, &date, 2);
+    memcpy(entry + 24, &date, 2);
+    memcpy(entry + 22, &time, 2);
+    memcpy(entry + 14, &time, 2);
+
+    txn_stage_entry(offset, entry);
+}
+
+
+/*
+* Function: build_short_name(char *short_name)
+* =================================
+* Purpose: build the space padded 8.3 directory entry name of fileInfo.file_name,
+*          longer parts are cut off
+*
+* Input:
+*   char* short_name: 11 byte output, not null terminated
+*
+*/
+void build_short_name(char *short_name){
+    char *ext = strrchr(fileInfo.file_name, '.');
+    int name_len = ext ? (int)(ext - fileInfo.file_name) : (int)strlen(fileInfo.file_name);
+
+    memset(short_name, ' ', 11);
+    memcpy(short_name, fileInfo.file_name, name_len < 8 ? name_len : 8);
+    if(ext != NULL){
+        int ext_len = strlen(ext + 1);
+        memcpy(short_name + 8, ext + 1, ext_len < 3 ? ext_len : 3);
+    }
+}
+
+
+/*
+* Function: update_file(char *p, size_t offset)
+* =================================
+* Purpose: append to (-a) or overwrite (-o) an existing file in place. Only the
+*          clusters from the write position on are touched: the chain is walked in the
+*          decoded FAT, the slack of the tail cluster is filled, the chain is extended
+*          and with -o any clusters past the new end are freed
+*
+* Input:
+*   char* p: image data pointer
+*   size_t offset: byte offset of the existing directory entry
+*
+*/
+void update_file(char *p, size_t offset){
+    int cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+    char entry[32];
+    char *staged = txn_staged_entry(offset);
+    uint32_t flc;
+    uint32_t old_size;
+    int chain_len = 0;
+
+    memcpy(entry, staged ? staged : p + offset, 32);
+    flc = get_entry_flc(entry);
+    memcpy(&old_size, entry + 28, 4);
+
+    uint32_t pos = (put_mode == PUT_APPEND) ? old_size : 0;
+    uint32_t new_size = pos + fileInfo.size;
+
+    for(uint32_t c = flc; c >= 2 && c < diskInfo.eoc_min && chain_len < txn.cluster_count; c = txn.fat_table[c]){
+        chain_len++;
+    }
+    if((int)((new_size + cluster_bytes - 1) / cluster_bytes) - chain_len > txn.free_clusters){
+        printf("Insufficient space on disk\n");
+        exit(1);
+    }
+
+    // walk to the cluster holding the write position
+    int prev = 0;
+    int curr = flc;
+    for(uint32_t i = 0; i < pos / cluster_bytes && curr >= 2 && curr < diskInfo.eoc_min; i++){
+        prev = curr;
+        curr = txn.fat_table[curr];
+    }
 
-    memcpy(p + offset + 26, &flc, 2);
-    memcpy(p + offset + 28, &size, 4);
+    int cluster_offset = pos % cluster_bytes;
+    int data_inserted = 0;
+    while(data_inserted < fileInfo.size){
+        if(curr < 2 || curr >= diskInfo.eoc_min){
+            curr = find_open_fat(p, prev >= 2 ? prev + 1 : 2);
+            if(curr == -1){
+                curr = find_open_fat(p, 2);
+            }
+            if(prev == 0){
+                flc = curr;
+            }else{
+                set_fat(prev, curr);
+            }
+            set_fat(curr, diskInfo.eoc);
+        }
 
-    // (TODO) figure out date-time
-    memcpy(p + offset + 16, &date, 2);
-    memcpy(p + offset + 24, &date, 2);
-    memcpy(p + offset + 22, &time, 2);
-    memcpy(p + offset + 14, &time, 2);
+        int data_len = fileInfo.size - data_inserted;
+        if(data_len > cluster_bytes - cluster_offset){
+            data_len = cluster_bytes - cluster_offset;
+        }
+        size_t data_loc = (size_t)calc_data_loc(p, curr) * diskInfo.bytes_per_sector + cluster_offset;
+        data_inserted = data_inserted + insert_file_data(p, data_loc, data_len, cluster_bytes - cluster_offset);
 
+        cluster_offset = 0;
+        prev = curr;
+        curr = txn.fat_table[curr];
+    }
 
+    // -o drops whatever is left of the old chain
+    if(put_mode == PUT_OVERWRITE){
+        uint32_t c;
+        if(new_size == 0){
+            c = flc;
+            flc = 0;
+        }else{
+            c = txn.fat_table[prev];
+            set_fat(prev, diskInfo.eoc);
+        }
+        for(int steps = 0; c >= 2 && c < diskInfo.eoc_min && steps < txn.cluster_count; steps++){
+            uint32_t next = txn.fat_table[c];
+            set_fat(c, 0x000);
+            c = next;
+        }
+    }
 
+    uint16_t date = fileInfo.date;
+    uint16_t time = fileInfo.time;
+    set_entry_flc(entry, flc);
+    memcpy(entry + 28, &new_size, 4);
+    memcpy(entry + 22, &time, 2);
+    memcpy(entry + 24, &date, 2);
+    txn_stage_entry(offset, entry);
 }
 
 
@@ -374,8 +705,8 @@ void get_file_mod_time(){
     strcat(path, fileInfo.file_name);
     
     stat(path, &attr);
-    char weekday[3];
-    char month_name[3];
+    char weekday[4];
+    char month_name[4];
     int month;
     int day;
     int year;
@@ -454,36 +785,136 @@ void get_file_mod_time(){
 
 
 /*
-* Function: find_open_dir(char *p, int start, int end, int sub_dir)
+* Function: find_open_dir(char *p, uint32_t start, uint32_t end, int sub_dir, char *short_name)
 * =================================
-* Purpose: find the first open directory entry
+* Purpose: find the first open directory entry, or the file entry with a given name
 *
 * Input: 
 *   char* p: image data pointer
-*   int start: start location for directory
-*   int end: end location for directory
-*   int sub_dir: flag to control slight difference in looping for subdir
+*   uint32_t start: start location for directory
+*   uint32_t end: end location for directory
+*   int sub_dir: 1 for the first cluster of a sub directory (skips . and ..)
+*   char* short_name: 11 byte 8.3 name to look for, NULL for an open entry
+*
+* Return:
+*   long long: byte offset of the entry, -1 if there is none
 *
 */
-int find_open_dir(char *p, int start, int end, int sub_dir){
-    uint8_t entry_free = 0x01; // Just a inital value so while loop enters
-    int i = start;
-
-    while(i < end && entry_free != 0x00){
-        for(int k = 0; k < 16; k++){
-            if(sub_dir != 1 || k > 1){
-                memcpy(&entry_free , (p + 512*i + 32*k), 1);
-                if(entry_free == 0x00){
-                    return 512*i + 32*k;
-                }
+long long find_open_dir(char *p, uint32_t start, uint32_t end, int sub_dir, char *short_name){
+    uint32_t entry_count = (end - start) * (diskInfo.bytes_per_sector / 32);
+    size_t dir_offset = (size_t)start * diskInfo.bytes_per_sector;
+
+    // entries staged by this run are seen as they will be after commit
+    for(uint32_t k = (sub_dir == 1) ? 2 : 0; k < entry_count; k++){
+        size_t offset = dir_offset + (size_t)32*k;
+        char *staged = txn_staged_entry(offset);
+        uint8_t *entry = (uint8_t *)(staged ? staged : p + offset);
+
+        if(short_name == NULL){
+            // deleted (0xE5) entries are reused
+            if(entry[0] == 0x00 || entry[0] == 0xE5){
+                return offset;
+            }
+        }else{
+            if(entry[0] == 0x00){
+                return -1;
+            }
+            if(entry[0] != 0xE5 && entry[11] != 0x0F && !(entry[11] & 0x18) && memcmp(entry, short_name, 11) == 0){
+                return offset;
             }
         }
-        i++;
     }
     return -1;
 }
 
 
+/*
+* Function: find_dir_entry(char *p, char *short_name)
+* =================================
+* Purpose: run find_open_dir over the root or every cluster of the insert sub directory
+*
+* Input:
+*   char* p: image data pointer
+*   char* short_name: 11 byte 8.3 name to look for, NULL for an open entry
+*
+* Return:
+*   long long: byte offset of the entry, -1 if there is none
+*
+*/
+long long find_dir_entry(char *p, char *short_name){
+    long long dir_entry = -1;
+    uint32_t cluster;
+    int sub_dir = 1;
+
+    if(insert_dir == -1){
+        if(diskInfo.fat_type != 32){
+            uint32_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
+            uint32_t root_dir_ends = root_dir_start + diskInfo.root_dir_sectors;
+            return find_open_dir(p, root_dir_start, root_dir_ends, 0, short_name);
+        }
+        // the FAT32 root is a cluster chain without . and .. entries
+        cluster = diskInfo.root_cluster;
+        sub_dir = 0;
+    }else{
+        cluster = sub_dir_list[insert_dir].flc;
+    }
+    for(int steps = 0; dir_entry == -1 && cluster >= 2 && cluster < diskInfo.eoc_min && steps < txn.cluster_count; steps++){
+        uint32_t dir_loc = calc_data_loc(p, cluster);
+        uint32_t cluster_ends = dir_loc + diskInfo.sectors_per_cluster;
+        dir_entry = find_open_dir(p, dir_loc, cluster_ends, sub_dir, short_name);
+        sub_dir = 0;
+        cluster = txn.fat_table[cluster];
+    }
+    return dir_entry;
+}
+
+
+/*
+* Function: extend_dir(char *p, int clusters)
+* =================================
+* Purpose: grow the insert directory by one zeroed cluster linked to its tail. The
+*          cluster is zeroed with the file data and linked with the FAT, so it becomes
+*          part of the directory in the same commit as the entry put into it
+*
+* Input:
+*   char* p: image data pointer
+*   int clusters: clusters the file itself still needs
+*
+* Return:
+*   long long: byte offset of the first entry of the new cluster, -1 for the fixed
+*              FAT12/FAT16 root directory
+*
+*/
+long long extend_dir(char *p, int clusters){
+    uint32_t tail;
+
+    if(insert_dir == -1 && diskInfo.fat_type != 32){
+        return -1;
+    }
+    if(clusters + 1 > txn.free_clusters){
+        printf("Insufficient space on disk\n");
+        exit(1);
+    }
+
+    tail = (insert_dir == -1) ? diskInfo.root_cluster : (uint32_t)sub_dir_list[insert_dir].flc;
+    for(int steps = 0; steps < txn.cluster_count; steps++){
+        uint32_t next = txn.fat_table[tail];
+        if(next < 2 || next >= diskInfo.eoc_min || next >= (uint32_t)txn.cluster_count){
+            break;
+        }
+        tail = next;
+    }
+
+    uint32_t cluster = find_open_fat(p, 2);
+    size_t data_loc = (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+    memset(p + data_loc, 0, (size_t)diskInfo.sectors_per_cluster * diskInfo.bytes_per_sector);
+    txn_mark(TXN_DATA, data_loc, (size_t)diskInfo.sectors_per_cluster * diskInfo.bytes_per_sector);
+    set_fat(cluster, diskInfo.eoc);
+    set_fat(tail, cluster);
+    return data_loc;
+}
+
+
 /*
 * Function: get_disk_info(char *p)
 * =================================
@@ -494,80 +925,144 @@ int find_open_dir(char *p, int start, int end, int sub_dir){
 *
 */
 void get_disk_info(char *p){
-    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
-    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
-    memcpy(&diskInfo.sector_per_fat, (p + 22), 2);
-    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
-    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
-    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
-    memcpy(&diskInfo.sector_count, (p + 19), 2);
+    get_geometry(p);
+
+    diskInfo.total_space = (long long)diskInfo.bytes_per_sector * diskInfo.sector_count;
+    uint32_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
+    uint32_t root_dir_ends = root_dir_start + diskInfo.root_dir_sectors;
 
-    diskInfo.total_space = diskInfo.bytes_per_sector * diskInfo.sector_count;
-    uint16_t root_dir_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors;
-    uint16_t root_dir_ends = root_dir_start + (diskInfo.root_dir_entries / 16);
+    if(use_index && load_index(p)){
+        return;
+    }
 
-    currDir.dir_name = malloc(sizeof(char));
+    currDir.dir_name = malloc(sizeof(char)*3);
     strcpy(currDir.dir_name, "./");
     
-    traverse(p, root_dir_start, root_dir_ends, 0);
+    if(diskInfo.fat_type == 32){
+        traverse_sub_directory(p, diskInfo.root_cluster, 0);
+    }else{
+        traverse(p, root_dir_start, root_dir_ends, 0);
+    }
 
     subdir_traversal_controller(p);
 }
 
 
 /*
-* Function: traverse(char *p, uint16_t start, uint16_t ends, int sub_dir)
+* Function: get_geometry(char *p)
 * =================================
-* Purpose: traverse a directory
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t start: location to start the traversal
-*   uint16_t ends: location traversal ends
-*   int sub_dir: flag for controlling subdir traversal differences
 *
 */
-void traverse(char *p, uint16_t start, uint16_t ends, int sub_dir){
-    uint8_t entry_free = 0x01; // Just a inital value so while loop enters
-    int i = start;
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
 
-    while(i < ends && entry_free != 0x00){
-        for(int k = 0; k < 16; k++){
-            if(sub_dir != 1 || k > 1){
-                memcpy(&entry_free , (p + 512*i + 32*k), 1);
-                if(entry_free == 0x00){
-                    break;
-                }
-                if(entry_free != 0xE5){
-                    read_file_info(p, i, k);
-                }
-            }
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: traverse(char *p, uint32_t start, uint32_t ends, int sub_dir)
+* =================================
+* Purpose: traverse a directory, bytes_per_sector / 32 entries per sector
+*
+* Input: 
+*   char* p: image data pointer
+*   uint32_t start: location to start the traversal
+*   uint32_t ends: location traversal ends
+*   int sub_dir: 1 for the first cluster of a sub directory (skips . and ..)
+*
+* Return:
+*   int: 1 when the end of directory entry was reached
+*
+*/
+int traverse(char *p, uint32_t start, uint32_t ends, int sub_dir){
+    uint8_t entry_free;
+    uint32_t entries_per_sector = diskInfo.bytes_per_sector / 32;
+    uint32_t entry_count = (ends - start) * entries_per_sector;
+    char *dir_start = p + (size_t)start * diskInfo.bytes_per_sector;
+
+    for(uint32_t k = (sub_dir == 1) ? 2 : 0; k < entry_count; k++){
+        memcpy(&entry_free, (dir_start + (size_t)32*k), 1);
+        if(entry_free == 0x00){
+            return 1;
+        }
+        if(entry_free != 0xE5){
+            read_file_info(p, start + k / entries_per_sector, k % entries_per_sector);
         }
-        i++;
     }
+    return 0;
 }
 
 
 /*
-* Function: traverse_sub_directory(char *p, uint16_t flc)
+* Function: traverse_sub_directory(char *p, uint32_t flc, int sub_dir)
 * =================================
-* Purpose: set needed data for sub dir traversal
+* Purpose: set needed data for sub dir traversal, also used for the FAT32 root chain
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster of directory start
+*   uint32_t flc: first logical cluster of directory start
+*   int sub_dir: 1 for a sub directory, 0 for the FAT32 root (no . and .. entries)
 *
 */
-void traverse_sub_directory(char *p, uint16_t flc){
-    uint16_t data_loc;
-    uint16_t cluster_ends;
+void traverse_sub_directory(char *p, uint32_t flc, int sub_dir){
+    uint32_t data_loc;
+    uint32_t cluster_ends;
+    uint32_t steps = 0;
     
-    // get sector data starts
-    while(flc != 0xFFF){
+    // get sector data starts, the step limit keeps a cyclic chain from looping forever
+    while(flc >= 2 && flc < diskInfo.eoc_min && steps++ < diskInfo.cluster_count){
         data_loc = calc_data_loc(p, flc);
         cluster_ends = data_loc + diskInfo.sectors_per_cluster;
         
-        traverse(p, data_loc, cluster_ends, 1);
+        if(traverse(p, data_loc, cluster_ends, sub_dir)){
+            break;
+        }
+        sub_dir = 0; // only the first cluster holds . and ..
 
         // check FAT for next cluster
         flc = get_fat_entry(p, flc);
@@ -587,38 +1082,39 @@ void traverse_sub_directory(char *p, uint16_t flc){
 void subdir_traversal_controller(char *p){
     // travel the sub directories
     for(int i = 0; i < sub_dir_count; i++){
-        currDir.dir_name = realloc(currDir.dir_name, (sizeof(char)*strlen(sub_dir_list[i].path)));
+        currDir.dir_name = realloc(currDir.dir_name, (sizeof(char)*(strlen(sub_dir_list[i].path)+1)));
         strcpy(currDir.dir_name, sub_dir_list[i].path);
-        traverse_sub_directory(p, sub_dir_list[i].flc);
+        traverse_sub_directory(p, sub_dir_list[i].flc, 1);
     }
 }
 
 
 /*
-* Function: read_file_info(char *p, uint16_t sector, uint16_t entry)
+* Function: read_file_info(char *p, uint32_t sector, uint16_t entry)
 * =================================
 * Purpose: read the file meta data from directory entry
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t sector: FAT12 sector
+*   uint32_t sector: image sector
 *   uint16_t entry: entry in the sector
 *
 */
-void read_file_info(char *p, uint16_t sector, uint16_t entry){
+void read_file_info(char *p, uint32_t sector, uint16_t entry){
+    char *dir_start = p + ((size_t)diskInfo.bytes_per_sector*sector + 32*entry);
     uint8_t file_attributes;
-    uint16_t flc;
+    uint32_t flc;
     uint32_t file_size;
     char file_name[9];
 
-    memcpy(&file_attributes, (p + (512*sector + 32*entry) + 11), 1);
+    memcpy(&file_attributes, (dir_start + 11), 1);
 
     if(file_attributes != 0x0F && !(0x04 & file_attributes)){
-        memcpy(file_name, (p + (512*sector + 32*entry)), 8);
-        file_name[9] = '\0';
+        memcpy(file_name, dir_start, 8);
+        file_name[8] = '\0';
 
-        memcpy(&flc, (p + (512*sector + 32*entry) + 26), 2);
-        memcpy(&file_size, (p + (512*sector + 32*entry) + 28), 4);
+        flc = get_entry_flc(dir_start);
+        memcpy(&file_size, (dir_start + 28), 4);
         diskInfo.used_space = diskInfo.used_space + file_size;
 
         if(0x10 & file_attributes){
@@ -626,9 +1122,7 @@ void read_file_info(char *p, uint16_t sector, uint16_t entry){
                 sub_dir_list = mem_alloc(sub_dir_list, sub_dir_count+1);
                 build_dir_path(file_name);
                 sub_dir_list[sub_dir_count].flc = flc;
-                if(strcmp(sub_dir_list[sub_dir_count].path, fileInfo.file_dir) == 0){
-                    insert_dir = sub_dir_count;
-                }
+                sub_dir_list[sub_dir_count].name_hash = hash_string(sub_dir_list[sub_dir_count].path);
 
                 sub_dir_count++;
             }
@@ -651,7 +1145,7 @@ void build_dir_path(char *dir_name){
     int p_path_len = strlen(currDir.dir_name);
     int c_path_len = strlen(dir_name);
     int total_len = p_path_len + c_path_len;
-    char *path = malloc(sizeof(char)*total_len);
+    char *path = malloc(sizeof(char)*(total_len+2));
 
     strcpy(path, currDir.dir_name);
     if(strcmp(currDir.dir_name, "./") != 0){
@@ -659,52 +1153,78 @@ void build_dir_path(char *dir_name){
     }
     strcat(path, dir_name);
 
-    sub_dir_list[sub_dir_count].path = malloc(sizeof(char));
-    int size = 1;
-    for(int i = 0; i <= total_len; i++){
+    // drop the space padding of the 8.3 name
+    sub_dir_list[sub_dir_count].path = malloc(sizeof(char)*(total_len+2));
+    int size = 0;
+    for(int i = 0; path[i] != '\0'; i++){
         if(isspace(path[i]) == 0){
-            sub_dir_list[sub_dir_count].path[i] = path[i];
-            sub_dir_list[sub_dir_count].path = realloc(sub_dir_list[sub_dir_count].path, (sizeof(char))*size);
+            sub_dir_list[sub_dir_count].path[size] = path[i];
             size++;
         }
     }
+    sub_dir_list[sub_dir_count].path[size] = '\0';
+    free(path);
 }
 
 
 /*
-* Function: calc_data_loc(char *p, uint16_t flc)
+* Function: calc_data_loc(char *p, uint32_t flc)
 * =================================
 * Purpose: calculate the data location for a given flc
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-uint16_t calc_data_loc(char *p, uint16_t flc){
-    uint8_t data_region_start;
-    uint16_t data_loc;
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
 
-    data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + (diskInfo.root_dir_entries / 16) + diskInfo.reserved_sectors;
-    data_loc = ((flc - 2) * diskInfo.sectors_per_cluster) + data_region_start;
-    
-    return data_loc;
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input: 
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
 }
 
 
 /*
-* Function: get_fat_entry(char *p, uint16_t flc)
+* Function: get_fat_entry(char *p, uint32_t flc)
 * =================================
 * Purpose: get the entry value at a FAT location
 *
 * Input: 
 *   char* p: image data pointer
-*   uint16_t flc: first logical cluster 
+*   uint32_t flc: first logical cluster 
 *
 */
-unsigned int get_fat_entry(char *p, uint16_t flc){
-    int ent_offset = (flc * 3) / 2;
-    unsigned short entry = *(unsigned short*)(p + 512 + ent_offset);
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
     
     if(flc % 2 == 1){
         entry >>= 4;
@@ -717,38 +1237,82 @@ unsigned int get_fat_entry(char *p, uint16_t flc){
 
 
 /*
-* Function: split_input_name(char *input)
+* Function: get_entry_flc(char *entry)
 * =================================
-* Purpose: split user input into file name and file directory
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
 *
 * Input: 
-*   char* input: user input to be split 
+*   char* entry: start of the 32 byte directory entry
 *
 */
-void split_input_name(char *input){
-    char *raw = malloc(sizeof(char)*strlen(input));
-    strcpy(raw, input);
-    int raw_len = strlen(raw);
-    int end_of_dir = 0;
-    int count_dir = 0;
-    int count_name = 0;
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
 
-    for(int i = raw_len - 1; i >= 0; i--){
-        if(raw[i] == '/'){
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: set_entry_flc(char *entry, uint32_t flc)
+* =================================
+* Purpose: store the first cluster in a directory entry (high 16 bits only on FAT32)
+*
+* Input: 
+*   char* entry: start of the 32 byte directory entry
+*   uint32_t flc: first logical cluster
+*
+*/
+void set_entry_flc(char *entry, uint32_t flc){
+    uint16_t low = flc & 0xFFFF;
+    uint16_t high = flc >> 16;
+
+    memcpy((entry + 26), &low, 2);
+    if(diskInfo.fat_type == 32){
+        memcpy((entry + 20), &high, 2);
+    }
+}
+
+
+/*
+* Function: split_input_name(char *input)
+* =================================
+* Purpose: split user input into file name and file directory
+*
+* Input: 
+*   char* input: user input to be split 
+*
+*/
+void split_input_name(char *input){
+    char *raw = malloc(sizeof(char)*(strlen(input)+1));
+    strcpy(raw, input);
+    int raw_len = strlen(raw);
+    int end_of_dir = 0;
+    int count_dir = 0;
+    int count_name = 0;
+
+    // sized for the whole input plus the "./" prefix and terminator
+    fileInfo.file_dir = calloc(raw_len + 3, sizeof(char));
+    fileInfo.file_name = calloc(raw_len + 1, sizeof(char));
+
+    for(int i = raw_len - 1; i >= 0; i--){
+        if(raw[i] == '/'){
             end_of_dir = i;
             break;
         }
     }
 
     if(end_of_dir <= 1){
-        fileInfo.file_dir = realloc(fileInfo.file_dir, sizeof(char)*2);
-        fileInfo.file_name = realloc(fileInfo.file_name, sizeof(char)*8);
         int ind = 0;
         int i = 0;
         if(raw[0] == '.'){
             i = 1;
         }
-        for(i; i < raw_len; i++){
+        for(; i < raw_len; i++){
             if(raw[i] != '/'){
                 fileInfo.file_name[ind] = raw[i];
                 ind++;
@@ -762,24 +1326,20 @@ void split_input_name(char *input){
             if(i < end_of_dir){
                 if(count_dir == 0){
                     if(raw[i] != '.'){
-                        fileInfo.file_dir = realloc(fileInfo.file_dir, sizeof(char)*count_dir+1);
                         fileInfo.file_dir[0] = '.';
                         count_dir++;
                     }
                 }
                 if(count_dir == 1){
                     if(raw[i] != '/'){
-                        fileInfo.file_dir = realloc(fileInfo.file_dir, sizeof(char)*count_dir+1);
                         fileInfo.file_dir[1] = '/';
                         count_dir++;
                     }
                 }
-                fileInfo.file_dir = realloc(fileInfo.file_dir, sizeof(char)*count_dir+1);
                 fileInfo.file_dir[count_dir] = raw[i];
                 count_dir++;
                 
             }else if(i > end_of_dir){  
-                fileInfo.file_name = realloc(fileInfo.file_name, sizeof(char)*count_name+1);
                 fileInfo.file_name[count_name] = raw[i];
                 count_name++;
                 
@@ -804,3 +1364,651 @@ void convert_to_upper(char *str){
         str[i] = toupper(str[i]);
     }
 }
+
+
+/*
+* Function: hash_string(const char *str)
+* =================================
+* Purpose: 32 bit FNV-1a hash of a name or path
+*
+* Input:
+*   const char* str: string to hash
+*
+*/
+uint32_t hash_string(const char *str){
+    uint32_t hash = 2166136261u;
+    while(*str){
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+
+/*
+* Function: checksum_image(char *p, uint32_t *dir_sectors, int dir_sector_count)
+* =================================
+* Purpose: checksum the first FAT, the root directory and the listed sub directory
+*          sectors, 8 bytes at a time (must match disklist.c)
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t* dir_sectors: sub directory sectors
+*   int dir_sector_count: number of sub directory sectors
+*
+*/
+uint32_t checksum_image(char *p, uint32_t *dir_sectors, int dir_sector_count){
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+    size_t sector_bytes = diskInfo.bytes_per_sector;
+    size_t root_dir_start = ((size_t)diskInfo.num_of_fats * diskInfo.sector_per_fat + diskInfo.reserved_sectors) * sector_bytes;
+    size_t root_dir_ends = root_dir_start + (size_t)diskInfo.root_dir_sectors * sector_bytes;
+
+    for(size_t i = 0; i < (size_t)diskInfo.sector_per_fat * sector_bytes; i += 8){
+        memcpy(&word, p + diskInfo.fat_start + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i < root_dir_ends; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(int s = 0; s < dir_sector_count; s++){
+        for(size_t i = 0; i < sector_bytes; i += 8){
+            memcpy(&word, p + (size_t)dir_sectors[s]*sector_bytes + i, 8);
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+/*
+* Function: load_index(char *p)
+* =================================
+* Purpose: take the directory list and used space from the sidecar index
+*          instead of walking the image, if the index still matches it
+*
+* Input:
+*   char* p: image data pointer
+*
+* Return:
+*   int: 1 if the index was used, 0 if the image has to be walked
+*
+*/
+int load_index(char *p){
+    struct stat isb;
+    struct indexHeader *header;
+    int fd = open(index_name, O_RDONLY);
+
+    if(fd < 0){
+        return 0;
+    }
+    fstat(fd, &isb);
+    if(isb.st_size < sizeof(struct indexHeader)){
+        close(fd);
+        return 0;
+    }
+
+    char *ip = mmap(NULL, isb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ip == MAP_FAILED){
+        return 0;
+    }
+
+    header = (struct indexHeader *)ip;
+    uint32_t *dir_sectors = (uint32_t *)(ip + sizeof(struct indexHeader) + sizeof(uint32_t)*header->cluster_count);
+    struct indexDir *dirs = (struct indexDir *)(dir_sectors + header->dir_sector_count);
+
+    if(memcmp(header->magic, "FATIDX2", 8) != 0
+        || header->image_mtime != image_stat.st_mtime
+        || header->image_size != image_stat.st_size
+        || (char *)(dirs + header->dir_count) > ip + isb.st_size){
+        munmap(ip, isb.st_size);
+        return 0;
+    }
+    for(int s = 0; s < header->dir_sector_count; s++){
+        if(((size_t)dir_sectors[s] + 1) * diskInfo.bytes_per_sector > image_stat.st_size){
+            munmap(ip, isb.st_size);
+            return 0;
+        }
+    }
+    if(checksum_image(p, dir_sectors, header->dir_sector_count) != header->checksum){
+        munmap(ip, isb.st_size);
+        return 0;
+    }
+
+    // directory 0 of the index is the root, the rest match sub_dir_list
+    for(int i = 1; i < header->dir_count; i++){
+        sub_dir_list = mem_alloc(sub_dir_list, sub_dir_count+1);
+        sub_dir_list[sub_dir_count].path = strdup(dirs[i].path);
+        sub_dir_list[sub_dir_count].flc = dirs[i].flc;
+        sub_dir_list[sub_dir_count].name_hash = dirs[i].name_hash;
+        sub_dir_count++;
+    }
+    diskInfo.used_space = header->used_space;
+
+    // the decoded FAT of the index becomes the allocator state
+    uint32_t *fat = (uint32_t *)(ip + sizeof(struct indexHeader));
+    txn.cluster_count = header->cluster_count;
+    txn.fat_table = malloc(sizeof(uint32_t)*txn.cluster_count);
+    txn.fat_dirty = calloc((txn.cluster_count / 8) + 1, 1);
+    memcpy(txn.fat_table, fat, sizeof(uint32_t)*txn.cluster_count);
+    for(int i = 2; i < txn.cluster_count; i++){
+        if(txn.fat_table[i] == 0x000){
+            txn.free_clusters++;
+        }
+    }
+
+    munmap(ip, isb.st_size);
+    return 1;
+}
+
+
+/*
+* Function: decode_fat(char *p)
+* =================================
+* Purpose: decode the FAT into the transaction's table and count the free clusters
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void decode_fat(char *p){
+    txn.cluster_count = diskInfo.cluster_count;
+    txn.fat_table = malloc(sizeof(uint32_t)*txn.cluster_count);
+    txn.fat_dirty = calloc((txn.cluster_count / 8) + 1, 1);
+
+    for(int i = 0; i < txn.cluster_count; i++){
+        txn.fat_table[i] = get_fat_entry(p, i);
+        if(i >= 2 && txn.fat_table[i] == 0x000){
+            txn.free_clusters++;
+        }
+    }
+}
+
+
+/*
+* Function: set_fat(uint32_t cluster, uint32_t value)
+* =================================
+* Purpose: change an entry of the decoded FAT, it is written to the image on commit
+*
+* Input:
+*   uint32_t cluster: location of entry
+*   uint32_t value: entry to be put into FAT
+*
+*/
+void set_fat(uint32_t cluster, uint32_t value){
+    if(txn.fat_table[cluster] == 0x000 && value != 0x000){
+        txn.free_clusters--;
+    }else if(txn.fat_table[cluster] != 0x000 && value == 0x000){
+        txn.free_clusters++;
+    }
+    txn.fat_table[cluster] = value;
+    txn.fat_dirty[cluster / 8] |= (uint8_t)(1 << (cluster % 8));
+}
+
+
+/*
+* Function: txn_mark(int kind, size_t start, size_t len)
+* =================================
+* Purpose: record a dirty range of the image, merging it into the last range when they touch
+*
+* Input:
+*   int kind: TXN_DATA, TXN_FAT or TXN_DIR
+*   size_t start: byte offset in the image
+*   size_t len: length of the range
+*
+*/
+void txn_mark(int kind, size_t start, size_t len){
+    int count = txn.range_count[kind];
+
+    if(count > 0){
+        struct writeRange *last = &txn.ranges[kind][count-1];
+        if(start >= last->start && start <= last->start + last->len){
+            if(start + len > last->start + last->len){
+                last->len = start + len - last->start;
+            }
+            return;
+        }
+    }
+    txn.ranges[kind] = realloc(txn.ranges[kind], sizeof(struct writeRange)*(count+1));
+    txn.ranges[kind][count].start = start;
+    txn.ranges[kind][count].len = len;
+    txn.range_count[kind]++;
+}
+
+
+/*
+* Function: txn_stage_entry(size_t offset, char *entry)
+* =================================
+* Purpose: keep a directory entry until commit
+*
+* Input:
+*   size_t offset: byte offset of the entry in the image
+*   char* entry: the 32 byte entry
+*
+*/
+void txn_stage_entry(size_t offset, char *entry){
+    char *staged = txn_staged_entry(offset);
+    if(staged != NULL){
+        memcpy(staged, entry, 32);
+        return;
+    }
+    txn.entries = realloc(txn.entries, sizeof(struct pendingEntry)*(txn.entry_count+1));
+    txn.entries[txn.entry_count].offset = offset;
+    memcpy(txn.entries[txn.entry_count].entry, entry, 32);
+    txn.entry_count++;
+}
+
+
+/*
+* Function: txn_staged_entry(size_t offset)
+* =================================
+* Purpose: find the entry this transaction has staged for a slot
+*
+* Input:
+*   size_t offset: byte offset of the entry in the image
+*
+* Return:
+*   char*: the staged 32 byte entry, NULL if the slot is untouched
+*
+*/
+char *txn_staged_entry(size_t offset){
+    for(int i = 0; i < txn.entry_count; i++){
+        if(txn.entries[i].offset == offset){
+            return txn.entries[i].entry;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Function: compare_ranges(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering ranges by start offset
+*
+*/
+int compare_ranges(const void *a, const void *b){
+    const struct writeRange *x = a;
+    const struct writeRange *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+
+/*
+* Function: txn_sync(char *p, int kind)
+* =================================
+* Purpose: flush every dirty range of one kind with one msync per run of pages
+*
+* Input:
+*   char* p: image data pointer
+*   int kind: TXN_DATA, TXN_FAT or TXN_DIR
+*
+*/
+void txn_sync(char *p, int kind){
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t run_start = 0;
+    size_t run_end = 0;
+    struct writeRange *ranges = txn.ranges[kind];
+
+    qsort(ranges, txn.range_count[kind], sizeof(struct writeRange), compare_ranges);
+
+    // in overlay mode the ranges only pick the sectors that go to the delta file
+    if(overlay.name){
+        for(int i = 0; i < txn.range_count[kind]; i++){
+            size_t first = ranges[i].start / diskInfo.bytes_per_sector;
+            size_t last = (ranges[i].start + ranges[i].len - 1) / diskInfo.bytes_per_sector;
+            for(size_t s = first; s <= last && s < (size_t)overlay.total_sectors; s++){
+                overlay.sectors[s / 8] |= (uint8_t)(1 << (s % 8));
+            }
+        }
+        return;
+    }
+
+    for(int i = 0; i < txn.range_count[kind]; i++){
+        size_t start = ranges[i].start & ~(page - 1);
+        size_t end = ranges[i].start + ranges[i].len;
+
+        if(run_end > run_start && start <= run_end){
+            if(end > run_end){
+                run_end = end;
+            }
+            continue;
+        }
+        if(run_end > run_start && msync(p + run_start, run_end - run_start, MS_SYNC) != 0){
+            printf("Error: failed to sync image\n");
+            exit(1);
+        }
+        run_start = start;
+        run_end = end;
+    }
+    if(run_end > run_start && msync(p + run_start, run_end - run_start, MS_SYNC) != 0){
+        printf("Error: failed to sync image\n");
+        exit(1);
+    }
+}
+
+
+/*
+* Function: txn_commit(char *p, int fd)
+* =================================
+* Purpose: make the batch durable in crash safe order: file data, then the FAT,
+*          then the directory entries that point at them
+*
+* Input:
+*   char* p: image data pointer
+*   int fd: image file descriptor
+*
+*/
+void txn_commit(char *p, int fd){
+    // the journal names every change before it is flushed, a crash can only over-report
+    if(use_journal && !overlay.name){
+        journal_changes(p);
+    }
+
+    txn_sync(p, TXN_DATA);
+
+    // whole sectors are marked so the mirror copies below can be done per sector run
+    for(int c = 0; c < txn.cluster_count; c++){
+        if(txn.fat_dirty[c / 8] & (1 << (c % 8))){
+            size_t offset = fat_entry_offset(c);
+            size_t first_sector = offset / diskInfo.bytes_per_sector;
+            size_t last_sector = (offset + (diskInfo.fat_type == 32 ? 3 : 1)) / diskInfo.bytes_per_sector;
+
+            set_next_fat_entry(p, c, txn.fat_table[c]);
+            txn_mark(TXN_FAT, diskInfo.fat_start + first_sector * diskInfo.bytes_per_sector, (last_sector - first_sector + 1) * diskInfo.bytes_per_sector);
+        }
+    }
+    mirror_fat(p);
+    if(diskInfo.fat_type == 32){
+        update_fsinfo(p);
+    }
+    txn_sync(p, TXN_FAT);
+
+    for(int i = 0; i < txn.entry_count; i++){
+        memcpy(p + txn.entries[i].offset, txn.entries[i].entry, 32);
+        txn_mark(TXN_DIR, txn.entries[i].offset, 32);
+    }
+    txn_sync(p, TXN_DIR);
+
+    if(!overlay.name){
+        fdatasync(fd);
+    }
+}
+
+
+/*
+* Function: mirror_fat(char *p)
+* =================================
+* Purpose: copy the dirty sector runs of the first FAT over every other FAT copy,
+*          one memcpy per run and copy, and add the copied runs to the FAT ranges
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void mirror_fat(char *p){
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * diskInfo.bytes_per_sector;
+    int run_count = txn.range_count[TXN_FAT];
+
+    // a copy of the FAT1 runs, marking a mirror range can merge into the list being walked
+    struct writeRange *runs = malloc(sizeof(struct writeRange)*(run_count + 1));
+    memcpy(runs, txn.ranges[TXN_FAT], sizeof(struct writeRange)*run_count);
+
+    for(int k = 1; k < diskInfo.num_of_fats; k++){
+        for(int i = 0; i < run_count; i++){
+            memcpy(p + runs[i].start + k * fat_bytes, p + runs[i].start, runs[i].len);
+        }
+    }
+    for(int k = 1; k < diskInfo.num_of_fats; k++){
+        for(int i = 0; i < run_count; i++){
+            txn_mark(TXN_FAT, runs[i].start + k * fat_bytes, runs[i].len);
+        }
+    }
+    free(runs);
+}
+
+
+/*
+* Function: load_delta(char *p, size_t image_size)
+* =================================
+* Purpose: lay the sectors of an existing delta file over the private base mapping,
+*          so every later read sees the overlay first. A missing delta file starts empty
+*
+* Input:
+*   char* p: image data pointer (MAP_PRIVATE)
+*   size_t image_size: size of the base image
+*
+*/
+void load_delta(char *p, size_t image_size){
+    struct deltaHeader header;
+    uint16_t bytes_per_sector;
+
+    memcpy(&bytes_per_sector, (p + 11), 2);
+    overlay.total_sectors = image_size / bytes_per_sector;
+    overlay.sectors = calloc((overlay.total_sectors / 8) + 1, 1);
+    overlay.base_checksum = checksum_base(p, image_size);
+
+    FILE *delta = fopen(overlay.name, "r");
+    if(delta == NULL){
+        return;
+    }
+    if(fread(&header, sizeof(header), 1, delta) != 1 || memcmp(header.magic, "FATDLT2", 8) != 0
+        || header.base_size != (int64_t)image_size || header.sector_size != bytes_per_sector
+        || header.base_checksum != overlay.base_checksum){
+        printf("Error: %s is not a delta of this image\n", overlay.name);
+        exit(1);
+    }
+
+    uint32_t *sector_list = malloc(sizeof(uint32_t)*(header.sector_count + 1));
+    if(fread(sector_list, sizeof(uint32_t), header.sector_count, delta) != header.sector_count){
+        printf("Error: %s is truncated\n", overlay.name);
+        exit(1);
+    }
+    for(uint32_t i = 0; i < header.sector_count; i++){
+        uint32_t s = sector_list[i];
+        if(s >= (uint32_t)overlay.total_sectors || fread(p + (size_t)s * bytes_per_sector, bytes_per_sector, 1, delta) != 1){
+            printf("Error: %s is truncated\n", overlay.name);
+            exit(1);
+        }
+        overlay.sectors[s / 8] |= (uint8_t)(1 << (s % 8));
+    }
+    free(sector_list);
+    fclose(delta);
+}
+
+
+/*
+* Function: save_delta(char *p, size_t image_size)
+* =================================
+* Purpose: write every sector held by the overlay to a new delta file and rename it
+*          over the old one, so the delta is replaced in one step
+*
+* Input:
+*   char* p: image data pointer (MAP_PRIVATE)
+*   size_t image_size: size of the base image
+*
+*/
+void save_delta(char *p, size_t image_size){
+    struct deltaHeader header;
+    char tmp_name[4096];
+    uint32_t *sector_list = malloc(sizeof(uint32_t)*(overlay.total_sectors + 1));
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FATDLT2", 8);
+    header.base_size = image_size;
+    header.sector_size = diskInfo.bytes_per_sector;
+    header.base_checksum = overlay.base_checksum;
+    for(int s = 0; s < overlay.total_sectors; s++){
+        if(overlay.sectors[s / 8] & (1 << (s % 8))){
+            sector_list[header.sector_count++] = s;
+        }
+    }
+
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", overlay.name);
+    FILE *delta = fopen(tmp_name, "w");
+    if(delta == NULL){
+        printf("Error: failed to write %s\n", overlay.name);
+        exit(1);
+    }
+    fwrite(&header, sizeof(header), 1, delta);
+    fwrite(sector_list, sizeof(uint32_t), header.sector_count, delta);
+    for(uint32_t i = 0; i < header.sector_count; i++){
+        fwrite(p + (size_t)sector_list[i] * diskInfo.bytes_per_sector, diskInfo.bytes_per_sector, 1, delta);
+    }
+    if(fflush(delta) != 0 || fsync(fileno(delta)) != 0){
+        printf("Error: failed to write %s\n", overlay.name);
+        exit(1);
+    }
+    fclose(delta);
+    rename(tmp_name, overlay.name);
+    free(sector_list);
+}
+
+
+/*
+* Function: journal_changes(char *p)
+* =================================
+* Purpose: append the data clusters, FAT sectors and directory entries of this
+*          transaction to the change journal and fsync it
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void journal_changes(char *p){
+    size_t cluster_bytes = (size_t)diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+    size_t data_start = (size_t)diskInfo.data_region_start * diskInfo.bytes_per_sector;
+    struct journalRecord record;
+    int last_sector = -1;
+
+    FILE *journal = fopen(journal_name, "a");
+    if(journal == NULL){
+        printf("Error: failed to open %s\n", journal_name);
+        exit(1);
+    }
+    if(ftell(journal) == 0){
+        fwrite("FATJNL1", 8, 1, journal);
+    }
+    memset(&record, 0, sizeof(record));
+
+    record.kind = 'C';
+    for(int i = 0; i < txn.range_count[TXN_DATA]; i++){
+        struct writeRange *range = &txn.ranges[TXN_DATA][i];
+        for(size_t c = (range->start - data_start) / cluster_bytes; c <= (range->start + range->len - 1 - data_start) / cluster_bytes; c++){
+            record.value = c + 2;
+            fwrite(&record, sizeof(record), 1, journal);
+        }
+    }
+
+    record.kind = 'F';
+    for(int c = 0; c < txn.cluster_count; c++){
+        if(txn.fat_dirty[c / 8] & (1 << (c % 8))){
+            size_t offset = fat_entry_offset(c);
+            for(size_t byte = offset; byte <= offset + (diskInfo.fat_type == 32 ? 3 : 1); byte++){
+                int sector = byte / diskInfo.bytes_per_sector;
+                if(sector != last_sector){
+                    record.value = sector;
+                    fwrite(&record, sizeof(record), 1, journal);
+                    last_sector = sector;
+                }
+            }
+        }
+    }
+    if(diskInfo.fat_type == 32){
+        uint16_t fsinfo_sector;
+        memcpy(&fsinfo_sector, (p + 48), 2);
+        record.kind = 'S';
+        record.value = fsinfo_sector;
+        fwrite(&record, sizeof(record), 1, journal);
+    }
+
+    record.kind = 'E';
+    for(int i = 0; i < txn.entry_count; i++){
+        record.value = txn.entries[i].offset / 32;
+        fwrite(&record, sizeof(record), 1, journal);
+    }
+
+    if(fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+        printf("Error: failed to write %s\n", journal_name);
+        exit(1);
+    }
+    fclose(journal);
+}
+
+
+/*
+* Function: update_fsinfo(char *p)
+* =================================
+* Purpose: keep the free cluster count and next free hint of the FAT32 FSInfo sector
+*          in step with the FAT, so other systems do not trust stale values
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void update_fsinfo(char *p){
+    uint16_t fsinfo_sector;
+    uint32_t signature;
+    uint32_t free_count = txn.free_clusters;
+    uint32_t next_free = 0xFFFFFFFF;
+
+    memcpy(&fsinfo_sector, (p + 48), 2);
+    if(fsinfo_sector == 0 || fsinfo_sector >= diskInfo.reserved_sectors){
+        return;
+    }
+    char *fsinfo = p + (size_t)fsinfo_sector * diskInfo.bytes_per_sector;
+    memcpy(&signature, fsinfo, 4);
+    if(signature != 0x41615252){
+        return;
+    }
+
+    memcpy((fsinfo + 488), &free_count, 4);
+    memcpy((fsinfo + 492), &next_free, 4);
+    txn_mark(TXN_FAT, (size_t)fsinfo_sector * diskInfo.bytes_per_sector, diskInfo.bytes_per_sector);
+}
+
+
+/*
+* Function: checksum_base(char *p, size_t image_size)
+* =================================
+* Purpose: checksum the first FAT and root directory of the base image, 8 bytes at a
+*          time, so a delta is only laid over the base it was made from
+*
+* Input:
+*   char* p: base image data pointer, before any delta is laid over it
+*   size_t image_size: size of the base image
+*
+*/
+uint32_t checksum_base(char *p, size_t image_size){
+    uint16_t bytes_per_sector, reserved_sectors, root_dir_entries, sector_per_fat16;
+    uint8_t num_of_fats;
+    uint32_t sector_per_fat;
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+
+    memcpy(&bytes_per_sector, (p + 11), 2);
+    memcpy(&reserved_sectors, (p + 14), 2);
+    memcpy(&num_of_fats, (p + 16), 1);
+    memcpy(&root_dir_entries, (p + 17), 2);
+    memcpy(&sector_per_fat16, (p + 22), 2);
+    sector_per_fat = sector_per_fat16;
+    if(sector_per_fat == 0){
+        memcpy(&sector_per_fat, (p + 36), 4);
+    }
+
+    size_t fat_start = (size_t)reserved_sectors * bytes_per_sector;
+    size_t fat_ends = fat_start + (size_t)sector_per_fat * bytes_per_sector;
+    size_t root_dir_start = fat_start + (size_t)num_of_fats * sector_per_fat * bytes_per_sector;
+    size_t root_dir_ends = root_dir_start + (size_t)root_dir_entries * 32;
+
+    for(size_t i = fat_start; i + 8 <= fat_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = root_dir_start; i + 8 <= root_dir_ends && i + 8 <= image_size; i += 8){
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -0,0 +1,510 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Read byte ranges of a file inside a FAT12/FAT16/FAT32 image without following
+*            its whole cluster chain for every read
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// a run of physically contiguous clusters of the file
+struct extent{
+    uint32_t file_offset;        // offset in the file of the first byte of the run
+    uint32_t length;             // bytes in the run
+    size_t image_offset;         // offset in the image of the first byte of the run
+};
+
+// an open file of the image, the extent index is built by the first read
+struct imageFile{
+    uint32_t flc;
+    uint32_t size;
+    struct extent *extents;
+    int extent_count;
+    int indexed;
+};
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+char* scan_directory(char *p, uint32_t dir_flc, char *short_name);
+char* resolve_path(char *p, char *path);
+int make_short_name(char *name, char *short_name);
+void build_extent_index(char *p, struct imageFile *file);
+int find_extent(struct imageFile *file, uint32_t offset);
+long image_pread(char *p, struct imageFile *file, char *buf, uint32_t len, uint32_t offset);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+    struct imageFile file;
+
+    if(argc < 5 || argc % 2 == 0){
+        printf("Input format: ./diskread {image file} {image path} {offset} {length} [{offset} {length} ...]\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+
+    char *entry = resolve_path(p, argv[2]);
+    if(entry == NULL || (entry[11] & 0x18)){
+        printf("%s: no such file\n", argv[2]);
+        exit(1);
+    }
+    memset(&file, 0, sizeof(file));
+    file.flc = get_entry_flc(entry);
+    memcpy(&file.size, (entry + 28), 4);
+
+    // every range is written to stdout in the order given, a negative offset counts from the end
+    for(int i = 3; i + 1 < argc; i += 2){
+        long long offset = atoll(argv[i]);
+        long long length = atoll(argv[i+1]);
+        if(offset < 0){
+            offset = (long long)file.size + offset;
+        }
+        if(offset < 0 || length < 0 || offset > file.size){
+            printf("Error: range %s %s is outside the file\n", argv[i], argv[i+1]);
+            exit(1);
+        }
+        if(length > file.size - offset){
+            length = file.size - offset;
+        }
+
+        char *buf = malloc(length + 1);
+        long got = image_pread(p, &file, buf, length, offset);
+        if(got < 0){
+            printf("Error: %s has a broken cluster chain\n", argv[2]);
+            exit(1);
+        }
+        fwrite(buf, 1, got, stdout);
+        free(buf);
+    }
+
+    free(file.extents);
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: image_pread(char *p, struct imageFile *file, char *buf, uint32_t len, uint32_t offset)
+* =================================
+* Purpose: pread() for a file of the image, copy up to len bytes starting at offset.
+*          The extent holding offset is found by binary search, then whole extents are
+*          copied until len is reached
+*
+* Input:
+*   char* p: image data pointer
+*   struct imageFile* file: the file to read
+*   char* buf: destination, at least len bytes
+*   uint32_t len: bytes wanted
+*   uint32_t offset: offset in the file
+*
+* Return:
+*   long: bytes copied, short at the end of the file, -1 if the chain ends before the file size
+*
+*/
+long image_pread(char *p, struct imageFile *file, char *buf, uint32_t len, uint32_t offset){
+    long copied = 0;
+
+    if(!file->indexed){
+        build_extent_index(p, file);
+    }
+    if(offset >= file->size){
+        return 0;
+    }
+    if(len > file->size - offset){
+        len = file->size - offset;
+    }
+
+    int i = find_extent(file, offset);
+    while(len > 0){
+        if(i < 0 || i >= file->extent_count){
+            return -1;
+        }
+        struct extent *ext = &file->extents[i];
+        uint32_t skip = offset - ext->file_offset;
+        uint32_t chunk = ext->length - skip;
+        if(chunk > len){
+            chunk = len;
+        }
+        memcpy(buf + copied, p + ext->image_offset + skip, chunk);
+        copied += chunk;
+        offset += chunk;
+        len -= chunk;
+        i++;
+    }
+    return copied;
+}
+
+
+/*
+* Function: build_extent_index(char *p, struct imageFile *file)
+* =================================
+* Purpose: follow the cluster chain once and record it as runs of contiguous clusters,
+*          stopping at the file size or at a bad or cyclic chain
+*
+* Input:
+*   char* p: image data pointer
+*   struct imageFile* file: the file to index
+*
+*/
+void build_extent_index(char *p, struct imageFile *file){
+    uint32_t cluster = file->flc;
+    uint32_t mapped = 0;
+    uint32_t steps = 0;
+
+    file->indexed = 1;
+    while(mapped < file->size && cluster >= 2 && cluster < diskInfo.cluster_count && steps++ < diskInfo.cluster_count){
+        size_t image_offset = (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+        struct extent *last = file->extent_count > 0 ? &file->extents[file->extent_count - 1] : NULL;
+
+        if(last != NULL && last->image_offset + last->length == image_offset){
+            last->length += diskInfo.cluster_bytes;
+        }else{
+            file->extents = realloc(file->extents, sizeof(struct extent)*(file->extent_count + 1));
+            file->extents[file->extent_count].file_offset = mapped;
+            file->extents[file->extent_count].length = diskInfo.cluster_bytes;
+            file->extents[file->extent_count].image_offset = image_offset;
+            file->extent_count++;
+        }
+        mapped += diskInfo.cluster_bytes;
+        cluster = get_fat_entry(p, cluster);
+    }
+}
+
+
+/*
+* Function: find_extent(struct imageFile *file, uint32_t offset)
+* =================================
+* Purpose: binary search for the extent that holds a file offset
+*
+* Input:
+*   struct imageFile* file: indexed file
+*   uint32_t offset: offset in the file
+*
+* Return:
+*   int: index of the extent, -1 if the offset is past the mapped chain
+*
+*/
+int find_extent(struct imageFile *file, uint32_t offset){
+    int low = 0;
+    int high = file->extent_count - 1;
+
+    while(low <= high){
+        int mid = low + (high - low) / 2;
+        struct extent *ext = &file->extents[mid];
+        if(offset < ext->file_offset){
+            high = mid - 1;
+        }else if(offset - ext->file_offset >= ext->length){
+            low = mid + 1;
+        }else{
+            return mid;
+        }
+    }
+    return -1;
+}
+
+
+/*
+* Function: resolve_path(char *p, char *path)
+* =================================
+* Purpose: find the directory entry of a path like /SUB1/FILE.TXT
+*
+* Input:
+*   char* p: image data pointer
+*   char* path: path in the image, case is ignored
+*
+* Return:
+*   char*: the entry, NULL if any part of the path is missing
+*
+*/
+char* resolve_path(char *p, char *path){
+    char *copy = strdup(path);
+    char short_name[11];
+    char *entry = NULL;
+    uint32_t dir_flc = 0;
+
+    for(char *part = strtok(copy, "/"); part != NULL; part = strtok(NULL, "/")){
+        if(strcmp(part, ".") == 0){
+            continue;
+        }
+        if(entry != NULL){
+            if(!(entry[11] & 0x10)){
+                entry = NULL;
+                break;
+            }
+            dir_flc = get_entry_flc(entry);
+        }
+        for(int k = 0; part[k] != '\0'; k++){
+            part[k] = toupper((unsigned char)part[k]);
+        }
+        if(make_short_name(part, short_name) != 0){
+            entry = NULL;
+            break;
+        }
+        entry = scan_directory(p, dir_flc, short_name);
+        if(entry == NULL){
+            break;
+        }
+    }
+    free(copy);
+    return entry;
+}
+
+
+/*
+* Function: scan_directory(char *p, uint32_t dir_flc, char *short_name)
+* =================================
+* Purpose: find an entry by its 8.3 name in the root or a sub directory
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* short_name: 11 byte name to look for
+*
+* Return:
+*   char*: the entry, NULL if there is none
+*
+*/
+char* scan_directory(char *p, uint32_t dir_flc, char *short_name){
+    int fixed_root = (dir_flc == 0 && diskInfo.fat_type != 32);
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    char *start;
+    int entry_count;
+
+    for(uint32_t steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(fixed_root){
+            start = p + (size_t)(diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            start = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+
+            if(first == 0x00){
+                return NULL;
+            }
+            if(first != 0xE5 && entry_start[11] != 0x0F && !(entry_start[11] & 0x08) && memcmp(entry_start, short_name, 11) == 0){
+                return entry_start;
+            }
+        }
+
+        if(fixed_root){
+            return NULL;
+        }
+        cluster = get_fat_entry(p, cluster);
+        if(cluster < 2 || cluster >= diskInfo.eoc_min){
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Function: make_short_name(char *name, char *short_name)
+* =================================
+* Purpose: turn an upper case name like FILE.TXT into the padded 11 byte 8.3 form
+*
+* Input:
+*   char* name: file name
+*   char* short_name: output, 11 bytes
+*
+* Return:
+*   int: 0 on success, -1 if the name does not fit 8.3
+*
+*/
+int make_short_name(char *name, char *short_name){
+    char *ext = strrchr(name, '.');
+    int name_len = ext ? (int)(ext - name) : (int)strlen(name);
+    int ext_len = ext ? (int)strlen(ext + 1) : 0;
+
+    if(name_len == 0 || name_len > 8 || ext_len > 3){
+        return -1;
+    }
+    memset(short_name, ' ', 11);
+    memcpy(short_name, name, name_len);
+    if(ext != NULL){
+        memcpy(short_name + 8, ext + 1, ext_len);
+    }
+    return 0;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+    }
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
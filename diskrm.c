@@ -0,0 +1,847 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Delete files and directories from a FAT12, FAT16 or FAT32 image
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MAX_DEPTH 32
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// every chain is freed in the decoded table first and written back in one pass
+struct removeInfo{
+    uint32_t *fat_table;     // decoded first FAT
+    uint8_t *freed;          // one bit per cluster freed by this run
+    char *components[MAX_DEPTH];
+    int component_count;
+    int matches;
+    int files;
+    int dirs;
+    int freed_clusters;
+    int errors;
+    char path[256];
+}removeInfo;
+
+// change journal {image}.jnl, see diskput.c for the record layout
+struct journalRecord{
+    char kind;
+    char pad[3];
+    uint32_t value;
+};
+
+int recursive = 0;
+int punch_holes = 0;
+int use_journal = 0;
+uint32_t *removed_entries = NULL;
+int removed_entry_count = 0;
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc);
+size_t fat_entry_offset(uint32_t cluster);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+char* cluster_ptr(char *p, uint32_t cluster);
+void decode_fat(char *p);
+void split_path(char *input);
+void remove_matches(char *p, uint32_t dir_flc, int depth);
+void remove_entry(char *p, char *entry_start, char *first_entry);
+void remove_tree(char *p, uint32_t dir_flc);
+void free_chain(uint32_t flc);
+void write_fat(char *p);
+int update_fsinfo(char *p);
+void punch_freed(int fd);
+void journal_changes(char *p, char *image_name);
+void mark_deleted(char *p, char *entry_start);
+void entry_name(char *entry_start, char *name_out);
+int skip_entry(char *entry_start);
+int test_bit(uint8_t *map, int bit);
+void set_bit(uint8_t *map, int bit);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+    int path_count = 0;
+
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-r") == 0){
+            recursive = 1;
+        }else if(strcmp(argv[i], "-p") == 0){
+            punch_holes = 1;
+        }else if(strcmp(argv[i], "-j") == 0){
+            use_journal = 1;
+        }else{
+            path_count++;
+        }
+    }
+    if(argc < 3 || path_count == 0){
+        printf("Input format: ./diskrm {image file} {image path} [{image path} ...] [-r] [-p] [-j]\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+    decode_fat(p);
+
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "-j") == 0){
+            continue;
+        }
+        removeInfo.matches = 0;
+        split_path(argv[i]);
+        if(removeInfo.component_count == 0){
+            printf("%s: refusing to remove the root directory\n", argv[i]);
+            removeInfo.errors++;
+            continue;
+        }
+        strcpy(removeInfo.path, "");
+        remove_matches(p, 0, 0);
+        if(removeInfo.matches == 0){
+            printf("%s: no such file or directory\n", argv[i]);
+            removeInfo.errors++;
+        }
+    }
+
+    if(use_journal){
+        journal_changes(p, argv[1]);
+    }
+
+    // entries are gone before their clusters are freed, a crash in between only leaves lost clusters
+    msync(p, sb.st_size, MS_SYNC);
+    write_fat(p);
+    msync(p, sb.st_size, MS_SYNC);
+    munmap(p, sb.st_size);
+
+    if(punch_holes){
+        punch_freed(fd);
+    }
+    close(fd);
+
+    printf("Removed %d files and %d directories, freed %d clusters\n", removeInfo.files, removeInfo.dirs, removeInfo.freed_clusters);
+	return removeInfo.errors == 0 ? 0 : 1;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: decode_fat(char *p)
+* =================================
+* Purpose: decode the first FAT into a flat table and allocate the freed cluster bitmap
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void decode_fat(char *p){
+    int count = diskInfo.cluster_count;
+
+    removeInfo.fat_table = malloc(sizeof(uint32_t)*count);
+    removeInfo.freed = calloc((count / 8) + 1, 1);
+
+    for(int i = 0; i < count; i++){
+        removeInfo.fat_table[i] = get_fat_entry(p, i);
+    }
+}
+
+
+/*
+* Function: split_path(char *input)
+* =================================
+* Purpose: split an image path into upper case components, each may hold * ? [] wildcards
+*
+* Input:
+*   char* input: path as given on the command line
+*
+*/
+void split_path(char *input){
+    char *copy = strdup(input);
+
+    removeInfo.component_count = 0;
+    for(char *part = strtok(copy, "/"); part != NULL && removeInfo.component_count < MAX_DEPTH; part = strtok(NULL, "/")){
+        if(strcmp(part, ".") == 0){
+            continue;
+        }
+        for(int i = 0; part[i] != '\0'; i++){
+            part[i] = toupper((unsigned char)part[i]);
+        }
+        removeInfo.components[removeInfo.component_count++] = part;
+    }
+}
+
+
+/*
+* Function: remove_matches(char *p, uint32_t dir_flc, int depth)
+* =================================
+* Purpose: find the entries of a directory matching one path component, removing them
+*          at the last component and descending into matching directories before that
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   int depth: index of the path component to match
+*
+*/
+void remove_matches(char *p, uint32_t dir_flc, int depth){
+    char name[13];
+    char saved_path[256];
+    int last = (depth == removeInfo.component_count - 1);
+    int entries_per_cluster = diskInfo.cluster_bytes / 32;
+    // the FAT32 root is a cluster chain like any sub directory
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    char *first_entry;
+    int entry_count;
+
+    strcpy(saved_path, removeInfo.path);
+    for(int steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(cluster == 0){
+            first_entry = p + (diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            first_entry = cluster_ptr(p, cluster);
+            entry_count = entries_per_cluster;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = first_entry + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                return;
+            }
+            if(skip_entry(entry_start)){
+                continue;
+            }
+            entry_name(entry_start, name);
+            if(fnmatch(removeInfo.components[depth], name, 0) != 0){
+                continue;
+            }
+
+            snprintf(removeInfo.path, sizeof(removeInfo.path), "%s/%s", saved_path, name);
+            if(last){
+                removeInfo.matches++;
+                remove_entry(p, entry_start, first_entry);
+            }else if(entry_start[11] & 0x10){
+                remove_matches(p, get_entry_flc(entry_start), depth + 1);
+            }
+            strcpy(removeInfo.path, saved_path);
+        }
+
+        if(cluster == 0){
+            return;
+        }
+        cluster = removeInfo.fat_table[cluster];
+        if(cluster < 2 || cluster >= diskInfo.cluster_count){
+            return;
+        }
+    }
+}
+
+
+/*
+* Function: remove_entry(char *p, char *entry_start, char *first_entry)
+* =================================
+* Purpose: remove one file or directory: free its chain and mark its entry and the
+*          long name entries in front of it deleted
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the directory entry
+*   char* first_entry: first entry of the same directory cluster, bounds the long name walk
+*
+*/
+void remove_entry(char *p, char *entry_start, char *first_entry){
+    uint32_t flc = get_entry_flc(entry_start);
+
+    if(entry_start[11] & 0x10){
+        if(!recursive){
+            printf("%s: is a directory, use -r\n", removeInfo.path);
+            removeInfo.errors++;
+            return;
+        }
+        remove_tree(p, flc);
+        removeInfo.dirs++;
+    }else{
+        removeInfo.files++;
+    }
+    free_chain(flc);
+
+    mark_deleted(p, entry_start);
+    for(char *lfn = entry_start - 32; lfn >= first_entry && lfn[11] == 0x0F && (uint8_t)lfn[0] != 0xE5; lfn -= 32){
+        mark_deleted(p, lfn);
+    }
+}
+
+
+/*
+* Function: mark_deleted(char *p, char *entry_start)
+* =================================
+* Purpose: mark a directory entry deleted and remember its offset for the journal
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry_start: start location of the directory entry
+*
+*/
+void mark_deleted(char *p, char *entry_start){
+    entry_start[0] = (char)0xE5;
+    removed_entries = realloc(removed_entries, sizeof(uint32_t)*(removed_entry_count + 1));
+    removed_entries[removed_entry_count++] = entry_start - p;
+}
+
+
+/*
+* Function: remove_tree(char *p, uint32_t dir_flc)
+* =================================
+* Purpose: remove everything inside a directory
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory
+*
+*/
+void remove_tree(char *p, uint32_t dir_flc){
+    char name[13];
+    char saved_path[256];
+    int entries_per_cluster = diskInfo.cluster_bytes / 32;
+    uint32_t cluster = dir_flc;
+
+    strcpy(saved_path, removeInfo.path);
+    for(int steps = 0; steps < diskInfo.cluster_count && cluster >= 2 && cluster < diskInfo.cluster_count; steps++){
+        char *first_entry = cluster_ptr(p, cluster);
+        for(int k = 0; k < entries_per_cluster; k++){
+            char *entry_start = first_entry + 32*k;
+            if((uint8_t)entry_start[0] == 0x00){
+                return;
+            }
+            if(skip_entry(entry_start)){
+                continue;
+            }
+            entry_name(entry_start, name);
+            snprintf(removeInfo.path, sizeof(removeInfo.path), "%s/%s", saved_path, name);
+            remove_entry(p, entry_start, first_entry);
+            strcpy(removeInfo.path, saved_path);
+        }
+        cluster = removeInfo.fat_table[cluster];
+    }
+}
+
+
+/*
+* Function: free_chain(uint32_t flc)
+* =================================
+* Purpose: free a chain in the decoded FAT, nothing is written to the image yet
+*
+* Input:
+*   uint32_t flc: first logical cluster of the chain
+*
+*/
+void free_chain(uint32_t flc){
+    uint32_t cluster = flc;
+
+    for(int steps = 0; steps < diskInfo.cluster_count && cluster >= 2 && cluster < diskInfo.cluster_count; steps++){
+        uint32_t next = removeInfo.fat_table[cluster];
+        if(next == 0x000 || test_bit(removeInfo.freed, cluster)){
+            return;
+        }
+        removeInfo.fat_table[cluster] = 0x000;
+        set_bit(removeInfo.freed, cluster);
+        removeInfo.freed_clusters++;
+        cluster = next;
+    }
+}
+
+
+/*
+* Function: write_fat(char *p)
+* =================================
+* Purpose: encode the freed clusters into the first FAT, then copy each run of
+*          changed FAT sectors over the other FAT copies with one memcpy per run.
+*          FAT32 also gets its FSInfo free count updated
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void write_fat(char *p){
+    int sector_bytes = diskInfo.bytes_per_sector;
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * sector_bytes;
+    char *fat_start = p + diskInfo.fat_start;
+    uint8_t *dirty_sectors = calloc(diskInfo.sector_per_fat + 1, 1);
+
+    // a 12 bit entry can straddle two sectors, 16 and 32 bit entries never do
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        if(test_bit(removeInfo.freed, c)){
+            set_next_fat_entry(p, c, 0x000);
+            dirty_sectors[fat_entry_offset(c) / sector_bytes] = 1;
+            dirty_sectors[(fat_entry_offset(c) + 1) / sector_bytes] = 1;
+        }
+    }
+
+    for(int s = 0; s < diskInfo.sector_per_fat; s++){
+        if(!dirty_sectors[s]){
+            continue;
+        }
+        int run = 1;
+        while(s + run < diskInfo.sector_per_fat && dirty_sectors[s + run]){
+            run++;
+        }
+        for(int i = 1; i < diskInfo.num_of_fats; i++){
+            memcpy(fat_start + i*fat_bytes + (size_t)s*sector_bytes, fat_start + (size_t)s*sector_bytes, (size_t)run * sector_bytes);
+        }
+        s += run;
+    }
+    free(dirty_sectors);
+    update_fsinfo(p);
+}
+
+
+/*
+* Function: punch_freed(int fd)
+* =================================
+* Purpose: give the freed clusters back to the host file system, one fallocate call
+*          per run of freed clusters. The image size does not change and the holes read as zeros
+*
+* Input:
+*   int fd: image file descriptor
+*
+*/
+void punch_freed(int fd){
+    int runs = 0;
+
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        if(!test_bit(removeInfo.freed, c)){
+            continue;
+        }
+        int start = c;
+        while(c < diskInfo.cluster_count && test_bit(removeInfo.freed, c)){
+            c++;
+        }
+        off_t offset = (off_t)calc_data_loc(NULL, start) * diskInfo.bytes_per_sector;
+        if(fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, (off_t)(c - start) * diskInfo.cluster_bytes) != 0){
+            printf("Warning: the host file system does not support punching holes\n");
+            return;
+        }
+        runs++;
+    }
+    printf("Punched %d holes in the image file\n", runs);
+}
+
+
+/*
+* Function: journal_changes(char *p, char *image_name)
+* =================================
+* Purpose: append the FAT sectors and directory entries this run changes to the
+*          change journal {image}.jnl and fsync it. Freed clusters keep their data, so
+*          they are not journaled
+*
+* Input:
+*   char* p: image data pointer
+*   char* image_name: image file name
+*
+*/
+void journal_changes(char *p, char *image_name){
+    char journal_name[4096];
+    struct journalRecord record;
+    int last_sector = -1;
+
+    snprintf(journal_name, sizeof(journal_name), "%s.jnl", image_name);
+    FILE *journal = fopen(journal_name, "a");
+    if(journal == NULL){
+        printf("Error: failed to open %s\n", journal_name);
+        exit(1);
+    }
+    if(ftell(journal) == 0){
+        fwrite("FATJNL1", 8, 1, journal);
+    }
+    memset(&record, 0, sizeof(record));
+
+    record.kind = 'F';
+    for(int c = 2; c < diskInfo.cluster_count; c++){
+        if(test_bit(removeInfo.freed, c)){
+            for(size_t byte = fat_entry_offset(c); byte <= fat_entry_offset(c) + 1; byte++){
+                int sector = byte / diskInfo.bytes_per_sector;
+                if(sector != last_sector){
+                    record.value = sector;
+                    fwrite(&record, sizeof(record), 1, journal);
+                    last_sector = sector;
+                }
+            }
+        }
+    }
+
+    record.kind = 'E';
+    for(int i = 0; i < removed_entry_count; i++){
+        record.value = removed_entries[i] / 32;
+        fwrite(&record, sizeof(record), 1, journal);
+    }
+
+    // the FAT32 FSInfo sector is rewritten with the new free count
+    if(diskInfo.fat_type == 32 && removeInfo.freed_clusters > 0){
+        uint16_t fsinfo_sector;
+        memcpy(&fsinfo_sector, (p + 48), 2);
+        record.kind = 'S';
+        record.value = fsinfo_sector;
+        fwrite(&record, sizeof(record), 1, journal);
+    }
+
+    if(fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+        printf("Error: failed to write %s\n", journal_name);
+        exit(1);
+    }
+    fclose(journal);
+}
+
+
+/*
+* Function: skip_entry(char *entry_start)
+* =================================
+* Purpose: check for entries that are never matched: deleted, long name, volume label, . and ..
+*
+* Input:
+*   char* entry_start: start location of the directory entry
+*
+*/
+int skip_entry(char *entry_start){
+    uint8_t first = (uint8_t)entry_start[0];
+    uint8_t attributes = (uint8_t)entry_start[11];
+
+    return first == 0xE5 || first == '.' || attributes == 0x0F || (attributes & 0x08);
+}
+
+
+/*
+* Function: entry_name(char *entry_start, char *name_out)
+* =================================
+* Purpose: build the NAME.EXT form of an 8.3 entry name
+*
+* Input:
+*   char* entry_start: start location of the directory entry
+*   char* name_out: output string location, at least 13 bytes
+*
+*/
+void entry_name(char *entry_start, char *name_out){
+    int len = 0;
+
+    for(int i = 0; i < 8 && entry_start[i] != ' '; i++){
+        name_out[len++] = entry_start[i];
+    }
+    if(entry_start[8] != ' '){
+        name_out[len++] = '.';
+    }
+    for(int i = 8; i < 11 && entry_start[i] != ' '; i++){
+        name_out[len++] = entry_start[i];
+    }
+    name_out[len] = '\0';
+}
+
+
+/*
+* Function: cluster_ptr(char *p, uint32_t cluster)
+* =================================
+* Purpose: get a pointer to the data of a cluster
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t cluster: cluster number
+*
+*/
+char* cluster_ptr(char *p, uint32_t cluster){
+    return p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT (1.5, 2 or 4 bytes per entry)
+*
+* Input:
+*   uint32_t cluster: cluster number
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    size_t ent_offset = fat_entry_offset(flc);
+
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + ent_offset), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+    if(diskInfo.fat_type == 16){
+        return entry;
+    }
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc)
+* =================================
+* Purpose: set the entry value at a FAT location
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: location of entry
+*   uint32_t next_flc: entry to be put into FAT
+*
+*/
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc){
+    char *fat = p + diskInfo.fat_start;
+    size_t ent_offset = fat_entry_offset(flc);
+    uint8_t first, second;
+
+    if(diskInfo.fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        return;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
+        first = (uint8_t)(0xff & next_flc);
+        second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
+
+    }else{
+        first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
+        second = (uint8_t)(0xff & (next_flc >> 4));
+    }
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
+}
+
+
+/*
+* Function: update_fsinfo(char *p)
+* =================================
+* Purpose: store the free cluster count of the decoded FAT in the FAT32 FSInfo sector
+*          and drop its next free hint
+*
+* Input:
+*   char* p: image data pointer
+*
+* Return:
+*   int: the FSInfo sector, 0 when the image has none
+*
+*/
+int update_fsinfo(char *p){
+    uint16_t fsinfo_sector;
+    uint32_t signature;
+    uint32_t free_count = 0;
+    uint32_t next_free = 0xFFFFFFFF;
+
+    if(diskInfo.fat_type != 32){
+        return 0;
+    }
+    memcpy(&fsinfo_sector, (p + 48), 2);
+    if(fsinfo_sector == 0 || fsinfo_sector >= diskInfo.reserved_sectors){
+        return 0;
+    }
+    char *fsinfo = p + (size_t)fsinfo_sector * diskInfo.bytes_per_sector;
+    memcpy(&signature, fsinfo, 4);
+    if(signature != 0x41615252){
+        return 0;
+    }
+
+    for(uint32_t c = 2; c < diskInfo.cluster_count; c++){
+        if(removeInfo.fat_table[c] == 0){
+            free_count++;
+        }
+    }
+    memcpy((fsinfo + 488), &free_count, 4);
+    memcpy((fsinfo + 492), &next_free, 4);
+    return fsinfo_sector;
+}
+
+
+/*
+* Function: test_bit(uint8_t *map, int bit) / set_bit(uint8_t *map, int bit)
+* =================================
+* Purpose: read and change single bits of a cluster bitmap
+*
+*/
+int test_bit(uint8_t *map, int bit){
+    return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+void set_bit(uint8_t *map, int bit){
+    map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+}
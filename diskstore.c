@@ -0,0 +1,1137 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Keep FAT12/FAT16/FAT32 images in a content addressed store that holds each
+*            distinct block of data once, and rebuild any stored image on demand
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+#define STORE_MAX_DEPTH 64
+#define STORE_RUN_CLUSTERS 64        // longest cluster run hashed as one block
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// cluster owners while an image is split into records
+#define OWNER_NONE 0                 // free, lost or past a broken chain
+#define OWNER_DIR 1                  // directory cluster, kept in the recipe
+#define OWNER_FILE 2                 // file data, kept in the block pack
+#define OWNER_FILE_START 3           // file data that starts a new block
+
+// recipe records, they cover the image front to back
+#define RECIPE_RAW 0                 // bytes follow in the recipe
+#define RECIPE_BLOCK 1               // a 32 byte block hash follows
+#define RECIPE_ZERO 2                // zero bytes, nothing follows
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// running SHA-256 state, see disksum.c
+struct sha256{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    int used;
+};
+
+// {store}/blocks.idx: one record per block in {store}/blocks.pack
+struct indexRecord{
+    uint8_t hash[32];
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+// {store}/recipes/{image name}: header, then records until image_size bytes are covered
+struct recipeHeader{
+    char magic[8];               // "FATRCP1"
+    uint64_t image_size;
+    uint32_t record_count;
+    uint32_t reserved;
+};
+
+struct recipeRecord{
+    uint32_t kind;
+    uint32_t length;
+};
+
+// the block index, an open addressing table keyed by the block hash
+struct blockStore{
+    char *dir;
+    int pack_fd;
+    int index_fd;
+    uint64_t pack_size;
+    struct indexRecord *slots;
+    size_t capacity;             // power of two, at most half full
+    size_t count;
+    struct indexRecord *pending; // index records of blocks added since the last commit
+    int pending_count;
+}blockStore;
+
+// the recipe being built for one image
+struct recipe{
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t last;                 // offset of the last record, merged with the next RAW or ZERO one
+    uint32_t record_count;
+    uint8_t *owners;             // OWNER_* per cluster
+    long long new_blocks;
+    long long new_bytes;
+    long long zero_bytes;
+}recipe;
+
+static const uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+void open_store(char *dir, int create);
+void commit_store();
+struct indexRecord *find_block(uint8_t *hash);
+struct indexRecord *insert_block(struct indexRecord *record);
+void add_image(char *image_path);
+void mark_directory(char *p, uint32_t dir_flc, int depth);
+void mark_file(char *p, uint32_t flc, uint32_t size);
+void add_data(char *data, size_t len);
+void add_sectors(char *data, size_t len);
+void add_record(uint32_t kind, char *data, size_t len);
+void recipe_append(const void *data, size_t len);
+void get_image(char *name, char *out_path);
+void list_images();
+char *recipe_path(char *name);
+void write_all(int fd, const void *data, size_t len, uint64_t offset);
+void read_all(int fd, void *data, size_t len, uint64_t offset);
+void sha256_init(struct sha256 *sha);
+void sha256_update(struct sha256 *sha, const uint8_t *data, size_t len);
+void sha256_final(struct sha256 *sha, uint8_t *digest);
+void sha256_block(uint32_t *state, const uint8_t *block);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+    if(argc >= 4 && strcmp(argv[2], "add") == 0){
+        open_store(argv[1], 1);
+        for(int i = 3; i < argc; i++){
+            add_image(argv[i]);
+        }
+    }else if(argc == 5 && strcmp(argv[2], "get") == 0){
+        open_store(argv[1], 0);
+        get_image(argv[3], argv[4]);
+    }else if(argc == 3 && strcmp(argv[2], "list") == 0){
+        open_store(argv[1], 0);
+        list_images();
+    }else{
+        printf("Input format: ./diskstore {store dir} add {image file} [...]\n");
+        printf("              ./diskstore {store dir} get {image name} {output file}\n");
+        printf("              ./diskstore {store dir} list\n");
+        exit(1);
+    }
+
+    close(blockStore.pack_fd);
+    close(blockStore.index_fd);
+    free(blockStore.slots);
+	return 0;
+}
+
+
+/*
+* Function: open_store(char *dir, int create)
+* =================================
+* Purpose: open the block pack and load the block index of a store. Index records
+*          past the end of the pack or cut short by a crash are ignored. The index file
+*          stays locked until the process exits, exclusively for add
+*
+* Input:
+*   char* dir: store directory
+*   int create: 1 to create the store if it does not exist
+*
+*/
+void open_store(char *dir, int create){
+    char path[PATH_MAX];
+    struct stat sb;
+    struct indexRecord record;
+
+    if(create){
+        mkdir(dir, 0755);
+        snprintf(path, sizeof(path), "%s/recipes", dir);
+        mkdir(path, 0755);
+    }
+    blockStore.dir = dir;
+
+    snprintf(path, sizeof(path), "%s/blocks.pack", dir);
+    blockStore.pack_fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    snprintf(path, sizeof(path), "%s/blocks.idx", dir);
+    blockStore.index_fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if(blockStore.pack_fd < 0 || blockStore.index_fd < 0){
+        printf("Error: %s is not a store\n", dir);
+        exit(1);
+    }
+
+    // an add appends at the pack size read here, so adds to one store take turns
+    if(flock(blockStore.index_fd, create ? LOCK_EX : LOCK_SH) != 0){
+        printf("Error: failed to lock %s\n", dir);
+        exit(1);
+    }
+    fstat(blockStore.pack_fd, &sb);
+    blockStore.pack_size = sb.st_size;
+
+    blockStore.capacity = 1024;
+    blockStore.slots = calloc(blockStore.capacity, sizeof(struct indexRecord));
+
+    fstat(blockStore.index_fd, &sb);
+    size_t records = sb.st_size / sizeof(struct indexRecord);
+    for(size_t i = 0; i < records; i++){
+        read_all(blockStore.index_fd, &record, sizeof(record), i * sizeof(record));
+        if(record.length > 0 && record.offset + record.length <= blockStore.pack_size){
+            insert_block(&record);
+        }
+    }
+}
+
+
+/*
+* Function: commit_store()
+* =================================
+* Purpose: make the blocks added for an image durable: the pack is flushed before the
+*          index records that point into it are appended
+*
+*/
+void commit_store(){
+    struct stat sb;
+
+    if(blockStore.pending_count == 0){
+        return;
+    }
+    if(fdatasync(blockStore.pack_fd) != 0){
+        printf("Error: failed to write the block pack\n");
+        exit(1);
+    }
+
+    // whole records only, a torn record at the end is dropped by the next open_store()
+    fstat(blockStore.index_fd, &sb);
+    uint64_t end = (sb.st_size / sizeof(struct indexRecord)) * sizeof(struct indexRecord);
+    write_all(blockStore.index_fd, blockStore.pending, sizeof(struct indexRecord)*blockStore.pending_count, end);
+    if(fdatasync(blockStore.index_fd) != 0){
+        printf("Error: failed to write the block index\n");
+        exit(1);
+    }
+    blockStore.pending_count = 0;
+}
+
+
+/*
+* Function: find_block(uint8_t *hash)
+* =================================
+* Purpose: look a block up by its SHA-256
+*
+* Input:
+*   uint8_t* hash: 32 byte block hash
+*
+* Return:
+*   struct indexRecord*: the block, NULL if the store does not have it
+*
+*/
+struct indexRecord *find_block(uint8_t *hash){
+    uint64_t key;
+
+    memcpy(&key, hash, 8);
+    for(size_t i = key & (blockStore.capacity - 1); blockStore.slots[i].length != 0; i = (i + 1) & (blockStore.capacity - 1)){
+        if(memcmp(blockStore.slots[i].hash, hash, 32) == 0){
+            return &blockStore.slots[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Function: insert_block(struct indexRecord *record)
+* =================================
+* Purpose: add a block to the index, the table doubles before it is half full
+*
+* Input:
+*   struct indexRecord* record: the block
+*
+* Return:
+*   struct indexRecord*: the stored copy, the existing one for a known hash
+*
+*/
+struct indexRecord *insert_block(struct indexRecord *record){
+    struct indexRecord *existing = find_block(record->hash);
+    uint64_t key;
+
+    if(existing != NULL){
+        return existing;
+    }
+    if((blockStore.count + 1) * 2 > blockStore.capacity){
+        struct indexRecord *old = blockStore.slots;
+        size_t old_capacity = blockStore.capacity;
+
+        blockStore.capacity *= 2;
+        blockStore.slots = calloc(blockStore.capacity, sizeof(struct indexRecord));
+        blockStore.count = 0;
+        for(size_t i = 0; i < old_capacity; i++){
+            if(old[i].length != 0){
+                insert_block(&old[i]);
+            }
+        }
+        free(old);
+    }
+
+    memcpy(&key, record->hash, 8);
+    size_t i = key & (blockStore.capacity - 1);
+    while(blockStore.slots[i].length != 0){
+        i = (i + 1) & (blockStore.capacity - 1);
+    }
+    blockStore.slots[i] = *record;
+    blockStore.count++;
+    return &blockStore.slots[i];
+}
+
+
+/*
+* Function: add_image(char *image_path)
+* =================================
+* Purpose: split an image into recipe records and store it. The reserved sectors, the fixed
+*          root and directory clusters stay in the recipe, every FAT copy and every run of
+*          file clusters becomes a block, zero filled ranges take no space at all
+*
+* Input:
+*   char* image_path: image file
+*
+*/
+void add_image(char *image_path){
+    struct stat sb;
+    struct recipeHeader header;
+
+    // recipes are named after the image file, an image of the same name is never replaced
+    char *name = strrchr(image_path, '/') ? strrchr(image_path, '/') + 1 : image_path;
+    char *final_path = recipe_path(name);
+    if(access(final_path, F_OK) == 0){
+        printf("Error: the store already has an image named %s\n", name);
+        exit(1);
+    }
+
+    int fd = open(image_path, O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open %s\n", image_path);
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+    madvise(p, sb.st_size, MADV_SEQUENTIAL);
+
+    // the geometry divides by both fields
+    if(sb.st_size < 512 || *(uint16_t *)(p + 11) == 0 || *(uint8_t *)(p + 13) == 0){
+        printf("Error: %s is not a FAT image\n", image_path);
+        exit(1);
+    }
+    get_geometry(p);
+    size_t data_start = (size_t)diskInfo.data_region_start * diskInfo.bytes_per_sector;
+    size_t data_end = data_start + (size_t)(diskInfo.cluster_count - 2) * diskInfo.cluster_bytes;
+    if(diskInfo.data_region_start >= diskInfo.sector_count || data_end > (size_t)sb.st_size){
+        printf("Error: %s is not a FAT image\n", image_path);
+        exit(1);
+    }
+
+    memset(&recipe, 0, sizeof(recipe));
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, "FATRCP1");
+    header.image_size = sb.st_size;
+    recipe_append(&header, sizeof(header));
+
+    // which cluster holds what, found from the directory tree
+    recipe.owners = calloc(diskInfo.cluster_count, 1);
+    mark_directory(p, 0, 0);
+
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * diskInfo.bytes_per_sector;
+    add_sectors(p, diskInfo.fat_start);
+    for(int k = 0; k < diskInfo.num_of_fats; k++){
+        add_data(p + diskInfo.fat_start + k * fat_bytes, fat_bytes);
+    }
+    size_t root_start = diskInfo.fat_start + diskInfo.num_of_fats * fat_bytes;
+    add_sectors(p + root_start, data_start - root_start);
+
+    for(uint32_t c = 2; c < diskInfo.cluster_count; ){
+        uint8_t owner = recipe.owners[c];
+        uint32_t run = 1;
+
+        // file blocks end at the next block start, the other kinds at the next owner change
+        if(owner == OWNER_FILE || owner == OWNER_FILE_START){
+            while(c + run < diskInfo.cluster_count && recipe.owners[c + run] == OWNER_FILE && run < STORE_RUN_CLUSTERS){
+                run++;
+            }
+        }else{
+            while(c + run < diskInfo.cluster_count && recipe.owners[c + run] == owner && run < STORE_RUN_CLUSTERS){
+                run++;
+            }
+        }
+
+        char *data = p + data_start + (size_t)(c - 2) * diskInfo.cluster_bytes;
+        if(owner == OWNER_DIR){
+            add_sectors(data, (size_t)run * diskInfo.cluster_bytes);
+        }else{
+            add_data(data, (size_t)run * diskInfo.cluster_bytes);
+        }
+        c += run;
+    }
+    // sectors past the last whole cluster and anything appended to the image
+    if(data_end < (size_t)sb.st_size){
+        add_data(p + data_end, sb.st_size - data_end);
+    }
+    memcpy(recipe.data + offsetof(struct recipeHeader, record_count), &recipe.record_count, 4);
+
+    // blocks first, then the recipe that names them, linked into place in one step
+    commit_store();
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", final_path);
+    int out_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out_fd < 0){
+        printf("Error: failed to create %s\n", temp_path);
+        exit(1);
+    }
+    write_all(out_fd, recipe.data, recipe.len, 0);
+    if(fdatasync(out_fd) != 0 || link(temp_path, final_path) != 0){
+        printf("Error: failed to write %s\n", final_path);
+        unlink(temp_path);
+        exit(1);
+    }
+    unlink(temp_path);
+    close(out_fd);
+
+    printf("%s: %lld bytes, recipe %zu bytes, %lld new blocks (%lld bytes), %lld zero bytes\n", name,
+        (long long)sb.st_size, recipe.len, recipe.new_blocks, recipe.new_bytes, recipe.zero_bytes);
+
+    free(final_path);
+    free(recipe.owners);
+    free(recipe.data);
+    munmap(p, sb.st_size);
+    close(fd);
+}
+
+
+/*
+* Function: mark_directory(char *p, uint32_t dir_flc, int depth)
+* =================================
+* Purpose: mark the clusters of a directory and of everything below it
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   int depth: nesting level, guards against directory loops
+*
+*/
+void mark_directory(char *p, uint32_t dir_flc, int depth){
+    int fixed_root = (dir_flc == 0 && diskInfo.fat_type != 32);
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    char *start;
+    int entry_count;
+
+    if(depth > STORE_MAX_DEPTH){
+        return;
+    }
+
+    for(uint32_t steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(fixed_root){
+            start = p + (size_t)(diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            // a cluster already marked means a loop or a cross link
+            if(cluster < 2 || cluster >= diskInfo.cluster_count || recipe.owners[cluster] != OWNER_NONE){
+                return;
+            }
+            recipe.owners[cluster] = OWNER_DIR;
+            start = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+            uint32_t size;
+
+            if(first == 0x00){
+                return;
+            }
+            // deleted, long name, volume label and the . and .. entries
+            if(first == 0xE5 || entry_start[11] == 0x0F || (entry_start[11] & 0x08) || first == '.'){
+                continue;
+            }
+            if(entry_start[11] & 0x10){
+                mark_directory(p, get_entry_flc(entry_start), depth + 1);
+            }else{
+                memcpy(&size, (entry_start + 28), 4);
+                mark_file(p, get_entry_flc(entry_start), size);
+            }
+        }
+
+        if(fixed_root){
+            return;
+        }
+        cluster = get_fat_entry(p, cluster);
+        if(cluster < 2 || cluster >= diskInfo.eoc_min){
+            return;
+        }
+    }
+}
+
+
+/*
+* Function: mark_file(char *p, uint32_t flc, uint32_t size)
+* =================================
+* Purpose: mark the clusters of a file. A block starts at the first cluster, wherever the
+*          chain jumps and every STORE_RUN_CLUSTERS clusters of the file, so the same file
+*          gives the same blocks in every image it is stored contiguously in
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*   uint32_t size: file size
+*
+*/
+void mark_file(char *p, uint32_t flc, uint32_t size){
+    uint32_t needed = (uint32_t)(((uint64_t)size + diskInfo.cluster_bytes - 1) / diskInfo.cluster_bytes);
+    uint32_t cluster = flc;
+    uint32_t prev = 0;
+
+    for(uint32_t n = 0; n < needed && cluster >= 2 && cluster < diskInfo.cluster_count; n++){
+        if(recipe.owners[cluster] != OWNER_NONE){
+            return;
+        }
+        recipe.owners[cluster] = (n % STORE_RUN_CLUSTERS == 0 || cluster != prev + 1) ? OWNER_FILE_START : OWNER_FILE;
+        prev = cluster;
+        cluster = get_fat_entry(p, cluster);
+    }
+}
+
+
+/*
+* Function: add_data(char *data, size_t len)
+* =================================
+* Purpose: add a range of the image as a zero record or as a block, a block the store
+*          does not have yet is appended to the pack
+*
+* Input:
+*   char* data: start of the range in the image
+*   size_t len: length of the range
+*
+*/
+void add_data(char *data, size_t len){
+    struct sha256 sha;
+    struct indexRecord record;
+    size_t k = 0;
+
+    while(k < len && data[k] == 0){
+        k++;
+    }
+    if(k == len){
+        add_record(RECIPE_ZERO, NULL, len);
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    sha256_init(&sha);
+    sha256_update(&sha, (const uint8_t *)data, len);
+    sha256_final(&sha, record.hash);
+
+    if(find_block(record.hash) == NULL){
+        record.offset = blockStore.pack_size;
+        record.length = len;
+        write_all(blockStore.pack_fd, data, len, record.offset);
+        blockStore.pack_size += len;
+        insert_block(&record);
+
+        blockStore.pending = realloc(blockStore.pending, sizeof(struct indexRecord)*(blockStore.pending_count + 1));
+        blockStore.pending[blockStore.pending_count++] = record;
+        recipe.new_blocks++;
+        recipe.new_bytes += len;
+    }
+    add_record(RECIPE_BLOCK, (char *)record.hash, 32);
+}
+
+
+/*
+* Function: add_sectors(char *data, size_t len)
+* =================================
+* Purpose: add metadata sectors to the recipe itself, zero sectors as zero records
+*
+* Input:
+*   char* data: start of the range in the image
+*   size_t len: length of the range
+*
+*/
+void add_sectors(char *data, size_t len){
+    for(size_t start = 0; start < len; start += diskInfo.bytes_per_sector){
+        size_t sector_len = (len - start < diskInfo.bytes_per_sector) ? len - start : diskInfo.bytes_per_sector;
+        size_t k = 0;
+
+        while(k < sector_len && data[start + k] == 0){
+            k++;
+        }
+        add_record((k == sector_len) ? RECIPE_ZERO : RECIPE_RAW, data + start, sector_len);
+    }
+}
+
+
+/*
+* Function: add_record(uint32_t kind, char *data, size_t len)
+* =================================
+* Purpose: append a record to the recipe, a RAW or ZERO record right after one of the
+*          same kind is merged into it
+*
+* Input:
+*   uint32_t kind: RECIPE_RAW, RECIPE_BLOCK or RECIPE_ZERO
+*   char* data: RAW bytes or the block hash, NULL for ZERO
+*   size_t len: bytes of the image covered, 32 for a block hash
+*
+*/
+void add_record(uint32_t kind, char *data, size_t len){
+    struct recipeRecord record;
+
+    if(len == 0){
+        return;
+    }
+    if(kind == RECIPE_ZERO){
+        recipe.zero_bytes += len;
+    }
+    if(kind != RECIPE_BLOCK && recipe.record_count > 0){
+        memcpy(&record, recipe.data + recipe.last, sizeof(record));
+        if(record.kind == kind && (uint64_t)record.length + len <= UINT32_MAX){
+            record.length += len;
+            memcpy(recipe.data + recipe.last, &record, sizeof(record));
+            if(kind == RECIPE_RAW){
+                recipe_append(data, len);
+            }
+            return;
+        }
+    }
+
+    // the length of a BLOCK record is the length of the block, found in the index
+    record.kind = kind;
+    record.length = (kind == RECIPE_BLOCK) ? find_block((uint8_t *)data)->length : len;
+    recipe.last = recipe.len;
+    recipe.record_count++;
+    recipe_append(&record, sizeof(record));
+    if(kind != RECIPE_ZERO){
+        recipe_append(data, len);
+    }
+}
+
+
+/*
+* Function: recipe_append(const void *data, size_t len)
+* =================================
+* Purpose: append bytes to the recipe buffer
+*
+*/
+void recipe_append(const void *data, size_t len){
+    if(recipe.len + len > recipe.cap){
+        recipe.cap = (recipe.len + len) * 2;
+        recipe.data = realloc(recipe.data, recipe.cap);
+    }
+    memcpy(recipe.data + recipe.len, data, len);
+    recipe.len += len;
+}
+
+
+/*
+* Function: get_image(char *name, char *out_path)
+* =================================
+* Purpose: rebuild a stored image from its recipe, every block is checked against its
+*          hash on the way out and zero records are left as holes
+*
+* Input:
+*   char* name: image name in the store
+*   char* out_path: file to write
+*
+*/
+void get_image(char *name, char *out_path){
+    struct recipeHeader header;
+    struct recipeRecord record;
+    struct sha256 sha;
+    uint8_t hash[32];
+    uint8_t digest[32];
+    uint64_t offset = 0;
+    char *buf = NULL;
+    size_t buf_len = 0;
+
+    char *path = recipe_path(name);
+    FILE *fptr = fopen(path, "r");
+    if(fptr == NULL){
+        printf("Error: %s is not in the store\n", name);
+        exit(1);
+    }
+    if(fread(&header, sizeof(header), 1, fptr) != 1 || strcmp(header.magic, "FATRCP1") != 0){
+        printf("Error: %s is not a recipe\n", path);
+        exit(1);
+    }
+
+    int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out_fd < 0){
+        printf("Error: failed to create %s\n", out_path);
+        exit(1);
+    }
+
+    for(uint32_t i = 0; i < header.record_count; i++){
+        if(fread(&record, sizeof(record), 1, fptr) != 1){
+            printf("Error: %s is cut short\n", path);
+            exit(1);
+        }
+        if(record.kind == RECIPE_ZERO){
+            offset += record.length;
+            continue;
+        }
+
+        if(record.length > buf_len){
+            buf_len = record.length;
+            buf = realloc(buf, buf_len);
+        }
+        if(record.kind == RECIPE_RAW){
+            if(fread(buf, 1, record.length, fptr) != record.length){
+                printf("Error: %s is cut short\n", path);
+                exit(1);
+            }
+        }else{
+            if(fread(hash, 32, 1, fptr) != 1){
+                printf("Error: %s is cut short\n", path);
+                exit(1);
+            }
+            struct indexRecord *block = find_block(hash);
+            if(block == NULL || block->length != record.length){
+                printf("Error: a block of %s is missing from the store\n", name);
+                exit(1);
+            }
+            read_all(blockStore.pack_fd, buf, record.length, block->offset);
+            sha256_init(&sha);
+            sha256_update(&sha, (const uint8_t *)buf, record.length);
+            sha256_final(&sha, digest);
+            if(memcmp(digest, hash, 32) != 0){
+                printf("Error: a block of %s is damaged in the store\n", name);
+                exit(1);
+            }
+        }
+        write_all(out_fd, buf, record.length, offset);
+        offset += record.length;
+    }
+
+    if(offset != header.image_size || ftruncate(out_fd, header.image_size) != 0 || fsync(out_fd) != 0){
+        printf("Error: failed to rebuild %s\n", name);
+        exit(1);
+    }
+    printf("%s: %llu bytes written to %s\n", name, (unsigned long long)header.image_size, out_path);
+
+    free(buf);
+    free(path);
+    close(out_fd);
+    fclose(fptr);
+}
+
+
+/*
+* Function: list_images()
+* =================================
+* Purpose: print every stored image with its size and the size of its recipe, then the
+*          totals against the size of the block pack
+*
+*/
+void list_images(){
+    char path[PATH_MAX];
+    struct recipeHeader header;
+    struct stat sb;
+    unsigned long long image_bytes = 0;
+    unsigned long long recipe_bytes = 0;
+    int images = 0;
+
+    snprintf(path, sizeof(path), "%s/recipes", blockStore.dir);
+    DIR *dir = opendir(path);
+    if(dir == NULL){
+        printf("Error: %s is not a store\n", blockStore.dir);
+        exit(1);
+    }
+
+    for(struct dirent *ent = readdir(dir); ent != NULL; ent = readdir(dir)){
+        size_t len = strlen(ent->d_name);
+        if(ent->d_name[0] == '.' || (len > 4 && strcmp(ent->d_name + len - 4, ".tmp") == 0)){
+            continue;
+        }
+        char *file_path = recipe_path(ent->d_name);
+        FILE *fptr = fopen(file_path, "r");
+        if(fptr != NULL && fread(&header, sizeof(header), 1, fptr) == 1 && strcmp(header.magic, "FATRCP1") == 0){
+            fstat(fileno(fptr), &sb);
+            printf("%-32s %12llu %10llu\n", ent->d_name, (unsigned long long)header.image_size, (unsigned long long)sb.st_size);
+            image_bytes += header.image_size;
+            recipe_bytes += sb.st_size;
+            images++;
+        }
+        if(fptr != NULL){
+            fclose(fptr);
+        }
+        free(file_path);
+    }
+    closedir(dir);
+
+    printf("%d images, %llu bytes, stored in %llu bytes of recipes and %llu bytes in %zu blocks\n", images,
+        image_bytes, recipe_bytes, (unsigned long long)blockStore.pack_size, blockStore.count);
+}
+
+
+/*
+* Function: recipe_path(char *name)
+* =================================
+* Purpose: path of the recipe of a stored image
+*
+* Input:
+*   char* name: image name
+*
+* Return:
+*   char*: malloc'd path
+*
+*/
+char *recipe_path(char *name){
+    char *path = malloc(PATH_MAX);
+    snprintf(path, PATH_MAX, "%s/recipes/%s", blockStore.dir, name);
+    return path;
+}
+
+
+/*
+* Function: write_all(int fd, const void *data, size_t len, uint64_t offset)
+* =================================
+* Purpose: pwrite a range, retrying short writes
+*
+*/
+void write_all(int fd, const void *data, size_t len, uint64_t offset){
+    while(len > 0){
+        ssize_t written = pwrite(fd, data, len, offset);
+        if(written < 0 && errno == EINTR){
+            continue;
+        }
+        if(written <= 0){
+            printf("Error: failed to write to the store\n");
+            exit(1);
+        }
+        data = (const char *)data + written;
+        offset += written;
+        len -= written;
+    }
+}
+
+
+/*
+* Function: read_all(int fd, void *data, size_t len, uint64_t offset)
+* =================================
+* Purpose: pread a range, retrying short reads
+*
+*/
+void read_all(int fd, void *data, size_t len, uint64_t offset){
+    while(len > 0){
+        ssize_t got = pread(fd, data, len, offset);
+        if(got < 0 && errno == EINTR){
+            continue;
+        }
+        if(got <= 0){
+            printf("Error: failed to read from the store\n");
+            exit(1);
+        }
+        data = (char *)data + got;
+        offset += got;
+        len -= got;
+    }
+}
+
+
+/*
+* Function: sha256_init(struct sha256 *sha)
+* =================================
+* Purpose: start a SHA-256
+*
+*/
+void sha256_init(struct sha256 *sha){
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+
+/*
+* Function: sha256_update(struct sha256 *sha, const uint8_t *data, size_t len)
+* =================================
+* Purpose: add bytes to a SHA-256, whole blocks are hashed straight from the input
+*
+*/
+void sha256_update(struct sha256 *sha, const uint8_t *data, size_t len){
+    sha->length += len;
+
+    if(sha->used > 0){
+        size_t take = 64 - sha->used;
+        if(take > len){
+            take = len;
+        }
+        memcpy(sha->block + sha->used, data, take);
+        sha->used += take;
+        data += take;
+        len -= take;
+        if(sha->used < 64){
+            return;
+        }
+        sha256_block(sha->state, sha->block);
+        sha->used = 0;
+    }
+    while(len >= 64){
+        sha256_block(sha->state, data);
+        data += 64;
+        len -= 64;
+    }
+    memcpy(sha->block, data, len);
+    sha->used = len;
+}
+
+
+/*
+* Function: sha256_final(struct sha256 *sha, uint8_t *digest)
+* =================================
+* Purpose: pad the last block and write the 32 byte digest
+*
+*/
+void sha256_final(struct sha256 *sha, uint8_t *digest){
+    uint64_t bits = sha->length * 8;
+
+    sha->block[sha->used++] = 0x80;
+    if(sha->used > 56){
+        memset(sha->block + sha->used, 0, 64 - sha->used);
+        sha256_block(sha->state, sha->block);
+        sha->used = 0;
+    }
+    memset(sha->block + sha->used, 0, 56 - sha->used);
+    for(int i = 0; i < 8; i++){
+        sha->block[63 - i] = (uint8_t)(bits >> (8*i));
+    }
+    sha256_block(sha->state, sha->block);
+
+    for(int i = 0; i < 8; i++){
+        digest[4*i] = (uint8_t)(sha->state[i] >> 24);
+        digest[4*i + 1] = (uint8_t)(sha->state[i] >> 16);
+        digest[4*i + 2] = (uint8_t)(sha->state[i] >> 8);
+        digest[4*i + 3] = (uint8_t)sha->state[i];
+    }
+}
+
+
+/*
+* Function: sha256_block(uint32_t *state, const uint8_t *block)
+* =================================
+* Purpose: the SHA-256 compression function on one 64 byte block
+*
+*/
+void sha256_block(uint32_t *state, const uint8_t *block){
+    uint32_t w[64];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for(int i = 0; i < 16; i++){
+        w[i] = ((uint32_t)block[4*i] << 24) | ((uint32_t)block[4*i + 1] << 16) | ((uint32_t)block[4*i + 2] << 8) | block[4*i + 3];
+    }
+    for(int i = 16; i < 64; i++){
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    for(int i = 0; i < 64; i++){
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+    }
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
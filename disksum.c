@@ -0,0 +1,769 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Write a CRC32C (and optionally SHA-256) manifest of every file in a
+*            FAT12/FAT16/FAT32 image, computed in place from the mapped image
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+#define SUM_MAX_DEPTH 64
+#define SUM_MAX_THREADS 8            // hashing threads, at most one per online CPU
+#define CRC32C_POLY 0x82F63B78       // Castagnoli polynomial, bit reversed
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// running SHA-256 state of one file
+struct sha256{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    int used;
+};
+
+// a file of the image and its sums
+struct sumFile{
+    char *path;
+    uint32_t flc;
+    uint32_t size;
+    uint32_t crc;
+    uint8_t sha[32];
+    int broken;                  // the chain ends before the file size
+};
+
+struct sumInfo{
+    struct sumFile *files;
+    int count;
+    int next;                    // next file to hand to a thread
+    int use_sha;
+    int use_hw_crc;              // the CPU has the SSE4.2 crc32 instruction
+    pthread_mutex_t lock;
+}sumInfo = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint32_t crc_table[8][256];
+
+static const uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+void collect_directory(char *p, uint32_t dir_flc, char *path, int depth);
+int make_entry_name(char *entry, char *name);
+void *sum_thread(void *arg);
+void sum_file(char *p, struct sumFile *file);
+void crc32c_init();
+uint32_t crc32c_update(uint32_t crc, const uint8_t *data, size_t len);
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len);
+uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len);
+void sha256_init(struct sha256 *sha);
+void sha256_update(struct sha256 *sha, const uint8_t *data, size_t len);
+void sha256_final(struct sha256 *sha, uint8_t *digest);
+void sha256_block(uint32_t *state, const uint8_t *block);
+int compare_flc(const void *a, const void *b);
+int compare_path(const void *a, const void *b);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb;
+
+    if(argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "-s") != 0)){
+        printf("Input format: ./disksum {image file} [-s]\n");
+        exit(1);
+    }
+    sumInfo.use_sha = (argc == 3);
+
+    fd = open(argv[1], O_RDONLY);
+    if(fd < 0){
+        printf("Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+    crc32c_init();
+
+    char path[PATH_MAX] = "/";
+    collect_directory(p, 0, path, 0);
+
+    // threads take the files in disk order so the image is still read mostly front to back
+    qsort(sumInfo.files, sumInfo.count, sizeof(struct sumFile), compare_flc);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = (cpus < 1) ? 1 : (cpus > SUM_MAX_THREADS) ? SUM_MAX_THREADS : (int)cpus;
+    pthread_t threads[SUM_MAX_THREADS];
+    for(int i = 0; i < thread_count; i++){
+        if(pthread_create(&threads[i], NULL, sum_thread, p) != 0){
+            printf("Error: failed to start thread\n");
+            exit(1);
+        }
+    }
+    for(int i = 0; i < thread_count; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    // one line per file sorted by path, so two manifests can be compared with diff
+    qsort(sumInfo.files, sumInfo.count, sizeof(struct sumFile), compare_path);
+    for(int i = 0; i < sumInfo.count; i++){
+        struct sumFile *file = &sumInfo.files[i];
+        if(file->broken){
+            fprintf(stderr, "Warning: %s has a broken cluster chain\n", file->path);
+        }
+        printf("%08x  ", file->crc);
+        if(sumInfo.use_sha){
+            for(int k = 0; k < 32; k++){
+                printf("%02x", file->sha[k]);
+            }
+            printf("  ");
+        }
+        printf("%10u  %s\n", file->size, file->path);
+        free(file->path);
+    }
+
+    free(sumInfo.files);
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: collect_directory(char *p, uint32_t dir_flc, char *path, int depth)
+* =================================
+* Purpose: add every file of a directory and its sub directories to the file list
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* path: path of the directory with a trailing /, PATH_MAX bytes
+*   int depth: nesting level, guards against directory loops
+*
+*/
+void collect_directory(char *p, uint32_t dir_flc, char *path, int depth){
+    int fixed_root = (dir_flc == 0 && diskInfo.fat_type != 32);
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    size_t len = strlen(path);
+    char *start;
+    int entry_count;
+
+    if(depth > SUM_MAX_DEPTH){
+        fprintf(stderr, "Warning: %s is nested too deep, skipped\n", path);
+        return;
+    }
+
+    for(uint32_t steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(fixed_root){
+            start = p + (size_t)(diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            start = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+            char name[13];
+
+            if(first == 0x00){
+                return;
+            }
+            // deleted, long name, volume label and the . and .. entries
+            if(first == 0xE5 || entry_start[11] == 0x0F || (entry_start[11] & 0x08) || first == '.'){
+                continue;
+            }
+            make_entry_name(entry_start, name);
+            if(len + strlen(name) + 2 > PATH_MAX){
+                continue;
+            }
+
+            if(entry_start[11] & 0x10){
+                uint32_t sub_flc = get_entry_flc(entry_start);
+                if(sub_flc >= 2 && sub_flc < diskInfo.cluster_count){
+                    sprintf(path + len, "%s/", name);
+                    collect_directory(p, sub_flc, path, depth + 1);
+                    path[len] = '\0';
+                }
+                continue;
+            }
+
+            sumInfo.files = realloc(sumInfo.files, sizeof(struct sumFile)*(sumInfo.count + 1));
+            struct sumFile *file = &sumInfo.files[sumInfo.count++];
+            memset(file, 0, sizeof(struct sumFile));
+            sprintf(path + len, "%s", name);
+            file->path = strdup(path);
+            path[len] = '\0';
+            file->flc = get_entry_flc(entry_start);
+            memcpy(&file->size, (entry_start + 28), 4);
+        }
+
+        if(fixed_root){
+            return;
+        }
+        cluster = get_fat_entry(p, cluster);
+        if(cluster < 2 || cluster >= diskInfo.eoc_min){
+            return;
+        }
+    }
+}
+
+
+/*
+* Function: make_entry_name(char *entry, char *name)
+* =================================
+* Purpose: build NAME.EXT (or NAME without an extension) from a directory entry
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*   char* name: output, at least 13 bytes
+*
+* Return:
+*   int: length of the name
+*
+*/
+int make_entry_name(char *entry, char *name){
+    int len = 0;
+
+    for(int i = 0; i < 8 && entry[i] != ' '; i++){
+        name[len++] = entry[i];
+    }
+    // 0x05 stands for a leading 0xE5 byte
+    if(len > 0 && (uint8_t)name[0] == 0x05){
+        name[0] = (char)0xE5;
+    }
+    if(entry[8] != ' '){
+        name[len++] = '.';
+        for(int i = 8; i < 11 && entry[i] != ' '; i++){
+            name[len++] = entry[i];
+        }
+    }
+    name[len] = '\0';
+    return len;
+}
+
+
+/*
+* Function: sum_thread(void *arg)
+* =================================
+* Purpose: take the next unsummed file until none are left
+*
+* Input:
+*   void* arg: image data pointer
+*
+*/
+void *sum_thread(void *arg){
+    while(1){
+        pthread_mutex_lock(&sumInfo.lock);
+        int index = sumInfo.next++;
+        pthread_mutex_unlock(&sumInfo.lock);
+
+        if(index >= sumInfo.count){
+            return NULL;
+        }
+        sum_file((char *)arg, &sumInfo.files[index]);
+    }
+}
+
+
+/*
+* Function: sum_file(char *p, struct sumFile *file)
+* =================================
+* Purpose: hash a file straight from the mapping, runs of contiguous clusters are fed
+*          to the hash functions in one call
+*
+* Input:
+*   char* p: image data pointer
+*   struct sumFile* file: the file
+*
+*/
+void sum_file(char *p, struct sumFile *file){
+    struct sha256 sha;
+    uint32_t crc = 0;
+    uint32_t left = file->size;
+    uint32_t cluster = file->flc;
+
+    if(sumInfo.use_sha){
+        sha256_init(&sha);
+    }
+
+    for(uint32_t steps = 0; left > 0 && steps < diskInfo.cluster_count; steps++){
+        if(cluster < 2 || cluster >= diskInfo.cluster_count){
+            file->broken = 1;
+            break;
+        }
+
+        // extend the run while the chain stays contiguous
+        uint32_t run = 1;
+        uint32_t next = get_fat_entry(p, cluster);
+        while((size_t)run * diskInfo.cluster_bytes < left && next == cluster + run){
+            next = get_fat_entry(p, next);
+            run++;
+        }
+        steps += run - 1;
+
+        size_t len = (size_t)run * diskInfo.cluster_bytes;
+        if(len > left){
+            len = left;
+        }
+        const uint8_t *data = (const uint8_t *)p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+        crc = crc32c_update(crc, data, len);
+        if(sumInfo.use_sha){
+            sha256_update(&sha, data, len);
+        }
+        left -= len;
+        cluster = next;
+    }
+    if(left > 0){
+        file->broken = 1;
+    }
+
+    file->crc = crc;
+    if(sumInfo.use_sha){
+        sha256_final(&sha, file->sha);
+    }
+}
+
+
+/*
+* Function: crc32c_init()
+* =================================
+* Purpose: build the slicing-by-8 tables of the portable CRC32C and check whether the
+*          CPU can run the SSE4.2 version
+*
+*/
+void crc32c_init(){
+    for(int n = 0; n < 256; n++){
+        uint32_t crc = n;
+        for(int k = 0; k < 8; k++){
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[0][n] = crc;
+    }
+    for(int n = 0; n < 256; n++){
+        for(int k = 1; k < 8; k++){
+            crc_table[k][n] = (crc_table[k-1][n] >> 8) ^ crc_table[0][crc_table[k-1][n] & 0xff];
+        }
+    }
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    sumInfo.use_hw_crc = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+
+/*
+* Function: crc32c_update(uint32_t crc, const uint8_t *data, size_t len)
+* =================================
+* Purpose: continue a CRC32C over more data, 0 starts a new one
+*
+* Input:
+*   uint32_t crc: CRC of the data so far
+*   const uint8_t* data: next bytes
+*   size_t len: number of bytes
+*
+* Return:
+*   uint32_t: CRC including the new bytes
+*
+*/
+uint32_t crc32c_update(uint32_t crc, const uint8_t *data, size_t len){
+    if(sumInfo.use_hw_crc){
+        return crc32c_hw(crc, data, len);
+    }
+    return crc32c_sw(crc, data, len);
+}
+
+
+/*
+* Function: crc32c_sw(uint32_t crc, const uint8_t *data, size_t len)
+* =================================
+* Purpose: portable CRC32C, 8 bytes per step with the slicing-by-8 tables
+*
+*/
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len){
+    crc = ~crc;
+    while(len > 0 && ((uintptr_t)data & 7)){
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xff];
+        len--;
+    }
+    while(len >= 8){
+        uint64_t word;
+        memcpy(&word, data, 8);
+        word ^= crc;
+        crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff]
+            ^ crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff]
+            ^ crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff]
+            ^ crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+        data += 8;
+        len -= 8;
+    }
+    while(len > 0){
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xff];
+        len--;
+    }
+    return ~crc;
+}
+
+
+#if defined(__x86_64__)
+/*
+* Function: crc32c_hw(uint32_t crc, const uint8_t *data, size_t len)
+* =================================
+* Purpose: CRC32C with the SSE4.2 crc32 instruction, 8 bytes per instruction
+*
+*/
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len){
+    uint64_t crc64;
+
+    crc = ~crc;
+    while(len > 0 && ((uintptr_t)data & 7)){
+        crc = _mm_crc32_u8(crc, *data++);
+        len--;
+    }
+    crc64 = crc;
+    while(len >= 8){
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while(len > 0){
+        crc = _mm_crc32_u8(crc, *data++);
+        len--;
+    }
+    return ~crc;
+}
+#else
+uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len){
+    return crc32c_sw(crc, data, len);
+}
+#endif
+
+
+/*
+* Function: sha256_init(struct sha256 *sha)
+* =================================
+* Purpose: start a SHA-256
+*
+*/
+void sha256_init(struct sha256 *sha){
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+
+/*
+* Function: sha256_update(struct sha256 *sha, const uint8_t *data, size_t len)
+* =================================
+* Purpose: add bytes to a SHA-256, whole blocks are hashed straight from the input
+*
+*/
+void sha256_update(struct sha256 *sha, const uint8_t *data, size_t len){
+    sha->length += len;
+
+    if(sha->used > 0){
+        size_t take = 64 - sha->used;
+        if(take > len){
+            take = len;
+        }
+        memcpy(sha->block + sha->used, data, take);
+        sha->used += take;
+        data += take;
+        len -= take;
+        if(sha->used < 64){
+            return;
+        }
+        sha256_block(sha->state, sha->block);
+        sha->used = 0;
+    }
+    while(len >= 64){
+        sha256_block(sha->state, data);
+        data += 64;
+        len -= 64;
+    }
+    memcpy(sha->block, data, len);
+    sha->used = len;
+}
+
+
+/*
+* Function: sha256_final(struct sha256 *sha, uint8_t *digest)
+* =================================
+* Purpose: pad the last block and write the 32 byte digest
+*
+*/
+void sha256_final(struct sha256 *sha, uint8_t *digest){
+    uint64_t bits = sha->length * 8;
+
+    sha->block[sha->used++] = 0x80;
+    if(sha->used > 56){
+        memset(sha->block + sha->used, 0, 64 - sha->used);
+        sha256_block(sha->state, sha->block);
+        sha->used = 0;
+    }
+    memset(sha->block + sha->used, 0, 56 - sha->used);
+    for(int i = 0; i < 8; i++){
+        sha->block[63 - i] = (uint8_t)(bits >> (8*i));
+    }
+    sha256_block(sha->state, sha->block);
+
+    for(int i = 0; i < 8; i++){
+        digest[4*i] = (uint8_t)(sha->state[i] >> 24);
+        digest[4*i + 1] = (uint8_t)(sha->state[i] >> 16);
+        digest[4*i + 2] = (uint8_t)(sha->state[i] >> 8);
+        digest[4*i + 3] = (uint8_t)sha->state[i];
+    }
+}
+
+
+/*
+* Function: sha256_block(uint32_t *state, const uint8_t *block)
+* =================================
+* Purpose: the SHA-256 compression function on one 64 byte block
+*
+*/
+void sha256_block(uint32_t *state, const uint8_t *block){
+    uint32_t w[64];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for(int i = 0; i < 16; i++){
+        w[i] = ((uint32_t)block[4*i] << 24) | ((uint32_t)block[4*i + 1] << 16) | ((uint32_t)block[4*i + 2] << 8) | block[4*i + 3];
+    }
+    for(int i = 16; i < 64; i++){
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    for(int i = 0; i < 64; i++){
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+/*
+* Function: compare_flc(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering files by first cluster
+*
+*/
+int compare_flc(const void *a, const void *b){
+    const struct sumFile *x = a;
+    const struct sumFile *y = b;
+    return (x->flc > y->flc) - (x->flc < y->flc);
+}
+
+
+/*
+* Function: compare_path(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering files by path
+*
+*/
+int compare_path(const void *a, const void *b){
+    const struct sumFile *x = a;
+    const struct sumFile *y = b;
+    return strcmp(x->path, y->path);
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+    }
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
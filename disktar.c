@@ -0,0 +1,1741 @@
+/*
+*   Author: Jonathan Cote V00962634
+*   Title: A3 CSC 360
+*   Purpose: Write the contents of a FAT12/FAT16/FAT32 image to stdout as a POSIX ustar stream,
+*            or import a ustar stream from stdin into the image
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// FAT12 volumes have fewer than 4085 data clusters, FAT16 fewer than 65525, anything larger is FAT32
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+#define TAR_BLOCK 512
+#define TAR_MAX_DEPTH 64
+#define TAR_IOV_COUNT 1024   // below IOV_MAX, one writev / vmsplice per batch
+#define TAR_HEADER_COUNT 128 // headers held by one batch
+
+#define TXN_DATA 0
+#define TXN_FAT 1
+#define TXN_DIR 2
+
+
+struct diskInfo{
+    uint8_t num_of_fats;
+    uint8_t sectors_per_cluster;
+    uint8_t fat_type;            // 12, 16 or 32
+    uint32_t sector_per_fat;
+    uint16_t reserved_sectors;
+    uint16_t root_dir_entries;
+    uint16_t bytes_per_sector;
+    uint32_t sector_count;
+    uint32_t root_dir_sectors;
+    uint32_t root_cluster;       // FAT32 only, the root directory is a cluster chain
+    uint32_t data_region_start;
+    uint32_t cluster_count;
+    uint32_t eoc_min;            // FAT values from here on end a chain
+    uint32_t eoc;                // value written to end a chain
+    size_t fat_start;
+    int cluster_bytes;
+}diskInfo;
+
+// ustar header, one 512 byte block
+struct tarHeader{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+// output batch: headers and file data go out as one vector, file data straight from the mapping
+struct tarOutput{
+    struct iovec iov[TAR_IOV_COUNT];
+    int iov_count;
+    struct tarHeader *headers;   // the current batch of headers
+    int header_count;
+    char **old_headers;          // batches already handed to a pipe, see flush_output()
+    int old_header_count;
+    int use_vmsplice;
+}tarOutput;
+
+static const char zero_block[2*TAR_BLOCK];
+
+// a dirty byte range of the image
+struct writeRange{
+    size_t start;
+    size_t len;
+};
+
+// a directory entry that is only written to the image on commit
+struct pendingEntry{
+    size_t offset;
+    char entry[32];
+};
+
+// write transaction of the whole import, see diskput.c. File data goes straight
+// into free clusters, FAT changes stay in the decoded table and directory entries
+// stay pending until txn_commit() flushes them in that order.
+struct transaction{
+    struct writeRange *ranges[3];
+    int range_count[3];
+    struct pendingEntry *entries;
+    int entry_count;
+    uint32_t *fat_table;
+    uint8_t *fat_dirty;
+    int cluster_count;
+    int free_clusters;
+    uint32_t next_free;          // allocator cursor, the search for a free cluster resumes here
+}txn;
+
+// a name in a directory touched by the import
+struct importName{
+    char short_name[11];
+    size_t offset;               // byte offset of the entry in the image
+    int pending;                 // index in txn.entries, -1 while the entry is only on disk
+};
+
+// a directory touched by the import, scanned once when it is first used
+struct importDir{
+    char *path;                  // upper case path without the trailing /, "" for root
+    uint32_t flc;                // 0 for the fixed FAT12/FAT16 root
+    uint32_t last_cluster;       // tail of the chain, grown when the free entries run out
+    size_t *slots;               // byte offsets of free entries in directory order
+    int slot_count;
+    int next_slot;
+    struct importName *names;
+    int name_count;
+};
+
+struct importInfo{
+    struct importDir *dirs;
+    int dir_count;
+    long long files;
+    long long dirs_made;
+    long long bytes;
+}importInfo;
+
+
+void get_geometry(char *p);
+unsigned int get_fat_entry(char *p, uint32_t flc);
+uint32_t get_entry_flc(char *entry);
+uint32_t calc_data_loc(char *p, uint32_t flc);
+void export_directory(char *p, uint32_t dir_flc, char *path, int depth);
+void export_entry(char *p, char *entry, char *path);
+int make_entry_name(char *entry, char *name);
+int fill_header(struct tarHeader *header, char *path, char typeflag, uint32_t size, char *entry);
+time_t entry_mtime(char *entry);
+void queue_output(const void *data, size_t len);
+struct tarHeader *new_header();
+void flush_output();
+void import_tar(char *p, int fd);
+void import_file(char *p, char *path, uint32_t size, time_t mtime, int mode);
+struct importDir *get_import_dir(char *p, char *path, time_t mtime);
+void scan_import_dir(char *p, struct importDir *dir);
+struct importName *find_import_name(struct importDir *dir, char *short_name);
+void add_import_name(struct importDir *dir, char *short_name, size_t offset, int pending);
+size_t take_slot(char *p, struct importDir *dir);
+uint32_t alloc_cluster();
+void free_chain(uint32_t flc);
+void build_entry(char *entry, char *short_name, uint8_t attributes, uint32_t flc, uint32_t size, time_t mtime);
+char *entry_contents(char *p, struct importName *name);
+void write_entry(struct importDir *dir, struct importName *name, size_t offset, char *entry);
+int normalize_path(char *path, char *out);
+void split_path(char *path, char *parent, char *short_name);
+int make_short_name(char *name, char *short_name);
+long long parse_octal(char *field, int len);
+size_t read_input(void *buf, size_t len);
+void read_full(void *buf, size_t len);
+void skip_input(long long len);
+void decode_fat(char *p);
+void set_fat(uint32_t cluster, uint32_t value);
+size_t fat_entry_offset(uint32_t cluster);
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc);
+void set_entry_flc(char *entry, uint32_t flc);
+void txn_mark(int kind, size_t start, size_t len);
+void txn_sync(char *p, int kind);
+void txn_commit(char *p, int fd);
+void mirror_fat(char *p);
+void update_fsinfo(char *p);
+int compare_ranges(const void *a, const void *b);
+
+
+// Code referenced from mmap_test.c provided in tutorials
+int main(int argc, char *argv[]){
+	int fd;
+	struct stat sb, out_sb;
+
+    int import = (argc == 3 && strcmp(argv[2], "-x") == 0);
+    if(argc != 2 && !import){
+        fprintf(stderr, "Input format: ./disktar {image file} > {tar file}\n");
+        fprintf(stderr, "              ./disktar {image file} -x < {tar file}\n");
+        exit(1);
+    }
+
+    fd = open(argv[1], import ? O_RDWR : O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "Error: failed to open image\n");
+        exit(1);
+    }
+    fstat(fd, &sb);
+
+    // Make pointer to start of image
+    char *p = mmap(NULL, sb.st_size, import ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Error: failed to map memory\n");
+        exit(1);
+    }
+
+    get_geometry(p);
+
+    if(import){
+        import_tar(p, fd);
+        printf("Imported %lld files (%lld bytes), created %lld directories\n", importInfo.files, importInfo.bytes, importInfo.dirs_made);
+        munmap(p, sb.st_size);
+        close(fd);
+        return 0;
+    }
+    madvise(p, sb.st_size, MADV_SEQUENTIAL);
+
+    // a pipe takes the mapped pages by reference, anything else gets a plain writev
+    tarOutput.use_vmsplice = (fstat(STDOUT_FILENO, &out_sb) == 0 && S_ISFIFO(out_sb.st_mode));
+    tarOutput.headers = malloc(sizeof(struct tarHeader)*TAR_HEADER_COUNT);
+
+    char path[PATH_MAX] = "";
+    export_directory(p, 0, path, 0);
+
+    // end of archive
+    queue_output(zero_block, sizeof(zero_block));
+    flush_output();
+
+    for(int i = 0; i < tarOutput.old_header_count; i++){
+        free(tarOutput.old_headers[i]);
+    }
+    free(tarOutput.old_headers);
+    free(tarOutput.headers);
+    munmap(p, sb.st_size);
+    close(fd);
+	return 0;
+}
+
+
+/*
+* Function: export_directory(char *p, uint32_t dir_flc, char *path, int depth)
+* =================================
+* Purpose: write every file and sub directory of a directory to the tar stream,
+*          the tree is walked once in directory order
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t dir_flc: first logical cluster of the directory, 0 for root
+*   char* path: tar path of the directory ("" for root, else ending in /), PATH_MAX bytes
+*   int depth: nesting level, guards against directory loops
+*
+*/
+void export_directory(char *p, uint32_t dir_flc, char *path, int depth){
+    int fixed_root = (dir_flc == 0 && diskInfo.fat_type != 32);
+    uint32_t cluster = (dir_flc == 0) ? diskInfo.root_cluster : dir_flc;
+    char *start;
+    int entry_count;
+
+    if(depth > TAR_MAX_DEPTH){
+        fprintf(stderr, "Warning: %s is nested too deep, skipped\n", path);
+        return;
+    }
+
+    for(uint32_t steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(fixed_root){
+            start = p + (size_t)(diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            start = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.cluster_bytes / 32;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+
+            if(first == 0x00){
+                return;
+            }
+            // deleted, long name, volume label and the . and .. entries
+            if(first == 0xE5 || entry_start[11] == 0x0F || (entry_start[11] & 0x08) || first == '.'){
+                continue;
+            }
+            export_entry(p, entry_start, path);
+            if(entry_start[11] & 0x10){
+                size_t len = strlen(path);
+                char name[13];
+                make_entry_name(entry_start, name);
+                uint32_t sub_flc = get_entry_flc(entry_start);
+                if(sub_flc >= 2 && sub_flc < diskInfo.cluster_count && len + strlen(name) + 2 < PATH_MAX){
+                    sprintf(path + len, "%s/", name);
+                    export_directory(p, sub_flc, path, depth + 1);
+                    path[len] = '\0';
+                }
+            }
+        }
+
+        if(fixed_root){
+            return;
+        }
+        cluster = get_fat_entry(p, cluster);
+        if(cluster < 2 || cluster >= diskInfo.eoc_min){
+            return;
+        }
+    }
+}
+
+
+/*
+* Function: export_entry(char *p, char *entry, char *path)
+* =================================
+* Purpose: queue the header of one entry and, for a file, its data as runs of contiguous
+*          clusters pointing into the mapping, padded to the 512 byte tar block
+*
+* Input:
+*   char* p: image data pointer
+*   char* entry: the 32 byte directory entry
+*   char* path: tar path of the parent directory
+*
+*/
+void export_entry(char *p, char *entry, char *path){
+    char name[13];
+    char full_path[PATH_MAX];
+    int is_dir = entry[11] & 0x10;
+    uint32_t size = 0;
+
+    make_entry_name(entry, name);
+    snprintf(full_path, sizeof(full_path), "%s%s%s", path, name, is_dir ? "/" : "");
+    if(!is_dir){
+        memcpy(&size, (entry + 28), 4);
+    }
+
+    struct tarHeader *header = new_header();
+    if(fill_header(header, full_path, is_dir ? '5' : '0', size, entry) != 0){
+        fprintf(stderr, "Warning: %s does not fit a ustar header, skipped\n", full_path);
+        tarOutput.header_count--;
+        return;
+    }
+    queue_output(header, TAR_BLOCK);
+    if(is_dir){
+        return;
+    }
+
+    // a chain shorter than the size is padded with zeros so the stream stays valid
+    uint32_t cluster = get_entry_flc(entry);
+    uint32_t left = size;
+    uint32_t steps = 0;
+    while(left > 0 && cluster >= 2 && cluster < diskInfo.cluster_count && steps++ < diskInfo.cluster_count){
+        char *run = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+        uint32_t run_len = 0;
+        do{
+            run_len += diskInfo.cluster_bytes;
+            uint32_t next = get_fat_entry(p, cluster);
+            if(next != cluster + 1 || next >= diskInfo.cluster_count || run_len >= left){
+                cluster = next;
+                break;
+            }
+            cluster = next;
+        }while(steps++ < diskInfo.cluster_count);
+
+        if(run_len > left){
+            run_len = left;
+        }
+        queue_output(run, run_len);
+        left -= run_len;
+    }
+    if(left > 0){
+        fprintf(stderr, "Warning: %s has a short cluster chain, padded with zeros\n", full_path);
+        while(left > 0){
+            uint32_t len = left < sizeof(zero_block) ? left : sizeof(zero_block);
+            queue_output(zero_block, len);
+            left -= len;
+        }
+    }
+    if(size % TAR_BLOCK != 0){
+        queue_output(zero_block, TAR_BLOCK - size % TAR_BLOCK);
+    }
+}
+
+
+/*
+* Function: make_entry_name(char *entry, char *name)
+* =================================
+* Purpose: build NAME.EXT (or NAME with no extension) from an 8.3 entry
+*
+* Input:
+*   char* entry: the 32 byte directory entry
+*   char* name: output, at least 13 bytes
+*
+* Return:
+*   int: length of the name
+*
+*/
+int make_entry_name(char *entry, char *name){
+    int len = 0;
+
+    for(int i = 0; i < 8 && entry[i] != ' '; i++){
+        name[len++] = entry[i];
+    }
+    // 0x05 stands for a leading 0xE5 byte
+    if(len > 0 && (uint8_t)name[0] == 0x05){
+        name[0] = (char)0xE5;
+    }
+    if(entry[8] != ' '){
+        name[len++] = '.';
+        for(int i = 8; i < 11 && entry[i] != ' '; i++){
+            name[len++] = entry[i];
+        }
+    }
+    name[len] = '\0';
+    return len;
+}
+
+
+/*
+* Function: fill_header(struct tarHeader *header, char *path, char typeflag, uint32_t size, char *entry)
+* =================================
+* Purpose: fill a ustar header, paths over 100 bytes are split into prefix and name at a /
+*
+* Input:
+*   struct tarHeader* header: header to fill
+*   char* path: full tar path
+*   char typeflag: '0' file, '5' directory
+*   uint32_t size: file size
+*   char* entry: the directory entry, for the attributes and time
+*
+* Return:
+*   int: 0 on success, -1 if the path cannot be stored
+*
+*/
+int fill_header(struct tarHeader *header, char *path, char typeflag, uint32_t size, char *entry){
+    size_t len = strlen(path);
+    unsigned int sum = 0;
+
+    memset(header, 0, sizeof(struct tarHeader));
+    if(len <= sizeof(header->name)){
+        memcpy(header->name, path, len);
+    }else{
+        // the split / is dropped, a trailing / of a directory stays with the name
+        char *split = path + len - sizeof(header->name) - 1;
+        while(*split != '\0' && *split != '/'){
+            split++;
+        }
+        if(*split == '\0' || split - path > (long)sizeof(header->prefix) || split == path + len - 1){
+            return -1;
+        }
+        memcpy(header->prefix, path, split - path);
+        memcpy(header->name, split + 1, path + len - split - 1);
+    }
+
+    // read only files lose their write bits
+    int mode = (typeflag == '5') ? 0755 : ((entry[11] & 0x01) ? 0444 : 0644);
+    snprintf(header->mode, sizeof(header->mode), "%07o", mode);
+    snprintf(header->uid, sizeof(header->uid), "%07o", 0);
+    snprintf(header->gid, sizeof(header->gid), "%07o", 0);
+    snprintf(header->size, sizeof(header->size), "%011o", size);
+    snprintf(header->mtime, sizeof(header->mtime), "%011llo", (unsigned long long)entry_mtime(entry));
+    header->typeflag = typeflag;
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+
+    // the checksum is taken with its own field as spaces
+    memset(header->chksum, ' ', sizeof(header->chksum));
+    for(size_t i = 0; i < sizeof(struct tarHeader); i++){
+        sum += ((unsigned char *)header)[i];
+    }
+    snprintf(header->chksum, sizeof(header->chksum), "%06o", sum);
+    header->chksum[7] = ' ';
+    return 0;
+}
+
+
+/*
+* Function: entry_mtime(char *entry)
+* =================================
+* Purpose: convert the last write date and time of an entry to seconds since 1970 (UTC)
+*
+* Input:
+*   char* entry: the 32 byte directory entry
+*
+*/
+time_t entry_mtime(char *entry){
+    uint16_t time_field, date_field;
+    struct tm tm;
+
+    memcpy(&time_field, (entry + 22), 2);
+    memcpy(&date_field, (entry + 24), 2);
+    if(date_field == 0){
+        return 0;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = ((date_field >> 9) & 0x7F) + 80;
+    tm.tm_mon = ((date_field >> 5) & 0x0F) - 1;
+    tm.tm_mday = date_field & 0x1F;
+    tm.tm_hour = (time_field >> 11) & 0x1F;
+    tm.tm_min = (time_field >> 5) & 0x3F;
+    tm.tm_sec = (time_field & 0x1F) * 2;
+    return timegm(&tm);
+}
+
+
+/*
+* Function: new_header()
+* =================================
+* Purpose: hand out the next header of the current batch, flushing when the batch is full
+*
+* Return:
+*   struct tarHeader*: header that stays valid until the batch is flushed
+*
+*/
+struct tarHeader *new_header(){
+    // with room for the header in the vector, queue_output() cannot flush it away before it is queued
+    if(tarOutput.header_count == TAR_HEADER_COUNT || tarOutput.iov_count == TAR_IOV_COUNT){
+        flush_output();
+    }
+    return &tarOutput.headers[tarOutput.header_count++];
+}
+
+
+/*
+* Function: queue_output(const void *data, size_t len)
+* =================================
+* Purpose: add a range to the output vector, joining it to the last one when they touch
+*
+* Input:
+*   const void* data: start of the range (a header, the mapping or the zero block)
+*   size_t len: bytes in the range
+*
+*/
+void queue_output(const void *data, size_t len){
+    if(len == 0){
+        return;
+    }
+    if(tarOutput.iov_count > 0){
+        struct iovec *last = &tarOutput.iov[tarOutput.iov_count - 1];
+        if((char *)last->iov_base + last->iov_len == (char *)data && data != zero_block){
+            last->iov_len += len;
+            return;
+        }
+    }
+    if(tarOutput.iov_count == TAR_IOV_COUNT){
+        flush_output();
+    }
+    tarOutput.iov[tarOutput.iov_count].iov_base = (void *)data;
+    tarOutput.iov[tarOutput.iov_count].iov_len = len;
+    tarOutput.iov_count++;
+}
+
+
+/*
+* Function: flush_output()
+* =================================
+* Purpose: write the queued vector to stdout with vmsplice (pipe) or writev, retrying
+*          partial writes. A pipe keeps references to the header pages, so those headers
+*          are set aside until exit instead of being reused
+*
+*/
+void flush_output(){
+    struct iovec *iov = tarOutput.iov;
+    int count = tarOutput.iov_count;
+
+    while(count > 0){
+        ssize_t written;
+        if(tarOutput.use_vmsplice){
+            written = vmsplice(STDOUT_FILENO, iov, count, 0);
+            if(written < 0 && errno == EINVAL){
+                tarOutput.use_vmsplice = 0;
+                continue;
+            }
+        }else{
+            written = writev(STDOUT_FILENO, iov, count);
+        }
+        if(written < 0 && errno == EINTR){
+            continue;
+        }
+        if(written <= 0){
+            fprintf(stderr, "Error: failed to write tar stream\n");
+            exit(1);
+        }
+        while(count > 0 && (size_t)written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    tarOutput.iov_count = 0;
+
+    if(tarOutput.use_vmsplice && tarOutput.header_count > 0){
+        tarOutput.old_headers = realloc(tarOutput.old_headers, sizeof(char *)*(tarOutput.old_header_count + 1));
+        tarOutput.old_headers[tarOutput.old_header_count++] = (char *)tarOutput.headers;
+        tarOutput.headers = malloc(sizeof(struct tarHeader)*TAR_HEADER_COUNT);
+    }
+    tarOutput.header_count = 0;
+}
+
+
+/*
+* Function: get_geometry(char *p)
+* =================================
+* Purpose: read the boot sector fields and work out the FAT type, the 32 bit sector
+*          counts and where the FAT and the data region start
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void get_geometry(char *p){
+    uint16_t sector_count;
+    uint16_t sector_per_fat;
+
+    memcpy(&diskInfo.root_dir_entries, (p + 17), 2);
+    memcpy(&diskInfo.num_of_fats, (p + 16), 1);
+    memcpy(&sector_per_fat, (p + 22), 2);
+    memcpy(&diskInfo.reserved_sectors, (p + 14), 2);
+    memcpy(&diskInfo.sectors_per_cluster, (p + 13), 1);
+    memcpy(&diskInfo.bytes_per_sector, (p + 11), 2);
+    memcpy(&sector_count, (p + 19), 2);
+
+    // a zero 16 bit field means the 32 bit one is used, the FAT size moves to the FAT32 BPB
+    diskInfo.sector_count = sector_count;
+    if(sector_count == 0){
+        memcpy(&diskInfo.sector_count, (p + 32), 4);
+    }
+    diskInfo.sector_per_fat = sector_per_fat;
+    diskInfo.root_cluster = 0;
+    if(sector_per_fat == 0){
+        memcpy(&diskInfo.sector_per_fat, (p + 36), 4);
+        memcpy(&diskInfo.root_cluster, (p + 44), 4);
+    }
+
+    diskInfo.root_dir_sectors = ((diskInfo.root_dir_entries * 32) + diskInfo.bytes_per_sector - 1) / diskInfo.bytes_per_sector;
+    diskInfo.data_region_start = (diskInfo.num_of_fats * diskInfo.sector_per_fat) + diskInfo.reserved_sectors + diskInfo.root_dir_sectors;
+    diskInfo.cluster_count = ((diskInfo.sector_count - diskInfo.data_region_start) / diskInfo.sectors_per_cluster) + 2;
+    diskInfo.fat_start = (size_t)diskInfo.reserved_sectors * diskInfo.bytes_per_sector;
+    diskInfo.cluster_bytes = diskInfo.bytes_per_sector * diskInfo.sectors_per_cluster;
+
+    // the cluster count alone decides the FAT type
+    if(diskInfo.cluster_count - 2 < FAT12_MAX_CLUSTERS){
+        diskInfo.fat_type = 12;
+        diskInfo.eoc_min = 0xFF8;
+        diskInfo.eoc = 0xFFF;
+    }else if(diskInfo.cluster_count - 2 < FAT16_MAX_CLUSTERS){
+        diskInfo.fat_type = 16;
+        diskInfo.eoc_min = 0xFFF8;
+        diskInfo.eoc = 0xFFFF;
+    }else{
+        diskInfo.fat_type = 32;
+        diskInfo.eoc_min = 0x0FFFFFF8;
+        diskInfo.eoc = 0x0FFFFFFF;
+    }
+}
+
+
+/*
+* Function: calc_data_loc(char *p, uint32_t flc)
+* =================================
+* Purpose: calculate the data location for a given flc
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+uint32_t calc_data_loc(char *p, uint32_t flc){
+    return ((flc - 2) * diskInfo.sectors_per_cluster) + diskInfo.data_region_start;
+}
+
+
+/*
+* Function: get_fat_entry(char *p, uint32_t flc)
+* =================================
+* Purpose: get the entry value at a FAT location (12, 16 or 32 bit entries)
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: first logical cluster
+*
+*/
+unsigned int get_fat_entry(char *p, uint32_t flc){
+    if(diskInfo.fat_type == 32){
+        uint32_t entry32;
+        memcpy(&entry32, (p + diskInfo.fat_start + (size_t)flc * 4), 4);
+        return entry32 & 0x0FFFFFFF;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry16;
+        memcpy(&entry16, (p + diskInfo.fat_start + (size_t)flc * 2), 2);
+        return entry16;
+    }
+
+    size_t ent_offset = ((size_t)flc * 3) / 2;
+    unsigned short entry;
+    memcpy(&entry, (p + diskInfo.fat_start + ent_offset), 2);
+
+    if(flc % 2 == 1){
+        entry >>= 4;
+
+    }else{
+        entry &= 0x0fff;
+    }
+    return entry;
+}
+
+
+/*
+* Function: get_entry_flc(char *entry)
+* =================================
+* Purpose: first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*
+*/
+uint32_t get_entry_flc(char *entry){
+    uint16_t low;
+    uint16_t high = 0;
+
+    memcpy(&low, (entry + 26), 2);
+    if(diskInfo.fat_type == 32){
+        memcpy(&high, (entry + 20), 2);
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+
+/*
+* Function: import_tar(char *p, int fd)
+* =================================
+* Purpose: read a ustar stream from stdin and create its directories and files as the
+*          members arrive. One allocator state and one scan per directory serve the whole
+*          stream, and nothing becomes visible before the single txn_commit() at the end
+*
+* Input:
+*   char* p: image data pointer
+*   int fd: image file descriptor
+*
+*/
+void import_tar(char *p, int fd){
+    struct tarHeader header;
+    char raw_path[PATH_MAX];
+    char path[PATH_MAX];
+    int zero_blocks = 0;
+
+    decode_fat(p);
+    get_import_dir(p, "", 0);
+
+    while(1){
+        size_t got = read_input(&header, TAR_BLOCK);
+        if(got == 0){
+            break;
+        }
+        if(got != TAR_BLOCK){
+            fprintf(stderr, "Error: tar stream ends inside a header, nothing was imported\n");
+            exit(1);
+        }
+        if(memcmp(&header, zero_block, TAR_BLOCK) == 0){
+            // two zero blocks end the archive
+            if(++zero_blocks == 2){
+                break;
+            }
+            continue;
+        }
+        zero_blocks = 0;
+
+        unsigned int sum = 0;
+        for(size_t i = 0; i < sizeof(struct tarHeader); i++){
+            sum += (i >= 148 && i < 156) ? ' ' : ((unsigned char *)&header)[i];
+        }
+        long long size = parse_octal(header.size, sizeof(header.size));
+        if(parse_octal(header.chksum, sizeof(header.chksum)) != sum || size < 0){
+            fprintf(stderr, "Error: input is not a ustar archive, nothing was imported\n");
+            exit(1);
+        }
+        long long padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+        if(header.prefix[0] != '\0'){
+            snprintf(raw_path, sizeof(raw_path), "%.155s/%.100s", header.prefix, header.name);
+        }else{
+            snprintf(raw_path, sizeof(raw_path), "%.100s", header.name);
+        }
+
+        // pax headers only carry attributes this image cannot store
+        if(header.typeflag == 'x' || header.typeflag == 'g'){
+            skip_input(padded);
+            continue;
+        }
+        if(header.typeflag != '0' && header.typeflag != '\0' && header.typeflag != '5'){
+            fprintf(stderr, "Warning: %s is not a file or directory, skipped\n", raw_path);
+            skip_input(padded);
+            continue;
+        }
+        if(normalize_path(raw_path, path) != 0 || (path[0] == '\0' && header.typeflag != '5')){
+            fprintf(stderr, "Warning: %s is not a valid 8.3 path, skipped\n", raw_path);
+            skip_input(padded);
+            continue;
+        }
+
+        time_t mtime = (time_t)parse_octal(header.mtime, sizeof(header.mtime));
+        if(header.typeflag == '5'){
+            if(get_import_dir(p, path, mtime) == NULL){
+                fprintf(stderr, "Warning: %s cannot be created, skipped\n", raw_path);
+            }
+            skip_input(padded);
+            continue;
+        }
+        if(size > 0xFFFFFFFFll){
+            fprintf(stderr, "Error: %s is too large for a FAT file system, nothing was imported\n", raw_path);
+            exit(1);
+        }
+        import_file(p, path, (uint32_t)size, mtime, (int)parse_octal(header.mode, sizeof(header.mode)));
+        skip_input(padded - size);
+    }
+
+    txn_commit(p, fd);
+}
+
+
+/*
+* Function: import_file(char *p, char *path, uint32_t size, time_t mtime, int mode)
+* =================================
+* Purpose: read one member's data from stdin straight into newly allocated clusters and
+*          stage its directory entry. A file that already exists is replaced, its old
+*          clusters are only freed after the new ones are filled
+*
+* Input:
+*   char* p: image data pointer
+*   char* path: normalized upper case path of the file
+*   uint32_t size: size of the data that follows on stdin
+*   time_t mtime: modification time from the header
+*   int mode: permission bits from the header
+*
+*/
+void import_file(char *p, char *path, uint32_t size, time_t mtime, int mode){
+    char parent_path[PATH_MAX];
+    char short_name[11];
+    char entry[32];
+    uint32_t first = 0;
+    uint32_t prev = 0;
+    uint32_t left = size;
+
+    split_path(path, parent_path, short_name);
+    struct importDir *dir = get_import_dir(p, parent_path, mtime);
+    struct importName *name = (dir != NULL) ? find_import_name(dir, short_name) : NULL;
+    if(dir == NULL || (name != NULL && (entry_contents(p, name)[11] & 0x18))){
+        fprintf(stderr, "Warning: %s cannot be created, skipped\n", path);
+        skip_input(size);
+        return;
+    }
+
+    while(left > 0){
+        uint32_t cluster = alloc_cluster();
+        char *data = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+        uint32_t len = (left < (uint32_t)diskInfo.cluster_bytes) ? left : (uint32_t)diskInfo.cluster_bytes;
+
+        if(prev != 0){
+            set_fat(prev, cluster);
+        }else{
+            first = cluster;
+        }
+        read_full(data, len);
+        memset(data + len, 0, diskInfo.cluster_bytes - len);
+        txn_mark(TXN_DATA, data - p, diskInfo.cluster_bytes);
+        left -= len;
+        prev = cluster;
+    }
+
+    if(name != NULL){
+        free_chain(get_entry_flc(entry_contents(p, name)));
+    }
+    // files without the owner write bit become read only
+    build_entry(entry, short_name, (mode & 0200) ? 0x00 : 0x01, first, size, mtime);
+    write_entry(dir, name, (name != NULL) ? name->offset : take_slot(p, dir), entry);
+    importInfo.files++;
+    importInfo.bytes += size;
+}
+
+
+/*
+* Function: get_import_dir(char *p, char *path, time_t mtime)
+* =================================
+* Purpose: find the state of a directory, scanning it on first use. Missing directories
+*          along the path are created
+*
+* Input:
+*   char* p: image data pointer
+*   char* path: normalized upper case path, "" for root
+*   time_t mtime: time given to directories created here
+*
+* Return:
+*   struct importDir*: the directory, valid until the next call, NULL if a file is in the way
+*
+*/
+struct importDir *get_import_dir(char *p, char *path, time_t mtime){
+    uint32_t flc = 0;
+
+    for(int i = 0; i < importInfo.dir_count; i++){
+        if(strcmp(importInfo.dirs[i].path, path) == 0){
+            return &importInfo.dirs[i];
+        }
+    }
+
+    if(path[0] != '\0'){
+        char parent_path[PATH_MAX];
+        char short_name[11];
+        char entry[32];
+
+        split_path(path, parent_path, short_name);
+        struct importDir *parent = get_import_dir(p, parent_path, mtime);
+        if(parent == NULL){
+            return NULL;
+        }
+        struct importName *name = find_import_name(parent, short_name);
+        if(name != NULL){
+            char *existing = entry_contents(p, name);
+            if(!(existing[11] & 0x10)){
+                return NULL;
+            }
+            flc = get_entry_flc(existing);
+        }else{
+            // the new cluster cannot be reached before commit, so . and .. go in with the data
+            flc = alloc_cluster();
+            char *data = p + (size_t)calc_data_loc(p, flc) * diskInfo.bytes_per_sector;
+            memset(data, 0, diskInfo.cluster_bytes);
+            build_entry(data, ".          ", 0x10, flc, 0, mtime);
+            build_entry(data + 32, "..         ", 0x10, parent->flc, 0, mtime);
+            txn_mark(TXN_DATA, data - p, diskInfo.cluster_bytes);
+
+            build_entry(entry, short_name, 0x10, flc, 0, mtime);
+            write_entry(parent, NULL, take_slot(p, parent), entry);
+            importInfo.dirs_made++;
+        }
+    }
+
+    importInfo.dirs = realloc(importInfo.dirs, sizeof(struct importDir)*(importInfo.dir_count + 1));
+    struct importDir *dir = &importInfo.dirs[importInfo.dir_count++];
+    memset(dir, 0, sizeof(struct importDir));
+    dir->path = strdup(path);
+    dir->flc = flc;
+    scan_import_dir(p, dir);
+    return dir;
+}
+
+
+/*
+* Function: scan_import_dir(char *p, struct importDir *dir)
+* =================================
+* Purpose: the one pass over a directory: record its names, its free entries and the
+*          last cluster of its chain
+*
+* Input:
+*   char* p: image data pointer
+*   struct importDir* dir: directory with path and flc set
+*
+*/
+void scan_import_dir(char *p, struct importDir *dir){
+    int fixed_root = (dir->flc == 0 && diskInfo.fat_type != 32);
+    uint32_t cluster = (dir->flc == 0) ? diskInfo.root_cluster : dir->flc;
+    int ended = 0;
+    char *start;
+    int entry_count;
+
+    for(uint32_t steps = 0; steps < diskInfo.cluster_count; steps++){
+        if(fixed_root){
+            start = p + (size_t)(diskInfo.reserved_sectors + diskInfo.num_of_fats * diskInfo.sector_per_fat) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.root_dir_entries;
+        }else{
+            start = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+            entry_count = diskInfo.cluster_bytes / 32;
+            dir->last_cluster = cluster;
+        }
+
+        for(int k = 0; k < entry_count; k++){
+            char *entry_start = start + 32*k;
+            uint8_t first = (uint8_t)entry_start[0];
+
+            // everything after the end of directory entry is free
+            if(ended || first == 0x00 || first == 0xE5){
+                ended = ended || first == 0x00;
+                dir->slots = realloc(dir->slots, sizeof(size_t)*(dir->slot_count + 1));
+                dir->slots[dir->slot_count++] = entry_start - p;
+                continue;
+            }
+            if(entry_start[11] == 0x0F || (entry_start[11] & 0x08) || first == '.'){
+                continue;
+            }
+            add_import_name(dir, entry_start, entry_start - p, -1);
+        }
+
+        if(fixed_root){
+            return;
+        }
+        uint32_t next = txn.fat_table[cluster];
+        if(next < 2 || next >= diskInfo.eoc_min){
+            return;
+        }
+        cluster = next;
+    }
+}
+
+
+/*
+* Function: find_import_name(struct importDir *dir, char *short_name)
+* =================================
+* Purpose: look up an 11 byte 8.3 name in a scanned directory
+*
+* Input:
+*   struct importDir* dir: scanned directory
+*   char* short_name: 11 byte name
+*
+* Return:
+*   struct importName*: the name, NULL if the directory has none
+*
+*/
+struct importName *find_import_name(struct importDir *dir, char *short_name){
+    for(int i = 0; i < dir->name_count; i++){
+        if(memcmp(dir->names[i].short_name, short_name, 11) == 0){
+            return &dir->names[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Function: add_import_name(struct importDir *dir, char *short_name, size_t offset, int pending)
+* =================================
+* Purpose: remember a name of a directory and where its entry lives
+*
+* Input:
+*   struct importDir* dir: the directory
+*   char* short_name: 11 byte name
+*   size_t offset: byte offset of the entry in the image
+*   int pending: index in txn.entries, -1 for an entry only on disk
+*
+*/
+void add_import_name(struct importDir *dir, char *short_name, size_t offset, int pending){
+    dir->names = realloc(dir->names, sizeof(struct importName)*(dir->name_count + 1));
+    memcpy(dir->names[dir->name_count].short_name, short_name, 11);
+    dir->names[dir->name_count].offset = offset;
+    dir->names[dir->name_count].pending = pending;
+    dir->name_count++;
+}
+
+
+/*
+* Function: take_slot(char *p, struct importDir *dir)
+* =================================
+* Purpose: hand out the next free entry of a directory, a full sub directory (or FAT32
+*          root) grows by a zeroed cluster
+*
+* Input:
+*   char* p: image data pointer
+*   struct importDir* dir: the directory
+*
+* Return:
+*   size_t: byte offset of the free entry
+*
+*/
+size_t take_slot(char *p, struct importDir *dir){
+    if(dir->next_slot == dir->slot_count){
+        if(dir->flc == 0 && diskInfo.fat_type != 32){
+            fprintf(stderr, "Error: the root directory is full, nothing was imported\n");
+            exit(1);
+        }
+        uint32_t cluster = alloc_cluster();
+        char *data = p + (size_t)calc_data_loc(p, cluster) * diskInfo.bytes_per_sector;
+        memset(data, 0, diskInfo.cluster_bytes);
+        txn_mark(TXN_DATA, data - p, diskInfo.cluster_bytes);
+        set_fat(dir->last_cluster, cluster);
+        dir->last_cluster = cluster;
+
+        dir->slots = realloc(dir->slots, sizeof(size_t)*(dir->slot_count + diskInfo.cluster_bytes / 32));
+        for(int k = 0; k < diskInfo.cluster_bytes / 32; k++){
+            dir->slots[dir->slot_count++] = (data - p) + 32*k;
+        }
+    }
+    return dir->slots[dir->next_slot++];
+}
+
+
+/*
+* Function: alloc_cluster()
+* =================================
+* Purpose: take the next free cluster from the allocator cursor and end a chain on it,
+*          running out of space stops the import before anything is committed
+*
+* Return:
+*   uint32_t: the cluster
+*
+*/
+uint32_t alloc_cluster(){
+    for(int n = 2; n < txn.cluster_count; n++){
+        uint32_t cluster = txn.next_free;
+        txn.next_free = (cluster + 1 < (uint32_t)txn.cluster_count) ? cluster + 1 : 2;
+        if(txn.fat_table[cluster] == 0x000){
+            set_fat(cluster, diskInfo.eoc);
+            return cluster;
+        }
+    }
+    fprintf(stderr, "Error: not enough free space on the image, nothing was imported\n");
+    exit(1);
+}
+
+
+/*
+* Function: free_chain(uint32_t flc)
+* =================================
+* Purpose: free every cluster of a chain in the decoded FAT
+*
+* Input:
+*   uint32_t flc: first logical cluster of the chain
+*
+*/
+void free_chain(uint32_t flc){
+    for(int steps = 0; flc >= 2 && flc < diskInfo.eoc_min && flc < (uint32_t)txn.cluster_count && steps < txn.cluster_count; steps++){
+        uint32_t next = txn.fat_table[flc];
+        set_fat(flc, 0x000);
+        flc = next;
+    }
+}
+
+
+/*
+* Function: build_entry(char *entry, char *short_name, uint8_t attributes, uint32_t flc, uint32_t size, time_t mtime)
+* =================================
+* Purpose: fill a 32 byte directory entry, the time is stored as UTC like disktar writes it
+*
+* Input:
+*   char* entry: output, 32 bytes
+*   char* short_name: 11 byte 8.3 name
+*   uint8_t attributes: attribute byte
+*   uint32_t flc: first logical cluster
+*   uint32_t size: file size
+*   time_t mtime: modification time
+*
+*/
+void build_entry(char *entry, char *short_name, uint8_t attributes, uint32_t flc, uint32_t size, time_t mtime){
+    struct tm tm;
+    uint16_t date = (1 << 5) | 1; // 1980-01-01, the earliest FAT date
+    uint16_t time = 0;
+
+    memset(entry, 0, 32);
+    memcpy(entry, short_name, 11);
+    memcpy(entry + 11, &attributes, 1);
+    set_entry_flc(entry, flc);
+    memcpy(entry + 28, &size, 4);
+
+    if(gmtime_r(&mtime, &tm) != NULL && tm.tm_year >= 80 && tm.tm_year < 208){
+        date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+        time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+    }
+    memcpy(entry + 16, &date, 2);
+    memcpy(entry + 24, &date, 2);
+    memcpy(entry + 22, &time, 2);
+    memcpy(entry + 14, &time, 2);
+}
+
+
+/*
+* Function: entry_contents(char *p, struct importName *name)
+* =================================
+* Purpose: the current bytes of an entry, the pending copy if this import changed it
+*
+* Input:
+*   char* p: image data pointer
+*   struct importName* name: the name
+*
+*/
+char *entry_contents(char *p, struct importName *name){
+    if(name->pending >= 0){
+        return txn.entries[name->pending].entry;
+    }
+    return p + name->offset;
+}
+
+
+/*
+* Function: write_entry(struct importDir *dir, struct importName *name, size_t offset, char *entry)
+* =================================
+* Purpose: stage an entry for commit, replacing the pending copy of an existing name
+*
+* Input:
+*   struct importDir* dir: directory of the entry
+*   struct importName* name: the existing name, NULL for a new one
+*   size_t offset: byte offset of the entry in the image
+*   char* entry: 32 byte entry
+*
+*/
+void write_entry(struct importDir *dir, struct importName *name, size_t offset, char *entry){
+    if(name != NULL && name->pending >= 0){
+        memcpy(txn.entries[name->pending].entry, entry, 32);
+        return;
+    }
+
+    txn.entries = realloc(txn.entries, sizeof(struct pendingEntry)*(txn.entry_count + 1));
+    txn.entries[txn.entry_count].offset = offset;
+    memcpy(txn.entries[txn.entry_count].entry, entry, 32);
+    if(name != NULL){
+        name->pending = txn.entry_count;
+    }else{
+        add_import_name(dir, entry, offset, txn.entry_count);
+    }
+    txn.entry_count++;
+}
+
+
+/*
+* Function: normalize_path(char *path, char *out)
+* =================================
+* Purpose: turn a tar member name into an upper case image path: . parts and slashes at
+*          either end are dropped, every part must be a valid 8.3 name
+*
+* Input:
+*   char* path: member name
+*   char* out: output, PATH_MAX bytes, "" for the root
+*
+* Return:
+*   int: 0 on success, -1 if a part cannot be stored
+*
+*/
+int normalize_path(char *path, char *out){
+    char *copy = strdup(path);
+    char short_name[11];
+    int status = 0;
+
+    out[0] = '\0';
+    for(char *part = strtok(copy, "/"); part != NULL; part = strtok(NULL, "/")){
+        if(strcmp(part, ".") == 0){
+            continue;
+        }
+        for(int k = 0; part[k] != '\0'; k++){
+            part[k] = toupper((unsigned char)part[k]);
+        }
+        if(make_short_name(part, short_name) != 0 || strlen(out) + strlen(part) + 2 > PATH_MAX){
+            status = -1;
+            break;
+        }
+        if(out[0] != '\0'){
+            strcat(out, "/");
+        }
+        strcat(out, part);
+    }
+    free(copy);
+    return status;
+}
+
+
+/*
+* Function: split_path(char *path, char *parent, char *short_name)
+* =================================
+* Purpose: split a normalized path into its parent path and the 8.3 name of its last part
+*
+* Input:
+*   char* path: normalized path, not the root
+*   char* parent: output, PATH_MAX bytes
+*   char* short_name: output, 11 bytes
+*
+*/
+void split_path(char *path, char *parent, char *short_name){
+    char *last = strrchr(path, '/');
+
+    if(last == NULL){
+        parent[0] = '\0';
+        make_short_name(path, short_name);
+        return;
+    }
+    memcpy(parent, path, last - path);
+    parent[last - path] = '\0';
+    make_short_name(last + 1, short_name);
+}
+
+
+/*
+* Function: make_short_name(char *name, char *short_name)
+* =================================
+* Purpose: turn an upper case name like FILE.TXT into the padded 11 byte 8.3 form
+*
+* Input:
+*   char* name: file name
+*   char* short_name: output, 11 bytes
+*
+* Return:
+*   int: 0 on success, -1 if the name does not fit 8.3 or has characters FAT does not allow
+*
+*/
+int make_short_name(char *name, char *short_name){
+    char *ext = strrchr(name, '.');
+    int name_len = ext ? (int)(ext - name) : (int)strlen(name);
+    int ext_len = ext ? (int)strlen(ext + 1) : 0;
+
+    if(name_len == 0 || name_len > 8 || ext_len > 3){
+        return -1;
+    }
+    for(int i = 0; name[i] != '\0'; i++){
+        unsigned char c = name[i];
+        if(name + i != ext && !isalnum(c) && strchr("!#$%&'()-@^_`{}~", c) == NULL){
+            return -1;
+        }
+    }
+    memset(short_name, ' ', 11);
+    memcpy(short_name, name, name_len);
+    if(ext != NULL){
+        memcpy(short_name + 8, ext + 1, ext_len);
+    }
+    return 0;
+}
+
+
+/*
+* Function: parse_octal(char *field, int len)
+* =================================
+* Purpose: read a ustar numeric field, octal digits with optional leading spaces
+*
+* Input:
+*   char* field: the field
+*   int len: field length
+*
+* Return:
+*   long long: the value, -1 for a field in the base-256 extension
+*
+*/
+long long parse_octal(char *field, int len){
+    long long value = 0;
+    int i = 0;
+
+    if((unsigned char)field[0] & 0x80){
+        return -1;
+    }
+    while(i < len && field[i] == ' '){
+        i++;
+    }
+    for(; i < len && field[i] >= '0' && field[i] <= '7'; i++){
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+
+/*
+* Function: read_input(void *buf, size_t len)
+* =================================
+* Purpose: read from stdin until len bytes or the end of the stream
+*
+* Input:
+*   void* buf: destination
+*   size_t len: bytes wanted
+*
+* Return:
+*   size_t: bytes read, short only at the end of the stream
+*
+*/
+size_t read_input(void *buf, size_t len){
+    size_t done = 0;
+
+    while(done < len){
+        ssize_t got = read(STDIN_FILENO, (char *)buf + done, len - done);
+        if(got < 0 && errno == EINTR){
+            continue;
+        }
+        if(got < 0){
+            fprintf(stderr, "Error: failed to read tar stream, nothing was imported\n");
+            exit(1);
+        }
+        if(got == 0){
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+
+/*
+* Function: read_full(void *buf, size_t len)
+* =================================
+* Purpose: read exactly len bytes of member data from stdin
+*
+* Input:
+*   void* buf: destination
+*   size_t len: bytes wanted
+*
+*/
+void read_full(void *buf, size_t len){
+    if(read_input(buf, len) != len){
+        fprintf(stderr, "Error: tar stream ends inside a member, nothing was imported\n");
+        exit(1);
+    }
+}
+
+
+/*
+* Function: skip_input(long long len)
+* =================================
+* Purpose: discard member data that is not imported, or the padding after it
+*
+* Input:
+*   long long len: bytes to skip
+*
+*/
+void skip_input(long long len){
+    char buf[64*TAR_BLOCK];
+
+    while(len > 0){
+        size_t chunk = (len < (long long)sizeof(buf)) ? (size_t)len : sizeof(buf);
+        read_full(buf, chunk);
+        len -= chunk;
+    }
+}
+
+
+/*
+* Function: decode_fat(char *p)
+* =================================
+* Purpose: decode the first FAT into txn.fat_table, the allocator state of the import
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void decode_fat(char *p){
+    txn.cluster_count = diskInfo.cluster_count;
+    txn.fat_table = malloc(sizeof(uint32_t)*txn.cluster_count);
+    txn.fat_dirty = calloc((txn.cluster_count / 8) + 1, 1);
+    txn.next_free = 2;
+
+    for(int i = 0; i < txn.cluster_count; i++){
+        txn.fat_table[i] = get_fat_entry(p, i);
+        if(i >= 2 && txn.fat_table[i] == 0x000){
+            txn.free_clusters++;
+        }
+    }
+}
+
+
+/*
+* Function: set_fat(uint32_t cluster, uint32_t value)
+* =================================
+* Purpose: change a decoded FAT entry and remember it for commit
+*
+* Input:
+*   uint32_t cluster: FAT index
+*   uint32_t value: new entry value
+*
+*/
+void set_fat(uint32_t cluster, uint32_t value){
+    if(txn.fat_table[cluster] == 0x000 && value != 0x000){
+        txn.free_clusters--;
+    }else if(txn.fat_table[cluster] != 0x000 && value == 0x000){
+        txn.free_clusters++;
+    }
+    txn.fat_table[cluster] = value;
+    txn.fat_dirty[cluster / 8] |= (uint8_t)(1 << (cluster % 8));
+}
+
+
+/*
+* Function: fat_entry_offset(uint32_t cluster)
+* =================================
+* Purpose: byte offset of a cluster's entry inside the FAT
+*
+* Input:
+*   uint32_t cluster: FAT index
+*
+*/
+size_t fat_entry_offset(uint32_t cluster){
+    if(diskInfo.fat_type == 32){
+        return (size_t)cluster * 4;
+    }
+    if(diskInfo.fat_type == 16){
+        return (size_t)cluster * 2;
+    }
+    return ((size_t)cluster * 3) / 2;
+}
+
+
+/*
+* Function: set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc)
+* =================================
+* Purpose: write an entry of the first FAT (12, 16 or 32 bit entries)
+*
+* Input:
+*   char* p: image data pointer
+*   uint32_t flc: FAT index
+*   uint32_t next_flc: value to store
+*
+*/
+void set_next_fat_entry(char *p, uint32_t flc, uint32_t next_flc){
+    char *fat = p + diskInfo.fat_start;
+    size_t ent_offset = fat_entry_offset(flc);
+    uint8_t first, second;
+
+    if(diskInfo.fat_type == 32){
+        // the top 4 bits of a FAT32 entry are reserved and kept
+        uint32_t entry;
+        memcpy(&entry, (fat + ent_offset), 4);
+        entry = (entry & 0xF0000000) | (next_flc & 0x0FFFFFFF);
+        memcpy((fat + ent_offset), &entry, 4);
+        return;
+    }
+    if(diskInfo.fat_type == 16){
+        uint16_t entry = next_flc;
+        memcpy((fat + ent_offset), &entry, 2);
+        return;
+    }
+
+    memcpy(&first, (fat + ent_offset), 1);
+    memcpy(&second, (fat + ent_offset + 1), 1);
+
+    if(flc % 2 == 0){
+        first = (uint8_t)(0xff & next_flc);
+        second = (uint8_t)((0xf0 & second) | (0x0f & (next_flc >> 8)));
+    }else{
+        first = (uint8_t)((0x0f & first) | ((0x0f & next_flc) << 4));
+        second = (uint8_t)(0xff & (next_flc >> 4));
+    }
+    memcpy((fat + ent_offset), &first, 1);
+    memcpy((fat + ent_offset + 1), &second, 1);
+}
+
+
+/*
+* Function: set_entry_flc(char *entry, uint32_t flc)
+* =================================
+* Purpose: store the first cluster of a directory entry, FAT32 keeps the high 16 bits at offset 20
+*
+* Input:
+*   char* entry: start of the 32 byte directory entry
+*   uint32_t flc: first logical cluster
+*
+*/
+void set_entry_flc(char *entry, uint32_t flc){
+    uint16_t low = flc & 0xFFFF;
+    uint16_t high = flc >> 16;
+
+    memcpy((entry + 26), &low, 2);
+    if(diskInfo.fat_type == 32){
+        memcpy((entry + 20), &high, 2);
+    }
+}
+
+
+/*
+* Function: txn_mark(int kind, size_t start, size_t len)
+* =================================
+* Purpose: record a dirty byte range, joined to the last one of its kind when they touch
+*
+* Input:
+*   int kind: TXN_DATA, TXN_FAT or TXN_DIR
+*   size_t start: offset in the image
+*   size_t len: length of the range
+*
+*/
+void txn_mark(int kind, size_t start, size_t len){
+    int count = txn.range_count[kind];
+
+    if(count > 0){
+        struct writeRange *last = &txn.ranges[kind][count-1];
+        if(start >= last->start && start <= last->start + last->len){
+            if(start + len > last->start + last->len){
+                last->len = start + len - last->start;
+            }
+            return;
+        }
+    }
+    txn.ranges[kind] = realloc(txn.ranges[kind], sizeof(struct writeRange)*(count+1));
+    txn.ranges[kind][count].start = start;
+    txn.ranges[kind][count].len = len;
+    txn.range_count[kind]++;
+}
+
+
+/*
+* Function: compare_ranges(const void *a, const void *b)
+* =================================
+* Purpose: qsort comparator ordering ranges by start offset
+*
+*/
+int compare_ranges(const void *a, const void *b){
+    const struct writeRange *x = a;
+    const struct writeRange *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+
+/*
+* Function: txn_sync(char *p, int kind)
+* =================================
+* Purpose: msync the dirty ranges of one kind, page aligned and merged into runs
+*
+* Input:
+*   char* p: image data pointer
+*   int kind: TXN_DATA, TXN_FAT or TXN_DIR
+*
+*/
+void txn_sync(char *p, int kind){
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t run_start = 0;
+    size_t run_end = 0;
+    struct writeRange *ranges = txn.ranges[kind];
+
+    qsort(ranges, txn.range_count[kind], sizeof(struct writeRange), compare_ranges);
+
+    for(int i = 0; i < txn.range_count[kind]; i++){
+        size_t start = ranges[i].start & ~(page - 1);
+        size_t end = ranges[i].start + ranges[i].len;
+
+        if(run_end > run_start && start <= run_end){
+            if(end > run_end){
+                run_end = end;
+            }
+            continue;
+        }
+        if(run_end > run_start && msync(p + run_start, run_end - run_start, MS_SYNC) != 0){
+            fprintf(stderr, "Error: failed to sync image\n");
+            exit(1);
+        }
+        run_start = start;
+        run_end = end;
+    }
+    if(run_end > run_start && msync(p + run_start, run_end - run_start, MS_SYNC) != 0){
+        fprintf(stderr, "Error: failed to sync image\n");
+        exit(1);
+    }
+}
+
+
+/*
+* Function: txn_commit(char *p, int fd)
+* =================================
+* Purpose: make the import durable in crash safe order: file data and new directory
+*          clusters, then the FAT, then the directory entries that point at them
+*
+* Input:
+*   char* p: image data pointer
+*   int fd: image file descriptor
+*
+*/
+void txn_commit(char *p, int fd){
+    txn_sync(p, TXN_DATA);
+
+    // whole sectors are marked so the mirror copies below can be done per sector run
+    for(int c = 0; c < txn.cluster_count; c++){
+        if(txn.fat_dirty[c / 8] & (1 << (c % 8))){
+            size_t offset = fat_entry_offset(c);
+            size_t first_sector = offset / diskInfo.bytes_per_sector;
+            size_t last_sector = (offset + (diskInfo.fat_type == 32 ? 3 : 1)) / diskInfo.bytes_per_sector;
+
+            set_next_fat_entry(p, c, txn.fat_table[c]);
+            txn_mark(TXN_FAT, diskInfo.fat_start + first_sector * diskInfo.bytes_per_sector, (last_sector - first_sector + 1) * diskInfo.bytes_per_sector);
+        }
+    }
+    mirror_fat(p);
+    if(diskInfo.fat_type == 32){
+        update_fsinfo(p);
+    }
+    txn_sync(p, TXN_FAT);
+
+    for(int i = 0; i < txn.entry_count; i++){
+        memcpy(p + txn.entries[i].offset, txn.entries[i].entry, 32);
+        txn_mark(TXN_DIR, txn.entries[i].offset, 32);
+    }
+    txn_sync(p, TXN_DIR);
+
+    fdatasync(fd);
+}
+
+
+/*
+* Function: mirror_fat(char *p)
+* =================================
+* Purpose: copy the changed sector runs of the first FAT to every other FAT copy
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void mirror_fat(char *p){
+    size_t fat_bytes = (size_t)diskInfo.sector_per_fat * diskInfo.bytes_per_sector;
+    int run_count = txn.range_count[TXN_FAT];
+
+    // a copy of the FAT1 runs, marking a mirror range can merge into the list being walked
+    struct writeRange *runs = malloc(sizeof(struct writeRange)*(run_count + 1));
+    memcpy(runs, txn.ranges[TXN_FAT], sizeof(struct writeRange)*run_count);
+
+    for(int k = 1; k < diskInfo.num_of_fats; k++){
+        for(int i = 0; i < run_count; i++){
+            memcpy(p + runs[i].start + k * fat_bytes, p + runs[i].start, runs[i].len);
+        }
+    }
+    for(int k = 1; k < diskInfo.num_of_fats; k++){
+        for(int i = 0; i < run_count; i++){
+            txn_mark(TXN_FAT, runs[i].start + k * fat_bytes, runs[i].len);
+        }
+    }
+    free(runs);
+}
+
+
+/*
+* Function: update_fsinfo(char *p)
+* =================================
+* Purpose: store the new free cluster count in the FAT32 FSInfo sector and drop its
+*          next free hint
+*
+* Input:
+*   char* p: image data pointer
+*
+*/
+void update_fsinfo(char *p){
+    uint16_t fsinfo_sector;
+    uint32_t signature;
+    uint32_t free_count = txn.free_clusters;
+    uint32_t next_free = 0xFFFFFFFF;
+
+    memcpy(&fsinfo_sector, (p + 48), 2);
+    if(fsinfo_sector == 0 || fsinfo_sector >= diskInfo.reserved_sectors){
+        return;
+    }
+    char *fsinfo = p + (size_t)fsinfo_sector * diskInfo.bytes_per_sector;
+    memcpy(&signature, fsinfo, 4);
+    if(signature != 0x41615252){
+        return;
+    }
+
+    memcpy((fsinfo + 488), &free_count, 4);
+    memcpy((fsinfo + 492), &next_free, 4);
+    txn_mark(TXN_FAT, (size_t)fsinfo_sector * diskInfo.bytes_per_sector, diskInfo.bytes_per_sector);
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+# diskcheck -r on FAT16 and FAT32: X is pointed at Y's first cluster and Z's chain is linked into
+# W after its first cluster. Both keep their entry with one cluster of data, Y and W are untouched,
+# the clusters X and Z lost are freed and a second check finds the image clean
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+for type in 16 32; do
+    make_test_image disk.img $type
+    make_file Y.DAT 10000
+    make_file X.DAT 7000
+    make_file W.DAT 9000
+    make_file Z.DAT 8000
+    make_file K.DAT 3000
+    "$bin/diskput" disk.img Y.DAT X.DAT W.DAT Z.DAT K.DAT >/dev/null
+
+    # the FAT16 root directory and the first cluster of FAT32 (its root) both start after the FATs
+    bps=$(get_le disk.img 11 2)
+    reserved=$(get_le disk.img 14 2)
+    cluster_bytes=$((bps * $(get_le disk.img 13 1)))
+    if [ $type -eq 16 ]; then
+        spf=$(get_le disk.img 22 2)
+    else
+        spf=$(get_le disk.img 36 4)
+    fi
+    fat=$((reserved * bps))
+    root=$(((reserved + 2 * spf) * bps))
+    entry=$((type / 8))
+    y=$(get_le disk.img $((root + 26)) 2)
+    w=$(get_le disk.img $((root + 2 * 32 + 26)) 2)
+    z=$(get_le disk.img $((root + 3 * 32 + 26)) 2)
+    put_le disk.img $((root + 32 + 26)) 2 $y
+    put_le disk.img $((fat + z * entry)) $entry $(get_le disk.img $((fat + w * entry)) $entry)
+
+    if "$bin/diskcheck" disk.img -r > check.out; then
+        echo "check: corruption not found" >&2
+        exit 1
+    fi
+    grep -q "X.DAT: first cluster $y copied to" check.out
+    "$bin/diskcheck" disk.img >/dev/null
+    check_fsinfo disk.img
+
+    head -c $cluster_bytes Y.DAT > X.DAT
+    head -c $cluster_bytes Z.DAT > Z.cut
+    mv Z.cut Z.DAT
+    check_files disk.img Y.DAT X.DAT W.DAT Z.DAT K.DAT
+done
+echo "check: ok"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# diskcp between FAT12, FAT16 and FAT32 images, a directory tree in both directions, and
+# diskclone and diskdiff on the result
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+rm -rf tree
+mkdir -p tree/SUB/DEEP
+for i in 1 2 3; do
+    make_file tree/SUB/S$i.DAT $((i * 5100))
+    make_file tree/SUB/DEEP/D$i.DAT $((i * 800))
+done
+make_image f12.img 12 2880 512 1 224
+make_test_image f16.img 16
+make_test_image f32.img 32
+(cd tree && tar cf ../tree.tar *)
+"$bin/disktar" f16.img -x < tree.tar >/dev/null
+
+"$bin/diskcp" f16.img:/SUB f32.img:/ -r >/dev/null
+"$bin/diskcp" f32.img:/SUB f12.img:/COPY -r >/dev/null
+"$bin/diskcp" f12.img:/COPY/DEEP f32.img:/SUB/DEEP2 -r >/dev/null
+for img in f12 f16 f32; do
+    "$bin/diskcheck" $img.img >/dev/null
+    check_fsinfo $img.img
+done
+check_tree f16.img tree
+mv tree/SUB tree/COPY
+check_tree f12.img tree
+mv tree/COPY tree/SUB
+cp -r tree/SUB/DEEP tree/SUB/DEEP2
+check_tree f32.img tree
+
+"$bin/diskclone" f32.img clone.img >/dev/null
+"$bin/diskdiff" f32.img clone.img >/dev/null
+check_tree clone.img tree
+echo "cp: ok"
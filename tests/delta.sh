@@ -0,0 +1,55 @@
+#!/bin/sh
+# diskput -d leaves the image untouched, disklist and diskget see the files through the delta,
+# diskdelta discard drops it and diskdelta commit writes it into the image
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+for type in 16 32; do
+    rm -f disk.img.delta
+    make_test_image disk.img $type
+    make_file A.DAT 5000
+    "$bin/diskput" disk.img A.DAT >/dev/null
+    cp disk.img base.img
+
+    # two batches on the same delta, 20 files grow the FAT32 root past its first cluster
+    names=""
+    for i in $(seq 10 29); do
+        make_file D$i.DAT $((i * 1500))
+        names="$names D$i.DAT"
+    done
+    "$bin/diskput" disk.img $names -d disk.img.delta >/dev/null
+    make_file B.DAT 70000
+    "$bin/diskput" disk.img B.DAT -d disk.img.delta >/dev/null
+    cmp disk.img base.img
+
+    "$bin/disklist" disk.img -d disk.img.delta > list
+    # disklist prints the name without its extension
+    awk '$1 == "F" { print $3 }' list > listed
+    [ "$(wc -l < listed)" -eq 22 ]
+    grep -qx B listed
+    grep -qx D29 listed
+    rm -rf got
+    mkdir got
+    for name in A.DAT B.DAT $names; do
+        (cd got && "$bin/diskget" ../disk.img $name -d ../disk.img.delta >/dev/null)
+        cmp got/$name $name
+    done
+    "$bin/diskdelta" disk.img disk.img.delta info >/dev/null
+
+    cp disk.img.delta keep.delta
+    "$bin/diskdelta" disk.img disk.img.delta discard >/dev/null
+    [ ! -e disk.img.delta ]
+    cmp disk.img base.img
+
+    mv keep.delta disk.img.delta
+    "$bin/diskdelta" disk.img disk.img.delta commit >/dev/null
+    [ ! -e disk.img.delta ]
+    "$bin/diskcheck" disk.img >/dev/null
+    check_fsinfo disk.img
+    check_files disk.img A.DAT B.DAT $names
+done
+echo "delta: ok"
@@ -0,0 +1,41 @@
+#!/bin/sh
+# diskdiff reports a changed boot sector or reserved sector even when no file changed
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+for type in 16 32; do
+    make_test_image disk.img $type
+    make_file A.DAT 5000
+    "$bin/diskput" disk.img A.DAT >/dev/null
+    cp disk.img old.img
+    "$bin/diskdiff" old.img disk.img >/dev/null
+
+    # the volume label sits at 43 below FAT32 and at 71 on FAT32
+    if [ $type -eq 32 ]; then
+        put_str disk.img 71 "RELABELED  "
+    else
+        put_str disk.img 43 "RELABELED  "
+    fi
+    if "$bin/diskdiff" old.img disk.img > log; then
+        echo "diff: FAT$type boot sector change still exits 0"
+        exit 1
+    fi
+    grep -q "Changed boot/reserved sectors: 1" log
+    grep -q "Added: 0, removed: 0, modified: 0" log
+
+    # FSInfo is the second reserved sector on FAT32
+    if [ $type -eq 32 ]; then
+        cp old.img disk.img
+        put_le disk.img $((512 + 492)) 4 1000
+        if "$bin/diskdiff" old.img disk.img > log; then
+            echo "diff: FSInfo change still exits 0"
+            exit 1
+        fi
+        grep -q "Changed boot/reserved sectors: 1" log
+    fi
+done
+echo "diff: ok"
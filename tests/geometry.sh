@@ -0,0 +1,37 @@
+#!/bin/sh
+# Regression: a root directory that ends half way through a sector (224 entries in 2048 byte
+# sectors is 3.5 sectors) still puts the data region at the next whole sector for every tool
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+make_image disk.img 12 1440 2048 1 224
+for i in 1 2 3 4 5 6; do
+    make_file F$i.DAT $((i * 3000 + 777))
+done
+
+# F5 and F6 land in the hole F2 leaves, so both are fragmented
+"$bin/diskput" disk.img F1.DAT F2.DAT F3.DAT F4.DAT
+"$bin/diskrm" disk.img /F2.DAT >/dev/null
+"$bin/diskput" disk.img F5.DAT F6.DAT
+"$bin/diskcheck" disk.img >/dev/null
+"$bin/diskowner" disk.img 3 | grep -q F1.DAT
+check_files disk.img F1.DAT F3.DAT F4.DAT F5.DAT F6.DAT
+
+"$bin/diskclone" disk.img clone.img >/dev/null
+"$bin/diskdiff" disk.img clone.img >/dev/null
+check_files clone.img F1.DAT F3.DAT F4.DAT F5.DAT F6.DAT
+
+"$bin/diskdefrag" disk.img >/dev/null
+"$bin/diskcheck" disk.img >/dev/null
+check_files disk.img F1.DAT F3.DAT F4.DAT F5.DAT F6.DAT
+
+"$bin/diskmv" disk.img /F1.DAT /F7.DAT >/dev/null
+cp F1.DAT F7.DAT
+"$bin/diskcp" disk.img:/F7.DAT clone.img:/F7.DAT >/dev/null
+"$bin/diskcheck" clone.img >/dev/null
+check_files clone.img F7.DAT
+echo "geometry: ok"
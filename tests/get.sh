@@ -0,0 +1,42 @@
+#!/bin/sh
+# diskget -m extracts every listed file it can and exits with 1 when any of them is missing
+# or its local copy could not be written
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+make_test_image disk.img 16
+make_file A.DAT 5000
+make_file B.DAT 70000
+"$bin/diskput" disk.img A.DAT B.DAT >/dev/null
+
+mkdir out
+printf '/A.DAT\n/B.DAT\n' > all.txt
+(cd out && "$bin/diskget" ../disk.img -m ../all.txt >/dev/null)
+cmp out/A.DAT A.DAT
+cmp out/B.DAT B.DAT
+
+rm -rf out
+mkdir out
+printf '/A.DAT\n/NONE.DAT\n/B.DAT\n' > missing.txt
+if (cd out && "$bin/diskget" ../disk.img -m ../missing.txt > ../log); then
+    echo "get: a missing file still exits 0"
+    exit 1
+fi
+grep -q "File not found: NONE.DAT" log
+cmp out/A.DAT A.DAT
+cmp out/B.DAT B.DAT
+
+# a directory in the way of A.DAT makes its copy fail
+rm -rf out
+mkdir -p out/A.DAT
+if (cd out && "$bin/diskget" ../disk.img -m ../all.txt > ../log); then
+    echo "get: a failed write still exits 0"
+    exit 1
+fi
+grep -q "Error: failed to create" log
+cmp out/B.DAT B.DAT
+echo "get: ok"
@@ -0,0 +1,129 @@
+# Shared helpers for the tests, sourced after $bin and $work are set
+
+# put_le {file} {offset} {bytes} {value}: write value little endian at offset
+put_le(){
+    s=""
+    i=0
+    while [ $i -lt $3 ]; do
+        s="$s\\$(printf %o $(( ($4 >> (8 * i)) & 255 )))"
+        i=$((i + 1))
+    done
+    printf "$s" | dd of="$1" bs=1 seek=$2 conv=notrunc 2>/dev/null
+}
+
+# get_le {file} {offset} {1|2|4}: read an unsigned little endian value
+get_le(){
+    od -An -tu$3 -j $2 -N $3 "$1" | tr -d ' '
+}
+
+# put_str {file} {offset} {string}
+put_str(){
+    printf '%s' "$3" | dd of="$1" bs=1 seek=$2 conv=notrunc 2>/dev/null
+}
+
+# make_image {file} {12|16|32} {total sectors} {bytes per sector} {sectors per cluster} {root entries}
+# Formats an empty image with 2 FATs, the FAT size is grown until it covers every cluster
+make_image(){
+    file=$1; type=$2; total=$3; bps=$4; spc=$5; root=$6
+    reserved=1
+    if [ $type -eq 32 ]; then
+        reserved=32
+        root=0
+    fi
+    root_secs=$(( (root * 32 + bps - 1) / bps ))
+    spf=1
+    while :; do
+        clusters=$(( (total - reserved - 2 * spf - root_secs) / spc ))
+        need=$(( ((clusters + 2) * type / 8 + bps) / bps ))
+        [ $need -le $spf ] && break
+        spf=$need
+    done
+
+    rm -f "$file"
+    dd if=/dev/zero of="$file" bs=$bps count=0 seek=$total 2>/dev/null
+    put_le "$file" 0 3 $((0x903CEB))
+    put_str "$file" 3 "MSWIN4.1"
+    put_le "$file" 11 2 $bps
+    put_le "$file" 13 1 $spc
+    put_le "$file" 14 2 $reserved
+    put_le "$file" 16 1 2
+    put_le "$file" 17 2 $root
+    put_le "$file" 21 1 $((0xF8))
+    if [ $type -ne 32 ] && [ $total -lt 65536 ]; then
+        put_le "$file" 19 2 $total
+    else
+        put_le "$file" 32 4 $total
+    fi
+    if [ $type -eq 32 ]; then
+        put_le "$file" 36 4 $spf
+        put_le "$file" 44 4 2
+        put_le "$file" 48 2 1
+        put_le "$file" 66 1 $((0x29))
+        put_str "$file" 71 "TESTVOL    FAT32   "
+        put_le "$file" $bps 4 $((0x41615252))
+        put_le "$file" $((bps + 484)) 4 $((0x61417272))
+        put_le "$file" $((bps + 488)) 8 -1
+        put_le "$file" $((bps + 508)) 4 $((0xAA550000))
+    else
+        put_le "$file" 22 2 $spf
+        put_le "$file" 38 1 $((0x29))
+        put_str "$file" 43 "TESTVOL    FAT$type   "
+    fi
+    put_le "$file" 510 2 $((0xAA55))
+
+    # media byte and end of chain in entries 0 and 1, FAT32 also ends the root cluster
+    for fat in 0 1; do
+        at=$(( (reserved + fat * spf) * bps ))
+        case $type in
+            12) put_le "$file" $at 3 $((0xFFFFF8)) ;;
+            16) put_le "$file" $at 4 $((0xFFFFFFF8)) ;;
+            32) put_le "$file" $at 8 $((0x0FFFFFFF0FFFFFF8)); put_le "$file" $((at + 8)) 4 $((0x0FFFFFFF)) ;;
+        esac
+    done
+}
+
+# make_test_image {file} {16|32}: the FAT16 (1024 byte sectors, 2 sector clusters) and
+# FAT32 (512 byte clusters, so the root directory fills a cluster after 16 entries) test geometries
+make_test_image(){
+    case $2 in
+        16) make_image "$1" 16 40000 1024 2 512 ;;
+        32) make_image "$1" 32 70000 512 1 0 ;;
+    esac
+}
+
+# make_file {name} {bytes}: random local file
+make_file(){
+    head -c $2 /dev/urandom > "$1"
+}
+
+# check_files {image} {name} ...: extract each file from the image and compare it to the local copy
+check_files(){
+    image=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+    shift
+    rm -rf "$work/got"
+    mkdir "$work/got"
+    for name in "$@"; do
+        (cd "$work/got" && "$bin/diskget" "$image" "$name" >/dev/null)
+        cmp "$work/got/$(basename "$name")" "$work/$(basename "$name")"
+    done
+}
+
+# check_tree {image} {dir}: stream the whole image with disktar and compare it to a local tree
+check_tree(){
+    rm -rf "$work/tree_got"
+    mkdir "$work/tree_got"
+    "$bin/disktar" "$1" > "$work/tree_got.tar"
+    tar xf "$work/tree_got.tar" -C "$work/tree_got"
+    diff -r "$work/tree_got" "$2"
+}
+
+# check_fsinfo {image}: on FAT32 the FSInfo free count matches the free entries of the first FAT
+check_fsinfo(){
+    [ "$(get_le "$1" 22 2)" -eq 0 ] || return 0
+    f_bps=$(get_le "$1" 11 2)
+    f_reserved=$(get_le "$1" 14 2)
+    f_spf=$(get_le "$1" 36 4)
+    f_clusters=$(( ($(get_le "$1" 32 4) - f_reserved - 2 * f_spf) / $(get_le "$1" 13 1) ))
+    f_free=$(od -An -v -tu4 -w4 -j $((f_reserved * f_bps + 8)) -N $((f_clusters * 4)) "$1" | grep -c '^ *0$' || true)
+    [ "$(get_le "$1" $((f_bps + 488)) 4)" -eq "$f_free" ]
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Regression: mirroring FAT1 to the other FATs must not spill into the root directory
+# when a mirror range touches the end of the last FAT1 run (put, rm, then put again)
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cp "$bin/disk.IMA" "$work/disk.IMA"
+cd "$work"
+head -c 1341440 /dev/urandom > BIG.BIN
+head -c 1500 /dev/urandom > NEW.BIN
+
+"$bin/diskput" disk.IMA BIG.BIN
+"$bin/diskrm" disk.IMA /REMINDER.TXT >/dev/null
+"$bin/diskput" disk.IMA NEW.BIN
+"$bin/diskcheck" disk.IMA >/dev/null
+
+mkdir out
+cd out
+"$bin/diskget" ../disk.IMA NEW.BIN
+cmp NEW.BIN ../NEW.BIN
+echo "mirror_fat: ok"
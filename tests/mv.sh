@@ -0,0 +1,39 @@
+#!/bin/sh
+# diskmv on FAT16 and FAT32: a rename, a file into a sub directory, a directory to the root and
+# enough moves into the FAT32 root to make it grow, then the image must match the local tree
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+for type in 16 32; do
+    rm -rf tree
+    mkdir -p tree/SUB/DEEP tree/MANY
+    make_file tree/F1.DAT 7000
+    make_file tree/F2.DAT 300
+    make_file tree/SUB/DEEP/D1.DAT 12000
+    for i in $(seq 1 20); do
+        make_file tree/MANY/M$i.DAT $((i * 333))
+    done
+    make_test_image disk.img $type
+    (cd tree && tar cf ../tree.tar *)
+    "$bin/disktar" disk.img -x < tree.tar >/dev/null
+
+    "$bin/diskmv" disk.img /F1.DAT /RENAMED.DAT >/dev/null
+    mv tree/F1.DAT tree/RENAMED.DAT
+    "$bin/diskmv" disk.img /F2.DAT /SUB/DEEP >/dev/null
+    mv tree/F2.DAT tree/SUB/DEEP/F2.DAT
+    "$bin/diskmv" disk.img /SUB/DEEP / >/dev/null
+    mv tree/SUB/DEEP tree/DEEP
+    for i in $(seq 1 20); do
+        "$bin/diskmv" disk.img /MANY/M$i.DAT / >/dev/null
+        mv tree/MANY/M$i.DAT tree/M$i.DAT
+    done
+
+    "$bin/diskcheck" disk.img >/dev/null
+    check_fsinfo disk.img
+    check_tree disk.img tree
+done
+echo "mv: ok"
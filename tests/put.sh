@@ -0,0 +1,42 @@
+#!/bin/sh
+# diskput on FAT16 and FAT32: a batch large enough to grow the FAT32 root directory, a file in a
+# sub directory, -a and -o, then every file of the image is compared to its local copy
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+for type in 16 32; do
+    rm -rf tree
+    mkdir -p tree/SUB
+    make_file tree/SUB/S1.DAT 3000
+    make_test_image disk.img $type
+    (cd tree && tar cf ../tree.tar SUB)
+    "$bin/disktar" disk.img -x < tree.tar >/dev/null
+
+    names=""
+    for i in $(seq 1 40); do
+        make_file R$i.DAT $((i * 1237))
+        cp R$i.DAT tree/R$i.DAT
+        names="$names R$i.DAT"
+    done
+    "$bin/diskput" disk.img $names >/dev/null
+    make_file A.DAT 9000
+    cp A.DAT tree/SUB/A.DAT
+    "$bin/diskput" disk.img /SUB/A.DAT >/dev/null
+
+    # -a appends to R1.DAT, -o replaces R2.DAT with a shorter file
+    make_file R1.DAT 5000
+    cat R1.DAT >> tree/R1.DAT
+    "$bin/diskput" disk.img R1.DAT -a >/dev/null
+    make_file R2.DAT 700
+    cp R2.DAT tree/R2.DAT
+    "$bin/diskput" disk.img R2.DAT -o >/dev/null
+
+    "$bin/diskcheck" disk.img >/dev/null
+    check_fsinfo disk.img
+    check_tree disk.img tree
+done
+echo "put: ok"
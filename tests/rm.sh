@@ -0,0 +1,32 @@
+#!/bin/sh
+# diskrm on FAT16 and FAT32: a wildcard in a sub directory, a whole tree with -r and a root file,
+# then the rest of the image must still match the local tree
+set -e
+bin=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$bin/tests/lib.sh"
+
+cd "$work"
+for type in 16 32; do
+    rm -rf tree
+    mkdir -p tree/SUB/DEEP tree/KEEP
+    for i in 1 2 3 4; do
+        make_file tree/F$i.DAT $((i * 4100 + 3))
+        make_file tree/SUB/S$i.TXT $((i * 1500))
+        make_file tree/SUB/DEEP/D$i.DAT $((i * 2600))
+        make_file tree/KEEP/K$i.DAT $((i * 900))
+    done
+    make_test_image disk.img $type
+    (cd tree && tar cf ../tree.tar *)
+    "$bin/disktar" disk.img -x < tree.tar >/dev/null
+
+    "$bin/diskrm" disk.img "/SUB/S*.TXT" /F3.DAT >/dev/null
+    "$bin/diskrm" disk.img /SUB/DEEP -r >/dev/null
+    rm -rf tree/SUB/S*.TXT tree/F3.DAT tree/SUB/DEEP
+
+    "$bin/diskcheck" disk.img >/dev/null
+    check_fsinfo disk.img
+    check_tree disk.img tree
+done
+echo "rm: ok"